@@ -0,0 +1,58 @@
+#! /usr/bin/perl
+
+# Generate a large M1 program of a given shape, for testing how the
+# compiler scales (see run_scale.sh).
+#
+#   ./gen_scale.pl <shape> <size> > big.m1
+#
+# shapes:
+#   chunks     <size> functions, all called from main
+#   switch     a switch with <size> cases
+#   nesting    blocks nested <size> deep
+#   fields     a struct with <size> fields, all written and read
+
+use strict;
+use warnings;
+
+my ($shape, $size) = @ARGV;
+
+die "usage: $0 <chunks|switch|nesting|fields> <size>\n"
+    unless defined $size && $size =~ /^\d+$/;
+
+if ($shape eq 'chunks') {
+    for my $i (0 .. $size - 1) {
+        print "int f$i(int x) {\n    return x + $i % 7;\n}\n\n";
+    }
+    print "int main() {\n    int x = 0;\n";
+    print "    x = f$_(x);\n" for 0 .. $size - 1;
+    print "    print(x);\n    print(\"\\n\");\n}\n";
+}
+elsif ($shape eq 'switch') {
+    print "int main() {\n    int i;\n    int sum = 0;\n";
+    print "    for (i = 0; i < 10; i++) {\n        switch (i) {\n";
+    for my $i (0 .. $size - 1) {
+        print "            case $i:\n                sum = sum + $i;\n                break;\n";
+    }
+    print "            default:\n                sum = sum - 1;\n                break;\n";
+    print "        }\n    }\n    print(sum);\n    print(\"\\n\");\n}\n";
+}
+elsif ($shape eq 'nesting') {
+    print "int main() {\n    int x = $size;\n";
+    for my $i (0 .. $size - 1) {
+        print "    " x ($i % 16), "if (x > 0) {\n";
+        print "    " x ($i % 16), "x = x - 1;\n";
+    }
+    print "}\n" x $size;
+    print "    print(x);\n    print(\"\\n\");\n}\n";
+}
+elsif ($shape eq 'fields') {
+    print "struct big {\n";
+    print "    int f$_;\n" for 0 .. $size - 1;
+    print "}\n\nint main() {\n    big b = new big();\n    int sum = 0;\n";
+    print "    b.f$_ = $_ % 100;\n" for 0 .. $size - 1;
+    print "    sum = sum + b.f$_;\n" for 0 .. $size - 1;
+    print "    print(sum);\n    print(\"\\n\");\n}\n";
+}
+else {
+    die "unknown shape '$shape'\n";
+}
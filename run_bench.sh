@@ -0,0 +1,99 @@
+#! /bin/sh
+
+# Run the benchmarks and write the results as JSON, one object per
+# benchmark, so that the files of two revisions can be diffed.
+#
+#   ./run_bench.sh <output.json> <file.m1>...
+#
+# For every benchmark this records the time to compile it with m1, the
+# number of M0 instructions in the bytecode of each chunk, the number of
+# instructions executed by the interpreter (m0 --instr-count), and the wall
+# time of a run with the JIT off and on. Times are in seconds.
+
+[ -e 'm1' ] || { echo 'm1 does not exist'; exit 1; }
+[ -e 'm0' ] || { echo 'm0 does not exist'; exit 1; }
+[ $# -ge 2 ] || { echo "usage: $0 <output.json> <file.m1>..."; exit 1; }
+
+out=$1
+shift
+
+TMP=${TMPDIR:-/tmp}/m1bench.$$
+mkdir -p $TMP || exit 1
+trap 'rm -rf $TMP' EXIT
+
+now() {
+    date +%s%N
+}
+
+# print nanoseconds as seconds.
+seconds() {
+    awk -v ns="$1" 'BEGIN { printf "%.4f", ns / 1e9 }'
+}
+
+revision=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+if [ -n "$(git status --porcelain --untracked-files=no 2>/dev/null)" ]; then
+    revision="$revision-dirty"
+fi
+
+{
+    echo "{"
+    echo "  \"revision\": \"$revision\","
+    echo "  \"benchmarks\": ["
+
+    sep=""
+    for file in "$@"; do
+        name=$(basename $file .m1)
+        echo "running $name" >&2
+
+        start=$(now)
+        ./m1 $M1FLAGS $file 2>/dev/null > $TMP/$name.m0
+        stop=$(now)
+        compile=$(seconds $((stop - start)))
+        [ -s $TMP/$name.m0 ] || { echo "error: could not compile $file" >&2; exit 1; }
+
+        # count the instructions in the .bytecode section of each chunk; labels don't count.
+        chunks=$(awk '
+            /^\.chunk/    { if (name != "") { printf "%s\"%s\": %d", sep, name, n; sep = ", " }
+                            name = $2; gsub(/"/, "", name); n = 0; code = 0; next }
+            /^\.bytecode/ { code = 1; next }
+            /^\./         { code = 0; next }
+            code && /^[ \t]+[a-z]/ { n++; total++ }
+            END           { if (name != "") printf "%s\"%s\": %d", sep, name, n;
+                            printf "\n%d\n", total }' $TMP/$name.m0)
+        static=$(echo "$chunks" | tail -n 1)
+        chunks=$(echo "$chunks" | head -n 1)
+
+        ./m0 --instr-count $TMP/$name.m0 > /dev/null 2> $TMP/$name.count
+        instrs=$(sed -n 's/^# instructions: //p' $TMP/$name.count)
+
+        start=$(now)
+        ./m0 --jit=off $TMP/$name.m0 > /dev/null 2>&1
+        status=$?
+        stop=$(now)
+        interp=$(seconds $((stop - start)))
+
+        start=$(now)
+        ./m0 --jit=on $TMP/$name.m0 > /dev/null 2>&1
+        stop=$(now)
+        jit=$(seconds $((stop - start)))
+
+        [ -z "$sep" ] || echo "$sep"
+        echo "    {"
+        echo "      \"name\": \"$name\","
+        echo "      \"compile_seconds\": $compile,"
+        echo "      \"static_instructions\": $static,"
+        echo "      \"chunk_instructions\": { $chunks },"
+        echo "      \"instructions\": ${instrs:-0},"
+        echo "      \"interp_seconds\": $interp,"
+        echo "      \"jit_seconds\": $jit,"
+        echo "      \"status\": $status"
+        printf "    }"
+        sep=","
+    done
+
+    printf "\n  ]\n"
+    echo "}"
+} > $out || exit 1
+
+echo "wrote $out" >&2
+exit 0
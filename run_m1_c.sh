@@ -0,0 +1,36 @@
+#! /bin/sh
+
+# Compile a test to C with m1 --emit-c, build it with the native runtime,
+# and check that it gives the same output as the interpreter. The
+# interpreter's output is passed on, so this can be run with prove just
+# like run_m1.sh.
+
+[ -e 'm1' ] || { echo 'm1 does not exist'; exit 1; } 
+[ -e 'm0' ] || { echo 'm0 does not exist'; exit 1; } 
+[ -e 'libm0native.a' ] || { echo 'libm0native.a does not exist'; exit 1; } 
+
+CC=${CC:-gcc}
+
+filename=${1%.*}
+file_suffixe=${1##*.}
+[ "$file_suffixe" = 'm1' ] || { echo "file suffixe is not 'm1'"; exit 1; }
+
+./m1 $M1FLAGS $1 2>/dev/null > $filename.m0
+[ -s $filename.m0 ] || { echo "error: outputs a empty file $filename.m0 when compiling $1"; exit 1; }
+./m1 $M1FLAGS --emit-c $1 2>/dev/null > $filename.c
+$CC -O2 -Isrc -o $filename.native $filename.c libm0native.a -lm || { echo "error: could not compile $filename.c"; exit 1; }
+
+./m0 --jit=off $filename.m0 > $filename.m0.interp 2>&1
+interp_status=$?
+./$filename.native > $filename.m0.native 2>&1
+native_status=$?
+
+if [ $interp_status -ne $native_status ] || ! cmp -s $filename.m0.interp $filename.m0.native; then
+    echo "1..1"
+    echo "not ok 1 - C output differs from interpreter output"
+    diff $filename.m0.interp $filename.m0.native | sed 's/^/# /'
+    exit 1
+fi
+
+cat $filename.m0.interp
+exit $interp_status
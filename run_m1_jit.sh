@@ -0,0 +1,30 @@
+#! /bin/sh
+
+# Run a test with the interpreter and with the JIT compiling every chunk,
+# and check that both give the same output. The interpreter's output is
+# passed on, so this can be run with prove just like run_m1.sh.
+
+[ -e 'm1' ] || { echo 'm1 does not exist'; exit 1; } 
+[ -e 'm0' ] || { echo 'm0 does not exist'; exit 1; } 
+
+filename=${1%.*}
+file_suffixe=${1##*.}
+[ "$file_suffixe" = 'm1' ] || { echo "file suffixe is not 'm1'"; exit 1; }
+
+./m1 $M1FLAGS $1 2>/dev/null > $filename.m0
+[ -s $filename.m0 ] || { echo "error: outputs a empty file $filename.m0 when compiling $1"; exit 1; }
+
+./m0 --jit=off $filename.m0 > $filename.m0.interp 2>&1
+interp_status=$?
+./m0 --jit=on --jit-threshold=0 $filename.m0 > $filename.m0.jit 2>&1
+jit_status=$?
+
+if [ $interp_status -ne $jit_status ] || ! cmp -s $filename.m0.interp $filename.m0.jit; then
+    echo "1..1"
+    echo "not ok 1 - JIT output differs from interpreter output"
+    diff $filename.m0.interp $filename.m0.jit | sed 's/^/# /'
+    exit 1
+fi
+
+cat $filename.m0.interp
+exit $interp_status
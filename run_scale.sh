@@ -0,0 +1,89 @@
+#! /bin/sh
+
+# Measure how the compile time and memory use of m1 grow with the size of
+# its input, for the program shapes of gen_scale.pl.
+#
+#   ./run_scale.sh [<output.tsv>]
+#
+# Every shape is compiled at sizes that double; set SCALE_STEPS to change
+# their number (default 5). For every size this records the compile time
+# (wall seconds, from m1 --time-report), the peak RSS (from
+# m1 --mem-report) and whether m1 generated code, writes them to the output
+# file (default scale.tsv), and charts the time. The "exp" column estimates
+# the exponent of the growth from the previous size: about 1 for linear, 2
+# for quadratic behaviour.
+#
+# Set SCALE_SHAPES to a list of shape:size pairs to only run those, and
+# SCALE_MAX_EXP to fail if the time of any shape grows faster than that.
+
+[ -e 'm1' ] || { echo 'm1 does not exist'; exit 1; }
+
+out=${1:-scale.tsv}
+steps=${SCALE_STEPS:-5}
+
+TMP=${TMPDIR:-/tmp}/m1scale.$$
+mkdir -p $TMP || exit 1
+trap 'rm -rf $TMP' EXIT
+
+# shape and starting size
+shapes=${SCALE_SHAPES:-"chunks:1000 switch:500 nesting:250 fields:500"}
+
+printf "shape\tsize\tseconds\trss_bytes\tstatus\n" > $out
+
+for entry in $shapes; do
+    shape=${entry%%:*}
+    size=${entry##*:}
+    step=0
+
+    while [ $step -lt $steps ]; do
+        ./gen_scale.pl $shape $size > $TMP/$shape.m1 || exit 1
+        ./m1 --time-report --mem-report $TMP/$shape.m1 2> $TMP/$shape.err > $TMP/$shape.m0
+        status=ok
+        [ -s $TMP/$shape.m0 ] || status=failed
+        seconds=$(awk -F '\t' '$1 == "time" && $2 == "total" { print $3 }' $TMP/$shape.err)
+        rss=$(awk -F '\t' '$1 == "rss" { print $3 }' $TMP/$shape.err)
+        [ -n "$seconds" ] || { echo "error: m1 failed on $shape $size"; exit 1; }
+
+        printf "%s\t%d\t%s\t%s\t%s\n" $shape $size $seconds $rss $status >> $out
+        size=$((size * 2))
+        step=$((step + 1))
+    done
+done
+
+# chart the time of every shape, scaled to the slowest run of the shape.
+awk -F '\t' '
+    NR == 1 { next }
+    { shape[NR] = $1; size[NR] = $2; secs[NR] = $3; rss[NR] = $4; status[NR] = $5; n = NR
+      if ($3 > max[$1]) max[$1] = $3 }
+    END {
+        for (i = 2; i <= n; i++) {
+            if (shape[i] != shape[i - 1])
+                printf "\n%-8s %8s %10s %8s %5s\n", shape[i], "size", "seconds", "rss MB", "exp"
+            bar = max[shape[i]] > 0 ? int(40 * secs[i] / max[shape[i]] + 0.5) : 0
+            growth = "-"
+            if (shape[i] == shape[i - 1] && secs[i - 1] > 0 && secs[i] > 0)
+                growth = sprintf("%.2f", log(secs[i] / secs[i - 1]) / log(size[i] / size[i - 1]))
+            printf "%-8s %8d %10.4f %8.1f %5s ", "", size[i], secs[i], rss[i] / 1048576, growth
+            for (j = 0; j < bar; j++)
+                printf "#"
+            printf "%s\n", status[i] == "ok" ? "" : " (" status[i] ")"
+        }
+    }' $out
+
+echo ""
+echo "wrote $out"
+
+# runs of less than 10ms are too noisy to tell the growth.
+if [ -n "$SCALE_MAX_EXP" ]; then
+    awk -F '\t' -v max="$SCALE_MAX_EXP" '
+        $1 == prev && $5 == "ok" && psecs >= 0.01 {
+            growth = log($3 / psecs) / log($2 / psize)
+            if (growth > max) {
+                printf "error: %s grows as size^%.2f from %d to %d\n", $1, growth, psize, $2
+                bad = 1
+            }
+        }
+        { prev = $1; psize = $2; psecs = $3 }
+        END { exit bad }' $out || exit 1
+fi
+exit 0
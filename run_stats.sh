@@ -0,0 +1,32 @@
+#! /bin/sh
+
+# Check the code size statistics of a test against a golden file. For
+# t/stats/foo.stats, this compiles t/foo.m1 with m1 --stats, and compares
+# the statistics with the file. Run it with prove, like run_m1.sh.
+#
+# After a change to the code generator, regenerate a golden file with
+#
+#   ./m1 --stats t/foo.m1 2>&1 >/dev/null | grep '^stats' > t/stats/foo.stats
+#
+# and check the differences before committing it.
+
+[ -e 'm1' ] || { echo 'm1 does not exist'; exit 1; }
+
+file_suffixe=${1##*.}
+[ "$file_suffixe" = 'stats' ] || { echo "file suffixe is not 'stats'"; exit 1; }
+
+name=$(basename $1 .stats)
+source=t/$name.m1
+[ -e $source ] || { echo "$source does not exist"; exit 1; }
+
+echo "1..1"
+if ./m1 --stats $source 2>&1 >/dev/null | grep '^stats' | diff $1 - > $1.diff; then
+    echo "ok 1 - code size of $source"
+    rm -f $1.diff
+    exit 0
+fi
+
+echo "not ok 1 - code size of $source"
+sed 's/^/# /' $1.diff
+rm -f $1.diff
+exit 1
@@ -10,8 +10,10 @@ AST node constructors
 #include <string.h>
 
 #include "ast.h"
+#include "decl.h"
 #include "symtab.h"
 #include "compiler.h"
+#include "report.h"
 
 
 #include "ann.h"
@@ -23,12 +25,13 @@ static void expr_set_obj(m1_expression *node, m1_object *obj);
 
 
 static void *
-m1_malloc(size_t size) {
+m1_malloc(M1_compiler *comp, m1_nodekind kind, size_t size) {
     void *mem = calloc(1, size);
     if (mem == NULL) {
         fprintf(stderr, "Failed to allocate mem!\n");
         exit(EXIT_FAILURE);
     }
+    report_alloc(comp, kind, size);
     return mem;   
 }
 
@@ -37,13 +40,14 @@ m1_malloc(size_t size) {
 m1_chunk *
 chunk( ARGIN_NOTNULL( M1_compiler * const comp ), ARGIN( char *rettype ), ARGIN_NOTNULL( char *name ) ) 
 {
-    m1_chunk *c = (m1_chunk *)m1_malloc(sizeof(m1_chunk));
+    m1_chunk *c = (m1_chunk *)m1_malloc(comp, NODE_CHUNK, sizeof(m1_chunk));
     c->rettype  = rettype;
     c->name     = name;
     c->block    = NULL;
     c->next     = NULL;
     
     assert(comp != NULL);
+    c->line     = yyget_lineno(comp->yyscanner);
     
     /* reset comp->constindex to 0 for each chunk. For each chunk, start
        indexing its constants segment at 0.
@@ -57,6 +61,39 @@ chunk( ARGIN_NOTNULL( M1_compiler * const comp ), ARGIN( char *rettype ), ARGIN_
 void 
 block_set_stat(ARGIN(m1_block *block), m1_expression *stat) {
     block->stats = stat;   
+}
+
+/*
+
+The parser links statements and chunks in reverse order, as appending
+each one would walk the whole list, which takes quadratic time on large
+inputs. These functions reverse such a list in place, and return its new head.
+
+*/
+m1_expression *
+reverse_stats(m1_expression *stats) {
+    m1_expression *reversed = NULL;
+    
+    while (stats != NULL) {
+        m1_expression *next = stats->next;
+        stats->next = reversed;
+        reversed    = stats;
+        stats       = next;
+    }
+    return reversed;
+}
+
+m1_chunk *
+reverse_chunks(m1_chunk *chunks) {
+    m1_chunk *reversed = NULL;
+    
+    while (chunks != NULL) {
+        m1_chunk *next = chunks->next;
+        chunks->next = reversed;
+        reversed     = chunks;
+        chunks       = next;
+    }
+    return reversed;
 }    
 
 m1_expression *
@@ -66,7 +103,7 @@ expression(M1_compiler *comp, m1_expr_type type) {
     assert(comp != NULL);
     assert(comp->yyscanner != NULL);
     
-    expr        = (m1_expression *)m1_malloc(sizeof(m1_expression));
+    expr        = (m1_expression *)m1_malloc(comp, NODE_EXPRESSION, sizeof(m1_expression));
     expr->type  = type;
     /* set the current line number for error reporting. */
     expr->line  = yyget_lineno(comp->yyscanner);
@@ -75,8 +112,8 @@ expression(M1_compiler *comp, m1_expr_type type) {
 
 
 static m1_literal *
-new_literal(m1_valuetype type) {
-    m1_literal *l = (m1_literal *)m1_malloc(sizeof(m1_literal));
+new_literal(M1_compiler *comp, m1_valuetype type) {
+    m1_literal *l = (m1_literal *)m1_malloc(comp, NODE_LITERAL, sizeof(m1_literal));
     l->type       = type;
     return l;    
 }
@@ -85,7 +122,7 @@ new_literal(m1_valuetype type) {
 m1_expression *
 character(M1_compiler *comp, char ch) {
     m1_expression *expr      = expression(comp, EXPR_CHAR);
-    expr->expr.l             = new_literal(VAL_INT);
+    expr->expr.l             = new_literal(comp, VAL_INT);
     expr->expr.l->value.ival = (int)ch;
     expr->expr.l->sym        = sym_enter_int(comp, &comp->currentchunk->constants, (int)ch);
     return expr;    
@@ -96,7 +133,7 @@ number(M1_compiler *comp, double value) {
 	m1_expression *expr = expression(comp, EXPR_NUMBER);
 	
 	/* make a new literal node */
-	expr->expr.l             = new_literal(VAL_FLOAT);
+	expr->expr.l             = new_literal(comp, VAL_FLOAT);
     expr->expr.l->value.fval = value;
     /* store the constant in the constants segment. */
     expr->expr.l->sym        = sym_enter_num(comp, &comp->currentchunk->constants, value);   
@@ -108,7 +145,7 @@ m1_expression *
 integer(M1_compiler *comp, int value) {
 	m1_expression *expr = expression(comp, EXPR_INT);
     /* make a new literal node. */
-	expr->expr.l             = new_literal(VAL_INT);
+	expr->expr.l             = new_literal(comp, VAL_INT);
     expr->expr.l->value.ival = value;
     /* store the constant in the constants segment. */
     expr->expr.l->sym        = sym_enter_int(comp, &comp->currentchunk->constants, value);
@@ -121,7 +158,7 @@ string(M1_compiler *comp, char *str) {
 	m1_expression *expr = expression(comp, EXPR_STRING);
 	assert(str != NULL);
 
-    expr->expr.l = new_literal(VAL_STRING);
+    expr->expr.l = new_literal(comp, VAL_STRING);
     expr->expr.l->value.sval = str;
     
     assert(comp != NULL);
@@ -170,7 +207,7 @@ unaryexpr(M1_compiler *comp, m1_unop op, m1_expression *e) {
 m1_expression *
 binexpr(M1_compiler *comp, m1_expression *e1, int op, m1_expression *e2) {
 	m1_expression *expr = expression(comp, EXPR_BINARY);
-	expr->expr.b = (m1_binexpr *)m1_malloc(sizeof(m1_binexpr));
+	expr->expr.b = (m1_binexpr *)m1_malloc(comp, NODE_BINEXPR, sizeof(m1_binexpr));
     expr->expr.b->op    = (m1_binop)op;
     expr->expr.b->left  = e1;
     expr->expr.b->right = e2;       
@@ -186,7 +223,7 @@ printexpr(M1_compiler *comp, m1_expression *e) {
 
 static m1_unexpr *
 unexpr(M1_compiler *comp, m1_expression *node, m1_unop op) {
-    m1_unexpr *e = (m1_unexpr *)m1_malloc(sizeof(m1_unexpr));
+    m1_unexpr *e = (m1_unexpr *)m1_malloc(comp, NODE_UNEXPR, sizeof(m1_unexpr));
     e->expr      = node;
     e->op        = op;    
     
@@ -204,7 +241,7 @@ expr_set_unexpr(M1_compiler *comp, m1_expression *node, m1_expression *exp, m1_u
 m1_expression *
 funcall(M1_compiler *comp, m1_object *fun, m1_expression *args) {
 	m1_expression *expr     = expression(comp, EXPR_FUNCALL);
-	expr->expr.f            = (m1_funcall *)m1_malloc(sizeof(m1_funcall));
+	expr->expr.f            = (m1_funcall *)m1_malloc(comp, NODE_FUNCALL, sizeof(m1_funcall));
 	
 	
     expr->expr.f->name      = fun->obj.name;
@@ -220,8 +257,8 @@ funcall(M1_compiler *comp, m1_object *fun, m1_expression *args) {
 
 
 static m1_const *
-const_decl(char *type, char *name, m1_expression *expr) {
-    m1_const *c = (m1_const *)m1_malloc(sizeof(m1_const));
+const_decl(M1_compiler *comp, char *type, char *name, m1_expression *expr) {
+    m1_const *c = (m1_const *)m1_malloc(comp, NODE_CONST, sizeof(m1_const));
     c->type     = type;
     c->name     = name;
     c->value    = expr;
@@ -233,16 +270,16 @@ const_decl(char *type, char *name, m1_expression *expr) {
 m1_expression *
 constdecl(M1_compiler *comp, char *type, char *name, m1_expression *e) {
 	m1_expression *expr = expression(comp, EXPR_CONSTDECL);
-	expr->expr.c = const_decl(type, name, e);
+	expr->expr.c = const_decl(comp, type, name, e);
 	return expr;	
 }
 
 static void 
-expr_set_for(m1_expression *node, m1_expression *init,
+expr_set_for(M1_compiler *comp, m1_expression *node, m1_expression *init,
              m1_expression *cond, m1_expression *step,
              m1_expression *stat) 
 {
-    node->expr.o = (m1_forexpr *)m1_malloc(sizeof(m1_forexpr));
+    node->expr.o = (m1_forexpr *)m1_malloc(comp, NODE_FOR, sizeof(m1_forexpr));
     
     node->expr.o->init  = init;
     node->expr.o->cond  = cond;
@@ -253,7 +290,7 @@ expr_set_for(m1_expression *node, m1_expression *init,
 m1_expression *
 forexpr(M1_compiler *comp, m1_expression *init, m1_expression *cond, m1_expression *step, m1_expression *stat) {
 	m1_expression *expr = expression(comp, EXPR_FOR);
-	expr_set_for(expr, init, cond, step, stat);	
+	expr_set_for(comp, expr, init, cond, step, stat);	
 	return expr;
 }
 
@@ -274,7 +311,7 @@ assignexpr(M1_compiler *comp, m1_expression *lhs, int assignop, m1_expression *r
 	a = b  => normal case
 	a += b => a = a + b
 	*/
-    node->expr.a      = (m1_assignment *)m1_malloc(sizeof(m1_assignment));
+    node->expr.a      = (m1_assignment *)m1_malloc(comp, NODE_ASSIGNMENT, sizeof(m1_assignment));
     node->expr.a->lhs = lhs->expr.t; /* unwrap the m1_object representing lhs from its m1_expression wrapper. */
     
     switch (assignop) {
@@ -310,7 +347,7 @@ returnexpr(M1_compiler *comp, m1_expression *retexp) {
 static void 
 expr_set_while(M1_compiler *comp, m1_expression *node, m1_expression *cond, m1_expression *block) {
     assert(comp != NULL);
-    node->expr.w        = (m1_whileexpr *)m1_malloc(sizeof(m1_whileexpr));    
+    node->expr.w        = (m1_whileexpr *)m1_malloc(comp, NODE_WHILE, sizeof(m1_whileexpr));    
     node->expr.w->cond  = cond;
     node->expr.w->block = block;                            
 }   
@@ -320,7 +357,7 @@ expr_set_if(M1_compiler *comp, m1_expression *node, m1_expression *cond,
             m1_expression *ifblock, m1_expression *elseblock) 
 {
     assert(comp != NULL);
-    node->expr.i = (m1_ifexpr *)m1_malloc(sizeof(m1_ifexpr));              
+    node->expr.i = (m1_ifexpr *)m1_malloc(comp, NODE_IF, sizeof(m1_ifexpr));              
     node->expr.i->cond      = cond;
     node->expr.i->ifblock   = ifblock;
     node->expr.i->elseblock = elseblock;
@@ -346,7 +383,7 @@ obj_set_ident(m1_object *node, char *ident) {
 
 m1_object *
 object(M1_compiler *comp, m1_object_type type) {
-    m1_object *obj = (m1_object *)m1_malloc(sizeof(m1_object));
+    m1_object *obj = (m1_object *)m1_malloc(comp, NODE_OBJECT, sizeof(m1_object));
     obj->type      = type;
     
     assert(comp != NULL);
@@ -355,7 +392,7 @@ object(M1_compiler *comp, m1_object_type type) {
 
 m1_object *
 lhsobj(M1_compiler *comp, m1_object *parent, m1_object *field) {
-    m1_object *lhsobj = (m1_object *)m1_malloc(sizeof(m1_object));
+    m1_object *lhsobj = (m1_object *)m1_malloc(comp, NODE_OBJECT, sizeof(m1_object));
     lhsobj->type      = OBJECT_LINK;
     
     lhsobj->obj.field = field;
@@ -365,9 +402,21 @@ lhsobj(M1_compiler *comp, m1_object *parent, m1_object *field) {
     return lhsobj;   
 }
 
+m1_accesspath *
+accesspath(M1_compiler *comp, m1_symbol *root, unsigned num_steps) {
+    size_t         size = sizeof(m1_accesspath) + (num_steps > 0 ? num_steps - 1 : 0) * sizeof(m1_access);
+    m1_accesspath *path = (m1_accesspath *)m1_malloc(comp, NODE_ACCESSPATH, size);
+    
+    path->root      = root;
+    path->num_steps = num_steps;
+    
+    assert(comp != NULL);
+    return path;
+}
+
 m1_structfield *
 structfield(M1_compiler *comp, char *name, char *type) {
-    m1_structfield *fld = (m1_structfield *)m1_malloc(sizeof(m1_structfield));
+    m1_structfield *fld = (m1_structfield *)m1_malloc(comp, NODE_STRUCTFIELD, sizeof(m1_structfield));
     fld->name           = name;
     fld->type           = type;
     
@@ -375,26 +424,70 @@ structfield(M1_compiler *comp, char *name, char *type) {
     return fld;   
 }
 
+/*
+
+Lay out the fields of a struct. Each field is aligned to its size, as the
+M0 ops that load and store it (get_byte, deref) index memory in
+units of that size. The fields are placed in the order in which they are
+declared, unless the struct is packed; then they are placed by decreasing
+size, which leaves no padding between them. The size of the struct is
+rounded up to the alignment of its largest field.
+
+*/
+static unsigned
+place_field(m1_structfield *field, unsigned offset) {
+    offset        = (offset + field->size - 1) / field->size * field->size;
+    field->offset = offset;
+    return offset + field->size;
+}
+
 m1_struct *
-newstruct(M1_compiler *comp, char *name, m1_structfield *fields) {
-    m1_struct *str = (m1_struct *)m1_malloc(sizeof(m1_struct));    
-    str->name      = name;
-    str->fields    = fields;
-    
-    /* struct fields are linked in reverse order, so the first one is
-       in fact the one last added, and therefore has the highest offset.
-       The offset of the last field is the size of the whole struct
-       except the size of the last field itself, so add that.
-     */
-    str->size = fields->offset + field_size(fields);
-    
+newstruct(M1_compiler *comp, char *name, m1_structfield *fields, int packed) {
+    m1_struct      *str     = (m1_struct *)m1_malloc(comp, NODE_STRUCT, sizeof(m1_struct));    
+    m1_structfield *iter,
+                   *prev    = NULL;
+    unsigned        offset  = 0,
+                    maxsize = 1,
+                    size;
+                    
     assert(comp != NULL);
+    str->name = name;
+    
+    /* the parser links the fields in reverse order; put them back in order. */
+    while (fields != NULL) {
+        m1_structfield *next = fields->next;
+        fields->next = prev;
+        prev         = fields;
+        fields       = next;
+    }
+    str->fields = prev;
+    
+    for (iter = str->fields; iter != NULL; iter = iter->next) {
+        iter->size = field_size(comp, iter);
+        if (iter->size > maxsize)
+            maxsize = iter->size;
+    }
+    
+    if (packed) { /* field sizes are powers of 2. */
+        for (size = maxsize; size > 0; size /= 2) {
+            for (iter = str->fields; iter != NULL; iter = iter->next) {
+                if (iter->size == size)
+                    offset = place_field(iter, offset);
+            }
+        }
+    }
+    else {
+        for (iter = str->fields; iter != NULL; iter = iter->next)
+            offset = place_field(iter, offset);
+    }
+    
+    str->size = (offset + maxsize - 1) / maxsize * maxsize;
     return str;   
 }
 
 m1_pmc *
 newpmc(M1_compiler *comp, char *name, m1_structfield *fields, m1_chunk *methods) {
-    m1_pmc *pmc  = (m1_pmc *)m1_malloc(sizeof(m1_pmc));
+    m1_pmc *pmc  = (m1_pmc *)m1_malloc(comp, NODE_PMC, sizeof(m1_pmc));
     
     pmc->name    = name; 
     pmc->fields  = fields;
@@ -406,7 +499,7 @@ newpmc(M1_compiler *comp, char *name, m1_structfield *fields, m1_chunk *methods)
 
 m1_enum *
 newenum(M1_compiler *comp, char *name, m1_enumconst *enumconstants) {
-    m1_enum *en  = (m1_enum *)m1_malloc(sizeof(m1_enum));
+    m1_enum *en  = (m1_enum *)m1_malloc(comp, NODE_ENUM, sizeof(m1_enum));
     en->enumname = name;
     en->enums    = enumconstants;
     
@@ -429,7 +522,7 @@ vardecl(M1_compiler *comp, char *type, m1_var *v) {
 
 static m1_var *
 make_var(M1_compiler *comp, char *varname, m1_expression *init, unsigned num_elems) {
-    m1_var *v    = (m1_var *)m1_malloc(sizeof(m1_var));
+    m1_var *v    = (m1_var *)m1_malloc(comp, NODE_VAR, sizeof(m1_var));
     v->name      = varname;
     v->type      = comp->parsingtype;
     v->init      = init;
@@ -467,7 +560,7 @@ Parameters are also represented by m1_var nodes.
 */
 m1_var *
 parameter(M1_compiler *comp, char *paramtype, char *paramname) {
-    m1_var *p = (m1_var *)m1_malloc(sizeof(m1_var));
+    m1_var *p = (m1_var *)m1_malloc(comp, NODE_VAR, sizeof(m1_var));
     p->type   = paramtype;   	                        
     p->name   = paramname;
     /* cannot enter into a symbol table, as there is not yet an active symbol table. 
@@ -520,31 +613,39 @@ dowhileexpr(M1_compiler *comp, m1_expression *cond, m1_expression *block) {
 	return expr;	
 }
 
+/* size in bytes of a field; that's also its alignment. Ints are 64 bits in
+   registers and arrays, whatever the size of int says, so int fields
+   take 8 bytes too; only chars and bools are smaller. */
 unsigned 
-field_size(struct m1_structfield *field) {
+field_size(M1_compiler *comp, struct m1_structfield *field) {
+    m1_decl *type;
+    
     assert(field != NULL);
-	/*
-	switch (field->type) {
-		case VAL_INT:
-			return 4;
-		case VAL_FLOAT:
-			return 8;
-		case VAL_STRING: 
-			return 4;
-		case VAL_CHUNK: 
-			return 4;
-        case VAL_ADDRESS:
-            return 4;
-		default: 
-			return 4; 
-	}
-	*/	
-	return 4;
+    
+    type = type_find_def(comp, field->type);
+    if (type == NULL) /* reported when the field is accessed. */
+        return 8;
+        
+    switch (type->decltype) {
+        case DECL_NUM:
+        case DECL_BOOL:
+        case DECL_CHAR:
+        case DECL_STRING:
+            return type->d.size;
+        case DECL_INT:
+        case DECL_ENUM: /* enumeration constants are ints. */
+            return 8;
+        case DECL_VOID:
+            fprintf(stderr, "Field '%s' cannot have type 'void'\n", field->name);
+            exit(EXIT_FAILURE);
+        default: /* structs and PMCs are pointers. */
+            return 8;
+    }
 }
 
 static void
-expr_set_switch(m1_expression *node, m1_expression *selector, m1_case *cases, m1_expression *defaultstat) {
-	node->expr.s = (m1_switch *)m1_malloc(sizeof(m1_switch));
+expr_set_switch(M1_compiler *comp, m1_expression *node, m1_expression *selector, m1_case *cases, m1_expression *defaultstat) {
+	node->expr.s = (m1_switch *)m1_malloc(comp, NODE_SWITCH, sizeof(m1_switch));
 	node->expr.s->selector    = selector; 
 	node->expr.s->cases       = cases;
 	node->expr.s->defaultstat = defaultstat;
@@ -554,13 +655,13 @@ expr_set_switch(m1_expression *node, m1_expression *selector, m1_case *cases, m1
 m1_expression *
 switchexpr(M1_compiler *comp, m1_expression *selector, m1_case *cases, m1_expression *defaultstat) {
 	m1_expression *node = expression(comp, EXPR_SWITCH);
-	expr_set_switch(node, selector, cases, defaultstat); 
+	expr_set_switch(comp, node, selector, cases, defaultstat); 
 	return node;
 }
 
 m1_case *
 switchcase(M1_compiler *comp, int selector, m1_expression *block) {
-	m1_case *c  = (m1_case *)m1_malloc(sizeof(m1_case));
+	m1_case *c  = (m1_case *)m1_malloc(comp, NODE_CASE, sizeof(m1_case));
 	c->selector = selector;
 	c->block    = block;
 	c->next     = NULL;
@@ -573,7 +674,7 @@ switchcase(M1_compiler *comp, int selector, m1_expression *block) {
 m1_expression *
 newexpr(M1_compiler *comp, char *type, m1_expression *args) {
 	m1_expression *expr = expression(comp, EXPR_NEW);
-	expr->expr.n        = (m1_newexpr *)m1_malloc(sizeof(m1_newexpr));
+	expr->expr.n        = (m1_newexpr *)m1_malloc(comp, NODE_NEW, sizeof(m1_newexpr));
 	expr->expr.n->type  = type;
 	expr->expr.n->args  = args;
 	return expr;	
@@ -582,7 +683,7 @@ newexpr(M1_compiler *comp, char *type, m1_expression *args) {
 m1_expression *
 castexpr(M1_compiler *comp, char *type, m1_expression *castedexpr) {
     m1_expression *expr = expression(comp, EXPR_CAST);
-    m1_castexpr *cast   = (m1_castexpr *)m1_malloc(sizeof(m1_castexpr));
+    m1_castexpr *cast   = (m1_castexpr *)m1_malloc(comp, NODE_CAST, sizeof(m1_castexpr));
     cast->type          = type;
     cast->expr          = castedexpr;
     expr->expr.cast     = cast;
@@ -591,7 +692,7 @@ castexpr(M1_compiler *comp, char *type, m1_expression *castedexpr) {
 
 m1_enumconst *
 enumconst(M1_compiler *comp, char *enumitem, int enumvalue) {
-    m1_enumconst *ec = (m1_enumconst *)m1_malloc(sizeof(m1_enumconst));
+    m1_enumconst *ec = (m1_enumconst *)m1_malloc(comp, NODE_ENUMCONST, sizeof(m1_enumconst));
     ec->name         = enumitem;
     ec->value        = enumvalue;
     ec->next         = NULL;
@@ -624,7 +725,7 @@ m1_block *
 block( ARGIN_NOTNULL( M1_compiler *comp ) ) 
 {
     m1_block *block;
-    block = (m1_block *)m1_malloc(sizeof(m1_block)); 
+    block = (m1_block *)m1_malloc(comp, NODE_BLOCK, sizeof(m1_block)); 
     
     init_symtab(&block->locals);
     return block;   
@@ -34,7 +34,8 @@ typedef struct m1_chunk {
 typedef struct m1_structfield {
     char        *name;              /* name of struct member. */
     char        *type;              /* type of struct member. */
-    unsigned     offset;            /* memory offset of this member in the struct */
+    unsigned     offset;            /* byte offset of this member in the struct */
+    unsigned     size;              /* size in bytes; also its alignment */
     
     struct m1_structfield *next;    /* fields are stored as a list. */
     
@@ -184,11 +185,41 @@ typedef enum m1_object_type {
     
 } m1_object_type;
 
+/* kinds of steps in an access path. */
+typedef enum m1_access_kind {
+    ACCESS_FIELD, /* .b in a.b: a slot at a constant offset */
+    ACCESS_INDEX  /* [i] in a[i]: a slot at a computed index */
+    
+} m1_access_kind;
+
+/* one step in an access path: which part of the aggregate that the previous
+   step (or the variable) yields is accessed, and the type of what's in it. */
+typedef struct m1_access {
+    m1_access_kind        kind;
+    unsigned              offset;   /* for fields: byte offset of the field */
+    unsigned              size;     /* bytes loaded or stored: 1, 4 or 8 */
+    struct m1_expression *index;    /* for indices: the index expression */
+    struct m1_decl       *type;     /* type of the element or field */
+    
+} m1_access;
+
+/* an access chain like a.b[i].c, resolved by the semantic checker into
+   the variable it starts at and a flat array of steps, so that the code
+   generator can walk it in a loop without looking up fields. */
+typedef struct m1_accesspath {
+    struct m1_symbol *root;         /* the variable; a in a.b[i].c */
+    unsigned          num_steps;    /* 3 in a.b[i].c */
+    m1_access         steps[1];     /* actually num_steps of them */
+    
+} m1_accesspath;
+
 /* struct to represent an element or link between two elements
    in aggregates. In a.b.c, each element (a, b, c) is represented
    by one m1_object node. Links, between a and b, and b and c are ALSO
    represented by a m1_object node. Yes, that's a lot of nodes for 
-   an expression like "a.b.c" (5 in total).
+   an expression like "a.b.c" (5 in total). The semantic checker
+   resolves them into an m1_accesspath, stored in the outermost node,
+   which is all that the code generator looks at.
    
  */
 typedef struct m1_object {
@@ -203,6 +234,8 @@ typedef struct m1_object {
     struct m1_symbol   *sym;        /* pointer to this object's declaration. */ 
     
     struct m1_object   *parent;     /* pointer to its parent (in a.b.c, a is b's parent) */
+    
+    struct m1_accesspath *path;     /* resolved access path, set by the semantic checker. */
       
 } m1_object;
 
@@ -330,6 +363,9 @@ extern m1_chunk *chunk(ARGIN_NOTNULL(M1_compiler * const comp), ARGIN(char *rett
 extern m1_block *block(ARGIN_NOTNULL(M1_compiler *comp));
 
 extern m1_expression *expression(M1_compiler *comp, m1_expr_type type);       
+
+extern m1_expression *reverse_stats(m1_expression *stats);
+extern m1_chunk *reverse_chunks(m1_chunk *chunks);
 extern m1_expression *funcall(M1_compiler *comp, m1_object *fun, m1_expression *args);
             
 extern m1_object *object(M1_compiler *comp, m1_object_type type);            
@@ -337,7 +373,7 @@ extern void obj_set_ident(m1_object *node, char *ident);
 
 extern m1_structfield *structfield(M1_compiler *comp, char *name, char *type);
 
-extern m1_struct *newstruct(M1_compiler *comp, char *name, m1_structfield *fields);
+extern m1_struct *newstruct(M1_compiler *comp, char *name, m1_structfield *fields, int packed);
 
 extern m1_pmc *newpmc(M1_compiler *comp, char *name, m1_structfield *fields, m1_chunk *methods);
 
@@ -369,7 +405,7 @@ extern m1_expression *vardecl(M1_compiler *comp, char *type, m1_var *v);
 extern m1_var *var(M1_compiler *comp, char *name, m1_expression *init);
 extern m1_var *array(M1_compiler *comp, char *name, unsigned size, m1_expression *init);
 
-extern unsigned field_size(struct m1_structfield *field);
+extern unsigned field_size(M1_compiler *comp, struct m1_structfield *field);
 
 extern m1_expression *switchexpr(M1_compiler *comp, m1_expression *expr, m1_case *cases, m1_expression *defaultstat);
 extern m1_case *switchcase(M1_compiler *comp, int selector, m1_expression *block);
@@ -377,6 +413,7 @@ extern m1_case *switchcase(M1_compiler *comp, int selector, m1_expression *block
 extern m1_expression *newexpr(M1_compiler *copm, char *type, m1_expression *args);
 
 extern m1_object *lhsobj(M1_compiler *comp, m1_object *parent, m1_object *field);
+extern m1_accesspath *accesspath(M1_compiler *comp, struct m1_symbol *root, unsigned num_steps);
 extern m1_expression *castexpr(M1_compiler *comp, char *type, m1_expression *castedexpr);
 
 extern m1_structfield *struct_find_field(M1_compiler *comp, m1_struct *structdef, char *fieldname);
@@ -0,0 +1,1131 @@
+/*
+
+Control-flow graph of the M0 code of a chunk; see cfg.h.
+
+The code is read back from the text the code generator wrote, one
+instruction or label per line, with the source lines taken from the line
+marks of the chunk (see gencode.h). Any code that doesn't look like what
+the code generator writes makes cfg_build() give up, and the chunk is
+then left as it is.
+
+The dominator tree is computed with the algorithm of Cooper, Harvey and
+Kennedy ("A Simple, Fast Dominance Algorithm"), over the reverse
+postorder. Traversals of the graph use explicit stacks, as deeply nested
+code gives long chains of blocks.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include "compiler.h"
+#include "gencode.h"
+#include "instr.h"
+#include "cfg.h"
+
+static const char reg_chars[REG_TYPE_NUM] = {'I', 'N', 'S', 'P'};
+
+/* special registers, by their frame index; see PDD32. */
+static char const * const special_regs[] = {
+    "CF", "PCF", "PC", "RETPC", "EH", "CHUNK", "CONSTS", "MDS", "BCS", "INTERP", "SPILLCF"
+};
+
+#define NUM_SPECIAL_REGS    11
+
+/* frame index of register 0 of each type; for immediates that name a register. */
+static const unsigned reg_base[REG_TYPE_NUM] = { 12, 73, 134, 195 };
+
+#define MAX_LINE    256
+
+void *
+cfg_alloc(size_t size) {
+    void *p = calloc(1, size);
+    if (p == NULL) {
+        fprintf(stderr, "cant alloc mem for cfg\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+void *
+cfg_grow(void *p, unsigned *size, unsigned needed, size_t elemsize) {
+    if (needed <= *size)
+        return p;
+
+    while (*size < needed)
+        *size = *size == 0 ? 8 : *size * 2;
+
+    p = realloc(p, *size * elemsize);
+    if (p == NULL) {
+        fprintf(stderr, "cant alloc mem for cfg\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+m1_opnd
+opnd_reg(unsigned type, unsigned no) {
+    m1_opnd o;
+    o.kind = OPND_REG;
+    o.type = (unsigned char)type;
+    o.no   = no;
+    return o;
+}
+
+unsigned
+imm_value(m1_insn *insn) {
+    m1_opnd *hi = &insn->args[1],
+            *lo = &insn->args[2];
+    unsigned value;
+
+    assert(insn->op == M0_SET_IMM);
+    if (lo->type == IMM_NUMBER)
+        value = lo->no;
+    else if (lo->type == IMM_SPECIAL)
+        value = lo->no;
+    else
+        value = reg_base[lo->type - IMM_REG] + lo->no;
+
+    return hi->no * 256 + value;
+}
+
+/*
+
+Instructions.
+
+*/
+
+/* whether op writes its first operand. */
+static int
+op_writes(m0_instr_code op) {
+    switch (op) {
+        case M0_NOOP:
+        case M0_GOTO:
+        case M0_GOTO_IF:
+        case M0_GOTO_CHUNK:
+        case M0_SYS_FREE:
+        case M0_COPY_MEM:
+        case M0_SET_REF:
+        case M0_SET_BYTE:
+        case M0_SET_WORD:
+        case M0_CCALL_ARG:
+        case M0_CCALL:
+        case M0_PRINT_S:
+        case M0_PRINT_I:
+        case M0_PRINT_N:
+        case M0_EXIT:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+m1_opnd *
+insn_def(m1_insn *insn) {
+    if ((insn->flags & INSN_FOREIGN) || !op_writes(insn->op))
+        return NULL;
+    return insn->args[0].kind == OPND_REG ? &insn->args[0] : NULL;
+}
+
+m1_opnd *
+insn_use(m1_insn *insn, unsigned i) {
+    unsigned k;
+
+    if (insn->flags & INSN_FOREIGN)
+        return NULL;
+
+    if (insn->op == M1_PHI)
+        return i < insn->block->num_preds ? &insn->phiargs[i] : NULL;
+
+    for (k = op_writes(insn->op) ? 1 : 0; k < insn->num_args; k++) {
+        if (insn->args[k].kind == OPND_REG && i-- == 0)
+            return &insn->args[k];
+    }
+    return NULL;
+}
+
+int
+insn_has_effects(m1_insn *insn) {
+    if (insn->flags & (INSN_PINNED | INSN_FOREIGN))
+        return 1;
+    if (insn->op == M0_NOOP || insn->op == M1_PHI)
+        return 0;
+    if (!op_writes(insn->op) || insn->args[0].kind != OPND_REG)
+        return 1;
+
+    switch (insn->op) {
+        case M0_DIV_I:      /* may trap */
+        case M0_MOD_I:
+        case M0_GC_ALLOC:   /* may collect */
+        case M0_SYS_ALLOC:
+        case M0_CSYM:
+        case M0_CCALL_RET:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+int
+insn_is_pure(m1_insn *insn) {
+    unsigned k;
+
+    if (insn_has_effects(insn) || insn_def(insn) == NULL || insn->op == M1_PHI)
+        return 0;
+
+    /* the constants segment doesn't change; other special registers and memory may. */
+    for (k = 1; k < insn->num_args; k++) {
+        m1_opnd *o = &insn->args[k];
+        if (o->kind == OPND_SPECIAL && !(insn->op == M0_DEREF && k == 1 && o->no == SPECIAL_CONSTS))
+            return 0;
+    }
+
+    switch (insn->op) {
+        case M0_DEREF:
+            return insn->args[1].kind == OPND_SPECIAL;
+        case M0_GET_BYTE:
+        case M0_GET_WORD:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+int
+insn_is_terminator(m1_insn *insn) {
+    switch (insn->op) {
+        case M0_GOTO:
+        case M0_GOTO_IF:
+        case M0_EXIT:
+            return 1;
+        case M0_GOTO_CHUNK:
+            return !(insn->flags & INSN_FOREIGN);
+        default:
+            return 0;
+    }
+}
+
+m1_insn *
+insn_new(m0_instr_code op, unsigned line) {
+    m1_insn *insn = (m1_insn *)cfg_alloc(sizeof(m1_insn));
+    insn->op   = op;
+    insn->line = line;
+    return insn;
+}
+
+void
+insn_insert(m1_bblock *block, m1_insn *insn, m1_insn *position) {
+    assert(position == NULL || position->block == block);
+
+    insn->block = block;
+    insn->next  = position;
+    insn->prev  = position != NULL ? position->prev : block->last;
+
+    if (insn->prev != NULL)
+        insn->prev->next = insn;
+    else
+        block->first = insn;
+
+    if (position != NULL)
+        position->prev = insn;
+    else
+        block->last = insn;
+}
+
+void
+insn_append(m1_bblock *block, m1_insn *insn) {
+    m1_insn *last = block->last;
+
+    if (last != NULL && insn_is_terminator(last))
+        insn_insert(block, insn, last);
+    else
+        insn_insert(block, insn, NULL);
+}
+
+void
+insn_unlink(m1_insn *insn) {
+    m1_bblock *block = insn->block;
+
+    if (insn->prev != NULL)
+        insn->prev->next = insn->next;
+    else
+        block->first = insn->next;
+
+    if (insn->next != NULL)
+        insn->next->prev = insn->prev;
+    else
+        block->last = insn->prev;
+
+    insn->block = NULL;
+    insn->prev  = insn->next = NULL;
+}
+
+void
+insn_remove(m1_insn *insn) {
+    insn_unlink(insn);
+    free(insn->phiargs);
+    free(insn);
+}
+
+/*
+
+Blocks and edges.
+
+*/
+
+m1_bblock *
+cfg_new_block(m1_cfg *cfg, m1_bblock *position) {
+    m1_bblock *b = (m1_bblock *)cfg_alloc(sizeof(m1_bblock));
+
+    b->id    = cfg->num_blocks;
+    b->label = -1;
+
+    cfg->blocks = (m1_bblock **)cfg_grow(cfg->blocks, &cfg->block_size, cfg->num_blocks + 1, sizeof(m1_bblock *));
+    cfg->blocks[cfg->num_blocks++] = b;
+
+    if (position == NULL)
+        position = cfg->exit;
+
+    /* link into the layout, before position. */
+    b->next = position;
+    if (position != NULL) {
+        b->prev        = position->prev;
+        position->prev = b;
+    }
+    else {
+        b->prev   = cfg->last;
+        cfg->last = b;
+    }
+
+    if (b->prev != NULL)
+        b->prev->next = b;
+    else
+        cfg->entry = b;
+
+    cfg->has_doms = 0;
+    return b;
+}
+
+static void
+add_pred(m1_bblock *block, m1_bblock *pred) {
+    block->preds = (m1_bblock **)cfg_grow(block->preds, &block->pred_size, block->num_preds + 1, sizeof(m1_bblock *));
+    block->preds[block->num_preds++] = pred;
+}
+
+static void
+add_edge(m1_bblock *from, m1_bblock *to) {
+    assert(from->num_succs < 2);
+    from->succs[from->num_succs++] = to;
+    add_pred(to, from);
+}
+
+/* remove the index'th predecessor of block, and its arguments of phi functions. */
+static void
+remove_pred(m1_bblock *block, unsigned index) {
+    m1_insn  *insn;
+    unsigned  i;
+
+    for (insn = block->first; insn != NULL && insn->op == M1_PHI; insn = insn->next) {
+        for (i = index; i + 1 < block->num_preds; i++)
+            insn->phiargs[i] = insn->phiargs[i + 1];
+    }
+
+    for (i = index; i + 1 < block->num_preds; i++)
+        block->preds[i] = block->preds[i + 1];
+    --block->num_preds;
+}
+
+void
+cfg_add_edge(m1_bblock *from, m1_bblock *to) {
+    add_edge(from, to);
+}
+
+void
+cfg_remove_edge(m1_cfg *cfg, m1_bblock *from, unsigned index) {
+    m1_bblock *to = from->succs[index];
+
+    assert(index < from->num_succs);
+    remove_pred(to, block_pred_index(to, from));
+
+    if (index == 0 && from->num_succs == 2)
+        from->succs[0] = from->succs[1];
+    --from->num_succs;
+    cfg->has_doms = 0;
+}
+
+unsigned
+block_pred_index(m1_bblock *block, m1_bblock *pred) {
+    unsigned i;
+
+    for (i = 0; i < block->num_preds; i++) {
+        if (block->preds[i] == pred)
+            return i;
+    }
+    assert(0);
+    return 0;
+}
+
+m1_bblock *
+block_fallthrough(m1_bblock *block) {
+    m1_insn *last = block->last;
+
+    if (last == NULL || !insn_is_terminator(last))
+        return block->num_succs > 0 ? block->succs[0] : NULL;
+    if (last->op == M0_GOTO_IF)
+        return block->succs[1];
+    return NULL;
+}
+
+m1_bblock *
+cfg_split_edge(m1_cfg *cfg, m1_bblock *from, unsigned index) {
+    m1_bblock *to = from->succs[index];
+    m1_bblock *n;
+    int        fallthrough = block_fallthrough(from) == to
+                          && (from->last == NULL || from->last->op != M0_GOTO_IF || index == 1);
+
+    /* keep the fall-through edge a fall-through, so that it needs no goto;
+       otherwise fall into to, unless another block does. */
+    if (fallthrough)
+        n = cfg_new_block(cfg, from->next);
+    else if (to->prev == NULL || block_fallthrough(to->prev) != to)
+        n = cfg_new_block(cfg, to);
+    else
+        n = cfg_new_block(cfg, NULL);
+
+    n->succs[0]  = to;
+    n->num_succs = 1;
+    add_pred(n, from);
+
+    from->succs[index]                    = n;
+    to->preds[block_pred_index(to, from)] = n;
+    return n;
+}
+
+/* whether block does nothing but go on to its one successor. */
+static int
+is_empty_block(m1_bblock *block) {
+    if (block->num_succs != 1 || block->succs[0] == block)
+        return 0;
+    return block->first == NULL
+       || (block->first == block->last && block->first->op == M0_GOTO && !(block->first->flags & INSN_PINNED));
+}
+
+void
+cfg_cleanup(m1_cfg *cfg) {
+    unsigned i, k;
+
+    assert(!cfg->in_ssa);
+
+    for (i = 0; i < cfg->num_blocks; i++) {
+        m1_bblock *b = cfg->blocks[i];
+
+        if (b == NULL)
+            continue;
+
+        for (k = 0; k < b->num_succs; k++) {
+            m1_bblock *s = b->succs[k],
+                      *t = s;
+            unsigned   n = 0;
+
+            /* empty blocks may form a loop of their own. */
+            while (is_empty_block(t) && n++ < cfg->num_blocks)
+                t = t->succs[0];
+            if (t == s)
+                continue;
+
+            remove_pred(s, block_pred_index(s, b));
+            b->succs[k] = t;
+            add_pred(t, b);
+            cfg->has_doms = 0;
+        }
+    }
+
+    /* the empty blocks that were gone through are no longer reached. */
+    cfg_dominators(cfg);
+}
+
+/* take block, which has no edges left, out of the graph. */
+static void
+remove_block(m1_cfg *cfg, m1_bblock *block) {
+    m1_insn  *insn, *next;
+
+    assert(block->num_preds == 0 && block->num_succs == 0);
+
+    for (insn = block->first; insn != NULL; insn = next) {
+        next = insn->next;
+        free(insn->phiargs);
+        free(insn);
+    }
+
+    if (block->prev != NULL)
+        block->prev->next = block->next;
+    else
+        cfg->entry = block->next;
+    if (block->next != NULL)
+        block->next->prev = block->prev;
+    else
+        cfg->last = block->prev;
+
+    if (cfg->exit == block)
+        cfg->exit = NULL;
+
+    cfg->blocks[block->id] = NULL;
+    free(block->preds);
+    free(block);
+}
+
+/*
+
+Reverse postorder and dominators. Blocks that can't be reached from the
+entry are removed first.
+
+*/
+static void
+compute_rpo(m1_cfg *cfg) {
+    m1_bblock **stack;
+    unsigned   *nextsucc;
+    char       *visited;
+    unsigned    sp = 0,
+                n  = 0,
+                i;
+
+    stack    = (m1_bblock **)cfg_alloc(cfg->num_blocks * sizeof(m1_bblock *));
+    nextsucc = (unsigned *)cfg_alloc(cfg->num_blocks * sizeof(unsigned));
+    visited  = (char *)cfg_alloc(cfg->num_blocks);
+
+    free(cfg->rpo);
+    cfg->rpo = (m1_bblock **)cfg_alloc(cfg->num_blocks * sizeof(m1_bblock *));
+
+    /* depth-first; a block is added when all its successors are done,
+       from the end of the array, which gives reverse postorder. */
+    stack[sp++]               = cfg->entry;
+    visited[cfg->entry->id]   = 1;
+    nextsucc[cfg->entry->id]  = 0;
+
+    while (sp > 0) {
+        m1_bblock *b = stack[sp - 1];
+
+        if (nextsucc[b->id] < b->num_succs) {
+            m1_bblock *s = b->succs[nextsucc[b->id]++];
+            if (!visited[s->id]) {
+                visited[s->id]  = 1;
+                nextsucc[s->id] = 0;
+                stack[sp++]     = s;
+            }
+        }
+        else {
+            --sp;
+            ++n;
+            cfg->rpo[cfg->num_blocks - n] = b;
+        }
+    }
+
+    /* move the blocks to the start of the array. */
+    memmove(cfg->rpo, cfg->rpo + cfg->num_blocks - n, n * sizeof(m1_bblock *));
+    cfg->num_rpo = n;
+
+    for (i = 0; i < n; i++)
+        cfg->rpo[i]->rpo = i;
+
+    /* drop the unreachable blocks, after cutting their edges to the
+       reachable ones; they may also feed each other. */
+    for (i = 0; i < cfg->num_blocks; i++) {
+        m1_bblock *b = cfg->blocks[i];
+        unsigned   k;
+
+        if (b == NULL || visited[b->id])
+            continue;
+
+        for (k = 0; k < b->num_succs; k++) {
+            m1_bblock *s = b->succs[k];
+            if (visited[s->id])
+                remove_pred(s, block_pred_index(s, b));
+        }
+        b->num_succs = 0;
+        b->num_preds = 0;
+    }
+    for (i = 0; i < cfg->num_blocks; i++) {
+        m1_bblock *b = cfg->blocks[i];
+
+        if (b != NULL && !visited[b->id])
+            remove_block(cfg, b);
+    }
+
+    free(stack);
+    free(nextsucc);
+    free(visited);
+}
+
+static m1_bblock *
+intersect(m1_bblock *a, m1_bblock *b) {
+    while (a != b) {
+        while (a->rpo > b->rpo)
+            a = a->idom;
+        while (b->rpo > a->rpo)
+            b = b->idom;
+    }
+    return a;
+}
+
+void
+cfg_dominators(m1_cfg *cfg) {
+    unsigned i, k;
+    int      changed = 1;
+
+    if (cfg->has_doms)
+        return;
+
+    compute_rpo(cfg);
+
+    for (i = 0; i < cfg->num_rpo; i++)
+        cfg->rpo[i]->idom = NULL;
+    cfg->entry->idom = cfg->entry;
+
+    while (changed) {
+        changed = 0;
+        for (i = 1; i < cfg->num_rpo; i++) {
+            m1_bblock *b    = cfg->rpo[i];
+            m1_bblock *idom = NULL;
+
+            for (k = 0; k < b->num_preds; k++) {
+                m1_bblock *p = b->preds[k];
+                if (p->idom == NULL)
+                    continue;
+                idom = idom == NULL ? p : intersect(p, idom);
+            }
+            if (b->idom != idom) {
+                b->idom = idom;
+                changed = 1;
+            }
+        }
+    }
+
+    /* the tree; children are kept in reverse postorder. */
+    for (i = 0; i < cfg->num_rpo; i++)
+        cfg->rpo[i]->domchild = cfg->rpo[i]->domsibling = NULL;
+
+    for (i = cfg->num_rpo; i-- > 1; ) {
+        m1_bblock *b = cfg->rpo[i];
+        b->domsibling       = b->idom->domchild;
+        b->idom->domchild   = b;
+    }
+
+    cfg->entry->domdepth = 0;
+    for (i = 1; i < cfg->num_rpo; i++)
+        cfg->rpo[i]->domdepth = cfg->rpo[i]->idom->domdepth + 1;
+
+    cfg->has_doms = 1;
+}
+
+int
+cfg_dominates(m1_bblock *a, m1_bblock *b) {
+    while (b->domdepth > a->domdepth)
+        b = b->idom;
+    return a == b;
+}
+
+/*
+
+Reading the code.
+
+*/
+static char *
+trim(char *s) {
+    char *end;
+
+    while (isspace((unsigned char)*s))
+        s++;
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1]))
+        *--end = '\0';
+    return s;
+}
+
+/* parse operand text into o; immediates are operands 2 and 3 of set_imm. */
+static int
+parse_opnd(char const *text, m1_opnd *o, int is_imm) {
+    char const *p;
+    unsigned    i;
+
+    o->kind = OPND_NONE;
+    o->type = 0;
+    o->no   = 0;
+
+    if (strcmp(text, "x") == 0)
+        return 1;
+
+    if (text[0] != '\0' && strchr("INSP", text[0]) != NULL && isdigit((unsigned char)text[1])) {
+        unsigned type = (unsigned)(strchr("INSP", text[0]) - "INSP");
+
+        for (p = text + 1; isdigit((unsigned char)*p); p++)
+            ;
+        if (*p != '\0' || atoi(text + 1) >= REG_NUM)
+            return 0;
+
+        o->kind = is_imm ? OPND_IMM : OPND_REG;
+        o->type = (unsigned char)(is_imm ? IMM_REG + type : type);
+        o->no   = (unsigned)atoi(text + 1);
+        return 1;
+    }
+
+    for (i = 0; i < NUM_SPECIAL_REGS; i++) {
+        if (strcmp(text, special_regs[i]) == 0) {
+            o->kind = is_imm ? OPND_IMM : OPND_SPECIAL;
+            o->type = IMM_SPECIAL;
+            o->no   = i;
+            return 1;
+        }
+    }
+
+    if (text[0] == 'L' && isdigit((unsigned char)text[1])) {
+        o->kind = OPND_LABEL;
+        o->no   = (unsigned)atoi(text + 1);
+        return 1;
+    }
+
+    if (isdigit((unsigned char)text[0])) {
+        for (p = text; isdigit((unsigned char)*p); p++)
+            ;
+        if (*p != '\0' || atoi(text) > 255)
+            return 0;
+
+        /* a number where a register is read is a frame index; only
+           those of special registers are expected. */
+        o->kind = is_imm ? OPND_IMM : OPND_SPECIAL;
+        o->type = IMM_NUMBER;
+        o->no   = (unsigned)atoi(text);
+        return is_imm || o->no < NUM_SPECIAL_REGS;
+    }
+
+    return 0;
+}
+
+static int
+parse_op(char const *name, m0_instr_code *op) {
+    unsigned i;
+
+    for (i = 0; i < M1_PHI; i++) {
+        if (strcmp(name, m0_instr_names[i]) == 0) {
+            *op = (m0_instr_code)i;
+            return 1;
+        }
+    }
+    /* names used by the code generator for the conversion ops. */
+    if (strcmp(name, "convert_i_n") == 0) {
+        *op = M0_NTOI;
+        return 1;
+    }
+    if (strcmp(name, "convert_n_i") == 0) {
+        *op = M0_ITON;
+        return 1;
+    }
+    return 0;
+}
+
+/* parse the instruction in text, which is modified. */
+static m1_insn *
+parse_insn(char *text, unsigned line) {
+    m1_insn       *insn;
+    m0_instr_code  op;
+    char          *args;
+    char          *arg;
+
+    args = text;
+    while (*args != '\0' && !isspace((unsigned char)*args))
+        args++;
+    if (*args != '\0')
+        *args++ = '\0';
+
+    if (!parse_op(text, &op))
+        return NULL;
+
+    insn = insn_new(op, line);
+
+    for (arg = strtok(args, ","); arg != NULL; arg = strtok(NULL, ",")) {
+        unsigned i = insn->num_args;
+
+        if (i == 3 || !parse_opnd(trim(arg), &insn->args[i], op == M0_SET_IMM && i > 0)) {
+            free(insn);
+            return NULL;
+        }
+        /* labels are only expected as targets of goto and goto_if. */
+        if ((insn->args[i].kind == OPND_LABEL) != ((op == M0_GOTO || op == M0_GOTO_IF) && i == 0)) {
+            free(insn);
+            return NULL;
+        }
+        ++insn->num_args;
+    }
+
+    if ((op == M0_GOTO || op == M0_GOTO_IF) && insn->num_args == 0) {
+        free(insn);
+        return NULL;
+    }
+    return insn;
+}
+
+/* whether insn reads PC. */
+static int
+reads_pc(m1_insn *insn) {
+    unsigned i;
+
+    for (i = 1; i < insn->num_args; i++) {
+        if (insn->args[i].kind == OPND_SPECIAL && insn->args[i].no == SPECIAL_PC)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+
+Pin the code that computes an address as PC plus an offset, and the
+instructions up to that address. The offset is loaded with a set_imm
+just before.
+
+*/
+static int
+pin_pc_relative(m1_bblock *block) {
+    m1_insn *insn;
+
+    for (insn = block->first; insn != NULL; insn = insn->next) {
+        m1_insn  *def;
+        m1_opnd  *offset = NULL;
+        unsigned  i, k;
+
+        /* code in a callee's frame is pinned already. */
+        if (!reads_pc(insn) || (insn->flags & INSN_FOREIGN))
+            continue;
+
+        if (insn->op != M0_ADD_I)
+            return 0;
+        for (i = 1; i < 3; i++) {
+            if (insn->args[i].kind == OPND_REG)
+                offset = &insn->args[i];
+        }
+        if (offset == NULL)
+            return 0;
+
+        for (def = insn->prev; def != NULL; def = def->prev) {
+            m1_opnd *d = insn_def(def);
+            if (d != NULL && d->type == offset->type && d->no == offset->no)
+                break;
+        }
+        if (def == NULL || def->op != M0_SET_IMM || def->args[2].type != IMM_NUMBER)
+            return 0;
+
+        /* the run must not cross the end of the block. */
+        k = imm_value(def);
+        for (i = 0; i <= k; i++) {
+            if (insn == NULL)
+                return 0;
+            insn->flags |= INSN_PINNED;
+            if (i < k)
+                insn = insn->next;
+        }
+    }
+    return 1;
+}
+
+static void
+free_blocks(m1_cfg *cfg) {
+    unsigned i;
+
+    for (i = 0; i < cfg->num_blocks; i++) {
+        m1_bblock *b = cfg->blocks[i];
+        m1_insn   *insn, *next;
+
+        if (b == NULL)
+            continue;
+        for (insn = b->first; insn != NULL; insn = next) {
+            next = insn->next;
+            free(insn->phiargs);
+            free(insn);
+        }
+        free(b->preds);
+        free(b);
+    }
+}
+
+void
+cfg_free(m1_cfg *cfg) {
+    if (cfg == NULL)
+        return;
+    free_blocks(cfg);
+    free(cfg->blocks);
+    free(cfg->rpo);
+    free(cfg->values);
+    free(cfg);
+}
+
+m1_cfg *
+cfg_build(M1_compiler *comp, m1_chunk *c, char const *code, size_t codesize) {
+    m1_cfg       *cfg;
+    m1_linemark  *marks     = comp->linemarks;
+    unsigned      mark      = 0;
+    unsigned      line      = c->line;
+    m1_bblock   **labels;
+    m1_bblock    *block     = NULL;
+    m1_bblock    *b;
+    int           foreign   = 0;
+    size_t        pos       = 0;
+    char          text[MAX_LINE];
+
+    cfg         = (m1_cfg *)cfg_alloc(sizeof(m1_cfg));
+    cfg->comp   = comp;
+    cfg->chunk  = c;
+    labels      = (m1_bblock **)cfg_alloc((comp->label + 1) * sizeof(m1_bblock *));
+
+    while (pos < codesize) {
+        char const *eol  = (char const *)memchr(code + pos, '\n', codesize - pos);
+        size_t      next = eol == NULL ? codesize : (size_t)(eol - code) + 1;
+        size_t      len  = next - pos;
+        char       *s;
+
+        while (mark < comp->num_linemarks && marks[mark].offset <= (long)pos)
+            line = marks[mark++].line;
+
+        if (len >= MAX_LINE)
+            goto fail;
+        memcpy(text, code + pos, len);
+        text[len] = '\0';
+        pos       = next;
+
+        s = trim(text);
+        if (*s == '\0')
+            continue;
+
+        if (s[strlen(s) - 1] == ':') {
+            unsigned n = (unsigned)atoi(s + 1);
+
+            if (s[0] != 'L' || n >= (unsigned)comp->label || labels[n] != NULL || foreign)
+                goto fail;
+
+            if (block == NULL || block->first != NULL) {
+                block = cfg_new_block(cfg, NULL);
+            }
+            labels[n] = block;
+            if (block->label < 0)
+                block->label = (int)n;
+        }
+        else {
+            m1_insn *insn = parse_insn(s, line);
+
+            if (insn == NULL)
+                goto fail;
+
+            if (foreign) {
+                insn->flags |= INSN_PINNED | INSN_FOREIGN;
+                /* back in the chunk's own frame after this. */
+                if (insn->op == M0_SET && insn->args[0].kind == OPND_SPECIAL && insn->args[0].no == SPECIAL_CF
+                &&  insn->args[1].kind == OPND_SPECIAL && insn->args[1].no == SPECIAL_PCF)
+                    foreign = 0;
+            }
+            else if (insn->op == M0_SET && insn->args[0].kind == OPND_SPECIAL && insn->args[0].no == SPECIAL_CF) {
+                /* switch to a callee's frame. */
+                if (insn->args[1].kind != OPND_REG)
+                    goto fail;
+                insn->flags |= INSN_PINNED;
+                foreign      = 1;
+            }
+
+            if (block == NULL)
+                block = cfg_new_block(cfg, NULL);
+            insn_insert(block, insn, NULL);
+
+            if (insn_is_terminator(insn))
+                block = NULL;
+        }
+    }
+
+    if (foreign || cfg->entry == NULL)
+        goto fail;
+
+    /* the edges. */
+    for (b = cfg->entry; b != NULL; b = b->next) {
+        m1_insn *last = b->last;
+
+        if (last != NULL && (last->op == M0_GOTO || last->op == M0_GOTO_IF)) {
+            m1_bblock *target;
+
+            if (last->args[0].no >= (unsigned)comp->label || labels[last->args[0].no] == NULL)
+                goto fail;
+            target = labels[last->args[0].no];
+            add_edge(b, target);
+            if (last->op == M0_GOTO)
+                continue;
+        }
+        else if (last != NULL && insn_is_terminator(last))
+            continue;
+
+        /* falls through; the last block to the exit block. */
+        if (b->next == NULL && b != cfg->exit)
+            cfg->exit = cfg_new_block(cfg, NULL);
+        if (b != cfg->exit)
+            add_edge(b, b->next);
+    }
+
+    for (b = cfg->entry; b != NULL; b = b->next) {
+        if (!pin_pc_relative(b))
+            goto fail;
+    }
+
+    /* the entry must not be a branch target, for SSA form. */
+    if (cfg->entry->num_preds > 0) {
+        m1_bblock *old = cfg->entry;
+        b = cfg_new_block(cfg, old);
+        add_edge(b, old);
+    }
+
+    free(labels);
+    cfg_dominators(cfg);
+    return cfg;
+
+fail:
+    free(labels);
+    cfg_free(cfg);
+    return NULL;
+}
+
+/*
+
+Writing the code.
+
+*/
+static void
+print_opnd(FILE *out, m1_opnd const *o) {
+    switch (o->kind) {
+        case OPND_NONE:
+            fprintf(out, "x");
+            break;
+        case OPND_REG:
+            fprintf(out, "%c%u", reg_chars[o->type], o->no);
+            break;
+        case OPND_SPECIAL:
+            if (o->type == IMM_NUMBER)
+                fprintf(out, "%u", o->no);
+            else
+                fprintf(out, "%s", special_regs[o->no]);
+            break;
+        case OPND_LABEL:
+            fprintf(out, "L%u", o->no);
+            break;
+        case OPND_IMM:
+            if (o->type == IMM_NUMBER)
+                fprintf(out, "%u", o->no);
+            else if (o->type == IMM_SPECIAL)
+                fprintf(out, "%s", special_regs[o->no]);
+            else
+                fprintf(out, "%c%u", reg_chars[o->type - IMM_REG], o->no);
+            break;
+        default:
+            assert(0);
+    }
+}
+
+static void
+print_insn(FILE *out, m1_insn *insn) {
+    unsigned i;
+
+    fprintf(out, "\t%s\t", m0_instr_names[insn->op]);
+    if (insn->op == M1_PHI) {
+        print_opnd(out, &insn->args[0]);
+        for (i = 0; i < insn->block->num_preds; i++) {
+            fprintf(out, i == 0 ? " <- " : ", ");
+            print_opnd(out, &insn->phiargs[i]);
+        }
+        fprintf(out, "\n");
+        return;
+    }
+    for (i = 0; i < insn->num_args; i++) {
+        if (i > 0)
+            fprintf(out, ", ");
+        print_opnd(out, &insn->args[i]);
+    }
+    fprintf(out, "\n");
+}
+
+/* whether the goto that ends block jumps to the next block. */
+static int
+is_goto_next(m1_bblock *block) {
+    return block->last != NULL && block->last->op == M0_GOTO && !(block->last->flags & INSN_PINNED)
+        && block->succs[0] == block->next;
+}
+
+void
+cfg_print(m1_cfg *cfg) {
+    M1_compiler *comp = cfg->comp;
+    FILE        *out  = comp->outfile;
+    m1_bblock   *b, *f;
+    m1_insn     *insn;
+    char        *needs_label;
+
+    assert(!cfg->in_ssa);
+    assert(cfg->exit == NULL || cfg->exit->next == NULL);
+
+    /* find out which blocks are jumped to, and give them labels. */
+    needs_label = (char *)cfg_alloc(cfg->num_blocks);
+    for (b = cfg->entry; b != NULL; b = b->next) {
+        if (b->last != NULL && (b->last->op == M0_GOTO_IF || (b->last->op == M0_GOTO && !is_goto_next(b))))
+            needs_label[b->succs[0]->id] = 1;
+
+        f = block_fallthrough(b);
+        if (f != NULL && f != b->next)
+            needs_label[f->id] = 1;
+    }
+
+    for (b = cfg->entry; b != NULL; b = b->next) {
+        if (needs_label[b->id] && b->label < 0)
+            b->label = comp->label++;
+    }
+
+    for (b = cfg->entry; b != NULL; b = b->next) {
+        if (needs_label[b->id])
+            fprintf(out, "L%d:\n", b->label);
+
+        for (insn = b->first; insn != NULL; insn = insn->next) {
+            if (insn == b->last && is_goto_next(b))
+                break;
+            if (insn->op == M0_GOTO || insn->op == M0_GOTO_IF)
+                insn->args[0].no = (unsigned)b->succs[0]->label;
+
+            gencode_mark_line(comp, insn->line);
+            print_insn(out, insn);
+        }
+
+        f = block_fallthrough(b);
+        if (f != NULL && f != b->next)
+            fprintf(out, "\tgoto\tL%d\n", f->label);
+    }
+
+    free(needs_label);
+}
+
+void
+cfg_dump(m1_cfg *cfg, FILE *out) {
+    m1_bblock *b;
+    m1_insn   *insn;
+    unsigned   i;
+
+    fprintf(out, "cfg of chunk %s%s\n", cfg->chunk->name, cfg->in_ssa ? " (SSA)" : "");
+    for (b = cfg->entry; b != NULL; b = b->next) {
+        fprintf(out, "block %u", b->id);
+        if (b->label >= 0)
+            fprintf(out, " (L%d)", b->label);
+        if (b == cfg->exit)
+            fprintf(out, " exit");
+        fprintf(out, ", preds:");
+        for (i = 0; i < b->num_preds; i++)
+            fprintf(out, " %u", b->preds[i]->id);
+        fprintf(out, ", succs:");
+        for (i = 0; i < b->num_succs; i++)
+            fprintf(out, " %u", b->succs[i]->id);
+        if (cfg->has_doms && b->idom != NULL)
+            fprintf(out, ", idom: %u", b->idom->id);
+        fprintf(out, "\n");
+
+        for (insn = b->first; insn != NULL; insn = insn->next) {
+            fprintf(out, "%s", insn->flags & INSN_FOREIGN ? "F" : insn->flags & INSN_PINNED ? "P" : "");
+            print_insn(out, insn);
+        }
+    }
+}
@@ -0,0 +1,231 @@
+#ifndef __M1_CFG_H__
+#define __M1_CFG_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include "compiler.h"
+#include "ast.h"
+#include "instr.h"
+
+/*
+
+Control-flow graph of the M0 code of a chunk, for the optimization passes
+(see pass.h).
+
+The code generator writes the bytecode of a chunk as text; cfg_build()
+reads it back into a list of instructions per basic block. A block starts
+at a label, and after an instruction that transfers control: goto,
+goto_if, exit, or a goto_chunk that leaves the chunk. The successors of a
+block are explicit: succs[0] is the target of its goto or goto_if, or the
+block it falls through to, and succs[1] is the block a goto_if falls
+through to. cfg_print() writes the code back, adding a goto wherever a
+block isn't followed by the block it falls through to, so passes may
+reorder blocks freely. The last block of a chunk that runs off its end
+falls through to the exit block, which is empty and always last.
+
+A function call is a run of instructions that must stay as it is: parts
+of it compute return addresses as PC plus the number of instructions up
+to the return point, and parts run in the callee's frame, where registers
+are not the chunk's own. These instructions are marked INSN_PINNED, and
+those in the callee's frame also INSN_FOREIGN. Passes must not remove,
+move or insert instructions within a pinned run, and must not look at the
+registers of foreign instructions. Control comes back to the instruction
+after the call's goto_chunk, so that doesn't end a block.
+
+In SSA form (see ssa.h), the number of a register operand is that of the
+value it holds, in cfg->values, and every block starts with its phi
+functions, M1_PHI instructions with an argument per predecessor.
+
+*/
+
+typedef enum m1_opndkind {
+    OPND_NONE,      /* "x" */
+    OPND_REG,       /* I3, N0, S1, P2; in SSA form, a value */
+    OPND_SPECIAL,   /* special register: CF, PC, CONSTS, ... */
+    OPND_IMM,       /* 0-255, for set_imm and slot numbers */
+    OPND_LABEL      /* L12, for goto and goto_if */
+
+} m1_opndkind;
+
+/* how an immediate (or special register) is written: as a number, a special
+   register's name (set_imm I0, 0, RETPC) or, for IMM_REG + type, a register's
+   name (set_imm I0, 0, N0). */
+#define IMM_NUMBER      0
+#define IMM_SPECIAL     1
+#define IMM_REG         2
+
+typedef struct m1_opnd {
+    unsigned char kind;     /* m1_opndkind */
+    unsigned char type;     /* OPND_REG: VAL_INT, VAL_FLOAT, VAL_STRING or VAL_CHUNK; otherwise IMM_* */
+    unsigned      no;       /* number of the register, value, special register, label;
+                               value of the immediate, or number of the register named */
+} m1_opnd;
+
+/* numbers of some special registers, their index in a call frame. */
+#define SPECIAL_CF      0
+#define SPECIAL_PCF     1
+#define SPECIAL_PC      2
+#define SPECIAL_CONSTS  6
+
+#define INSN_PINNED     0x01    /* in a run of instructions that must stay as it is */
+#define INSN_FOREIGN    0x02    /* runs in a callee's frame */
+
+typedef struct m1_insn {
+    m0_instr_code      op;
+    unsigned char      num_args;     /* number of operands written */
+    unsigned char      flags;
+    m1_opnd            args[3];
+    m1_opnd           *phiargs;      /* M1_PHI: one per predecessor of the block */
+    unsigned           line;         /* source line */
+
+    struct m1_bblock  *block;
+    struct m1_insn    *prev,
+                      *next;
+
+} m1_insn;
+
+/* a basic block; m1_block is a block of statements in the AST. */
+typedef struct m1_bblock {
+    unsigned           id;           /* index in cfg->blocks */
+    int                label;        /* label at its start, or -1 */
+    m1_insn           *first,
+                      *last;
+
+    struct m1_bblock **preds;
+    unsigned           num_preds,
+                       pred_size;
+    struct m1_bblock  *succs[2];
+    unsigned           num_succs;
+
+    struct m1_bblock  *prev,         /* in the order of the code */
+                      *next;
+
+    /* dominator tree; see cfg_dominators(). */
+    unsigned           rpo;          /* position in reverse postorder */
+    struct m1_bblock  *idom;
+    struct m1_bblock  *domchild,
+                      *domsibling;
+    unsigned           domdepth;
+
+} m1_bblock;
+
+/* an SSA value: the register it was in before SSA construction, and the
+   instruction that defines it. Entry values, of registers that are read
+   before they are written (such as parameters), are defined on entry to
+   the chunk, and must stay in their register. */
+typedef struct m1_ssavalue {
+    unsigned char      type;
+    unsigned char      reg;
+    unsigned char      is_entry;
+    m1_insn           *def;
+
+} m1_ssavalue;
+
+typedef struct m1_cfg {
+    M1_compiler       *comp;
+    m1_chunk          *chunk;
+
+    m1_bblock         *entry;        /* first block; the chunk starts here */
+    m1_bblock         *last;         /* last block in the code */
+    m1_bblock         *exit;         /* empty last block, or NULL */
+    m1_bblock        **blocks;       /* by id; removed blocks are NULL */
+    unsigned           num_blocks,
+                       block_size;
+
+    m1_bblock        **rpo;          /* reachable blocks, in reverse postorder */
+    unsigned           num_rpo;
+    int                has_doms;     /* whether rpo and the dominator tree are up to date */
+
+    int                in_ssa;
+    m1_ssavalue       *values;
+    unsigned           num_values,
+                       value_size;
+
+} m1_cfg;
+
+/* build the graph of the code of chunk c; NULL if the code can't be optimized. */
+extern m1_cfg *cfg_build(M1_compiler *comp, m1_chunk *c, char const *code, size_t codesize);
+
+/* write the code, and the line marks for it (see gencode_mark_line()), to comp->outfile. */
+extern void cfg_print(m1_cfg *cfg);
+
+/* write the graph, with its blocks and edges, to out, for debugging. */
+extern void cfg_dump(m1_cfg *cfg, FILE *out);
+
+extern void cfg_free(m1_cfg *cfg);
+
+/* compute the reverse postorder and dominator tree, if they are out of date;
+   blocks that can no longer be reached are removed. */
+extern void cfg_dominators(m1_cfg *cfg);
+
+/* out of SSA form: let the edges into blocks that do nothing but go on to
+   another go there instead, and remove the blocks that are then unreached. */
+extern void cfg_cleanup(m1_cfg *cfg);
+
+/* whether block a dominates block b. */
+extern int cfg_dominates(m1_bblock *a, m1_bblock *b);
+
+/* a new empty block, placed before block position in the code (at the end,
+   but before the exit block, if NULL). */
+extern m1_bblock *cfg_new_block(m1_cfg *cfg, m1_bblock *position);
+
+/* put a new empty block on the edge from block from to from->succs[index], and return it. */
+extern m1_bblock *cfg_split_edge(m1_cfg *cfg, m1_bblock *from, unsigned index);
+
+/* add an edge from block from to block to, as its last successor. The
+   caller keeps the successors in the order that the instruction ending
+   from needs. */
+extern void cfg_add_edge(m1_bblock *from, m1_bblock *to);
+
+/* remove the edge from block from to from->succs[index]; the successors after it move up. */
+extern void cfg_remove_edge(m1_cfg *cfg, m1_bblock *from, unsigned index);
+
+/* the position of pred in the predecessors of block; the first if it has several. */
+extern unsigned block_pred_index(m1_bblock *block, m1_bblock *pred);
+
+/* the block that block falls through to, or NULL if it ends with a jump. */
+extern m1_bblock *block_fallthrough(m1_bblock *block);
+
+/* the register written by insn, or NULL. */
+extern m1_opnd *insn_def(m1_insn *insn);
+
+/* the i'th register read by insn, or NULL if it reads fewer. */
+extern m1_opnd *insn_use(m1_insn *insn, unsigned i);
+
+/* whether insn does more than write its register, so that it must stay even if that is unused. */
+extern int insn_has_effects(m1_insn *insn);
+
+/* whether insn only computes its register from its operands (or the constants
+   segment), so that it may be moved, or merged with another that does the same. */
+extern int insn_is_pure(m1_insn *insn);
+
+/* whether insn ends its block. */
+extern int insn_is_terminator(m1_insn *insn);
+
+/* the value loaded by set_imm insn. */
+extern unsigned imm_value(m1_insn *insn);
+
+/* a new instruction, not yet in a block. */
+extern m1_insn *insn_new(m0_instr_code op, unsigned line);
+
+/* add insn to block, before position (or at the end if position is NULL). */
+extern void insn_insert(m1_bblock *block, m1_insn *insn, m1_insn *position);
+
+/* add insn at the end of block, but before the jump that ends it, if any. */
+extern void insn_append(m1_bblock *block, m1_insn *insn);
+
+/* take insn out of its block. */
+extern void insn_unlink(m1_insn *insn);
+
+/* take insn out of its block, and free it. */
+extern void insn_remove(m1_insn *insn);
+
+/* an operand for register (or, in SSA form, value) no of type. */
+extern m1_opnd opnd_reg(unsigned type, unsigned no);
+
+/* allocation that exits on failure; cfg_grow() grows *size to hold needed elements. */
+extern void *cfg_alloc(size_t size);
+extern void *cfg_grow(void *p, unsigned *size, unsigned needed, size_t elemsize);
+
+#endif
+
@@ -2,6 +2,8 @@
 #ifndef __M1_COMPILER__
 #define __M1_COMPILER__
 
+#include <stdio.h>
+
 #define NUM_TYPES       4
 
 #define REG_TYPE_NUM    4
@@ -49,6 +51,27 @@ typedef struct M1_compiler {
 	
 	char                   registers[REG_TYPE_NUM][REG_NUM];
 	
+	FILE                  *outfile; /* where the generated M0 code is written. */
+	
+	struct m1_linemark    *linemarks; /* source line changes in the chunk being generated. */
+	unsigned               num_linemarks;
+	unsigned               linemark_size;
+	unsigned               currentline; /* source line of the code being generated. */
+	
+	struct m1_addrentry   *addrcache; /* addresses loaded in the current basic block. */
+	unsigned               num_addrs;
+	
+	struct m1_pinned      *pinned; /* constants kept in registers in the current chunk. */
+	unsigned               num_pinned;
+	
+	struct m1_report      *report; /* for --time-report and --mem-report; NULL if neither. */
+	struct m1_stats       *stats;  /* for --stats; NULL if not given. */
+	struct m1_remarks     *remarks; /* optimization remarks; NULL if off. */
+	
+	char const            *filename; /* source file being compiled. */
+	
+	unsigned               optlevel; /* -O level; 0 leaves the code as generated. */
+	
 } M1_compiler;
 
 #endif
@@ -0,0 +1,82 @@
+/*
+
+Dead code elimination, in SSA form.
+
+An instruction is live if it has an effect other than writing its
+register (see insn_has_effects()), such as a store, a jump or a call, or
+if a live instruction reads the value it writes. All other instructions
+are removed, phi functions included. Jumps are always live, so no blocks
+are removed.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "compiler.h"
+#include "cfg.h"
+#include "pass.h"
+#include "remark.h"
+
+/* mark the values that insn reads as live, and queue them. */
+static void
+mark_uses(m1_insn *insn, char *live, unsigned *work, unsigned *n) {
+    m1_opnd  *o;
+    unsigned  k;
+
+    for (k = 0; (o = insn_use(insn, k)) != NULL; k++) {
+        if (!live[o->no]) {
+            live[o->no]  = 1;
+            work[(*n)++] = o->no;
+        }
+    }
+}
+
+int
+pass_dce(m1_cfg *cfg) {
+    char     *live = (char *)cfg_alloc(cfg->num_values + 1);
+    unsigned *work = (unsigned *)cfg_alloc((cfg->num_values + 1) * sizeof(unsigned));
+    unsigned  n       = 0,
+              removed = 0,
+              i;
+
+    assert(cfg->in_ssa);
+
+    for (i = 0; i < cfg->num_rpo; i++) {
+        m1_insn *insn;
+
+        for (insn = cfg->rpo[i]->first; insn != NULL; insn = insn->next) {
+            if (insn_has_effects(insn))
+                mark_uses(insn, live, work, &n);
+        }
+    }
+
+    while (n > 0) {
+        m1_insn *def = cfg->values[work[--n]].def;
+
+        if (def != NULL)
+            mark_uses(def, live, work, &n);
+    }
+
+    for (i = 0; i < cfg->num_rpo; i++) {
+        m1_insn *insn, *next;
+
+        for (insn = cfg->rpo[i]->first; insn != NULL; insn = next) {
+            m1_opnd *d = insn_def(insn);
+
+            next = insn->next;
+            if (insn_has_effects(insn) || (d != NULL && live[d->no]))
+                continue;
+
+            insn_remove(insn);
+            ++removed;
+        }
+    }
+
+    if (removed > 0)
+        REMARK(cfg->comp, REMARK_PASSED, "dce", "DeadCode", cfg->chunk->line,
+               "removed %u dead instructions from chunk %s", removed, cfg->chunk->name);
+
+    free(live);
+    free(work);
+    return removed > 0;
+}
@@ -4,6 +4,7 @@
 #include <assert.h>
 #include "decl.h"
 #include "ast.h"
+#include "report.h"
 
 
 void
@@ -48,6 +49,7 @@ make_decl(M1_compiler *comp, int type) {
         fprintf(stderr, "cant alloc mem for decl\n");
         exit(EXIT_FAILURE);   
     }
+    report_alloc(comp, NODE_DECL, sizeof(m1_decl));
     decl->decltype = type;
     return decl;
 }
@@ -112,9 +114,8 @@ Interface for declaring basic types.
 */
 m1_decl *
 type_enter_type(M1_compiler *comp, char *type, m1_decl_type decltype, unsigned size) {
-    m1_decl *decl  = (m1_decl *)calloc(1, sizeof(m1_decl));    
+    m1_decl *decl  = make_decl(comp, decltype);
     decl->name     = type;
-    decl->decltype = decltype;    
     decl->d.size   = size;
     
     switch (decltype) {
@@ -164,6 +165,7 @@ type_get_size(m1_decl *decl) {
         case DECL_NUM:
         case DECL_STRING:
         case DECL_BOOL:
+        case DECL_CHAR:
             size = decl->d.size;
             break;
         case DECL_VOID:
@@ -0,0 +1,525 @@
+/*
+
+C backend: translate the generated M0 code into a C file.
+
+The M0 code is loaded with the same loader as the m0 runtime (see
+m0_loader.c), and every chunk is turned into one C function:
+
+    static uint64_t *chunk_<id>(M0_Native *rt, uint64_t *cf, uint64_t pc)
+
+M0 registers are the slots of the call frame array cf, so that frames can
+be passed around and written to by other chunks just like with the
+interpreter, and every instruction becomes a C statement on these slots.
+Instructions that are jumped to get a C label L<pc>, and a switch at the
+start of the function enters the chunk at the right place.
+
+When the chunk and PC of a goto_chunk are known (loaded with set_imm and
+deref from CONSTS in the same basic block, which is how the code generator
+calls functions), the target function is called directly; if it's the
+chunk itself, that's a plain goto. Any other goto_chunk returns to the
+caller with the target in rt->next. After a direct call returns, the chunk
+continues if the callee transferred control back to it (which is how
+functions return), and otherwise passes the transfer on. See m0_native.c
+for the runtime that the generated code links against.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "emitc.h"
+#include "m0_interp.h"
+#include "m0_ops.h"
+
+static char const * const opnames[] = {
+    "noop", "goto", "goto_if", "goto_chunk", "add_i", "add_n", "sub_i", "sub_n",
+    "mult_i", "mult_n", "div_i", "div_n", "mod_i", "mod_n", "iton", "ntoi",
+    "ashr", "lshr", "shl", "and", "or", "xor", "gc_alloc", "sys_alloc",
+    "sys_free", "copy_mem", "set", "set_imm", "deref", "set_ref", "set_byte", "get_byte",
+    "set_word", "get_word", "csym", "ccall_arg", "ccall_ret", "ccall", "print_s", "print_i",
+    "print_n", "exit", "isgt_i", "isge_i", "isgt_n", "isge_n"
+};
+
+#define NUM_OPS     (sizeof(opnames) / sizeof(opnames[0]))
+
+/* what is known about a register value before an instruction. */
+typedef enum known_kind {
+    KNOWN_NOTHING,
+    KNOWN_IMM,      /* value set with set_imm */
+    KNOWN_CONST     /* constant loaded from CONSTS; value is its index */
+} known_kind;
+
+typedef struct emit_chunk {
+    M0_Chunk      *chunk;
+    unsigned char *is_label;   /* per PC: jumped to, or entered from goto_chunk */
+    unsigned char *is_entry;   /* per PC: entered from goto_chunk */
+    int            has_goto_chunk;
+    int           *callee;     /* per goto_chunk: id of the target chunk, or -1 */
+    uint64_t      *calleepc;   /* per goto_chunk: PC in the target chunk */
+} emit_chunk;
+
+static int
+writes_operand1(unsigned char op) {
+    switch (op) {
+        case M0_NOOP:
+        case M0_GOTO:
+        case M0_GOTO_IF:
+        case M0_GOTO_CHUNK:
+        case M0_SYS_FREE:
+        case M0_COPY_MEM:
+        case M0_SET_REF:
+        case M0_SET_BYTE:
+        case M0_SET_WORD:
+        case M0_CCALL_ARG:
+        case M0_CCALL:
+        case M0_PRINT_S:
+        case M0_PRINT_I:
+        case M0_PRINT_N:
+        case M0_EXIT:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+static unsigned char *
+instr_at(M0_Chunk *c, unsigned pc) {
+    return c->bytecode + pc * M0_INSTR_SIZE;
+}
+
+static unsigned
+jump_target(unsigned char const *ops) {
+    return ops[1] * 256 + ops[2];
+}
+
+/* Find out what register reg holds before the instruction at pc, by looking
+   back in its basic block. Stores through pointers are assumed not to change
+   registers of the current frame. */
+static known_kind
+known_value(emit_chunk *ec, unsigned pc, unsigned char reg, uint64_t *value) {
+    while (pc > 0 && !ec->is_label[pc]) {
+        unsigned char *ops = instr_at(ec->chunk, --pc);
+
+        if (!writes_operand1(ops[0]))
+            continue;
+
+        if (ops[1] == M0_CF)
+            return KNOWN_NOTHING;
+
+        if (ops[1] != reg)
+            continue;
+
+        if (ops[0] == M0_SET_IMM) {
+            *value = ops[2] * 256 + ops[3];
+            return KNOWN_IMM;
+        }
+        if (ops[0] == M0_DEREF && ops[2] == M0_CONSTS
+        &&  known_value(ec, pc, ops[3], value) == KNOWN_IMM
+        &&  *value < ec->chunk->num_consts)
+            return KNOWN_CONST;
+
+        return KNOWN_NOTHING;
+    }
+    return KNOWN_NOTHING;
+}
+
+static void
+analyze_jumps(emit_chunk *ec) {
+    M0_Chunk *c = ec->chunk;
+    unsigned  pc;
+
+    ec->is_label = (unsigned char *)calloc(c->num_instrs + 1, 1);
+    ec->is_entry = (unsigned char *)calloc(c->num_instrs + 1, 1);
+    ec->callee   = (int *)calloc(c->num_instrs + 1, sizeof(int));
+    ec->calleepc = (uint64_t *)calloc(c->num_instrs + 1, sizeof(uint64_t));
+
+    ec->is_entry[0] = 1;
+    for (pc = 0; pc < c->num_instrs; pc++) {
+        unsigned char *ops = instr_at(c, pc);
+
+        if ((ops[0] == M0_GOTO || ops[0] == M0_GOTO_IF) && jump_target(ops) < c->num_instrs)
+            ec->is_label[jump_target(ops)] = 1;
+        else if (ops[0] == M0_GOTO_CHUNK) {
+            ec->is_entry[pc + 1] = 1;
+            ec->has_goto_chunk   = 1;
+        }
+    }
+    for (pc = 0; pc <= c->num_instrs; pc++) {
+        if (ec->is_entry[pc])
+            ec->is_label[pc] = 1;
+    }
+}
+
+/* Find the goto_chunk instructions with a known target, and mark the
+   PCs they enter. Returns the number of new entries; as these end basic
+   blocks, this is repeated for all chunks until nothing changes. */
+static unsigned
+analyze_calls(emit_chunk *chunks, emit_chunk *ec) {
+    M0_Chunk *c       = ec->chunk;
+    unsigned  entries = 0;
+    unsigned  pc;
+
+    for (pc = 0; pc < c->num_instrs; pc++) {
+        unsigned char *ops = instr_at(c, pc);
+        uint64_t       index, targetpc;
+        M0_Chunk      *target;
+
+        ec->callee[pc] = -1;
+        if (ops[0] != M0_GOTO_CHUNK
+        ||  known_value(ec, pc, ops[1], &index) != KNOWN_CONST
+        ||  c->const_types[index] != M0_CONST_CHUNK
+        ||  known_value(ec, pc, ops[2], &targetpc) != KNOWN_IMM)
+            continue;
+
+        target = (M0_Chunk *)c->constants[index];
+        if (targetpc < target->num_instrs && !chunks[target->id].is_entry[targetpc]) {
+            chunks[target->id].is_entry[targetpc] = 1;
+            chunks[target->id].is_label[targetpc] = 1;
+            ++entries;
+        }
+
+        ec->callee[pc]   = (int)target->id;
+        ec->calleepc[pc] = targetpc;
+    }
+    return entries;
+}
+
+static void
+emit_string(FILE *out, char const *s) {
+    fputc('"', out);
+    for (; *s != '\0'; s++) {
+        unsigned char ch = (unsigned char)*s;
+
+        if (ch == '"' || ch == '\\')
+            fprintf(out, "\\%c", ch);
+        else if (ch < 32 || ch >= 127)
+            fprintf(out, "\\%03o", ch);
+        else
+            fputc(ch, out);
+    }
+    fputc('"', out);
+}
+
+/* continue in another frame if CF was changed. */
+static void
+emit_switch_check(FILE *out, unsigned pc) {
+    fprintf(out, "    if ((uint64_t *)cf[M0_CF] != cf)\n"
+                 "        cf = m0_native_switch(rt, cf, self->name, %u);\n", pc);
+}
+
+/* after control was handed to another chunk, continue here if it came back. */
+static void
+emit_return_check(FILE *out) {
+    fprintf(out, "    if (rt->next != self)\n"
+                 "        return cf;\n"
+                 "    pc = rt->next_pc;\n"
+                 "    goto dispatch;\n");
+}
+
+static void
+emit_instr(FILE *out, emit_chunk *ec, unsigned pc) {
+    M0_Chunk      *c   = ec->chunk;
+    unsigned char *ops = instr_at(c, pc);
+    unsigned       a   = ops[1], b = ops[2], d = ops[3];
+
+    /* PC is the index of the next instruction. */
+    if (ops[0] != M0_SET_IMM && ops[0] != M0_GOTO && ops[0] != M0_GOTO_IF
+    &&  (b == M0_PC || d == M0_PC || (!writes_operand1(ops[0]) && a == M0_PC)))
+        fprintf(out, "    cf[M0_PC] = %u;\n", pc + 1);
+
+    switch (ops[0]) {
+        case M0_NOOP:
+            break;
+        case M0_GOTO:
+            if (jump_target(ops) < c->num_instrs)
+                fprintf(out, "    goto L%u;\n", jump_target(ops));
+            else
+                fprintf(out, "    goto end;\n");
+            break;
+        case M0_GOTO_IF:
+            if (jump_target(ops) < c->num_instrs)
+                fprintf(out, "    if (cf[%u])\n        goto L%u;\n", d, jump_target(ops));
+            else
+                fprintf(out, "    if (cf[%u])\n        goto end;\n", d);
+            break;
+        case M0_GOTO_CHUNK:
+            if (ec->callee[pc] == (int)c->id) {
+                fprintf(out, "    m0_native_enter(rt, cf, self, %" PRIu64 ");\n", ec->calleepc[pc]);
+                if (ec->calleepc[pc] < c->num_instrs)
+                    fprintf(out, "    goto L%" PRIu64 ";\n", ec->calleepc[pc]);
+                else
+                    fprintf(out, "    goto end;\n");
+                break;
+            }
+            else if (ec->callee[pc] >= 0) {
+                fprintf(out, "    m0_native_enter(rt, cf, &chunks[%d], %" PRIu64 ");\n",
+                        ec->callee[pc], ec->calleepc[pc]);
+                fprintf(out, "    cf = chunk_%d(rt, cf, %" PRIu64 ");\n", ec->callee[pc], ec->calleepc[pc]);
+            }
+            else {
+                fprintf(out, "    m0_native_goto_chunk(rt, cf, cf[%u], cf[%u], self->name, %u);\n", a, b, pc);
+            }
+            emit_return_check(out);
+            break;
+        case M0_ADD_I:
+            fprintf(out, "    cf[%u] = cf[%u] + cf[%u];\n", a, b, d);
+            break;
+        case M0_ADD_N:
+            fprintf(out, "    M0_SET_N(%u, M0_N(%u) + M0_N(%u));\n", a, b, d);
+            break;
+        case M0_SUB_I:
+            fprintf(out, "    cf[%u] = cf[%u] - cf[%u];\n", a, b, d);
+            break;
+        case M0_SUB_N:
+            fprintf(out, "    M0_SET_N(%u, M0_N(%u) - M0_N(%u));\n", a, b, d);
+            break;
+        case M0_MULT_I:
+            fprintf(out, "    cf[%u] = cf[%u] * cf[%u];\n", a, b, d);
+            break;
+        case M0_MULT_N:
+            fprintf(out, "    M0_SET_N(%u, M0_N(%u) * M0_N(%u));\n", a, b, d);
+            break;
+        case M0_DIV_I:
+        case M0_MOD_I:
+            fprintf(out, "    if (cf[%u] == 0)\n"
+                         "        m0_native_error(\"division by zero\", self->name, %u);\n", d, pc);
+            fprintf(out, "    cf[%u] = (uint64_t)(M0_I(%u) %c M0_I(%u));\n",
+                    a, b, ops[0] == M0_DIV_I ? '/' : '%', d);
+            break;
+        case M0_DIV_N:
+            fprintf(out, "    M0_SET_N(%u, M0_N(%u) / M0_N(%u));\n", a, b, d);
+            break;
+        case M0_MOD_N:
+            fprintf(out, "    M0_SET_N(%u, fmod(M0_N(%u), M0_N(%u)));\n", a, b, d);
+            break;
+        case M0_ITON:
+            fprintf(out, "    M0_SET_N(%u, (double)M0_I(%u));\n", a, b);
+            break;
+        case M0_NTOI:
+            fprintf(out, "    cf[%u] = (uint64_t)(int64_t)M0_N(%u);\n", a, b);
+            break;
+        case M0_ASHR:
+            fprintf(out, "    cf[%u] = (uint64_t)(M0_I(%u) >> (cf[%u] & 63));\n", a, b, d);
+            break;
+        case M0_LSHR:
+            fprintf(out, "    cf[%u] = cf[%u] >> (cf[%u] & 63);\n", a, b, d);
+            break;
+        case M0_SHL:
+            fprintf(out, "    cf[%u] = cf[%u] << (cf[%u] & 63);\n", a, b, d);
+            break;
+        case M0_AND:
+            fprintf(out, "    cf[%u] = cf[%u] & cf[%u];\n", a, b, d);
+            break;
+        case M0_OR:
+            fprintf(out, "    cf[%u] = cf[%u] | cf[%u];\n", a, b, d);
+            break;
+        case M0_XOR:
+            fprintf(out, "    cf[%u] = cf[%u] ^ cf[%u];\n", a, b, d);
+            break;
+        case M0_GC_ALLOC:
+            fprintf(out, "    cf = m0_native_gc_alloc(rt, cf, %u, cf[%u], cf[%u]);\n", a, b, d);
+            break;
+        case M0_SYS_ALLOC:
+            fprintf(out, "    cf[%u] = (uint64_t)calloc(1, cf[%u]);\n", a, b);
+            break;
+        case M0_SYS_FREE:
+            fprintf(out, "    free(M0_P(%u));\n", a);
+            break;
+        case M0_COPY_MEM:
+            fprintf(out, "    memcpy(M0_P(%u), M0_P(%u), cf[%u]);\n", a, b, d);
+            fprintf(out, "    m0_native_barrier_mem(rt, cf[%u]);\n", a);
+            emit_switch_check(out, pc);
+            break;
+        case M0_SET:
+            fprintf(out, "    cf[%u] = cf[%u];\n", a, b);
+            break;
+        case M0_SET_IMM:
+            fprintf(out, "    cf[%u] = %u;\n", a, b * 256 + d);
+            break;
+        case M0_DEREF:
+            fprintf(out, "    cf[%u] = ((uint64_t *)cf[%u])[cf[%u]];\n", a, b, d);
+            break;
+        case M0_SET_REF:
+            fprintf(out, "    ((uint64_t *)cf[%u])[cf[%u]] = cf[%u];\n", a, b, d);
+            fprintf(out, "    m0_native_barrier(rt, cf[%u], cf[%u]);\n", a, d);
+            emit_switch_check(out, pc);
+            break;
+        case M0_SET_BYTE:
+            fprintf(out, "    ((unsigned char *)cf[%u])[cf[%u]] = (unsigned char)cf[%u];\n", a, b, d);
+            fprintf(out, "    m0_native_barrier_mem(rt, cf[%u]);\n", a);
+            emit_switch_check(out, pc);
+            break;
+        case M0_GET_BYTE:
+            fprintf(out, "    cf[%u] = ((unsigned char *)cf[%u])[cf[%u]];\n", a, b, d);
+            break;
+        case M0_SET_WORD:
+            fprintf(out, "    ((uint32_t *)cf[%u])[cf[%u]] = (uint32_t)cf[%u];\n", a, b, d);
+            fprintf(out, "    m0_native_barrier_mem(rt, cf[%u]);\n", a);
+            emit_switch_check(out, pc);
+            break;
+        case M0_GET_WORD:
+            fprintf(out, "    cf[%u] = (uint64_t)(int64_t)(int32_t)((uint32_t *)cf[%u])[cf[%u]];\n", a, b, d);
+            break;
+        case M0_PRINT_S:
+            fprintf(out, "    m0_native_print(cf[%u], cf[%u], M0_PRINT_S);\n", a, b);
+            break;
+        case M0_PRINT_I:
+            fprintf(out, "    m0_native_print(cf[%u], cf[%u], M0_PRINT_I);\n", a, b);
+            break;
+        case M0_PRINT_N:
+            fprintf(out, "    m0_native_print(cf[%u], cf[%u], M0_PRINT_N);\n", a, b);
+            break;
+        case M0_EXIT:
+            fprintf(out, "    m0_native_exit(rt, M0_I(%u));\n", a);
+            break;
+        case M0_ISGT_I:
+            fprintf(out, "    cf[%u] = M0_I(%u) > M0_I(%u);\n", a, b, d);
+            break;
+        case M0_ISGE_I:
+            fprintf(out, "    cf[%u] = M0_I(%u) >= M0_I(%u);\n", a, b, d);
+            break;
+        case M0_ISGT_N:
+            fprintf(out, "    cf[%u] = M0_N(%u) > M0_N(%u);\n", a, b, d);
+            break;
+        case M0_ISGE_N:
+            fprintf(out, "    cf[%u] = M0_N(%u) >= M0_N(%u);\n", a, b, d);
+            break;
+        default:
+            /* ccall ops, and anything else the interpreter rejects too. */
+            fprintf(out, "    m0_native_error(\"unsupported instruction %s\", self->name, %u);\n",
+                    ops[0] < NUM_OPS ? opnames[ops[0]] : "?", pc);
+            break;
+    }
+
+    if (!writes_operand1(ops[0]) || ops[0] == M0_GC_ALLOC)
+        return;
+
+    if (a == M0_CF)
+        emit_switch_check(out, pc);
+    else if (a == M0_PC)
+        fprintf(out, "    m0_native_error(\"jumps through PC are not supported\", self->name, %u);\n", pc);
+}
+
+static void
+emit_chunk_function(FILE *out, emit_chunk *ec) {
+    M0_Chunk *c = ec->chunk;
+    unsigned  pc;
+
+    fprintf(out, "/* chunk \"%s\" */\n", c->name);
+    fprintf(out, "static uint64_t *\nchunk_%u(M0_Native *rt, uint64_t *cf, uint64_t pc) {\n", c->id);
+    fprintf(out, "    M0_NativeChunk * const self = &chunks[%u];\n\n", c->id);
+    if (ec->has_goto_chunk)
+        fprintf(out, "  dispatch:\n");
+    fprintf(out, "    switch (pc) {\n");
+    for (pc = 0; pc < c->num_instrs; pc++) {
+        if (ec->is_entry[pc])
+            fprintf(out, "        case %u: goto L%u;\n", pc, pc);
+    }
+    fprintf(out, "        default: break;\n    }\n");
+    fprintf(out, "    if (pc >= %u)\n        goto end;\n", c->num_instrs);
+    fprintf(out, "    m0_native_error(\"invalid PC\", self->name, pc);\n\n");
+
+    for (pc = 0; pc < c->num_instrs; pc++) {
+        unsigned char *ops = instr_at(c, pc);
+
+        if (ec->is_label[pc])
+            fprintf(out, "  L%u:\n", pc);
+        fprintf(out, "    /* %s %u, %u, %u */\n",
+                ops[0] < NUM_OPS ? opnames[ops[0]] : "?", ops[1], ops[2], ops[3]);
+        emit_instr(out, ec, pc);
+    }
+
+    fprintf(out, "  end:\n    rt->next = NULL;\n    return cf;\n}\n\n");
+}
+
+static void
+emit_constants(FILE *out, M0_Chunk *c) {
+    unsigned i;
+
+    for (i = 0; i < c->num_consts; i++) {
+        fprintf(out, "    consts_%u[%u] = ", c->id, i);
+        switch (c->const_types[i]) {
+            case M0_CONST_STR:
+                fprintf(out, "(uint64_t)");
+                emit_string(out, (char const *)c->constants[i]);
+                break;
+            case M0_CONST_CHUNK:
+                fprintf(out, "(uint64_t)&chunks[%u]", ((M0_Chunk *)c->constants[i])->id);
+                break;
+            default:
+                /* ints, and the bits of nums. */
+                fprintf(out, "UINT64_C(0x%" PRIx64 ")", c->constants[i]);
+                break;
+        }
+        fprintf(out, ";\n");
+    }
+}
+
+void
+emit_c(FILE *m0code, char const *filename, FILE *out) {
+    M0_Interp   interp;
+    M0_Chunk   *iter;
+    M0_Chunk   *entry;
+    emit_chunk *chunks;
+    unsigned    changed;
+    unsigned    i;
+
+    memset(&interp, 0, sizeof(M0_Interp));
+    m0_load_stream(&interp, m0code, filename);
+
+    entry = m0_find_chunk(&interp, "main");
+    if (entry == NULL) {
+        fprintf(stderr, "No chunk 'main' in %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    chunks = (emit_chunk *)calloc(interp.num_chunks, sizeof(emit_chunk));
+    for (iter = interp.chunks; iter != NULL; iter = iter->next) {
+        chunks[iter->id].chunk = iter;
+        analyze_jumps(&chunks[iter->id]);
+    }
+    do {
+        changed = 0;
+        for (i = 0; i < interp.num_chunks; i++)
+            changed += analyze_calls(chunks, &chunks[i]);
+    } while (changed > 0);
+
+    fprintf(out, "/* generated by m1 --emit-c from %s */\n", filename);
+    fprintf(out, "#include <stdlib.h>\n#include <string.h>\n#include <math.h>\n");
+    fprintf(out, "#include \"m0_native.h\"\n\n");
+
+    fprintf(out, "static M0_NativeChunk chunks[%u];\n\n", interp.num_chunks);
+    for (i = 0; i < interp.num_chunks; i++) {
+        fprintf(out, "static uint64_t *chunk_%u(M0_Native *rt, uint64_t *cf, uint64_t pc);\n", i);
+        if (chunks[i].chunk->num_consts > 0)
+            fprintf(out, "static uint64_t consts_%u[%u];\n", i, chunks[i].chunk->num_consts);
+    }
+    fprintf(out, "\n");
+
+    for (i = 0; i < interp.num_chunks; i++)
+        emit_chunk_function(out, &chunks[i]);
+
+    fprintf(out, "static M0_NativeChunk chunks[%u] = {\n", interp.num_chunks);
+    for (i = 0; i < interp.num_chunks; i++) {
+        fprintf(out, "    { ");
+        emit_string(out, chunks[i].chunk->name);
+        if (chunks[i].chunk->num_consts > 0)
+            fprintf(out, ", chunk_%u, consts_%u },\n", i, i);
+        else
+            fprintf(out, ", chunk_%u, NULL },\n", i);
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "int\nmain(void) {\n");
+    for (i = 0; i < interp.num_chunks; i++)
+        emit_constants(out, chunks[i].chunk);
+    fprintf(out, "    return m0_native_run(chunks, %u, %u);\n}\n", interp.num_chunks, entry->id);
+
+    for (i = 0; i < interp.num_chunks; i++) {
+        free(chunks[i].is_label);
+        free(chunks[i].is_entry);
+        free(chunks[i].callee);
+        free(chunks[i].calleepc);
+    }
+    free(chunks);
+}
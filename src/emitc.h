@@ -0,0 +1,10 @@
+#ifndef __M1_EMITC_H__
+#define __M1_EMITC_H__
+
+#include <stdio.h>
+
+/* translate the M0 assembly in m0code into C, and write it to out. */
+extern void emit_c(FILE *m0code, char const *filename, FILE *out);
+
+#endif
+
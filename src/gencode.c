@@ -27,10 +27,14 @@ This happens in gencode_number().
 #include "symtab.h"
 #include "decl.h"
 #include "instr.h"
+#include "stats.h"
+#include "remark.h"
+#include "pass.h"
 
 #include "ann.h"
 
-#define OUT	stdout
+/* all functions that generate code have a comp parameter. */
+#define OUT	(comp->outfile)
 
 
 #define M1DEBUG 1
@@ -48,8 +52,14 @@ This happens in gencode_number().
 #define M0_REG_P0   195
 
 static void gencode_expr(M1_compiler *comp, m1_expression *e);
+static void gencode_stat(M1_compiler *comp, m1_expression *e);
 static void gencode_block(M1_compiler *comp, m1_block *block);
-static unsigned gencode_obj(M1_compiler *comp, m1_object *obj, m1_object **parent, int is_target);
+static unsigned gencode_obj(M1_compiler *comp, m1_object *obj, int is_target);
+static void mark_line(M1_compiler *comp, unsigned line);
+static void gencode_cond(M1_compiler *comp, m1_expression *e, int truelabel, int falselabel);
+
+/* for gencode_cond(): no jump; go on with the code that follows. */
+#define NO_LABEL    (-1)
 
 static const char type_chars[REG_TYPE_NUM] = {'i', 'n', 's', 'p'};
 static const char reg_chars[REG_TYPE_NUM] = {'I', 'N', 'S', 'P'};
@@ -68,11 +78,18 @@ static void
 reset_reg(M1_compiler *comp) {
     /* Set all fields in the registers table to 0. */
     memset(comp->registers, 0, sizeof(char) * REG_NUM * REG_TYPE_NUM);    
+    comp->num_pinned = 0;
 }
 
 #define REG_UNUSED  0
 #define REG_USED    1
 #define REG_SYMBOL  2
+#define REG_CACHED  3   /* holds an address in the address cache; see below. */
+#define REG_CONST   4   /* holds a pinned constant; see below. */
+
+static void addr_forget_all(M1_compiler *comp);
+static int pin_spill(M1_compiler *comp);
+static void pin_release(M1_compiler *comp, m1_reg r);
 
 static m1_reg
 use_reg(M1_compiler *comp, m1_valuetype type) {
@@ -83,10 +100,21 @@ use_reg(M1_compiler *comp, m1_valuetype type) {
         i++;
     }
     
+    /* a pinned constant can be loaded again where it's used. */
+    if (i >= REG_NUM && type == VAL_INT)
+        i = pin_spill(comp);
+    
     /* XXX Need to properly handle spilling when out of registers. */
     if (i >= REG_NUM) {
+        REMARK(comp, REMARK_MISSED, "regalloc", "NoSpill", comp->currentline,
+               "ran out of %c registers in chunk %s; registers are reused without spilling",
+               reg_chars[type], comp->currentchunk->name);
         fprintf(stderr, "Out of registers!! Resetting it, hoping for the best!\n");
+        addr_forget_all(comp);
         memset(comp->registers[type], 0, sizeof(char) * REG_NUM);
+        if (type == VAL_INT)
+            comp->num_pinned = 0;
+        i = 0;
     }
     
     
@@ -96,6 +124,7 @@ use_reg(M1_compiler *comp, m1_valuetype type) {
     /* return the register. */
     r.no        = i;    
     r.type      = type;
+    stats_reg(comp, r);
     return r;
 }
 
@@ -121,8 +150,8 @@ freeze_reg(M1_compiler *comp, m1_reg r) {
 
 /*
 
-Make register C<r> available again, unless it's assigned to a symbol.
-In that case, the register is left alone. 
+Make register C<r> available again, unless it's assigned to a symbol,
+or holds a cached address. In that case, the register is left alone. 
 
 */
 static void
@@ -130,11 +159,13 @@ unuse_reg(M1_compiler *comp, m1_reg r) {
     int i;
 //    goto JUSTPRINT;
     
-    /* if it's not frozen, it may be freed. */
-    if (comp->registers[r.type][r.no] != REG_SYMBOL) {
+    /* if it's not frozen or cached, it may be freed. */
+    if (comp->registers[r.type][r.no] == REG_USED) {
 //        fprintf(stderr, "Unusing %d for good\n", r.no);        
         comp->registers[r.type][r.no] = REG_UNUSED;
     }
+    else if (comp->registers[r.type][r.no] == REG_CONST)
+        pin_release(comp, r);
     /* XXX this is for debugging. */
 JUSTPRINT:
     return;
@@ -152,6 +183,270 @@ JUSTPRINT:
 
 /*
 
+The address cache. Within a basic block, the objects that an access path
+loads on the way to its last field, such as s.edge in s.edge.from.x, stay
+in their registers, so that a following s.edge.to.y can start from the
+s.edge already loaded, rather than from s. Only prefixes of paths that
+consist of fields (constant offsets) are cached, and at most ADDR_CACHE_SIZE
+of them, to limit the registers they take.
+
+An entry is forgotten when what it loaded may have changed: at labels,
+where control flow from elsewhere joins; after calls; when its root
+variable is assigned; and when a field that overlaps one on its path is
+stored to (any object may be the one stored to). A store through an index
+forgets everything.
+
+*/
+#define ADDR_CACHE_SIZE     8
+
+typedef struct m1_addrentry {
+    m1_accesspath *path;    /* path of the access that loaded it, */
+    unsigned       len;     /* up to and including step len - 1 */
+    m1_reg         reg;     /* register holding the loaded object */
+    
+} m1_addrentry;
+
+/* remove entry i; if free_reg is set, its register is made available again. */
+static void
+addr_drop(M1_compiler *comp, unsigned i, int free_reg) {
+    m1_reg r = comp->addrcache[i].reg;
+    
+    assert(i < comp->num_addrs);
+    assert(comp->registers[r.type][r.no] == REG_CACHED);
+    
+    comp->registers[r.type][r.no] = free_reg ? REG_UNUSED : REG_USED;
+    
+    --comp->num_addrs;
+    memmove(&comp->addrcache[i], &comp->addrcache[i + 1], 
+            (comp->num_addrs - i) * sizeof(m1_addrentry));
+}
+
+static void
+addr_forget_all(M1_compiler *comp) {
+    while (comp->num_addrs > 0)
+        addr_drop(comp, comp->num_addrs - 1, 1);
+}
+
+/* forget the addresses loaded from the variable C<root>. */
+static void
+addr_forget_root(M1_compiler *comp, m1_symbol *root) {
+    unsigned i = 0;
+    
+    while (i < comp->num_addrs) {
+        if (comp->addrcache[i].path->root == root)
+            addr_drop(comp, i, 1);
+        else
+            ++i;
+    }
+}
+
+/* whether steps C<a> and C<b> access overlapping bytes. */
+static int
+steps_overlap(m1_access *a, m1_access *b) {
+    return a->offset < b->offset + b->size && b->offset < a->offset + a->size;
+}
+
+/* forget the addresses that a store through C<step> may change. */
+static void
+addr_forget_slot(M1_compiler *comp, m1_access *step) {
+    unsigned i = 0;
+    
+    if (step->kind != ACCESS_FIELD) {
+        addr_forget_all(comp);
+        return;
+    }
+    
+    while (i < comp->num_addrs) {
+        m1_addrentry *e = &comp->addrcache[i];
+        unsigned      j;
+        
+        for (j = 0; j < e->len; j++) {
+            if (steps_overlap(&e->path->steps[j], step))
+                break;
+        }
+        
+        if (j < e->len)
+            addr_drop(comp, i, 1);
+        else
+            ++i;
+    }
+}
+
+/* take C<reg> out of the cache, if it's in there; the caller then owns it. */
+static void
+addr_detach(M1_compiler *comp, m1_reg reg) {
+    unsigned i;
+    
+    for (i = 0; i < comp->num_addrs; i++) {
+        if (comp->addrcache[i].reg.no == reg.no && comp->addrcache[i].reg.type == reg.type) {
+            addr_drop(comp, i, 0);
+            return;
+        }
+    }
+}
+
+/* look up the object that the first C<len> steps of C<path> load. */
+static int
+addr_lookup(M1_compiler *comp, m1_accesspath *path, unsigned len, m1_reg *reg) {
+    unsigned i, j;
+    
+    for (i = 0; i < comp->num_addrs; i++) {
+        m1_addrentry *e = &comp->addrcache[i];
+        
+        if (e->path->root != path->root || e->len != len)
+            continue;
+            
+        for (j = 0; j < len; j++) {
+            if (e->path->steps[j].offset != path->steps[j].offset
+            ||  e->path->steps[j].size   != path->steps[j].size)
+                break;
+        }
+        
+        if (j == len) {
+            *reg = e->reg;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* remember that C<reg> holds what the first C<len> steps of C<path> load. */
+static void
+addr_remember(M1_compiler *comp, m1_accesspath *path, unsigned len, m1_reg reg) {
+    m1_addrentry *e;
+    
+    if (comp->addrcache == NULL) {
+        comp->addrcache = (m1_addrentry *)calloc(ADDR_CACHE_SIZE, sizeof(m1_addrentry));
+        if (comp->addrcache == NULL) {
+            fprintf(stderr, "Failed to allocate mem!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    if (comp->num_addrs == ADDR_CACHE_SIZE) /* full; forget the oldest. */
+        addr_drop(comp, 0, 1);
+    
+    e       = &comp->addrcache[comp->num_addrs++];
+    e->path = path;
+    e->len  = len;
+    e->reg  = reg;
+    
+    comp->registers[reg.type][reg.no] = REG_CACHED;
+}
+
+/*
+
+Pinned constants. The int literals that a chunk uses most, such as the 1
+that ++, -- and print() take, are loaded into registers of their own at
+its entry, by pin_consts(), and operands that are only read take them
+from there, rather than from a set_imm (or two instructions, for large
+values) at every use. Up to MAX_PINNED constants are pinned, if the
+chunk's variables leave registers free. Not at -O2, where licm.c moves
+constants out of loops and gvn.c loads each just once already.
+
+When use_reg() runs out of registers, the least used pin is given up,
+and later uses load the constant as before. Not one that an operation
+being generated still has to read, and not in a loop: the code for it
+that was generated already would read the register on the next
+iteration.
+
+*/
+#define MAX_PINNED      4
+
+typedef struct m1_pinned {
+    int        value;
+    m1_symbol *sym;     /* the literal's symbol, for its constindex; NULL for an implicit 1 */
+    unsigned   uses;    /* weighted by loop nesting; see count_expr() */
+    unsigned   busy;    /* operands that read it, and aren't let go of yet */
+    m1_reg     reg;
+    
+} m1_pinned;
+
+/* the register holding C<value>, if it's pinned, for an operand; it is 
+   let go of with unuse_reg(), as any other. */
+static int
+pin_lookup(M1_compiler *comp, int value, m1_reg *reg) {
+    unsigned i;
+    
+    for (i = 0; i < comp->num_pinned; i++) {
+        if (comp->pinned[i].value == value) {
+            ++comp->pinned[i].busy;
+            *reg = comp->pinned[i].reg;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void
+pin_release(M1_compiler *comp, m1_reg r) {
+    unsigned i;
+    
+    for (i = 0; i < comp->num_pinned; i++) {
+        if (comp->pinned[i].reg.no == r.no) {
+            assert(comp->pinned[i].busy > 0);
+            --comp->pinned[i].busy;
+            return;
+        }
+    }
+}
+
+/* give up the least used pin that may be; returns its register number, or REG_NUM. */
+static int
+pin_spill(M1_compiler *comp) {
+    m1_pinned pin;
+    int       i = (int)comp->num_pinned - 1;
+    
+    if (!intstack_isempty(comp->continuestack))
+        return REG_NUM;
+    
+    while (i >= 0 && comp->pinned[i].busy > 0)
+        --i;
+    if (i < 0)
+        return REG_NUM;
+    
+    pin = comp->pinned[i];
+    --comp->num_pinned;
+    memmove(&comp->pinned[i], &comp->pinned[i + 1], (comp->num_pinned - i) * sizeof(m1_pinned));
+    
+    assert(comp->registers[VAL_INT][pin.reg.no] == REG_CONST);
+    comp->registers[VAL_INT][pin.reg.no] = REG_UNUSED;
+    
+    REMARK(comp, REMARK_MISSED, "regalloc", "SpilledConstant", comp->currentline,
+           "constant %d is no longer kept in I%d in chunk %s: out of registers",
+           pin.value, pin.reg.no, comp->currentchunk->name);
+    return pin.reg.no;
+}
+
+/* the ops that load and store C<size> bytes; they index memory in units of that. */
+static char const *
+load_op(unsigned size) {
+    switch (size) {
+        case 1:
+            return "get_byte";
+        case 4:
+            return "get_word";
+        default:
+            assert(size == 8);
+            return "deref";
+    }
+}
+
+static char const *
+store_op(unsigned size) {
+    switch (size) {
+        case 1:
+            return "set_byte";
+        case 4:
+            return "set_word";
+        default:
+            assert(size == 8);
+            return "set_ref";
+    }
+}
+
+/*
+
 Generate label identifiers.
 
 */
@@ -161,7 +456,133 @@ gen_label(M1_compiler *comp) {
 	return comp->label++;	
 }
 
+/*
+
+Emit label C<label>. Control may come here from elsewhere, so it starts a
+new basic block.
+
+*/
+static void
+gencode_label(M1_compiler *comp, int label) {
+    fprintf(OUT, "L%d:\n", label);
+    addr_forget_all(comp);
+}
+
+
+/*
+
+Loading int constants. set_imm X, Y, Z sets X to 256 * Y + Z, with Y and 
+Z bytes, so it takes values up to 65535 in one instruction. Larger ones, 
+and negative ones, are built from such pieces with shl, or and sub_i:
+
+    70000 (0x11170):     set_imm X, 0, 1        # 0x1
+                         set_imm T, 0, 16
+                         shl     X, X, T
+                         set_imm T, 17, 112     # 0x1170
+                         or      X, X, T
+    800000 (25000 << 5): set_imm X, 97, 168     # 25000
+                         set_imm T, 0, 5
+                         shl     X, X, T
+    -3:                  set_imm X, 0, 3
+                         set_imm T, 0, 0
+                         sub_i   X, T, X
+
+A literal is in the constants segment too, from which set_imm and deref 
+load it in two instructions; gencode_load_int() does that instead when 
+building it takes more. Indices into the constants segment are loaded 
+like any other value, so that it may hold more than 256 entries.
+
+*/
+#define NO_CONSTINDEX   (-1)
+
+/* the number of trailing 0 bits of C<u>, which isn't 0. */
+static int
+trailing_zeros(unsigned long u) {
+    int k = 0;
+    
+    while ((u & 1) == 0) {
+        u >>= 1;
+        ++k;
+    }
+    return k;
+}
+
+/* the number of instructions that gencode_set_int() takes for C<value>. */
+static unsigned
+set_int_cost(long value) {
+    unsigned long u    = value < 0 ? -(unsigned long)value : (unsigned long)value;
+    unsigned      cost = value < 0 ? 2 : 0;
+    
+    while (u >= 256 * 256) {
+        if ((u >> trailing_zeros(u)) < 256 * 256)
+            return cost + 3;
+        cost += (u & 0xFFFF) != 0 ? 4 : 2;
+        u   >>= 16;
+    }
+    return cost + 1;
+}
+
+static void
+set_uint(M1_compiler *comp, m1_reg reg, unsigned long u) {
+    m1_reg t;
+    int    shift;
+    
+    if (u < 256 * 256) {
+        fprintf(OUT, "\tset_imm\tI%d, %lu, %lu\n", reg.no, u / 256, u % 256);
+        return;
+    }
+    
+    shift = trailing_zeros(u);
+    if ((u >> shift) < 256 * 256) { /* a 16-bit value, shifted */
+        set_uint(comp, reg, u >> shift);
+        t = use_reg(comp, VAL_INT);
+        fprintf(OUT, "\tset_imm\tI%d, 0, %d\n", t.no, shift);
+        fprintf(OUT, "\tshl\tI%d, I%d, I%d\n", reg.no, reg.no, t.no);
+    }
+    else { /* the bits above the lowest 16, shifted, or'ed with those */
+        set_uint(comp, reg, u >> 16);
+        t = use_reg(comp, VAL_INT);
+        fprintf(OUT, "\tset_imm\tI%d, 0, 16\n", t.no);
+        fprintf(OUT, "\tshl\tI%d, I%d, I%d\n", reg.no, reg.no, t.no);
+        if ((u & 0xFFFF) != 0) {
+            set_uint(comp, t, u & 0xFFFF);
+            fprintf(OUT, "\tor\tI%d, I%d, I%d\n", reg.no, reg.no, t.no);
+        }
+    }
+    unuse_reg(comp, t);
+}
+
+/* set int register C<reg> to C<value>, without the constants segment. */
+static void
+gencode_set_int(M1_compiler *comp, m1_reg reg, long value) {
+    assert(reg.type == VAL_INT);
+    
+    if (value < 0) {
+        m1_reg zero;
+        
+        set_uint(comp, reg, -(unsigned long)value);
+        zero = use_reg(comp, VAL_INT);
+        fprintf(OUT, "\tset_imm\tI%d, 0, 0\n", zero.no);
+        fprintf(OUT, "\tsub_i\tI%d, I%d, I%d\n", reg.no, zero.no, reg.no);
+        unuse_reg(comp, zero);
+    }
+    else
+        set_uint(comp, reg, (unsigned long)value);
+}
 
+/* load int C<value> into C<reg>, either with gencode_set_int(), or from 
+   the constants segment, where it is at C<constindex>, if that's not 
+   NO_CONSTINDEX; whichever takes fewer instructions. */
+static void
+gencode_load_int(M1_compiler *comp, m1_reg reg, long value, int constindex) {
+    if (constindex != NO_CONSTINDEX && set_int_cost(value) > set_int_cost(constindex) + 1) {
+        /* reuse the reg, first for the index, then for the result. */
+        gencode_set_int(comp, reg, constindex);
+        fprintf(OUT, "\tderef\tI%d, CONSTS, I%d\n", reg.no, reg.no);
+    }
+    else
+        gencode_set_int(comp, reg, value);
+}
 
 static void
 gencode_number(M1_compiler *comp, m1_literal *lit) {
@@ -181,7 +602,7 @@ gencode_number(M1_compiler *comp, m1_literal *lit) {
     //ins_set_imm(comp, &constindex, 0, lit->sym->constindex);
     //ins_deref(comp, &reg, CONSTS, &constindex);
     
-    fprintf(OUT, "\tset_imm\tI%d, 0, %d\n", constindex.no, lit->sym->constindex);
+    gencode_set_int(comp, constindex, lit->sym->constindex);
     fprintf(OUT, "\tderef\tN%d, CONSTS, I%d\n", reg.no, constindex.no);
 
     unuse_reg(comp, constindex);
@@ -192,7 +613,7 @@ gencode_number(M1_compiler *comp, m1_literal *lit) {
 static void
 gencode_char(M1_compiler *comp, m1_literal *lit) {
 	/*
-	deref Nx, CONSTS, <const_id>
+	set_imm Ix, 0, <char>
 	*/
     m1_reg reg;
     
@@ -202,11 +623,7 @@ gencode_char(M1_compiler *comp, m1_literal *lit) {
     assert(lit->sym != NULL);
        
     reg = use_reg(comp, VAL_INT);
-        
-    /* reuse the reg, first for the index, then for the result. */        
-    fprintf(OUT, "\tset_imm\tI%d, 0, %d\n", reg.no, lit->sym->constindex);
-    fprintf(OUT, "\tderef\tI%d, CONSTS, I%d\n", reg.no, reg.no);
-        
+    gencode_load_int(comp, reg, lit->sym->value.ival, lit->sym->constindex);
     pushreg(comp->regstack, reg);
     
 }  
@@ -214,13 +631,14 @@ gencode_char(M1_compiler *comp, m1_literal *lit) {
 static void
 gencode_int(M1_compiler *comp, m1_literal *lit) {
 	/*
-	If the value is smaller than 256*255 and > 0, 
-	then generate set_imm, otherwise, load the constant 
-	from the constants table.
+	If the value fits in 16 bits, then generate set_imm; otherwise,
+	build it, or load it from the constants table, as described
+	above gencode_load_int().
 
-	    deref Ix, CONSTS, <const_id>
-    or:	
     	set_imm Ix, y, z
+    or:	
+	    set_imm Ix, y, z     # <const_id>
+	    deref   Ix, CONSTS, Ix
 	
 	*/
     m1_reg reg;
@@ -231,23 +649,7 @@ gencode_int(M1_compiler *comp, m1_literal *lit) {
     assert(lit->sym != NULL);
 
     reg = use_reg(comp, VAL_INT);
-      
-    /* If the value is small enough, load it with set_imm; otherwise, take it from the constants table.
-       set_imm X, Y, Z: set X to: 256 * Y + Z. All operands are 8 bit, so maximum value is 255. 
-     */
-    if (lit->sym->value.ival < (256 * 255) && lit->sym->value.ival >= 0) { 
-        /* use set_imm X, N*256, remainder)   */
-        int remainder = lit->sym->value.ival % 256;
-        int num256    = (lit->sym->value.ival - remainder) / 256; 
-        fprintf(OUT, "\tset_imm\tI%d, %d, %d\n", reg.no, num256, remainder);
-    } 
-    else { /* too big enough for set_imm, so load it from constants segment. */
-        /* XXX this will fail if constindex > 255. */
-        fprintf(OUT, "\tset_imm\tI%d, 0, %d\n", reg.no, lit->sym->constindex);
-        fprintf(OUT, "\tderef\tI%d, CONSTS, I%d\n", reg.no, reg.no);
-
-    }
-    
+    gencode_load_int(comp, reg, lit->sym->value.ival, lit->sym->constindex);
     pushreg(comp->regstack, reg);
     
 }
@@ -259,7 +661,7 @@ gencode_bool(M1_compiler *comp, int boolval) {
        set_imm Ix, 0, 0 # for false
     */
     m1_reg reg = use_reg(comp, VAL_INT);
-    fprintf(OUT, "\tset_imm\t%d, 0, %d\n", reg.no, boolval);
+    fprintf(OUT, "\tset_imm\tI%d, 0, %d\n", reg.no, boolval);
     pushreg(comp->regstack, reg);   
 }
 
@@ -276,7 +678,7 @@ gencode_string(M1_compiler *comp, m1_literal *lit) {
     stringreg   = use_reg(comp, VAL_STRING);
     constidxreg = use_reg(comp, VAL_INT);
       
-    fprintf(OUT, "\tset_imm\tI%d, 0, %d\n", constidxreg.no, lit->sym->constindex);
+    gencode_set_int(comp, constidxreg, lit->sym->constindex);
     fprintf(OUT, "\tderef\tS%d, CONSTS, I%d\n", stringreg.no, constidxreg.no);
        
     unuse_reg(comp, constidxreg);
@@ -289,7 +691,6 @@ static void
 gencode_assign(M1_compiler *comp, NOTNULL(m1_assignment *a)) {
     m1_reg     lhs,    /* register holding result of left hand side  */
                rhs;    /* register holding result of right hand side */
-    m1_object *parent;    /* pointer storage needed for code generation of LHS. */
     unsigned   obj_reg_count; /* number of regs holding result of LHS (can be aggregate/indexed) */
 		
     assert(a != NULL);
@@ -298,7 +699,7 @@ gencode_assign(M1_compiler *comp, NOTNULL(m1_assignment *a)) {
     rhs = popreg(comp->regstack);
     
     /* generate code for LHS and get number of registers that hold the result */
-    obj_reg_count = gencode_obj(comp, a->lhs, &parent, 1);    
+    obj_reg_count = gencode_obj(comp, a->lhs, 1);    
     
     /* the number of registers that are available is always 1 or 2. 1 for the simple case,
        and 2 for field access (x.y and x[1]). 
@@ -314,16 +715,21 @@ gencode_assign(M1_compiler *comp, NOTNULL(m1_assignment *a)) {
         fprintf(OUT, "\tset \t%c%d, %c%d, x\n", reg_chars[(int)lhs.type], lhs.no, 
                                                 reg_chars[(int)rhs.type], rhs.no);
         
+        addr_forget_root(comp, a->lhs->path->root);
     }
     else if (obj_reg_count == 2) { /* complex lvalue, like x.y, or x[10]. */
-        m1_reg index  = popreg(comp->regstack);
-        m1_reg parent = popreg(comp->regstack);
+        m1_access *last   = &a->lhs->path->steps[a->lhs->path->num_steps - 1];
+        m1_reg     index  = popreg(comp->regstack);
+        m1_reg     parent = popreg(comp->regstack);
         
-        fprintf(OUT, "\tset_ref\t%c%d, %c%d, %c%d\n", reg_chars[(int)parent.type], parent.no, 
-                                                      reg_chars[(int)index.type], index.no,
-                                                      reg_chars[(int)rhs.type], rhs.no);
+        fprintf(OUT, "\t%s\t%c%d, %c%d, %c%d\n", store_op(last->size), 
+                                                 reg_chars[(int)parent.type], parent.no, 
+                                                 reg_chars[(int)index.type], index.no,
+                                                 reg_chars[(int)rhs.type], rhs.no);
         unuse_reg(comp, index);                                                      
         unuse_reg(comp, parent);
+        
+        addr_forget_slot(comp, last);
     }    
 
     unuse_reg(comp, rhs);      
@@ -339,237 +745,125 @@ gencode_null(M1_compiler *comp) {
     pushreg(comp->regstack, reg);
 }   
 
-static unsigned
-gencode_obj(M1_compiler *comp, m1_object *obj, m1_object **parent, int is_target) {
+/*
+
+Generate code for an object, using the access path that the semantic 
+checker resolved it into; for a.b[i].c, that's a, and the steps .b, [i]
+and .c. Each step loads the field or element of the aggregate that the
+previous one yielded, with the op for its size. If the object is the
+target of an assignment (is_target), the last step isn't loaded; the
+aggregate and the index are left on the regstack instead, for the store.
 
-    unsigned numregs_pushed = 0;
+Returns the number of registers pushed onto the regstack: 1 for the value
+of the object, or 2 for a target with an aggregate and index.
+
+*/
+static unsigned
+gencode_obj(M1_compiler *comp, m1_object *obj, int is_target) {
+    m1_accesspath *path = obj->path;
+    m1_symbol     *sym;
+    m1_reg         reg;
+    unsigned       i,
+                   start,
+                   numfields;
 
     assert(comp != NULL);
     assert(comp->currentchunk != NULL);
     assert(comp->currentsymtab != NULL);
-	   
-	/* visit this node's parent recursively, depth-first. 
-    parent parameter will return a pointer to it so it can
-    be passed on when visiting the field. Note that this invocation
-    is recursive, so THIS function will be called again. Note also that
-    the tree was built upside down, so obj->parent is really its parent
-    in which the current node is a (link-node to a) field.
-	   
-    x.y.z looks like this:
-	   
-         	 OBJECT_MAIN 
-	            |
-	            |  OBJECT_FIELD
-	            |   |
-	            |   |   OBJECT_FIELD
-	            V   V   V
-	       
-	            x   y   z
-	             \ /   /
-OBJECT_LINK-----> L1  /
-	               \ /
-OBJECT_LINK-------> L2
-	        
-	                 ^
-	                 |
-	                ROOT
-	       
-    Node L2 is the root in this tree. Both L1 and L2 are of type OBJECT_LINK.
-    Node "x" is OBJECT_MAIN, whereas nodes "y" and "z" are OBJECT_FIELD.
-    First this function (gencode_obj) goes all the way down to x, sets the
-    OUT parameter "parent" to itself, then as the function returns, comes
-    back to L1, then visits y, passing on a pointer to node for "x" through
-    the parent parameter. Then, node y sets the parent OUT parameter to itself
-    (again, in this funciton gencode_obj), and then control goes up to L2,
-    visiting z, passing a pointer to node "y" through the parent parameter.
-  	  
-  	  
-  	  
-  	x[42] looks like this:
-  	
-           OBJECT_MAIN
-                |    
-                |   OBJECT_INDEX
-                |    |
-                V    V
-  	
-  	            x   42 
-  	             \  /
-  	              \/
-OBJECT_LINK-----> L1  
-  	    
-  	              ^
-  	              |
-  	             ROOT   
-    */
-
-    switch (obj->type) {
-        case OBJECT_LINK:
-        {
-            /* set OUT parameter to this node (that's currently visited, obj) */
-            *parent = obj;   	
-            /* visit parent recursively. (go depth-first in order to reach first ident. first
-               That is, in "x.y.z", we want to visit x first.
-             */
-            gencode_obj(comp, obj->parent, parent, is_target);
-            /* At this point, we're done visiting parents, so now visit the "fields".
-               In x.y.z, after returning from x, we're visiting y. After that, we'll visit z.
-               As we do this, keep track of how many registers were used to store the result.
-             */
-            numregs_pushed += gencode_obj(comp, obj->obj.field, parent, is_target);     
-            
-            break;
-            
-        }
-        case OBJECT_MAIN: 
-        {   
-            m1_reg reg;              
-
-//            fprintf(stderr, "[object_main] handling '%s'\n", obj->obj.name); 
-        	assert(obj->obj.field != NULL);
-        	assert(obj->sym != NULL);
-        	assert(obj->sym->typedecl != NULL);
-
+    
+    if (path == NULL) {
+        fprintf(stderr, "unresolved object in gencode_obj()\n");
+        assert(0);
+    }
+    
+    sym = path->root;
+    assert(sym->typedecl != NULL);
              
-        	/* if symbol has not register allocated yet, do it now. */
-        	if (obj->sym->regno == NO_REG_ALLOCATED_YET) {
-
-                m1_reg r        = use_reg(comp, obj->sym->typedecl->valtype);
-                freeze_reg(comp, r);
-                obj->sym->regno = r.no;
-        	}  
-            
-            /* get the storage type. */
-            if (obj->sym->num_elems > 1) { /* it's an array! store it in an int register. */
-                reg.type = VAL_INT;                
-            }
-            else { 
-             /* it's not an array; just get the root type (in string[10], that's string). */
-                assert(obj->sym->num_elems == 1);
-                
-                reg.type = obj->sym->typedecl->valtype;     
-            }
-            
-        	reg.no = obj->sym->regno;    
-        	freeze_reg(comp, reg);   	
-                      
-            /* return a pointer to this node by OUT parameter. */
-            *parent = obj;
-            
-            pushreg(comp->regstack, reg);
-            ++numregs_pushed;
+    /* if symbol has not register allocated yet, do it now. */
+    if (sym->regno == NO_REG_ALLOCATED_YET) {
+        m1_reg r   = use_reg(comp, sym->typedecl->valtype);
+        freeze_reg(comp, r);
+        sym->regno = r.no;
+    }  
             
+    /* get the storage type. */
+    if (sym->num_elems > 1) { /* it's an array! store it in an int register. */
+        reg.type = VAL_INT;                
+    }
+    else { 
+        /* it's not an array; just get the root type (in string[10], that's string). */
+        reg.type = sym->typedecl->valtype;     
+    }
+    reg.no = sym->regno;    
+    freeze_reg(comp, reg);   	
+    
+    /* the leading field steps, whose loads may be in the address cache. */
+    for (numfields = 0; numfields < path->num_steps; numfields++) {
+        if (path->steps[numfields].kind != ACCESS_FIELD)
             break;
-        }
-        case OBJECT_FIELD: /* example: b in a.b */
-        {            
-            m1_reg          fieldreg;            
-            int             offset;                        
-            m1_structfield *field;
-            
-            assert((*parent)->sym != NULL);
-            assert((*parent)->sym->typedecl != NULL);
-            
-            /* pass comp, a pointer to the struct decl of this obj's parent, and this obj's name. */
-            field    = struct_find_field(comp, (*parent)->sym->typedecl->d.s, obj->obj.name);
-            assert(field != NULL); /* XXX need to check in semcheck. */
-            offset   = field->offset;                        
-            fieldreg = use_reg(comp, VAL_INT);/* reg for storing offset of field. */
-
-            /* load the offset into a reg. and make it available through the regstack. */
-            fprintf(OUT, "\tset_imm\tI%d, 0, %d\n", fieldreg.no, offset);             
-            pushreg(comp->regstack, fieldreg);
-            ++numregs_pushed;
-            
-            
-            /* XXX if offset = 0. special case? */
-          //  if (offset > 0) {
-                if (is_target) {  /* a.b = ... */
-                    /* reg. holding offset for field b is already pushed onto regstack, count it now. */
-                    ++numregs_pushed;
-
-                }
-                else { /* ... = a.b */
-                    
-                    m1_reg offsetreg = popreg(comp->regstack);
-                    m1_reg parentreg = popreg(comp->regstack); 
-                    m1_reg reg       = use_reg(comp, VAL_INT);
-                                   
-                    fprintf(OUT, "\tderef\t%c%d, %c%d, %c%d\n", reg_chars[(int)reg.type], reg.no,
-                                                            reg_chars[(int)parentreg.type], parentreg.no,
-                                                            reg_chars[(int)offsetreg.type], offsetreg.no);   
-                    unuse_reg(comp, offsetreg);
-                    unuse_reg(comp, parentreg);
-                    pushreg(comp->regstack, reg);
-                    ++numregs_pushed;                                                           
-                }
-           // }
-            
-            /* set parent OUT parameter to the current node. */
-            *parent = obj;
+    }
+    
+    /* start at the longest prefix of the path that was loaded before, if any; 
+       in s.edge.to.y, that may be s.edge.to or s.edge. The last step
+       always needs a deref or set_ref of its own.
+     */
+    start = path->num_steps > 0 ? path->num_steps - 1 : 0;
+    if (start > numfields)
+        start = numfields;
+        
+    while (start > 0 && !addr_lookup(comp, path, start, &reg))
+        --start;
+        
+    if (start > 0) {
+        REMARK(comp, REMARK_PASSED, "addrcache", "ReusedAddress", comp->currentline,
+               "reused %u load%s on the path of an access to %s from an earlier access",
+               start, start == 1 ? "" : "s", sym->name);
+    }
+    
+    for (i = start; i < path->num_steps; i++) {
+        m1_access *step = &path->steps[i];
+        m1_reg     indexreg,
+                   result;
+        
+        if (step->kind == ACCESS_FIELD) { 
+            /* load the field's index, in units of its size, into a reg. */
+            unsigned index = step->offset / step->size;
             
-            break;
+            assert(step->offset % step->size == 0);
+            indexreg = use_reg(comp, VAL_INT);
+            gencode_set_int(comp, indexreg, index);
         }
-        case OBJECT_DEREF: /* b in a->b */
-        {
-            m1_reg reg;
-            gencode_obj(comp, obj->obj.field, parent, is_target);
-            reg = popreg(comp->regstack);
-            fprintf(OUT, "\tadd_i <struct>, I%d\n", reg.no);
-            unuse_reg(comp, reg);
-            break;
+        else { 
+            assert(step->kind == ACCESS_INDEX);
+            /* the index expression may change the cache; keep reg out of it. */
+            addr_detach(comp, reg);
+            gencode_expr(comp, step->index);
+            indexreg = popreg(comp->regstack);
         }
-        case OBJECT_INDEX: /* b in a[b] */        
-        {
-
-            gencode_expr(comp, obj->obj.index);
-                        
-            if (is_target) { /* x[42] = ... */
-
-                /* don't pop it, just count it as it was pushed onto regstack
-                   by gencode_expr(). It will be popped by the calling function. 
-                */
-                ++numregs_pushed;
-            
-                
-            }
-            else { /* ... = x[42] */
-                m1_reg offsetreg, parentreg, result;
-                
-                assert((*parent) != NULL);
-                assert((*parent)->sym != NULL);
-                assert((*parent)->sym->typedecl != NULL);
-                
-                offsetreg = popreg(comp->regstack); /* containing the index. */
-                parentreg = popreg(comp->regstack); /* containing the struct or array */
-                result    = use_reg(comp, (*parent)->sym->typedecl->valtype); /* target reg to store result. */
-                    
-                fprintf(OUT, "\tderef\t%c%d, %c%d, %c%d\n", reg_chars[(int)result.type], result.no,
-                                                            reg_chars[(int)parentreg.type], parentreg.no,
-                                                            reg_chars[(int)offsetreg.type], offsetreg.no);   
-                unuse_reg(comp, parentreg);
-                unuse_reg(comp, offsetreg);
-                
-                pushreg(comp->regstack, result);
-                ++numregs_pushed;                                                            
-            }
-            
-            /* set parent OUT parameter to current node. */
-            *parent = obj;            
-                    
-            ++numregs_pushed;
-
-            break;            
+        
+        if (is_target && i == path->num_steps - 1) { /* a.b = ... or x[42] = ... */
+            pushreg(comp->regstack, reg);
+            pushreg(comp->regstack, indexreg);
+            return 2;
         }
-        default:
-            fprintf(stderr, "unknown object type in gencode_obj()\n");
-            assert(0);
-            break;
-    }  
-		
-	/* return the number of registers that are pushed onto the stack in this function. */	
-    return numregs_pushed;
-		
+        
+        /* ... = a.b or ... = x[42] */
+        result = use_reg(comp, step->type->valtype);
+        fprintf(OUT, "\t%s\t%c%d, %c%d, %c%d\n", load_op(step->size), 
+                                                 reg_chars[(int)result.type], result.no,
+                                                 reg_chars[(int)reg.type], reg.no,
+                                                 reg_chars[(int)indexreg.type], indexreg.no);   
+        unuse_reg(comp, indexreg);
+        unuse_reg(comp, reg);
+        reg = result;
+        
+        /* objects loaded on the way to the last step may be reused. */
+        if (i + 1 < path->num_steps && i < numfields)
+            addr_remember(comp, path, i + 1, reg);
+    }
+    
+    pushreg(comp->regstack, reg);
+    return 1;
 }
 
 
@@ -583,31 +877,30 @@ gencode_while(M1_compiler *comp, m1_whileexpr *w) {
 	  <block>
 	
 	LTEST:
-	   code for <cond>
-	   goto_if <cond>, LBLOCK
+	   code for <cond>: to LBLOCK if true
+	LEND:
 	   ...	
+	
+	The test is at the bottom, so that an iteration takes a single
+	branch; continue goes to the test, and break to LEND.
 	*/
-	m1_reg reg;
 	int startlabel = gen_label(comp), 
+	    testlabel  = gen_label(comp),
 	    endlabel   = gen_label(comp);
 	
 	/* push break label onto stack so break statement knows where to go. */
 	push(comp->breakstack, endlabel);
-	push(comp->continuestack, startlabel);
-	
-	fprintf(OUT, "\tgoto L%d\n", endlabel);
+	push(comp->continuestack, testlabel);
 	
-	fprintf(OUT, "L%d:\n", startlabel);
-	gencode_expr(comp, w->block);
+	fprintf(OUT, "\tgoto L%d\n", testlabel);
 	
-	fprintf(OUT, "L%d:\n", endlabel);
+	gencode_label(comp, startlabel);
+	gencode_stat(comp, w->block);
 	
-	gencode_expr(comp, w->cond);
-	reg = popreg(comp->regstack);
+	gencode_label(comp, testlabel);
+	gencode_cond(comp, w->cond, startlabel, NO_LABEL);
 	
-	fprintf(OUT, "\tgoto_if\tL%d, %c%d\n", startlabel, reg_chars[(int)reg.type], reg.no);
-	
-	unuse_reg(comp, reg);
+	gencode_label(comp, endlabel);
 			
 	/* remove break and continue labels from stack. */
 	(void)pop(comp->breakstack);
@@ -620,29 +913,25 @@ gencode_dowhile(M1_compiler *comp, m1_whileexpr *w) {
 	
 	LSTART:
 	  <code for block>
-	  cond = <code for cond>
-	  goto_if LSTART, cond
+	LTEST:
+	  <code for cond: to LSTART if true>
+	LEND:
 	  
 	*/
-    m1_reg reg;
-    
     int startlabel = gen_label(comp);
+    int testlabel  = gen_label(comp);
     int endlabel   = gen_label(comp);
     
     push(comp->breakstack, endlabel);
-    push(comp->continuestack, startlabel);
+    push(comp->continuestack, testlabel);
      
-    fprintf(OUT, "L%d:\n", startlabel);
-    gencode_expr(comp, w->block);
+    gencode_label(comp, startlabel);
+    gencode_stat(comp, w->block);
     
-    gencode_expr(comp, w->cond);
-    reg = popreg(comp->regstack);
-    
-    fprintf(OUT, "\tgoto_if\tL%d, %c%d\n", startlabel, reg_chars[(int)reg.type], reg.no);
+    gencode_label(comp, testlabel);
+    gencode_cond(comp, w->cond, startlabel, NO_LABEL);
 
-    fprintf(OUT, "L%d:\n", endlabel);
-    
-    unuse_reg(comp, reg);
+    gencode_label(comp, endlabel);
     
     (void)pop(comp->breakstack);
     (void)pop(comp->continuestack);
@@ -653,52 +942,50 @@ static void
 gencode_for(M1_compiler *comp, m1_forexpr *i) {
 	/*		
       <code for init>
-	LSTART:
-	  <code for cond>
-	  goto_if cond, LBLOCK
-      goto LEND
+      goto LTEST
     LBLOCK: 
       <code for block>
+    LSTEP:
       <code for step>
-	  goto LSTART
-	LEND:
+    LTEST:
+      <code for cond: to LBLOCK if true>
+    LEND:
 	
+	As for while loops, the test is at the bottom; without a condition,
+	there is no test, and LSTEP ends with "goto LBLOCK". continue goes
+	to LSTEP.
 	*/
-    int startlabel = gen_label(comp), 
-        endlabel   = gen_label(comp),
+    int blocklabel = gen_label(comp), 
         steplabel  = gen_label(comp), 
-        blocklabel = gen_label(comp); /* label where the block starts */
+        testlabel  = gen_label(comp),
+        endlabel   = gen_label(comp);
         
     push(comp->breakstack, endlabel);
-    push(comp->continuestack, steplabel); /* XXX check if this is the right label. */
+    push(comp->continuestack, steplabel);
     
     if (i->init)
-        gencode_expr(comp, i->init);
+        gencode_stat(comp, i->init);
 
-	fprintf(OUT, "L%d:\n", startlabel);
-	
-    if (i->cond) {
-        m1_reg reg;
-        gencode_expr(comp, i->cond);
-        reg = popreg(comp->regstack);
-        fprintf(OUT, "\tgoto_if L%d, %c%d\n", blocklabel, reg_chars[(int)reg.type], reg.no);
-
-        unuse_reg(comp, reg);
-    }   
-
-    fprintf(OUT, "\tgoto L%d\n", endlabel);
+    if (i->cond)
+        fprintf(OUT, "\tgoto L%d\n", testlabel);
     
-    fprintf(OUT, "L%d:\n", blocklabel);
+    gencode_label(comp, blocklabel);
     
     if (i->block) 
-        gencode_expr(comp, i->block);
+        gencode_stat(comp, i->block);
         
-    fprintf(OUT, "L%d:\n", steplabel);
+    gencode_label(comp, steplabel);
     if (i->step)
-        gencode_expr(comp, i->step);
+        gencode_stat(comp, i->step);
+    
+    if (i->cond) {
+        gencode_label(comp, testlabel);
+        gencode_cond(comp, i->cond, blocklabel, NO_LABEL);
+    }
+    else
+        fprintf(OUT, "\tgoto L%d\n", blocklabel);
     
-    fprintf(OUT, "\tgoto L%d\n", startlabel);
-    fprintf(OUT, "L%d:\n", endlabel);
+    gencode_label(comp, endlabel);
     
     (void)pop(comp->breakstack);
     (void)pop(comp->continuestack);
@@ -706,53 +993,97 @@ gencode_for(M1_compiler *comp, m1_forexpr *i) {
 }
 
 static void 
-gencode_if(M1_compiler *comp, m1_ifexpr *i) {
+gencode_if(M1_compiler *comp, m1_ifexpr *i, int used) {
 	/*
 	
-      result1 = <evaluate condition>
-	  goto_if L1, result1
+	  <code for condition: to L1 if true>
 	  <code for elseblock>
 	  goto L2
     L1:
 	  <code for ifblock>
 	L2:
 	
-	*/
-    m1_reg condreg;
-    int endlabel = gen_label(comp),
-        iflabel  = gen_label(comp);
-
+	An "else if" cascade is generated in a loop, rather than recursively,
+	as generated code can have very long ones. All conditions come first,
+	then the final else block, then the if blocks, last one first:
 	
-    gencode_expr(comp, i->cond);
-
-    condreg = popreg(comp->regstack);
-
-    fprintf(OUT, "\tgoto_if\tL%d, %c%d\n", iflabel, reg_chars[(int)condreg.type], condreg.no);
-
-    unuse_reg(comp, condreg);
+	  <code for condition 1: to L1 if true>
+	  <code for condition 2: to L2 if true>
+	  <code for final elseblock>
+	  goto LEND
+	L2:
+	  <code for ifblock 2>
+	  goto LEND
+	L1:
+	  <code for ifblock 1>
+	LEND:
+	
+	The blocks are statements, unless it's a ?: whose value is C<used>.
+	
+	*/
+    m1_ptrstack   *ifblocks  = new_ptrstack();
+    m1_intstack   *iflabels  = new_intstack();
+    m1_expression *elseblock;
+    unsigned       ifline    = comp->currentline;
+    int            endlabel  = gen_label(comp);
+
+    for (;;) {
+        int iflabel = gen_label(comp);
+        
+        gencode_cond(comp, i->cond, iflabel, NO_LABEL);
+        
+        pushptr(ifblocks, i->ifblock);
+        push(iflabels, iflabel);
+        
+        elseblock = i->elseblock;
+        if (elseblock == NULL || elseblock->type != EXPR_IF || elseblock->next != NULL)
+            break;
+            
+        mark_line(comp, elseblock->line);
+        i = elseblock->expr.i;
+    }
     
     /* else block */
-    if (i->elseblock) {            	
-        gencode_expr(comp, i->elseblock);     
+    if (elseblock) {            	
+        if (used)
+            gencode_expr(comp, elseblock);
+        else
+            gencode_stat(comp, elseblock);
     }
+    mark_line(comp, ifline);
     fprintf(OUT, "\tgoto L%d\n", endlabel);
     
-    /* if block */
-    fprintf(OUT, "L%d:\n", iflabel);
-    gencode_expr(comp, i->ifblock);
+    /* if blocks */
+    while (!ptrstack_isempty(ifblocks)) {
+        m1_expression *ifblock;
+        
+        gencode_label(comp, pop(iflabels));
+        ifblock = (m1_expression *)popptr(ifblocks);
+        if (used)
+            gencode_expr(comp, ifblock);
+        else
+            gencode_stat(comp, ifblock);
+        
+        if (!ptrstack_isempty(ifblocks)) {
+            mark_line(comp, ifline);
+            fprintf(OUT, "\tgoto L%d\n", endlabel);
+        }
+    }
 			
-    fprintf(OUT, "L%d:\n", endlabel);
-         
+    gencode_label(comp, endlabel);
+    
+    delete_ptrstack(ifblocks);
+    delete_stack(iflabels);
 }
 
 static void
 gencode_deref(M1_compiler *comp, m1_object *o) {
-    gencode_obj(comp, o, NULL, 0);   
+    gencode_obj(comp, o, 0);   
 }
 
 static void
 gencode_address(M1_compiler *comp, m1_object *o) {
-    gencode_obj(comp, o, NULL, 0);       
+    gencode_obj(comp, o, 0);       
 }
 
 static void
@@ -762,6 +1093,7 @@ gencode_return(M1_compiler *comp, m1_expression *e) {
     m1_reg chunk_index,
            retpc_reg,
            retpc_index;
+    int    held = -1; /* type of R0 that holds the value, if it was free */
     
     if (e != NULL) {
         /* returning a value:
@@ -784,8 +1116,11 @@ gencode_return(M1_compiler *comp, m1_expression *e) {
         unuse_reg(comp, indexreg);
         unuse_reg(comp, retvalreg);
 
-        /*  make register available. XXX is this needed? */
-
+        /* R0 holds the value now; it mustn't be used for the jump back. */
+        if (comp->registers[(int)retvalreg.type][0] == REG_UNUSED) {
+            held = retvalreg.type;
+            comp->registers[held][0] = REG_USED;
+        }
     }
 
     /* instructions to return:
@@ -809,7 +1144,21 @@ gencode_return(M1_compiler *comp, m1_expression *e) {
     unuse_reg(comp, chunk_index);    
     unuse_reg(comp, retpc_reg);
     unuse_reg(comp, retpc_index);
+    
+    if (held >= 0)
+        comp->registers[held][0] = REG_UNUSED;
+}
 
+/* generate code for C<e>, an operand that is only read; if it's a pinned 
+   constant, its register is used. */
+static void
+gencode_operand(M1_compiler *comp, m1_expression *e) {
+    m1_reg reg;
+    
+    if (e->type == EXPR_INT && pin_lookup(comp, e->expr.l->sym->value.ival, &reg))
+        pushreg(comp->regstack, reg);
+    else
+        gencode_expr(comp, e);
 }
 
 static void
@@ -844,7 +1193,7 @@ gencode_or(M1_compiler *comp, m1_binexpr *b) {
 	pushreg(comp->regstack, left);
 	unuse_reg(comp, right);
 	
-	fprintf(OUT, "L%d:\n", endlabel);
+	gencode_label(comp, endlabel);
 		
 }
 
@@ -869,14 +1218,14 @@ gencode_and(M1_compiler *comp, m1_binexpr *b) {
 	/* if left was false, no need to evaluate right, and go to end. */
 	fprintf(OUT, "\tgoto_if\tL%d, %c%d\n", evalright, reg_chars[(int)left.type], left.no);		
 	fprintf(OUT, "\tgoto L%d\n", endlabel);
-	fprintf(OUT, "L%d:\n", evalright);
+	gencode_label(comp, evalright);
 	
 	gencode_expr(comp, b->right);
 	right = popreg(comp->regstack);
 	
 	/* copy result from right to left result reg, as that's the reg that will be returned. */
 	fprintf(OUT, "\tset\t%c%d, %c%d, x\n", reg_chars[(int)left.type], left.no, reg_chars[(int)right.type], right.no);	
-	fprintf(OUT, "L%d:\n", endlabel);
+	gencode_label(comp, endlabel);
 	
 	unuse_reg(comp, right);
 	pushreg(comp->regstack, left);
@@ -911,10 +1260,10 @@ ne_eq_common(M1_compiler *comp, m1_binexpr *b, int is_eq_op) {
     int endlabel, 
         eq_ne_label;
     
-    gencode_expr(comp, b->left);
+    gencode_operand(comp, b->left);
     left = popreg(comp->regstack);
     
-    gencode_expr(comp, b->right);
+    gencode_operand(comp, b->right);
     right = popreg(comp->regstack);
     
     endlabel    = gen_label(comp);
@@ -929,9 +1278,9 @@ ne_eq_common(M1_compiler *comp, m1_binexpr *b, int is_eq_op) {
     fprintf(OUT, "\tset_imm\t%c%d, 0, %d\n", reg_chars[(int)reg.type], reg.no, is_eq_op);
     fprintf(OUT, "\tgoto L%d\n", endlabel);                                                      
     
-    fprintf(OUT, "L%d:\n", eq_ne_label);
+    gencode_label(comp, eq_ne_label);
     fprintf(OUT, "\tset_imm\t%c%d, 0, %d\n", reg_chars[(int)reg.type], reg.no, !is_eq_op);
-    fprintf(OUT, "L%d:\n", endlabel);
+    gencode_label(comp, endlabel);
     
     unuse_reg(comp, left);
     unuse_reg(comp, right);
@@ -955,10 +1304,10 @@ gencode_lt(M1_compiler *comp, m1_binexpr *b) {
     m1_reg result = use_reg(comp, VAL_INT);
     m1_reg left, right;
     
-    gencode_expr(comp, b->left);
+    gencode_operand(comp, b->left);
     left = popreg(comp->regstack);
     
-    gencode_expr(comp, b->right);
+    gencode_operand(comp, b->right);
     right = popreg(comp->regstack);
     
     fprintf(OUT, "\tisgt_%c I%d, %c%d, %c%d\n", type_chars[(int)left.type], result.no, 
@@ -976,10 +1325,10 @@ gencode_le(M1_compiler *comp, m1_binexpr *b) {
     m1_reg result = use_reg(comp, VAL_INT);
     m1_reg left, right;
     
-    gencode_expr(comp, b->left);
+    gencode_operand(comp, b->left);
     left = popreg(comp->regstack);
     
-    gencode_expr(comp, b->right);
+    gencode_operand(comp, b->right);
     right = popreg(comp->regstack);
     
     fprintf(OUT, "\tisge_%c I%d, %c%d, %c%d\n", type_chars[(int)left.type], result.no, 
@@ -1011,11 +1360,12 @@ The parse tree for:
 evaluated first, before it can be assigned to any variable.)
             
 Assign 42 to c, then either of them to b, and then either of them 
-(b or (c or 42)) to a. Doesn't matter which one.
+(b or (c or 42)) to a. Doesn't matter which one. The outermost one,
+when it's a statement, such as a for loop's step, leaves nothing.
             
 */
 static void
-gencode_binary_assign(M1_compiler *comp, m1_binexpr *b) {
+gencode_binary_assign(M1_compiler *comp, m1_binexpr *b, int used) {
     m1_reg left, right;
     
     gencode_expr(comp, b->left);
@@ -1028,17 +1378,20 @@ gencode_binary_assign(M1_compiler *comp, m1_binexpr *b) {
                                             reg_chars[(int)right.type], right.no);
 
     unuse_reg(comp, left);
-    pushreg(comp->regstack, right);                    
+    if (used)
+        pushreg(comp->regstack, right);
+    else
+        unuse_reg(comp, right);
 }
 
 static void
 gencode_binary_bitwise(M1_compiler *comp, m1_binexpr *b, char const * const op) {
     m1_reg left, right, target;
     
-    gencode_expr(comp, b->left);
+    gencode_operand(comp, b->left);
     left = popreg(comp->regstack);
 
-    gencode_expr(comp, b->right);  
+    gencode_operand(comp, b->right);  
     right  = popreg(comp->regstack);
     
     target = use_reg(comp, (m1_valuetype)left.type);    
@@ -1072,7 +1425,7 @@ gencode_binary_plus(M1_compiler *comp, m1_binexpr *b) {
     char *op;
     m1_reg left, right, target;
     
-    gencode_expr(comp, b->left);
+    gencode_operand(comp, b->left);
     left = popreg(comp->regstack);
 
     if (left.type == VAL_INT)
@@ -1083,7 +1436,7 @@ gencode_binary_plus(M1_compiler *comp, m1_binexpr *b) {
         fprintf(stderr, "wrong type for add");
         exit(EXIT_FAILURE);
     }
-    gencode_expr(comp, b->right);  
+    gencode_operand(comp, b->right);  
     right  = popreg(comp->regstack);
     
     target = use_reg(comp, (m1_valuetype)left.type);    
@@ -1102,7 +1455,7 @@ gencode_binary_minus(M1_compiler *comp, m1_binexpr *b) {
     char *op;
     m1_reg left, right, target;
     
-    gencode_expr(comp, b->left);
+    gencode_operand(comp, b->left);
     left = popreg(comp->regstack);
 
     if (left.type == VAL_INT)
@@ -1113,18 +1466,183 @@ gencode_binary_minus(M1_compiler *comp, m1_binexpr *b) {
         fprintf(stderr, "wrong type for sub");
         exit(EXIT_FAILURE);
     }
-    gencode_expr(comp, b->right);  
-    right  = popreg(comp->regstack);
-    
-    target = use_reg(comp, (m1_valuetype)left.type);    
-    fprintf(OUT, "\t%s\t%c%d, %c%d, %c%d\n", op, 
-                                             reg_chars[(int)target.type], target.no, 
-                                             reg_chars[(int)left.type], left.no, 
-                                             reg_chars[(int)right.type], right.no);
-    unuse_reg(comp, left);
-    unuse_reg(comp, right);
-    pushreg(comp->regstack, target);           
+    gencode_operand(comp, b->right);  
+    right  = popreg(comp->regstack);
+    
+    target = use_reg(comp, (m1_valuetype)left.type);    
+    fprintf(OUT, "\t%s\t%c%d, %c%d, %c%d\n", op, 
+                                             reg_chars[(int)target.type], target.no, 
+                                             reg_chars[(int)left.type], left.no, 
+                                             reg_chars[(int)right.type], right.no);
+    unuse_reg(comp, left);
+    unuse_reg(comp, right);
+    pushreg(comp->regstack, target);           
+    
+}
+
+/* the k for which value is 2^k, or -1 if it isn't a power of 2. */
+static int
+log2_exact(unsigned long value) {
+    int k = 0;
+    
+    if (value == 0 || (value & (value - 1)) != 0)
+        return -1;
+    while (value > 1) {
+        value >>= 1;
+        ++k;
+    }
+    return k;
+}
+
+/* load value into a new int register. */
+static m1_reg
+gencode_imm(M1_compiler *comp, unsigned value) {
+    m1_reg reg = use_reg(comp, VAL_INT);
+    
+    gencode_set_int(comp, reg, value);
+    return reg;
+}
+
+/* emit op target, left, right, with the constant value in a register for right; returns target. */
+static m1_reg
+gencode_op_imm(M1_compiler *comp, char const *op, m1_reg left, unsigned value) {
+    m1_reg right, target;
+    
+    if (!pin_lookup(comp, (int)value, &right))
+        right = gencode_imm(comp, value);
+    target = use_reg(comp, VAL_INT);
+    
+    fprintf(OUT, "\t%s\tI%d, I%d, I%d\n", op, target.no, left.no, right.no);
+    unuse_reg(comp, right);
+    return target;
+}
+
+/* whether gencode_by_const() handles int operation op with a constant operand of value. */
+static int
+is_cheap_const(m1_binop op, long value) {
+    if (value < 0)
+        return 0;
+    switch (op) {
+        case OP_MUL:
+            return value == 0 || log2_exact(value) >= 0;
+        case OP_DIV:
+            return log2_exact(value) >= 0;
+        case OP_MOD:
+            return log2_exact(value) >= 0 && value <= 256 * 256;
+        default:
+            return 0;
+    }
+}
+
+/*
+
+Generate code for x * c, x / c or x % c, with c an int literal that is 0
+or a power of 2, using shifts; a multiplication may have the constant on
+either side:
+
+    x * 0:  0
+    x * 1:  x
+    x * 8:  shl   r, x, 3
+    x / 8:  ashr  t, x, 63        # -1 if x < 0, else 0
+            lshr  t, t, 61        # 7 if x < 0, else 0
+            add_i u, x, t         # so that the shift rounds towards 0, as div_i
+            ashr  r, u, 3
+    x % 8:  (t and u as for x / 8)
+            and   u, u, 7
+            sub_i r, u, t
+
+Each shift amount and mask takes a set_imm as well, which -O2 moves out
+of loops. The JIT runs the division sequence in about half the time of
+div_i, whose idiv is slow. It's slower in the interpreter, which pays for
+every instruction, but the JIT takes over the hot loops. A shift and an
+add for x * 9 gain nothing over mult_i in either, so other multiplications
+are left alone. Returns 0, without generating any code, if b isn't one of
+those; if x turns out not to be an int, the constant is loaded, and the
+op for nums is used, as gencode_binary_mult() and friends would.
+
+*/
+static int
+gencode_by_const(M1_compiler *comp, m1_binexpr *b) {
+    m1_expression *x = b->left,
+                  *c = b->right;
+    m1_reg         reg, t, u, target;
+    long           value;
+    int            k;
+    
+    if (b->op == OP_MUL && c->type != EXPR_INT) {
+        x = b->right;
+        c = b->left;
+    }
+    if (c->type != EXPR_INT)
+        return 0;
+    value = c->expr.l->sym->value.ival;
+    if (!is_cheap_const(b->op, value))
+        return 0;
+    
+    gencode_expr(comp, x);
+    reg = popreg(comp->regstack);
+    
+    if (reg.type != VAL_INT) {
+        char const *op = b->op == OP_MUL ? "mult_n" : b->op == OP_DIV ? "div_n" : "mod_n";
+        m1_reg      left, right;
+        
+        gencode_expr(comp, c);
+        left  = x == b->left ? reg : popreg(comp->regstack);
+        right = x == b->left ? popreg(comp->regstack) : reg;
+        
+        target = use_reg(comp, (m1_valuetype)left.type);
+        fprintf(OUT, "\t%s\t%c%d, %c%d, %c%d\n", op, reg_chars[(int)target.type], target.no,
+                                                     reg_chars[(int)left.type], left.no,
+                                                     reg_chars[(int)right.type], right.no);
+        unuse_reg(comp, left);
+        unuse_reg(comp, right);
+        pushreg(comp->regstack, target);
+        return 1;
+    }
+    
+    k = log2_exact(value);
+    
+    if (b->op == OP_MUL && value == 0) {
+        unuse_reg(comp, reg);
+        target = gencode_imm(comp, 0);
+    }
+    else if (b->op == OP_MUL && k >= 0) {
+        target = k == 0 ? reg : gencode_op_imm(comp, "shl", reg, k);
+        if (k > 0)
+            unuse_reg(comp, reg);
+    }
+    else if (k == 0) { /* x / 1 or x % 1 */
+        if (b->op == OP_DIV)
+            target = reg;
+        else {
+            unuse_reg(comp, reg);
+            target = gencode_imm(comp, 0);
+        }
+    }
+    else {
+        /* t = 2^k - 1 if x < 0, else 0; u = x + t */
+        u = gencode_op_imm(comp, "ashr", reg, 63);
+        t = gencode_op_imm(comp, "lshr", u, 64 - k);
+        unuse_reg(comp, u);
+        u = use_reg(comp, VAL_INT);
+        fprintf(OUT, "\tadd_i\tI%d, I%d, I%d\n", u.no, reg.no, t.no);
+        unuse_reg(comp, reg);
+        
+        if (b->op == OP_DIV)
+            target = gencode_op_imm(comp, "ashr", u, k);
+        else {
+            m1_reg masked = gencode_op_imm(comp, "and", u, value - 1);
+            
+            target = use_reg(comp, VAL_INT);
+            fprintf(OUT, "\tsub_i\tI%d, I%d, I%d\n", target.no, masked.no, t.no);
+            unuse_reg(comp, masked);
+        }
+        unuse_reg(comp, t);
+        unuse_reg(comp, u);
+    }
     
+    pushreg(comp->regstack, target);
+    return 1;
 }
 
 static void
@@ -1132,7 +1650,10 @@ gencode_binary_mult(M1_compiler *comp, m1_binexpr *b) {
     char *op;
     m1_reg left, right, target;
     
-    gencode_expr(comp, b->left);
+    if (gencode_by_const(comp, b))
+        return;
+    
+    gencode_operand(comp, b->left);
     left = popreg(comp->regstack);
 
     if (left.type == VAL_INT)
@@ -1143,7 +1664,7 @@ gencode_binary_mult(M1_compiler *comp, m1_binexpr *b) {
         fprintf(stderr, "wrong type for mult");
         exit(EXIT_FAILURE);
     }
-    gencode_expr(comp, b->right);  
+    gencode_operand(comp, b->right);  
     right  = popreg(comp->regstack);
     
     target = use_reg(comp, (m1_valuetype)left.type);    
@@ -1162,7 +1683,10 @@ gencode_binary_mod(M1_compiler *comp, m1_binexpr *b) {
     char *op;
     m1_reg left, right, target;
     
-    gencode_expr(comp, b->left);
+    if (gencode_by_const(comp, b))
+        return;
+    
+    gencode_operand(comp, b->left);
     left = popreg(comp->regstack);
 
     if (left.type == VAL_INT)
@@ -1173,7 +1697,7 @@ gencode_binary_mod(M1_compiler *comp, m1_binexpr *b) {
         fprintf(stderr, "wrong type for mult");
         exit(EXIT_FAILURE);
     }
-    gencode_expr(comp, b->right);  
+    gencode_operand(comp, b->right);  
     right  = popreg(comp->regstack);
     
     target = use_reg(comp, (m1_valuetype)left.type);    
@@ -1192,7 +1716,10 @@ gencode_binary_div(M1_compiler *comp, m1_binexpr *b) {
     char *op;
     m1_reg left, right, target;
     
-    gencode_expr(comp, b->left);
+    if (gencode_by_const(comp, b))
+        return;
+    
+    gencode_operand(comp, b->left);
     left = popreg(comp->regstack);
 
     if (left.type == VAL_INT)
@@ -1203,7 +1730,7 @@ gencode_binary_div(M1_compiler *comp, m1_binexpr *b) {
         fprintf(stderr, "wrong type for mult");
         exit(EXIT_FAILURE);
     }
-    gencode_expr(comp, b->right);  
+    gencode_operand(comp, b->right);  
     right  = popreg(comp->regstack);
     
     target = use_reg(comp, (m1_valuetype)left.type);    
@@ -1223,7 +1750,7 @@ gencode_binary_isgt(M1_compiler *comp, m1_binexpr *b) {
     char *op;
     m1_reg left, right, target;
     
-    gencode_expr(comp, b->left);
+    gencode_operand(comp, b->left);
     left = popreg(comp->regstack);
 
     if (left.type == VAL_INT)
@@ -1234,7 +1761,7 @@ gencode_binary_isgt(M1_compiler *comp, m1_binexpr *b) {
         fprintf(stderr, "wrong type for mult");
         exit(EXIT_FAILURE);
     }
-    gencode_expr(comp, b->right);  
+    gencode_operand(comp, b->right);  
     right  = popreg(comp->regstack);
     
     target = use_reg(comp, (m1_valuetype)left.type);    
@@ -1253,7 +1780,7 @@ gencode_binary_isge(M1_compiler *comp, m1_binexpr *b) {
     char *op;
     m1_reg left, right, target;
     
-    gencode_expr(comp, b->left);
+    gencode_operand(comp, b->left);
     left = popreg(comp->regstack);
 
     if (left.type == VAL_INT)
@@ -1264,7 +1791,7 @@ gencode_binary_isge(M1_compiler *comp, m1_binexpr *b) {
         fprintf(stderr, "wrong type for mult");
         exit(EXIT_FAILURE);
     }
-    gencode_expr(comp, b->right);  
+    gencode_operand(comp, b->right);  
     right  = popreg(comp->regstack);
     
     target = use_reg(comp, (m1_valuetype)left.type);    
@@ -1280,12 +1807,12 @@ gencode_binary_isge(M1_compiler *comp, m1_binexpr *b) {
 
 
 static void
-gencode_binary(M1_compiler *comp, m1_binexpr *b) {
+gencode_binary(M1_compiler *comp, m1_binexpr *b, int used) {
 
     switch(b->op) {
     	case OP_ASSIGN:
     		/* in case of a = b = c; then b = c part is a binary expression */
-    		gencode_binary_assign(comp, b);
+    		gencode_binary_assign(comp, b, used);
     		break;
         case OP_PLUS:
             gencode_binary_plus(comp, b);
@@ -1373,9 +1900,9 @@ gencode_not(M1_compiler *comp, m1_unexpr *u) {
     fprintf(OUT, "\tgoto_if\tL%d, %c%d\n", label1, reg_chars[(int)reg.type], reg.no);
     fprintf(OUT, "\tset_imm\tI%d, 0, 1\n", temp.no);
     fprintf(OUT, "\tgoto L%d\n", label2);
-    fprintf(OUT, "L%d:\n", label1);
+    gencode_label(comp, label1);
     fprintf(OUT, "\tset_imm\tI%d, 0, 0\n", temp.no);
-    fprintf(OUT, "L%d:\n", label2);
+    gencode_label(comp, label2);
     fprintf(OUT, "\tset\t%c%d, I%d, x\n", reg_chars[(int)reg.type], reg.no, temp.no);
     
     unuse_reg(comp, reg);
@@ -1383,13 +1910,123 @@ gencode_not(M1_compiler *comp, m1_unexpr *u) {
    
 }
 
+/* jump to truelabel if reg is nonzero, and to falselabel otherwise; see gencode_cond(). */
+static void
+gencode_branch(M1_compiler *comp, m1_reg reg, int truelabel, int falselabel) {
+    int skiplabel;
+    
+    if (truelabel != NO_LABEL) {
+        fprintf(OUT, "\tgoto_if\tL%d, %c%d\n", truelabel, reg_chars[(int)reg.type], reg.no);
+        if (falselabel != NO_LABEL)
+            fprintf(OUT, "\tgoto L%d\n", falselabel);
+        return;
+    }
+    
+    /* goto_if only jumps if reg is nonzero, so jump over the goto to falselabel then. */
+    skiplabel = gen_label(comp);
+    fprintf(OUT, "\tgoto_if\tL%d, %c%d\n", skiplabel, reg_chars[(int)reg.type], reg.no);
+    fprintf(OUT, "\tgoto L%d\n", falselabel);
+    gencode_label(comp, skiplabel);
+}
+
+/*
+
+Generate code for condition e, as in an if statement or a loop: jump to 
+truelabel if it is true, and to falselabel if not. Either label may be
+NO_LABEL, to go on with the code that follows instead. Comparisons, !,
+&& and || jump to their targets directly, without putting a 0 or 1 in a
+register first:
+
+    a == b:  diff = a - b
+             goto_if falselabel, diff
+             goto truelabel
+
+    !a:      <code for a, with truelabel and falselabel swapped>
+
+    a && b:  <code for a: to falselabel if false, go on if true>
+             <code for b>
+
+Other expressions are evaluated, and their value tested with goto_if.
+Value context, as in x = a && b, still uses gencode_expr().
+
+*/
+static void
+gencode_cond(M1_compiler *comp, m1_expression *e, int truelabel, int falselabel) {
+    unsigned    parentline = comp->currentline;
+    m1_binexpr *b          = e->type == EXPR_BINARY ? e->expr.b : NULL;
+    m1_reg      reg;
+    
+    assert(truelabel != NO_LABEL || falselabel != NO_LABEL);
+    mark_line(comp, e->line);
+    
+    if (e->type == EXPR_TRUE || e->type == EXPR_FALSE || e->type == EXPR_INT) {
+        int value  = e->type == EXPR_INT ? e->expr.l->sym->value.ival != 0 : e->type == EXPR_TRUE;
+        int target = value ? truelabel : falselabel;
+        
+        if (target != NO_LABEL)
+            fprintf(OUT, "\tgoto L%d\n", target);
+    }
+    else if (e->type == EXPR_UNARY && e->expr.u->op == UNOP_NOT) {
+        gencode_cond(comp, e->expr.u->expr, falselabel, truelabel);
+    }
+    else if (b != NULL && b->op == OP_AND) {
+        int label = falselabel != NO_LABEL ? falselabel : gen_label(comp);
+        
+        gencode_cond(comp, b->left, NO_LABEL, label);
+        gencode_cond(comp, b->right, truelabel, falselabel);
+        if (falselabel == NO_LABEL)
+            gencode_label(comp, label);
+    }
+    else if (b != NULL && b->op == OP_OR) {
+        int label = truelabel != NO_LABEL ? truelabel : gen_label(comp);
+        
+        gencode_cond(comp, b->left, label, NO_LABEL);
+        gencode_cond(comp, b->right, truelabel, falselabel);
+        if (truelabel == NO_LABEL)
+            gencode_label(comp, label);
+    }
+    else if (b != NULL && (b->op == OP_EQ || b->op == OP_NE)) {
+        /* the same test as ne_eq_common(); a difference of 0 means equal. */
+        m1_reg left, right;
+        
+        gencode_operand(comp, b->left);
+        left = popreg(comp->regstack);
+        
+        gencode_operand(comp, b->right);
+        right = popreg(comp->regstack);
+        
+        reg = use_reg(comp, VAL_INT);
+        fprintf(OUT, "\tsub_i\tI%d, %c%d, %c%d\n", reg.no, reg_chars[(int)left.type], left.no,
+                                                          reg_chars[(int)right.type], right.no);
+        unuse_reg(comp, left);
+        unuse_reg(comp, right);
+        
+        if (b->op == OP_EQ)
+            gencode_branch(comp, reg, falselabel, truelabel);
+        else
+            gencode_branch(comp, reg, truelabel, falselabel);
+        unuse_reg(comp, reg);
+    }
+    else {
+        gencode_expr(comp, e);
+        reg = popreg(comp->regstack);
+        gencode_branch(comp, reg, truelabel, falselabel);
+        unuse_reg(comp, reg);
+    }
+    
+    mark_line(comp, parentline);
+}
 
+/* generate code for ++, -- or !; the old value that a postfix ++ or --
+   gives back is only kept if it's C<used>. */
 static void
-gencode_unary(M1_compiler *comp, NOTNULL(m1_unexpr *u)) {
+gencode_unary(M1_compiler *comp, NOTNULL(m1_unexpr *u), int used) {
     char  *op;
-    int    postfix = 0;
+    int    postfix = 0,
+           pinned;
     m1_reg reg, 
-           oldval; 
+           oldval,
+           one; 
     
     switch (u->op) {
         case UNOP_POSTINC:
@@ -1420,8 +2057,14 @@ gencode_unary(M1_compiler *comp, NOTNULL(m1_unexpr *u)) {
     gencode_expr(comp, u->expr);
     reg = popreg(comp->regstack);
     
-    /* register to hold the value "1". */        
-    m1_reg one = use_reg(comp, VAL_INT);
+    /* register to hold the value "1", unless it's pinned. */        
+    pinned = pin_lookup(comp, 1, &one);
+    if (!pinned)
+        one = use_reg(comp, VAL_INT);
+    
+    /* as a statement, i++ is ++i. */
+    if (!used)
+        postfix = 0;
     
     /* if it's a postfix op, then need to save the old value. */
     if (postfix == 1) {
@@ -1429,16 +2072,22 @@ gencode_unary(M1_compiler *comp, NOTNULL(m1_unexpr *u)) {
         fprintf(OUT, "\tset\tI%d, I%d, x\n", oldval.no, reg.no);
     }
     
-    fprintf(OUT, "\tset_imm\tI%d, 0, 1\n", one.no);
+    if (!pinned)
+        fprintf(OUT, "\tset_imm\tI%d, 0, 1\n", one.no);
     fprintf(OUT, "\t%s\tI%d, I%d, I%d\n", op, reg.no, reg.no, one.no);    
     
+    /* reg may be a variable's. */
+    addr_forget_all(comp);
+    
     if (postfix == 1) { /* postfix; give back the register containing the OLD value. */
     	pushreg(comp->regstack, oldval);
         unuse_reg(comp, reg);
     }
-    else { /* prefix; give back the register containing the NEW value. */
+    else if (used) { /* prefix; give back the register containing the NEW value. */
         pushreg(comp->regstack, reg);
     }
+    else
+        unuse_reg(comp, reg);
 
     /* release the register that was holding the constant "1". */
     unuse_reg(comp, one);       
@@ -1464,11 +2113,11 @@ gencode_break(M1_compiler *comp) {
 }
 
 /* Generate sequence for a function call, including setting arguments
- * and retrieving return value.
+ * and retrieving return value, if it's C<used>.
  * XXX this function needs a bit of refactoring, cleaning up and comments.
  */
 static void
-gencode_funcall(M1_compiler *comp, m1_funcall *f) {
+gencode_funcall(M1_compiler *comp, m1_funcall *f, int used) {
     m1_symbol *fun;
     fun = sym_find_chunk(&comp->currentchunk->constants, f->name);
     m1_reg pc_reg, cont_offset;
@@ -1480,14 +2129,18 @@ gencode_funcall(M1_compiler *comp, m1_funcall *f) {
         return;
     }
     
+    stats_call(comp);
+    REMARK(comp, REMARK_MISSED, "inline", "NoInline", comp->currentline,
+           "call to %s not inlined: functions are never inlined", f->name);
+    
     m1_reg cf_reg   = use_reg(comp, VAL_CHUNK);
     m1_reg sizereg  = use_reg(comp, VAL_INT);
     m1_reg flagsreg = use_reg(comp, VAL_INT);
     
     /* create a new call frame */
     /* alloc_cf: */
-    fprintf(OUT, "\tset_imm   I%d, 0, 198\n", sizereg.no);
-    /* fprintf(OUT, "\tset_imm   I%d, 8, 0\n", sizereg.no); / * XXX: why $2 = 8 ? */
+    /* a call frame has 256 registers of 8 bytes: 8 * 256 + 0 = 2048 bytes. */
+    fprintf(OUT, "\tset_imm   I%d, 8, 0\n", sizereg.no);
     fprintf(OUT, "\tset_imm   I%d, 0, 0\n", flagsreg.no);
     fprintf(OUT, "\tgc_alloc  P%d, I%d, I%d\n", cf_reg.no, sizereg.no, flagsreg.no);
     unuse_reg(comp, sizereg);
@@ -1568,8 +2221,9 @@ gencode_funcall(M1_compiler *comp, m1_funcall *f) {
 
     unuse_reg(comp, temp2);
 
-    /* init_cf_retpc: */    
-    fprintf(OUT, "\tset_imm   I%d, 0, 10\n", temp.no);
+    /* init_cf_retpc: PC points to the next instruction, so RETPC is the 
+       instruction right after the goto_chunk below (9 instructions ahead). */    
+    fprintf(OUT, "\tset_imm   I%d, 0, 9\n", temp.no);
     fprintf(OUT, "\tadd_i     RETPC, PC, I%d\n", temp.no);
 
     unuse_reg(comp, temp);
@@ -1599,8 +2253,17 @@ gencode_funcall(M1_compiler *comp, m1_funcall *f) {
 */
 
     int calledfun_index = fun->constindex;
-    fprintf(OUT, "\tset_imm    P%d, 0, %d\n", cf_reg.no, calledfun_index);
-    fprintf(OUT, "\tderef      P%d, CONSTS, P%d\n", cf_reg.no, cf_reg.no);
+    if (calledfun_index < 256 * 256) {
+        fprintf(OUT, "\tset_imm    P%d, %d, %d\n", cf_reg.no, calledfun_index / 256, calledfun_index % 256);
+        fprintf(OUT, "\tderef      P%d, CONSTS, P%d\n", cf_reg.no, cf_reg.no);
+    }
+    else { /* built in an int register, as shl and or work on ints. */
+        m1_reg indexreg = use_reg(comp, VAL_INT);
+        
+        gencode_set_int(comp, indexreg, calledfun_index);
+        fprintf(OUT, "\tderef      P%d, CONSTS, I%d\n", cf_reg.no, indexreg.no);
+        unuse_reg(comp, indexreg);
+    }
     
     m1_reg I0 = use_reg(comp, VAL_INT);    
     fprintf(OUT, "\tset_imm    I%d, 0, 0\n", I0.no);
@@ -1676,6 +2339,13 @@ gencode_funcall(M1_compiler *comp, m1_funcall *f) {
     */
     fprintf(OUT, "\tset       CF, PCF, x\n");
     
+    /* the callee may have changed any object. */
+    addr_forget_all(comp);
+    
+    if (!used) {
+        unuse_reg(comp, cf_reg);
+        return;
+    }
 
     
     /* generate code to get the return value. */
@@ -1714,10 +2384,11 @@ gencode_print(M1_compiler *comp, m1_expression *expr) {
 
     reg = popreg(comp->regstack);
     
-    /* register to hold value "1" */    
-    one = use_reg(comp, VAL_INT);    
-    
-    fprintf(OUT, "\tset_imm\tI%d, 0, 1\n",  one.no);
+    /* register to hold value "1", unless it's pinned. */    
+    if (!pin_lookup(comp, 1, &one)) {
+        one = use_reg(comp, VAL_INT);    
+        fprintf(OUT, "\tset_imm\tI%d, 0, 1\n",  one.no);
+    }
     fprintf(OUT, "\tprint_%c\tI%d, %c%d, x\n", type_chars[(int)reg.type], one.no, 
 	                                       reg_chars[(int)reg.type], reg.no);
 		
@@ -1732,7 +2403,7 @@ gencode_new(M1_compiler *comp, m1_newexpr *expr) {
 
 	unsigned size     = type_get_size(expr->typedecl);
 		
-	fprintf(OUT, "\tset_imm I%d, 0, %d\n", sizereg.no, size);
+	gencode_set_int(comp, sizereg, size);
 	fprintf(OUT, "\tgc_alloc\tI%d, I%d, 0\n", pointerreg.no, sizereg.no);
 	
 	unuse_reg(comp, sizereg);
@@ -1773,8 +2444,9 @@ gencode_switch(M1_compiler *comp, m1_switch *expr) {
     END: #break statements will go here.
       
     */
-    m1_case *caseiter;
-    m1_reg   reg;    
+    m1_case       *caseiter;
+    m1_expression *stat;
+    m1_reg         reg;    
     m1_reg   test     = use_reg(comp, VAL_INT);    
     int      endlabel = gen_label(comp);
 
@@ -1785,21 +2457,29 @@ gencode_switch(M1_compiler *comp, m1_switch *expr) {
     
     push(comp->breakstack, endlabel); /* for break statements to jump to. */    
 
+    if (comp->remarks != NULL) {
+        unsigned num_cases = 0;
+        for (caseiter = expr->cases; caseiter != NULL; caseiter = caseiter->next)
+            ++num_cases;
+        REMARK(comp, REMARK_MISSED, "switch", "CompareChain", comp->currentline,
+               "switch with %u cases lowered to a chain of compares, not a jump table", num_cases);
+    }
+
     /* iterate over cases and generate code for each. */
     caseiter = expr->cases;    
     while (caseiter != NULL) {
         int testlabel;
-        /* XXX TODO handle numbers > 255 */
         /* reuse register "test". */
-        fprintf(OUT, "\tset_imm\tI%d, 0, %d\n", test.no, caseiter->selector);
+        gencode_set_int(comp, test, caseiter->selector);
         fprintf(OUT, "\tsub_i\tI%d, I%d, I%d\n", test.no, reg.no, test.no);
      
         testlabel = gen_label(comp);
         fprintf(OUT, "\tgoto_if L%d, I%d\n", testlabel, test.no);
-        /* generate code for this case's block. */
-        gencode_expr(comp, caseiter->block);
+        /* generate code for this case's statements. */
+        for (stat = caseiter->block; stat != NULL; stat = stat->next)
+            gencode_stat(comp, stat);
         /* next test label. */
-        fprintf(OUT, "L%d:\n", testlabel);
+        gencode_label(comp, testlabel);
         
         caseiter = caseiter->next;   
     }
@@ -1807,11 +2487,10 @@ gencode_switch(M1_compiler *comp, m1_switch *expr) {
     unuse_reg(comp, test);
     unuse_reg(comp, reg);
     
-    if (expr->defaultstat) {
-       gencode_expr(comp, expr->defaultstat); 
-    }
+    for (stat = expr->defaultstat; stat != NULL; stat = stat->next)
+       gencode_stat(comp, stat);
     
-    fprintf(OUT, "L%d:\n", endlabel);      
+    gencode_label(comp, endlabel);      
     (void)pop(comp->breakstack);
     
     
@@ -1839,10 +2518,11 @@ gencode_var(M1_compiler *comp, m1_var *v) {
     }
     
     if (v->num_elems > 1) { /* generate code to allocate memory on the heap for arrays */
-        m1_symbol *sym;
+        m1_symbol *sym,
+                  *sizesym;
         m1_reg     memsize;                
-        int        elem_size = 4; /* XXX fix this. Size of one element in the array. */
-        int        size;
+        int        elem_size = 8; /* Size of one element in the array; each element takes one slot. */
+        long       size;
 
         sym = v->sym;
         assert(sym != NULL);
@@ -1853,28 +2533,14 @@ gencode_var(M1_compiler *comp, m1_var *v) {
             freeze_reg(comp, reg);
         }
         
-        /* calculate total size of array. If smaller than 256*255,
-         * then load the value with set_imm, otherwise from the 
-         * constants segment.
+        /* calculate total size of array, and load it; it's in the constants
+         * segment only if a literal happens to have the same value. 
          */
-        size = v->num_elems * elem_size;
-        
+        size    = (long)v->num_elems * elem_size;
+        sizesym = sym_find_int(&comp->currentchunk->constants, (int)size);
         memsize = use_reg(comp, VAL_INT);
-              
-        if (size < (256*255)) {
-            int remainder = size % 256;   
-            int num256    = (size - remainder) / 256;
-            fprintf(OUT, "\tset_imm\tI%d, %d, %d\n", memsize.no, num256, remainder);
-        }
-        else {
-            m1_symbol *sizesym = sym_find_int(&comp->currentchunk->constants, size);
-            m1_reg indexreg = use_reg(comp, VAL_INT);
-            assert(sizesym != NULL);
-            /* XXX this will fail if the const index in the CONSTS segment > 255. */
-            fprintf(OUT, "\tset_imm\tI%d, 0, %d\n", indexreg.no, sizesym->constindex); 
-            fprintf(OUT, "\tderef\tI%d, CONSTS, I%d\n", memsize.no, indexreg.no);
-            unuse_reg(comp, indexreg);
-        }
+        gencode_load_int(comp, memsize, size, 
+                         sizesym != NULL && sizesym->value.ival == size ? sizesym->constindex : NO_CONSTINDEX);
         
         fprintf(OUT, "\tgc_alloc\tI%d, I%d, 0\n", sym->regno, memsize.no);
         unuse_reg(comp, memsize);
@@ -1890,6 +2556,7 @@ gencode_vardecl(M1_compiler *comp, m1_var *v) {
     m1_var *iter = v;
     while (iter != NULL) {
         gencode_var(comp, iter);
+        addr_forget_root(comp, iter->sym);
         iter = iter->next;   
     }   
 }
@@ -1920,12 +2587,27 @@ gencode_cast(M1_compiler *comp, m1_castexpr *expr) {
   
 }
 
+/*
+
+Generate code for expression e. If its value is C<used>, it's left on
+the regstack; otherwise, e is a statement, such as i++; or f();, and the
+code for the value that nobody reads is left out: a postfix ++ or -- keeps
+no copy of the old value, a call doesn't fetch the return value from the
+callee's frame, and an assignment in a for loop's step pushes nothing.
+Anything else that a statement leaves on the regstack is dropped, so that
+its registers can be used again.
+
+*/
 static void
-gencode_expr(M1_compiler *comp, m1_expression *e) {
+gencode_expression(M1_compiler *comp, m1_expression *e, int used) {
+    unsigned parentline = comp->currentline;
+    int      sp         = comp->regstack->sp;
             
     if (e == NULL) {
     	debug("expr e is null in gencode_expr\n");
     }
+    
+    mark_line(comp, e->line);
         
     switch (e->type) {
         case EXPR_ADDRESS:
@@ -1935,7 +2617,7 @@ gencode_expr(M1_compiler *comp, m1_expression *e) {
             gencode_assign(comp, e->expr.a);
             break;
         case EXPR_BINARY:
-            gencode_binary(comp, e->expr.b);
+            gencode_binary(comp, e->expr.b, used);
             break;
         case EXPR_BLOCK:
             gencode_block(comp, e->expr.blck);
@@ -1968,10 +2650,10 @@ gencode_expr(M1_compiler *comp, m1_expression *e) {
             gencode_for(comp, e->expr.o);
             break;                      
         case EXPR_FUNCALL:
-            gencode_funcall(comp, e->expr.f);
+            gencode_funcall(comp, e->expr.f, used);
             break;
         case EXPR_IF:   
-            gencode_if(comp, e->expr.i);
+            gencode_if(comp, e->expr.i, used);
             break;            
         case EXPR_INT:
             gencode_int(comp, e->expr.l);
@@ -1986,11 +2668,8 @@ gencode_expr(M1_compiler *comp, m1_expression *e) {
             gencode_number(comp, e->expr.l);
             break;
         case EXPR_OBJECT: 
-        {
-            m1_object *obj; /* temp. storage. */
-            gencode_obj(comp, e->expr.t, &obj, 0);            
+            gencode_obj(comp, e->expr.t, 0);            
             break;
-        }
         case EXPR_PRINT:
             gencode_print(comp, e->expr.e);   
             break; 
@@ -2007,7 +2686,7 @@ gencode_expr(M1_compiler *comp, m1_expression *e) {
             gencode_bool(comp, 1);
             break;
         case EXPR_UNARY:
-            gencode_unary(comp, e->expr.u);
+            gencode_unary(comp, e->expr.u, used);
             break;
         case EXPR_VARDECL:
             gencode_vardecl(comp, e->expr.v);            
@@ -2019,7 +2698,22 @@ gencode_expr(M1_compiler *comp, m1_expression *e) {
             fprintf(stderr, "unknown expr type (%d)", e->type);   
             assert(0);
     }   
+    
+    while (!used && comp->regstack->sp > sp)
+        unuse_reg(comp, popreg(comp->regstack));
+    
+    /* code that follows, such as the jump back in a loop, belongs to the enclosing statement. */
+    mark_line(comp, parentline);
+}
+
+static void
+gencode_expr(M1_compiler *comp, m1_expression *e) {
+    gencode_expression(comp, e, 1);
+}
 
+static void
+gencode_stat(M1_compiler *comp, m1_expression *e) {
+    gencode_expression(comp, e, 0);
 }
 
 
@@ -2029,7 +2723,7 @@ Generate the constants segment.
 
 */
 static void
-gencode_consts(m1_symboltable *consttable) {
+gencode_consts(M1_compiler *comp, m1_symboltable *consttable) {
     m1_symbol *iter;
 	
 	fprintf(OUT, ".constants\n");
@@ -2063,13 +2757,107 @@ gencode_consts(m1_symboltable *consttable) {
 
 /*
 
-Generate the metadata segment. 
+Source line table. While generating a chunk's bytecode, the position in the
+output at which the source line changes is recorded, and once the chunk is
+done, these positions are translated into PCs. The table is written to the
+metadata segment as the line of the chunk's declaration, followed by pairs
+of PC and line deltas, each relative to the previous entry (the first one
+to PC 0 and the declaration line):
+
+    .metadata
+    line 12
+    lines 0:+0 5:+1 3:+1 9:-1
+
+An entry means that the instructions from its PC onwards belong to its line.
+Long tables are split over several "lines" lines.
+
+*/
+#define LINE_ENTRIES_PER_ROW    16
+
+static void
+mark_line(M1_compiler *comp, unsigned line) {
+    if (line == 0 || line == comp->currentline)
+        return;
+
+    comp->currentline = line;
+    if (comp->num_linemarks == comp->linemark_size) {
+        comp->linemark_size = comp->linemark_size ? comp->linemark_size * 2 : 64;
+        comp->linemarks     = (m1_linemark *)realloc(comp->linemarks, 
+                                                     comp->linemark_size * sizeof(m1_linemark));
+        if (comp->linemarks == NULL) {
+            fprintf(stderr, "Failed to allocate mem!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    comp->linemarks[comp->num_linemarks].offset = ftell(OUT);
+    comp->linemarks[comp->num_linemarks].line   = line;
+    ++comp->num_linemarks;
+}
+
+void
+gencode_mark_line(M1_compiler *comp, unsigned line) {
+    mark_line(comp, line);
+}
+
+/* Does the text from line up to the end of line hold an instruction (not a label)? */
+static int
+is_instruction_line(char const *line, char const *end) {
+    while (line < end && isspace((unsigned char)*line))
+        line++;
+    while (end > line && isspace((unsigned char)end[-1]))
+        end--;
+    return end > line && end[-1] != ':';
+}
+
+/*
+
+Generate the metadata segment, with the line table for the bytecode in code. 
 
 */
 static void
-gencode_metadata(m1_chunk *c) {
+gencode_metadata(M1_compiler *comp, m1_chunk *c, char const *code, size_t codesize) {
+    m1_linemark *marks    = comp->linemarks;
+    size_t       pos      = 0;
+    unsigned     pc       = 0;
+    unsigned     prevpc   = 0;
+    unsigned     prevline = c->line;
+    unsigned     entries  = 0;
+    unsigned     i;
+    
     assert(c != NULL);
 	fprintf(OUT, ".metadata\n");	
+	fprintf(OUT, "line %u\n", c->line);
+	
+	/* translate the marks' offsets into PCs, and drop the ones that don't
+	   change anything; a mark is overridden by a later one at the same PC. */
+	for (i = 0; i < comp->num_linemarks; i++) {
+	    while (pos < codesize && (long)pos < marks[i].offset) {
+	        char const *eol  = (char const *)memchr(code + pos, '\n', codesize - pos);
+	        size_t      next = eol == NULL ? codesize : (size_t)(eol - code) + 1;
+	        
+	        pc += is_instruction_line(code + pos, code + next);
+	        pos = next;
+	    }
+	    
+	    if (entries > 0 && (unsigned)marks[entries - 1].offset == pc)
+	        --entries;
+	    if (entries > 0 && marks[entries - 1].line == marks[i].line)
+	        continue;
+	    
+	    marks[entries].offset = pc;
+	    marks[entries].line   = marks[i].line;
+	    ++entries;
+	}
+	
+	for (i = 0; i < entries; i++) {
+	    if (i % LINE_ENTRIES_PER_ROW == 0)
+	        fprintf(OUT, i == 0 ? "lines" : "\nlines");
+	    fprintf(OUT, " %u:%+d", (unsigned)marks[i].offset - prevpc, (int)marks[i].line - (int)prevline);
+	    prevpc   = (unsigned)marks[i].offset;
+	    prevline = marks[i].line;
+	}
+	if (entries > 0)
+	    fprintf(OUT, "\n");
 }
 
 
@@ -2085,7 +2873,7 @@ gencode_block(M1_compiler *comp, m1_block *block) {
     
     /* iterate over block's statements and generate code for each. */
     while (iter != NULL) {
-        gencode_expr(comp, iter);
+        gencode_stat(comp, iter);
         iter = iter->next;
     }  
     
@@ -2155,45 +2943,308 @@ gencode_parameters(M1_compiler *comp, m1_chunk *chunk) {
 }
 
 
+/*
+
+Counting the uses of constants for pin_consts(): the int literals that
+gencode_operand() generates, except those that gencode_by_const() turns
+into shifts, and the 1 of ++, -- and print(). A use in a loop counts as
+LOOP_WEIGHT of them, as it is likely to run more often than once. The
+variables that are declared are counted too, as they keep their
+registers.
+
+*/
+#define LOOP_WEIGHT     4
+#define PIN_MIN_USES    3   /* fewer uses, and the load at the entry may cost more than it saves */
+#define PIN_RESERVE     16  /* registers left for temporaries, besides the variables */
+
+typedef struct m1_constuses {
+    m1_pinned *consts;      /* by constindex of the literal; the last one for an implicit 1 */
+    unsigned   num_consts;
+    unsigned   one;         /* where the 1 of ++, -- and print() is counted */
+    unsigned   loopdepth;
+    unsigned   num_vars;
+    
+} m1_constuses;
+
+static void count_expr(m1_constuses *u, m1_expression *e);
+
+static void
+count_list(m1_constuses *u, m1_expression *e) {
+    for (; e != NULL; e = e->next)
+        count_expr(u, e);
+}
+
+/* count a use of C<value>; C<sym> is its literal's symbol, or NULL for the implicit 1. */
+static void
+count_const(m1_constuses *u, int value, m1_symbol *sym) {
+    m1_pinned *c = &u->consts[sym != NULL ? (unsigned)sym->constindex : u->one];
+    
+    assert(c < u->consts + u->num_consts);
+    c->value = value;
+    if (sym != NULL)
+        c->sym = sym;
+    c->uses += u->loopdepth > 0 ? LOOP_WEIGHT : 1;
+}
+
+static void
+count_operand(m1_constuses *u, m1_expression *e) {
+    if (e->type == EXPR_INT)
+        count_const(u, e->expr.l->sym->value.ival, e->expr.l->sym);
+    else
+        count_expr(u, e);
+}
+
+static void
+count_object(m1_constuses *u, m1_object *obj) {
+    unsigned i;
+    
+    if (obj == NULL || obj->path == NULL)
+        return;
+    for (i = 0; i < obj->path->num_steps; i++) {
+        if (obj->path->steps[i].kind == ACCESS_INDEX)
+            count_expr(u, obj->path->steps[i].index);
+    }
+}
+
+static void
+count_binary(m1_constuses *u, m1_binexpr *b) {
+    switch (b->op) {
+        case OP_MUL:
+        case OP_DIV:
+        case OP_MOD: {
+            m1_expression *c = b->op == OP_MUL && b->right->type != EXPR_INT ? b->left : b->right;
+            
+            if (c->type == EXPR_INT && is_cheap_const(b->op, c->expr.l->sym->value.ival)) {
+                count_expr(u, c == b->left ? b->right : b->left);
+                return;
+            }
+        }
+        /* fall through */
+        case OP_PLUS:
+        case OP_MINUS:
+        case OP_XOR:
+        case OP_GT:
+        case OP_GE:
+        case OP_LT:
+        case OP_LE:
+        case OP_EQ:
+        case OP_NE:
+        case OP_BAND:
+        case OP_BOR:
+            count_operand(u, b->left);
+            count_operand(u, b->right);
+            break;
+        default:
+            count_expr(u, b->left);
+            count_expr(u, b->right);
+            break;
+    }
+}
+
+static void
+count_loop(m1_constuses *u, m1_expression *cond, m1_expression *block, m1_expression *step) {
+    ++u->loopdepth;
+    if (cond != NULL)
+        count_expr(u, cond);
+    if (block != NULL)
+        count_expr(u, block);
+    if (step != NULL)
+        count_expr(u, step);
+    --u->loopdepth;
+}
+
+static void
+count_expr(m1_constuses *u, m1_expression *e) {
+    m1_var  *v;
+    m1_case *c;
+    
+    switch (e->type) {
+        case EXPR_ADDRESS:
+        case EXPR_DEREF:
+        case EXPR_OBJECT:
+            count_object(u, e->expr.t);
+            break;
+        case EXPR_ASSIGN:
+            count_object(u, e->expr.a->lhs);
+            count_expr(u, e->expr.a->rhs);
+            break;
+        case EXPR_BINARY:
+            count_binary(u, e->expr.b);
+            break;
+        case EXPR_BLOCK:
+            count_list(u, e->expr.blck->stats);
+            break;
+        case EXPR_CAST:
+            count_expr(u, e->expr.cast->expr);
+            break;
+        case EXPR_DOWHILE:
+        case EXPR_WHILE:
+            count_loop(u, e->expr.w->cond, e->expr.w->block, NULL);
+            break;
+        case EXPR_FOR:
+            if (e->expr.o->init != NULL)
+                count_expr(u, e->expr.o->init);
+            count_loop(u, e->expr.o->cond, e->expr.o->block, e->expr.o->step);
+            break;
+        case EXPR_FUNCALL:
+            count_list(u, e->expr.f->arguments);
+            break;
+        case EXPR_IF:
+            count_expr(u, e->expr.i->cond);
+            count_expr(u, e->expr.i->ifblock);
+            if (e->expr.i->elseblock != NULL)
+                count_expr(u, e->expr.i->elseblock);
+            break;
+        case EXPR_NEW:
+            count_list(u, e->expr.n->args);
+            break;
+        case EXPR_PRINT:
+            count_expr(u, e->expr.e);
+            count_const(u, 1, NULL);
+            break;
+        case EXPR_RETURN:
+            if (e->expr.e != NULL)
+                count_expr(u, e->expr.e);
+            break;
+        case EXPR_SWITCH:
+            count_expr(u, e->expr.s->selector);
+            for (c = e->expr.s->cases; c != NULL; c = c->next)
+                count_expr(u, c->block);
+            if (e->expr.s->defaultstat != NULL)
+                count_expr(u, e->expr.s->defaultstat);
+            break;
+        case EXPR_UNARY:
+            count_expr(u, e->expr.u->expr);
+            if (e->expr.u->op != UNOP_NOT)
+                count_const(u, 1, NULL);
+            break;
+        case EXPR_VARDECL:
+            for (v = e->expr.v; v != NULL; v = v->next) {
+                ++u->num_vars;
+                if (v->init != NULL)
+                    count_expr(u, v->init);
+            }
+            break;
+        default: /* literals and the like */
+            break;
+    }
+}
+
+/* load the constants that chunk C<c> uses most into registers, at its entry. */
+static void
+pin_consts(M1_compiler *comp, m1_chunk *c) {
+    m1_constuses u;
+    m1_symbol   *one;
+    int          room;
+    unsigned     i;
+    
+    if (c->block == NULL || comp->optlevel >= 2)
+        return;
+    
+    memset(&u, 0, sizeof(m1_constuses));
+    one          = sym_find_int(&c->constants, 1);
+    u.num_consts = c->constants.num_syms + 1;
+    u.one        = one != NULL ? (unsigned)one->constindex : u.num_consts - 1;
+    u.consts     = (m1_pinned *)calloc(u.num_consts, sizeof(m1_pinned));
+    if (u.consts == NULL) {
+        fprintf(stderr, "Failed to allocate mem!\n");
+        exit(EXIT_FAILURE);
+    }
+    count_list(&u, c->block->stats);
+    
+    room = REG_NUM - PIN_RESERVE - (int)(u.num_vars + c->num_params);
+    
+    if (comp->pinned == NULL) {
+        comp->pinned = (m1_pinned *)calloc(MAX_PINNED, sizeof(m1_pinned));
+        if (comp->pinned == NULL) {
+            fprintf(stderr, "Failed to allocate mem!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    /* the most used first; of those used as often, the first in the constants segment. */
+    while (comp->num_pinned < MAX_PINNED) {
+        m1_pinned *best = NULL,
+                  *pin;
+        
+        for (i = 0; i < u.num_consts; i++) {
+            if (u.consts[i].uses >= PIN_MIN_USES && (best == NULL || u.consts[i].uses > best->uses))
+                best = &u.consts[i];
+        }
+        if (best == NULL)
+            break;
+        
+        if ((int)comp->num_pinned >= room) {
+            REMARK(comp, REMARK_MISSED, "regalloc", "NoPin", c->line,
+                   "constants in chunk %s are not kept in registers: its variables leave too few free",
+                   c->name);
+            break;
+        }
+        
+        pin        = &comp->pinned[comp->num_pinned++];
+        *pin       = *best;
+        pin->busy  = 0;
+        pin->reg   = use_reg(comp, VAL_INT);
+        best->uses = 0;
+        comp->registers[VAL_INT][pin->reg.no] = REG_CONST;
+        gencode_load_int(comp, pin->reg, pin->value, pin->sym != NULL ? pin->sym->constindex : NO_CONSTINDEX);
+        
+        REMARK(comp, REMARK_PASSED, "regalloc", "PinnedConstant", c->line,
+               "constant %d is kept in I%d in chunk %s (%u uses, those in loops weighted)",
+               pin->value, pin->reg.no, c->name, pin->uses);
+    }
+    
+    free(u.consts);
+}
+
 static void 
 gencode_chunk(M1_compiler *comp, m1_chunk *c) {
-#define PRELOAD_0_AND_1     0
-
+    FILE   *chunkout;
+    char   *code     = NULL;
+    size_t  codesize = 0;
+    
     fprintf(OUT, ".chunk \"%s\"\n", c->name);    
 
     /* for each chunk, reset the register allocator */
     reset_reg(comp);
         
-    gencode_consts(&c->constants);
-    gencode_metadata(c);
-    
-    fprintf(OUT, ".bytecode\n");  
-    
+    gencode_consts(comp, &c->constants);
+    
+    /* generate the bytecode into a buffer first, as the line table
+       in the metadata segment comes before it. */
+    chunkout  = OUT;
+    OUT       = open_memstream(&code, &codesize);
+    if (OUT == NULL) {
+        fprintf(stderr, "Failed to allocate mem!\n");
+        exit(EXIT_FAILURE);
+    }
+    comp->num_linemarks = 0;
+    comp->currentline   = 0;
+    comp->num_addrs     = 0; /* the registers were reset too. */
+    mark_line(comp, c->line);
         
-#if PRELOAD_0_AND_1    
-    m1_reg r0, r1;
-    
-    /* The numbers 0 and 1 are used quite a lot. Rather than
-       generating them as needed, pre-store them in registers
-       0 and 1. Small overhead for when it's not needed, but
-       saves quite a few instructions overall in more 
-       complex code. 
-     */
-     
-    r0 = gen_reg(comp, VAL_INT);
-    r1 = gen_reg(comp, VAL_INT); 
+    gencode_parameters(comp, c);
     
-    fprintf(OUT, "\tset_imm\tI%d, 0, 0\n", r0.no);
-    fprintf(OUT, "\tset_imm\tI%d, 0, 1\n", r1.no); 
-
-#endif
+    /* after the parameters, which come in the first registers. */
+    pin_consts(comp, c);
     
-    gencode_parameters(comp, c);
     /* generate code for statements */
     gencode_block(comp, c->block);
     
     /* helper function to generate instructions to return. */
     gencode_chunk_return(comp, c);
+    
+    fclose(OUT);
+    OUT = chunkout;
+    
+    if (comp->optlevel > 0)
+        optimize_chunk(comp, c, &code, &codesize);
+    
+    stats_chunk(comp, c, code, codesize);
+    gencode_metadata(comp, c, code, codesize);
+    fprintf(OUT, ".bytecode\n");  
+    fwrite(code, 1, codesize, OUT);
+    free(code);
 }
 
 /*
@@ -2217,7 +3268,7 @@ gencode_pmc_vtable(M1_compiler *comp, m1_pmc *pmc) {
     }
     
     fprintf(OUT, ".chunk \"__%s_init_vtable__\"\n", pmc->name);
-    gencode_consts(&comp->currentchunk->constants);
+    gencode_consts(comp, &comp->currentchunk->constants);
     fprintf(OUT, ".metadata\n");
     fprintf(OUT, ".bytecode\n");
     
@@ -2237,7 +3288,7 @@ gencode_pmc_vtable(M1_compiler *comp, m1_pmc *pmc) {
     while (methoditer != NULL) {
         /* generate code to copy the pointer to the chunk into the vtable. */
         /* XXX can we do with a memcopy? */
-        fprintf(OUT, "\tset_imm\tI%d, 0, %d\n", indexreg.no, i++);
+        gencode_set_int(comp, indexreg, i++);
         fprintf(OUT, "\tderef\tP%d, CONSTS, I%d\n", methodreg.no, indexreg.no);
         fprintf(OUT, "\tset_ref\tP%d, I%d, P%d\n", vtablereg.no, indexreg.no, methodreg.no);
         methoditer = methoditer->next;   
@@ -12,7 +12,16 @@ typedef struct m1_reg {
     
 } m1_reg;
 
+/* a change of source line in the code of a chunk; see gencode_metadata(). */
+typedef struct m1_linemark {
+    long     offset;    /* position in the chunk's bytecode output; PC once translated */
+    unsigned line;
+} m1_linemark;
+
 extern void gencode(M1_compiler *comp, m1_chunk *ast);
 
+/* note that the code written to comp->outfile from here on is for source line line. */
+extern void gencode_mark_line(M1_compiler *comp, unsigned line);
+
 #endif
 
@@ -0,0 +1,496 @@
+/*
+
+Global value numbering, in SSA form.
+
+In SSA form, two instructions that do the same to the same values compute
+the same value. The blocks are walked in preorder of the dominator tree,
+with a table of the pure instructions (see insn_is_pure()) of the blocks
+that dominate the current one: set_imm, a deref of the constants segment
+and arithmetic. An instruction that is in the table already is removed,
+and its value replaced by that of the one in the table, which dominates
+it. The operands of add_i and the other commutative instructions are put
+in order first, so that a + b and b + a are found as one; a copy, set d, x,
+is removed as well, with x read for d.
+
+Loads from memory, deref, get_word and get_byte, are merged only within
+an extended basic block, a block and those that it leads to and that have
+no other way in, so that no store on another path can come in between.
+A store, set_ref, set_word or set_byte, forgets the loads that may read
+what it writes: all but those from another object that was allocated in
+the chunk, and those from the same object at another constant index.
+Anything else with an effect on memory, such as a call or gc_alloc,
+forgets them all. A deref of what set_ref has just stored is the value
+stored.
+
+A value that replaces others is live for longer. As in licm.c, values are
+only merged while the code of the chunk leaves registers free for them.
+Values that are arguments of phi functions are left as they are: out of
+SSA form, each can take the register of its phi function, and a value that
+replaced them, live elsewhere too, could not, and would need a copy.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "compiler.h"
+#include "cfg.h"
+#include "loop.h"
+#include "pass.h"
+#include "remark.h"
+
+#define GVN_BUCKETS     1024
+#define GVN_MAX_LOADS   32
+
+/* an instruction in the table, in a chain of its bucket. */
+typedef struct m1_gvnentry {
+    m1_insn    *insn;
+    unsigned    hash;
+    int         next;
+
+} m1_gvnentry;
+
+/* a load that may be merged: op dtype, base[index], with the value it gave. */
+typedef struct m1_load {
+    m0_instr_code  op;
+    unsigned       dtype,
+                   base,
+                   index,
+                   value;
+
+} m1_load;
+
+typedef struct m1_gvn {
+    m1_cfg        *cfg;
+    unsigned      *replace;         /* per value; the value that replaces it, or itself */
+    char          *kept;            /* per value; whether it replaces others */
+    char          *phiarg;          /* per value; whether a phi function reads it */
+    int            buckets[GVN_BUCKETS];
+    m1_gvnentry   *entries;         /* the table, as a stack in the order of the walk */
+    unsigned       num_entries,
+                   entry_size;
+    m1_load      **loads;           /* per block id; the loads available at its end */
+    unsigned      *num_loads;
+    unsigned       pressure[REG_TYPE_NUM],
+                   num_kept[REG_TYPE_NUM];
+    unsigned       removed;
+    int            full;
+
+} m1_gvn;
+
+static unsigned
+find_value(m1_gvn *g, unsigned v) {
+    while (g->replace[v] != v)
+        v = g->replace[v];
+    return v;
+}
+
+static int
+is_commutative(m0_instr_code op) {
+    switch (op) {
+        case M0_ADD_I:
+        case M0_ADD_N:
+        case M0_MULT_I:
+        case M0_MULT_N:
+        case M0_AND:
+        case M0_OR:
+        case M0_XOR:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static unsigned
+hash_insn(m1_insn *insn) {
+    unsigned h = (unsigned)insn->op * 31 + insn->args[0].type,
+             k;
+
+    for (k = 1; k < insn->num_args; k++)
+        h = h * 31 + insn->args[k].kind * 7 + insn->args[k].no;
+    return h;
+}
+
+/* whether insn does the same as other; their operands are replaced already. */
+static int
+same_insn(m1_insn *insn, m1_insn *other) {
+    unsigned k;
+
+    if (insn->op != other->op || insn->num_args != other->num_args
+    ||  insn->args[0].type != other->args[0].type)
+        return 0;
+
+    for (k = 1; k < insn->num_args; k++) {
+        m1_opnd *a = &insn->args[k],
+                *b = &other->args[k];
+
+        if (a->kind != b->kind || a->type != b->type || a->no != b->no)
+            return 0;
+    }
+    return 1;
+}
+
+/* whether d may be replaced by value v, which then lives for longer. */
+static int
+may_keep(m1_gvn *g, unsigned v) {
+    unsigned type = g->cfg->values[v].type;
+
+    if (g->kept[v])
+        return 1;
+    if (g->pressure[type] + g->num_kept[type] + LOOP_RESERVE >= REG_NUM) {
+        g->full = 1;
+        return 0;
+    }
+    g->kept[v] = 1;
+    ++g->num_kept[type];
+    return 1;
+}
+
+/* remove insn, whose value is replaced by v. */
+static void
+replace_insn(m1_gvn *g, m1_insn *insn, unsigned v) {
+    unsigned d = insn->args[0].no;
+
+    g->replace[d]         = v;
+    g->cfg->values[d].def = NULL;
+    insn_remove(insn);
+    ++g->removed;
+}
+
+/*
+
+Memory.
+
+*/
+
+static unsigned
+access_size(m0_instr_code op) {
+    switch (op) {
+        case M0_GET_BYTE:
+        case M0_SET_BYTE:
+            return 1;
+        case M0_GET_WORD:
+        case M0_SET_WORD:
+            return 4;
+        default:
+            return 8;
+    }
+}
+
+/* whether value v is the address of an object allocated in the chunk. */
+static int
+is_allocation(m1_gvn *g, unsigned v) {
+    m1_insn *def = g->cfg->values[v].def;
+
+    return def != NULL && (def->op == M0_GC_ALLOC || def->op == M0_SYS_ALLOC);
+}
+
+/* the index that value v holds, if it is a constant; -1 otherwise. */
+static long
+const_index(m1_gvn *g, unsigned v) {
+    m1_insn *def = g->cfg->values[v].def;
+
+    return def != NULL && def->op == M0_SET_IMM ? (long)imm_value(def) : -1;
+}
+
+/* whether a store of size bytes to base[index] may change what load l read. */
+static int
+may_alias(m1_gvn *g, m1_load *l, unsigned base, unsigned index, unsigned size) {
+    long     a, b;
+    unsigned lsize = access_size(l->op);
+
+    if (l->base != base)
+        return !(is_allocation(g, l->base) && is_allocation(g, base));
+
+    a = const_index(g, l->index);
+    b = const_index(g, index);
+    if (a < 0 || b < 0)
+        return 1;
+    return a * (long)lsize < b * (long)size + (long)size && b * (long)size < a * (long)lsize + (long)lsize;
+}
+
+/* whether insn may write memory that isn't one of the stores below. */
+static int
+clobbers_memory(m1_insn *insn) {
+    if (insn->flags & INSN_PINNED)
+        return 1;
+
+    switch (insn->op) {
+        case M0_GOTO:
+        case M0_GOTO_IF:
+        case M0_EXIT:
+        case M0_PRINT_S:
+        case M0_PRINT_I:
+        case M0_PRINT_N:
+        case M0_DIV_I:          /* may trap, but write nothing */
+        case M0_MOD_I:
+            return 0;
+        default:
+            return insn_has_effects(insn);
+    }
+}
+
+static void
+add_load(m1_load *loads, unsigned *n, m0_instr_code op, unsigned dtype, unsigned base, unsigned index, unsigned value) {
+    m1_load *l;
+
+    if (*n == GVN_MAX_LOADS)
+        return;
+    l = &loads[(*n)++];
+    l->op    = op;
+    l->dtype = dtype;
+    l->base  = base;
+    l->index = index;
+    l->value = value;
+}
+
+/* merge or record the load insn; returns whether it was removed. */
+static int
+visit_load(m1_gvn *g, m1_insn *insn, m1_load *loads, unsigned *n) {
+    unsigned dtype = insn->args[0].type,
+             base  = insn->args[1].no,
+             index = insn->args[2].no,
+             i;
+
+    for (i = 0; i < *n; i++) {
+        m1_load *l = &loads[i];
+
+        if (l->op == insn->op && l->dtype == dtype && l->base == base && l->index == index) {
+            if (!may_keep(g, l->value))
+                return 0;
+            replace_insn(g, insn, l->value);
+            return 1;
+        }
+    }
+    add_load(loads, n, insn->op, dtype, base, index, insn->args[0].no);
+    return 0;
+}
+
+/* forget the loads that the store insn may change. */
+static void
+visit_store(m1_gvn *g, m1_insn *insn, m1_load *loads, unsigned *n) {
+    unsigned base  = insn->args[0].no,
+             index = insn->args[1].no,
+             size  = access_size(insn->op),
+             i     = 0;
+
+    while (i < *n) {
+        if (may_alias(g, &loads[i], base, index, size))
+            loads[i] = loads[--*n];
+        else
+            ++i;
+    }
+
+    /* what set_ref stores, deref reads back, bit for bit. */
+    if (insn->op == M0_SET_REF)
+        add_load(loads, n, M0_DEREF, insn->args[2].type, base, index, insn->args[2].no);
+}
+
+static int
+is_load(m1_insn *insn) {
+    return (insn->op == M0_DEREF || insn->op == M0_GET_WORD || insn->op == M0_GET_BYTE)
+        && !(insn->flags & INSN_PINNED)
+        && insn->args[0].kind == OPND_REG && insn->args[1].kind == OPND_REG && insn->args[2].kind == OPND_REG;
+}
+
+static int
+is_store(m1_insn *insn) {
+    return (insn->op == M0_SET_REF || insn->op == M0_SET_WORD || insn->op == M0_SET_BYTE)
+        && !(insn->flags & INSN_PINNED)
+        && insn->args[0].kind == OPND_REG && insn->args[1].kind == OPND_REG && insn->args[2].kind == OPND_REG;
+}
+
+/*
+
+The walk.
+
+*/
+
+/* look insn up in the table; add it if it isn't there. Returns whether it was removed. */
+static int
+visit_pure(m1_gvn *g, m1_insn *insn) {
+    unsigned h = hash_insn(insn);
+    int      e;
+
+    for (e = g->buckets[h % GVN_BUCKETS]; e >= 0; e = g->entries[e].next) {
+        m1_insn *other = g->entries[e].insn;
+
+        if (g->entries[e].hash == h && same_insn(insn, other)) {
+            if (!may_keep(g, other->args[0].no))
+                return 0;
+            replace_insn(g, insn, other->args[0].no);
+            return 1;
+        }
+    }
+
+    g->entries = (m1_gvnentry *)cfg_grow(g->entries, &g->entry_size, g->num_entries + 1, sizeof(m1_gvnentry));
+    g->entries[g->num_entries].insn = insn;
+    g->entries[g->num_entries].hash = h;
+    g->entries[g->num_entries].next = g->buckets[h % GVN_BUCKETS];
+    g->buckets[h % GVN_BUCKETS]     = (int)g->num_entries++;
+    return 0;
+}
+
+/* take the entries added since mark out of the table again. */
+static void
+pop_entries(m1_gvn *g, unsigned mark) {
+    while (g->num_entries > mark) {
+        m1_gvnentry *e = &g->entries[--g->num_entries];
+        g->buckets[e->hash % GVN_BUCKETS] = e->next;
+    }
+}
+
+static void
+visit_block(m1_gvn *g, m1_bblock *b) {
+    m1_load   loads[GVN_MAX_LOADS];
+    unsigned  n = 0,
+              k;
+    m1_insn  *insn, *next;
+
+    /* the loads of the block before, if that is the only way in. */
+    if (b->num_preds == 1 && b->preds[0] == b->idom && g->loads[b->idom->id] != NULL) {
+        n = g->num_loads[b->idom->id];
+        memcpy(loads, g->loads[b->idom->id], n * sizeof(m1_load));
+    }
+
+    for (insn = b->first; insn != NULL; insn = next) {
+        m1_opnd *o;
+
+        next = insn->next;
+        if (insn->op == M1_PHI)
+            continue;
+
+        for (k = 0; (o = insn_use(insn, k)) != NULL; k++)
+            o->no = find_value(g, o->no);
+
+        if (is_load(insn)) {
+            if (!g->phiarg[insn->args[0].no])
+                (void)visit_load(g, insn, loads, &n);
+            continue;
+        }
+        if (is_store(insn)) {
+            visit_store(g, insn, loads, &n);
+            continue;
+        }
+        if (clobbers_memory(insn)) {
+            n = 0;
+            continue;
+        }
+        if (!insn_is_pure(insn) || g->phiarg[insn->args[0].no])
+            continue;
+
+        if (insn->op == M0_SET && insn->args[1].kind == OPND_REG && insn->args[1].type == insn->args[0].type) {
+            replace_insn(g, insn, insn->args[1].no);
+            continue;
+        }
+
+        if (is_commutative(insn->op) && insn->args[1].kind == OPND_REG && insn->args[2].kind == OPND_REG
+        &&  insn->args[1].no > insn->args[2].no) {
+            m1_opnd o1    = insn->args[1];
+            insn->args[1] = insn->args[2];
+            insn->args[2] = o1;
+        }
+        (void)visit_pure(g, insn);
+    }
+
+    for (k = 0; k < b->num_succs; k++) {
+        if (b->succs[k]->num_preds == 1) {
+            g->loads[b->id] = (m1_load *)cfg_alloc(GVN_MAX_LOADS * sizeof(m1_load));
+            memcpy(g->loads[b->id], loads, n * sizeof(m1_load));
+            g->num_loads[b->id] = n;
+            break;
+        }
+    }
+}
+
+int
+pass_gvn(m1_cfg *cfg) {
+    m1_gvn       g;
+    m1_bblock  **stack;
+    unsigned    *mark;
+    unsigned     sp = 0,
+                 i, k, v;
+
+    assert(cfg->in_ssa);
+    cfg_dominators(cfg);
+
+    memset(&g, 0, sizeof(g));
+    g.cfg       = cfg;
+    g.replace   = (unsigned *)cfg_alloc((cfg->num_values + 1) * sizeof(unsigned));
+    g.kept      = (char *)cfg_alloc(cfg->num_values + 1);
+    g.phiarg    = (char *)cfg_alloc(cfg->num_values + 1);
+    g.loads     = (m1_load **)cfg_alloc(cfg->num_blocks * sizeof(m1_load *));
+    g.num_loads = (unsigned *)cfg_alloc(cfg->num_blocks * sizeof(unsigned));
+    for (v = 0; v < cfg->num_values; v++)
+        g.replace[v] = v;
+    for (i = 0; i < GVN_BUCKETS; i++)
+        g.buckets[i] = -1;
+    loops_pressure(cfg, g.pressure);
+
+    for (i = 0; i < cfg->num_rpo; i++) {
+        m1_insn *insn;
+        m1_opnd *o;
+
+        for (insn = cfg->rpo[i]->first; insn != NULL && insn->op == M1_PHI; insn = insn->next) {
+            for (k = 0; (o = insn_use(insn, k)) != NULL; k++)
+                g.phiarg[o->no] = 1;
+        }
+    }
+
+    /* as in ssa_construct(), a block is on the stack twice: to be visited,
+       and to take its instructions out of the table when its children are done. */
+    stack = (m1_bblock **)cfg_alloc(2 * cfg->num_blocks * sizeof(m1_bblock *));
+    mark  = (unsigned *)cfg_alloc(cfg->num_blocks * sizeof(unsigned));
+
+    stack[sp++] = cfg->entry;
+    while (sp > 0) {
+        m1_bblock *b = stack[--sp];
+
+        if (b == NULL) {
+            m1_bblock *done = stack[--sp];
+            pop_entries(&g, mark[done->id]);
+            continue;
+        }
+
+        mark[b->id] = g.num_entries;
+        visit_block(&g, b);
+
+        stack[sp++] = b;
+        stack[sp++] = NULL;
+        for (b = b->domchild; b != NULL; b = b->domsibling)
+            stack[sp++] = b;
+    }
+
+    /* phi functions read values from blocks that may come later in the walk. */
+    if (g.removed > 0) {
+        for (i = 0; i < cfg->num_rpo; i++) {
+            m1_insn *insn;
+            m1_opnd *o;
+
+            for (insn = cfg->rpo[i]->first; insn != NULL && insn->op == M1_PHI; insn = insn->next) {
+                for (k = 0; (o = insn_use(insn, k)) != NULL; k++)
+                    o->no = find_value(&g, o->no);
+            }
+        }
+        REMARK(cfg->comp, REMARK_PASSED, "gvn", "Redundant", cfg->chunk->line,
+               "removed %u redundant instruction%s from chunk %s",
+               g.removed, g.removed == 1 ? "" : "s", cfg->chunk->name);
+    }
+    if (g.full)
+        REMARK(cfg->comp, REMARK_MISSED, "gvn", "RegisterPressure", cfg->chunk->line,
+               "redundant instructions left in chunk %s: no registers free to keep their values",
+               cfg->chunk->name);
+
+    for (i = 0; i < cfg->num_blocks; i++)
+        free(g.loads[i]);
+    free(g.loads);
+    free(g.num_loads);
+    free(g.replace);
+    free(g.kept);
+    free(g.phiarg);
+    free(g.entries);
+    free(stack);
+    free(mark);
+
+    return g.removed > 0;
+}
@@ -47,8 +47,12 @@ char const * const m0_instr_names[] = {
     "print_s",
     "print_i",
     "print_n",
-    "exit"
-    
+    "exit",
+    "isgt_i",
+    "isge_i",
+    "isgt_n",
+    "isge_n",
+    "phi"
 };
 
 #define OUT stdout
@@ -43,7 +43,17 @@ typedef enum m0_instr_code {
     M0_PRINT_S,
     M0_PRINT_I,
     M0_PRINT_N,
-    M0_EXIT
+    M0_EXIT,
+    /* comparison ops generated by the M1 compiler; not in PDD32. */
+    M0_ISGT_I,
+    M0_ISGE_I,
+    M0_ISGT_N,
+    M0_ISGE_N,
+    
+    /* not an M0 op: a phi function, in the SSA form of the optimizer (see cfg.h). */
+    M1_PHI,
+    
+    NUM_INSTR_CODES /* not an op; keep this last. */
 
 } m0_instr_code;
 
@@ -0,0 +1,208 @@
+/*
+
+Loop-invariant code motion, in SSA form.
+
+Pure instructions (see insn_is_pure()), such as set_imm, a deref of the
+constants segment and arithmetic, whose operands are all defined outside
+a natural loop (see loop.h), are moved to its preheader: the one block
+outside the loop that leads to the header, made on the edge into the
+header if needed. Inner loops are done first, so that code can move out
+of several loops.
+
+A value that is moved out of a loop is live in all of it. So that the
+values still fit in the registers, no more are moved out than the code
+of the chunk leaves registers free. Instructions that compute the same
+value in a preheader are merged.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "compiler.h"
+#include "cfg.h"
+#include "loop.h"
+#include "pass.h"
+#include "remark.h"
+
+typedef struct m1_licm {
+    m1_cfg      *cfg;
+    m1_loops     loops;
+    unsigned    *replace;       /* per value; the value it was merged into, or itself */
+    char        *moved;         /* per value; whether it was moved out of a loop */
+    unsigned     pressure[REG_TYPE_NUM];    /* registers in use, as written by the code generator */
+    unsigned     hoisted;
+
+} m1_licm;
+
+static unsigned
+find_value(m1_licm *l, unsigned v) {
+    while (l->replace[v] != v)
+        v = l->replace[v];
+    return v;
+}
+
+/* whether insn does the same as other, with merged values taken as one. */
+static int
+same_insn(m1_licm *l, m1_insn *insn, m1_insn *other) {
+    unsigned k;
+
+    if (insn->op != other->op || insn->num_args != other->num_args)
+        return 0;
+
+    for (k = 1; k < insn->num_args; k++) {
+        m1_opnd *a = &insn->args[k],
+                *b = &other->args[k];
+
+        if (a->kind != b->kind || a->type != b->type)
+            return 0;
+        if (a->kind == OPND_REG ? find_value(l, a->no) != find_value(l, b->no) : a->no != b->no)
+            return 0;
+    }
+    return insn->args[0].type == other->args[0].type;
+}
+
+/* whether the operands of insn are all defined outside the current loop. */
+static int
+is_invariant(m1_licm *l, m1_insn *insn) {
+    m1_opnd  *o;
+    unsigned  k;
+
+    for (k = 0; (o = insn_use(insn, k)) != NULL; k++) {
+        m1_insn *def = l->cfg->values[find_value(l, o->no)].def;
+
+        if (def != NULL && IN_LOOP(&l->loops, def->block))
+            return 0;
+    }
+    return 1;
+}
+
+static void
+hoist_loop(m1_licm *l, m1_loop *loop) {
+    m1_cfg    *cfg  = l->cfg;
+    m1_loops  *lp   = &l->loops;
+    m1_bblock *pre;
+    m1_insn   *insn, *next;
+    unsigned   line = loop->header->first != NULL ? loop->header->first->line : cfg->chunk->line;
+    unsigned   inside[REG_TYPE_NUM] = { 0 };
+    unsigned   hoisted = 0,
+               i;
+    int        changed = 1,
+               full    = 0;
+
+    loop_body(lp, loop);
+
+    pre = loop_preheader(lp, loop);
+    if (pre == NULL) {
+        REMARK(cfg->comp, REMARK_MISSED, "licm", "NoPreheader", line,
+               "loop not optimized: it has more than one entry");
+        return;
+    }
+
+    /* values moved out of inner loops are live in this one as well. */
+    for (i = 0; i < lp->num_body; i++) {
+        for (insn = lp->body[i]->first; insn != NULL; insn = insn->next) {
+            m1_opnd *d = insn_def(insn);
+            if (d != NULL && l->moved[d->no])
+                ++inside[d->type];
+        }
+    }
+
+    while (changed) {
+        changed = 0;
+
+        for (i = 0; i < lp->num_body; i++) {
+            for (insn = lp->body[i]->first; insn != NULL; insn = next) {
+                m1_opnd *d = insn_def(insn);
+                m1_insn *same;
+
+                next = insn->next;
+                if (!insn_is_pure(insn) || !is_invariant(l, insn))
+                    continue;
+
+                /* merge with an instruction in the preheader that does the same. */
+                for (same = pre->first; same != NULL; same = same->next) {
+                    if (insn_is_pure(same) && same_insn(l, insn, same))
+                        break;
+                }
+                if (same != NULL) {
+                    l->replace[d->no]      = find_value(l, same->args[0].no);
+                    cfg->values[d->no].def = NULL;
+                    insn_remove(insn);
+                    ++hoisted;
+                    changed = 1;
+                    continue;
+                }
+
+                if (l->pressure[d->type] + inside[d->type] + LOOP_RESERVE >= REG_NUM) {
+                    full = 1;
+                    continue;
+                }
+
+                insn_unlink(insn);
+                insn_append(pre, insn);
+                l->moved[d->no] = 1;
+                ++inside[d->type];
+                ++hoisted;
+                changed = 1;
+            }
+        }
+    }
+
+    if (hoisted > 0)
+        REMARK(cfg->comp, REMARK_PASSED, "licm", "Hoisted", line,
+               "hoisted %u loop-invariant instructions out of loop", hoisted);
+    if (full)
+        REMARK(cfg->comp, REMARK_MISSED, "licm", "RegisterPressure", line,
+               "loop-invariant instructions left in loop: no registers free to hold them");
+    l->hoisted += hoisted;
+}
+
+int
+pass_licm(m1_cfg *cfg) {
+    m1_licm   l;
+    unsigned  i, k, v;
+
+    assert(cfg->in_ssa);
+    cfg_dominators(cfg);
+
+    memset(&l, 0, sizeof(l));
+    if (loops_find(cfg, &l.loops) == 0) {
+        loops_free(&l.loops);
+        return 0;
+    }
+
+    l.cfg     = cfg;
+    l.replace = (unsigned *)cfg_alloc(cfg->num_values * sizeof(unsigned));
+    l.moved   = (char *)cfg_alloc(cfg->num_values);
+
+    for (v = 0; v < cfg->num_values; v++)
+        l.replace[v] = v;
+
+    loops_pressure(cfg, l.pressure);
+
+    for (i = 0; i < l.loops.num_loops; i++)
+        hoist_loop(&l, &l.loops.loops[i]);
+
+    /* reads of merged values read the value they were merged into. */
+    if (l.hoisted > 0) {
+        for (i = 0; i < cfg->num_blocks; i++) {
+            m1_insn *insn;
+            m1_opnd *o;
+
+            if (cfg->blocks[i] == NULL)
+                continue;
+            for (insn = cfg->blocks[i]->first; insn != NULL; insn = insn->next) {
+                for (k = 0; (o = insn_use(insn, k)) != NULL; k++)
+                    o->no = find_value(&l, o->no);
+            }
+        }
+    }
+
+    loops_free(&l.loops);
+    free(l.replace);
+    free(l.moved);
+
+    cfg_dominators(cfg);
+    return l.hoisted > 0;
+}
@@ -0,0 +1,155 @@
+/*
+
+Natural loops; see loop.h.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "compiler.h"
+#include "cfg.h"
+#include "loop.h"
+
+static int
+compare_loops(void const *a, void const *b) {
+    m1_loop const *x = (m1_loop const *)a,
+                  *y = (m1_loop const *)b;
+
+    if (x->size != y->size)
+        return x->size < y->size ? -1 : 1;
+    return x->header->rpo < y->header->rpo ? -1 : x->header->rpo > y->header->rpo;
+}
+
+unsigned
+loops_find(m1_cfg *cfg, m1_loops *l) {
+    unsigned  size = 0,
+              n    = 0,
+              i, k;
+    int      *loopof = (int *)cfg_alloc(cfg->num_blocks * sizeof(int));
+
+    assert(cfg->has_doms);
+    memset(l, 0, sizeof(m1_loops));
+    l->cfg = cfg;
+
+    for (i = 0; i < cfg->num_blocks; i++)
+        loopof[i] = -1;
+
+    for (i = 0; i < cfg->num_rpo; i++) {
+        m1_bblock *b = cfg->rpo[i];
+
+        for (k = 0; k < b->num_succs; k++) {
+            m1_bblock *h = b->succs[k];
+            m1_loop   *loop;
+
+            if (!cfg_dominates(h, b) || (k == 1 && h == b->succs[0]))
+                continue;
+
+            if (loopof[h->id] < 0) {
+                l->loops = (m1_loop *)cfg_grow(l->loops, &size, n + 1, sizeof(m1_loop));
+                memset(&l->loops[n], 0, sizeof(m1_loop));
+                l->loops[n].header = h;
+                loopof[h->id]      = (int)n++;
+            }
+            loop = &l->loops[loopof[h->id]];
+            loop->tails = (m1_bblock **)cfg_grow(loop->tails, &loop->tail_size, loop->num_tails + 1, sizeof(m1_bblock *));
+            loop->tails[loop->num_tails++] = b;
+        }
+    }
+    free(loopof);
+    l->num_loops = n;
+
+    /* a preheader may be made for each loop. */
+    l->mark = (unsigned *)cfg_alloc((cfg->num_blocks + n + 1) * sizeof(unsigned));
+
+    for (i = 0; i < n; i++) {
+        loop_body(l, &l->loops[i]);
+        l->loops[i].size = l->num_body;
+    }
+    qsort(l->loops, n, sizeof(m1_loop), compare_loops);
+    return n;
+}
+
+void
+loops_free(m1_loops *l) {
+    unsigned i;
+
+    for (i = 0; i < l->num_loops; i++)
+        free(l->loops[i].tails);
+    free(l->loops);
+    free(l->mark);
+    free(l->body);
+}
+
+void
+loop_body(m1_loops *l, m1_loop *loop) {
+    unsigned stamp = ++l->stamp;
+    unsigned i, k;
+
+    l->num_body = 0;
+    l->mark[loop->header->id] = stamp;
+    l->body = (m1_bblock **)cfg_grow(l->body, &l->body_size, 1, sizeof(m1_bblock *));
+    l->body[l->num_body++] = loop->header;
+
+    for (i = 0; i < loop->num_tails; i++) {
+        m1_bblock *t = loop->tails[i];
+        if (l->mark[t->id] == stamp)
+            continue;
+        l->mark[t->id] = stamp;
+        l->body = (m1_bblock **)cfg_grow(l->body, &l->body_size, l->num_body + 1, sizeof(m1_bblock *));
+        l->body[l->num_body++] = t;
+    }
+
+    /* the body doubles as the work list, from the blocks after the header. */
+    for (i = 1; i < l->num_body; i++) {
+        m1_bblock *b = l->body[i];
+
+        for (k = 0; k < b->num_preds; k++) {
+            m1_bblock *p = b->preds[k];
+            if (l->mark[p->id] == stamp)
+                continue;
+            l->mark[p->id] = stamp;
+            l->body = (m1_bblock **)cfg_grow(l->body, &l->body_size, l->num_body + 1, sizeof(m1_bblock *));
+            l->body[l->num_body++] = p;
+        }
+    }
+}
+
+m1_bblock *
+loop_preheader(m1_loops *l, m1_loop *loop) {
+    m1_bblock *header = loop->header,
+              *p      = NULL;
+    unsigned   k;
+
+    for (k = 0; k < header->num_preds; k++) {
+        if (IN_LOOP(l, header->preds[k]))
+            continue;
+        if (p != NULL)
+            return NULL;
+        p = header->preds[k];
+    }
+    if (p == NULL)
+        return NULL;
+
+    if (p->num_succs == 1)
+        return p;
+    if (p->succs[0] == p->succs[1])
+        return NULL;
+    return cfg_split_edge(l->cfg, p, p->succs[0] == header ? 0 : 1);
+}
+
+void
+loops_pressure(m1_cfg *cfg, unsigned pressure[REG_TYPE_NUM]) {
+    char     used[REG_TYPE_NUM][REG_NUM];
+    unsigned v;
+
+    memset(used, 0, sizeof(used));
+    memset(pressure, 0, REG_TYPE_NUM * sizeof(unsigned));
+    for (v = 0; v < cfg->num_values; v++) {
+        m1_ssavalue *val = &cfg->values[v];
+        if (!used[val->type][val->reg]) {
+            used[val->type][val->reg] = 1;
+            ++pressure[val->type];
+        }
+    }
+}
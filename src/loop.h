@@ -0,0 +1,65 @@
+#ifndef __M1_LOOP_H__
+#define __M1_LOOP_H__
+
+#include "cfg.h"
+
+/*
+
+Natural loops of the graph of a chunk, for the loop passes (see licm.c
+and strength.c).
+
+A natural loop is made of the blocks that reach the source of a back
+edge, an edge to a block that dominates it (the header), without going
+through the header; back edges to the same header make one loop.
+loops_find() lists them inner loops first: they are smaller than the
+loops around them. A pass then walks them one at a time, with
+loop_body(), which makes a loop the current one.
+
+*/
+
+/* registers of each type that the loop passes leave free for the values
+   of a loop, for the copies of phi functions. */
+#define LOOP_RESERVE    2
+
+typedef struct m1_loop {
+    m1_bblock   *header;
+    m1_bblock  **tails;         /* sources of the back edges */
+    unsigned     num_tails,
+                 tail_size;
+    unsigned     size;          /* number of blocks */
+
+} m1_loop;
+
+typedef struct m1_loops {
+    m1_cfg      *cfg;
+    m1_loop     *loops;         /* inner loops first */
+    unsigned     num_loops;
+    unsigned    *mark;          /* per block id; in the current loop if its stamp */
+    unsigned     stamp;
+    m1_bblock  **body;          /* blocks of the current loop, header first */
+    unsigned     num_body,
+                 body_size;
+
+} m1_loops;
+
+/* find the loops of cfg, whose dominator tree must be up to date; returns their number. */
+extern unsigned loops_find(m1_cfg *cfg, m1_loops *l);
+
+extern void loops_free(m1_loops *l);
+
+/* make loop the current one: collect its blocks in l->body, and mark them. */
+extern void loop_body(m1_loops *l, m1_loop *loop);
+
+/* whether block b is in the current loop. */
+#define IN_LOOP(l, b)   ((l)->mark[(b)->id] == (l)->stamp)
+
+/* the number of registers of each type that the code generator used in the
+   code of cfg, in SSA form; values that share one aren't live at the same time. */
+extern void loops_pressure(m1_cfg *cfg, unsigned pressure[REG_TYPE_NUM]);
+
+/* the one block outside the current loop that leads to its header, put on
+   the edge into the header if needed; NULL if the header has several entries. */
+extern m1_bblock *loop_preheader(m1_loops *l, m1_loop *loop);
+
+#endif
+
@@ -0,0 +1,547 @@
+/*
+
+Generational garbage collector for the M0 runtime.
+
+Memory returned by gc_alloc() lives in one of two generations:
+
+ * the nursery, a single contiguous block in which new objects are
+   bump-allocated, each preceded by an 8-byte header. A bitmap records
+   where objects start, so that any 64-bit value can be checked for being
+   a pointer to a young object;
+
+ * the old generation, in which each object is malloc'ed separately and
+   linked into a list. The addresses of old objects are kept in a hash set,
+   again so that values can be identified as pointers.
+
+M0 has no type information for memory, so every 8-byte slot of an object
+is scanned, and a value is taken to be a pointer only if it is exactly the
+address of a live object. (The N registers in call frames are skipped.)
+
+When the nursery is full, a minor collection copies all reachable young
+objects into the old generation and leaves a forwarding pointer behind;
+after that the nursery is empty again. The roots for a minor collection are
+the current call frame and the remembered set: old objects that may have
+been written to since the last collection. The interpreter reports writes
+through gc_write_barrier(), and call frame switches through gc_frame_switch(),
+as an old frame may have been updated through its registers while it was
+running.
+
+Once the old generation has grown past a threshold, a major collection
+marks everything reachable from the current call frame (the parent frames
+are reachable through PCF), and frees the rest. The threshold is then set
+to twice the size of the live data.
+
+Set the environment variable M0_GC_STATS to print statistics to stderr
+at exit.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "m0_gc.h"
+
+#define GC_NURSERY_SIZE     (256 * 1024)
+#define GC_LARGE_OBJECT     (GC_NURSERY_SIZE / 8)   /* allocated directly in the old gen */
+#define GC_MAJOR_THRESHOLD  (1024 * 1024)
+#define GC_OLDSET_SIZE      1024                    /* initial size, must be a power of 2 */
+
+/* header flags */
+#define GC_FORWARDED    0x1     /* young object was copied; first word is the new address */
+#define GC_MARKED       0x2     /* reached during a major collection */
+#define GC_REMEMBERED   0x4     /* old object is in the remembered set */
+#define GC_FRAME        0x8     /* object was used as a call frame */
+
+#define GC_OLDSET_EMPTY     0
+#define GC_OLDSET_DELETED   1
+
+typedef struct gc_header {
+    uint32_t size;      /* payload size in bytes, a multiple of 8 */
+    uint32_t flags;
+} gc_header;
+
+/* an old object; the header is directly in front of the payload, as in the nursery. */
+typedef struct gc_oldobj {
+    struct gc_oldobj *next;
+    gc_header         hdr;
+} gc_oldobj;
+
+#define GC_HEADER(obj)  ((gc_header *)((char *)(obj) - sizeof(gc_header)))
+#define GC_PAYLOAD(o)   ((uint64_t)((gc_oldobj *)(o) + 1))
+
+typedef struct gc_vector {
+    uint64_t *items;
+    unsigned  count;
+    unsigned  size;
+} gc_vector;
+
+struct M0_Heap {
+    char          *nursery;
+    char          *top;             /* bump pointer */
+    char          *limit;
+    unsigned char *starts;          /* one bit per 8 bytes of nursery */
+
+    gc_oldobj     *oldobjs;
+    uint64_t      *oldset;          /* open addressing; addresses of old objects */
+    unsigned       oldset_size;
+    unsigned       oldset_count;
+    unsigned       oldset_used;     /* including deleted entries */
+    uint64_t       old_bytes;
+    uint64_t       major_threshold;
+
+    gc_vector      remembered;
+    gc_vector      worklist;
+
+    int            print_stats;
+    unsigned long  minor_count;
+    unsigned long  major_count;
+    uint64_t       bytes_allocated;
+    uint64_t       bytes_promoted;
+    uint64_t       bytes_freed;
+    double         pause_total;     /* milliseconds */
+    double         pause_max;
+};
+
+
+static void
+vector_push(gc_vector *v, uint64_t item) {
+    if (v->count == v->size) {
+        v->size  = v->size ? v->size * 2 : 64;
+        v->items = (uint64_t *)realloc(v->items, v->size * sizeof(uint64_t));
+        if (v->items == NULL) {
+            m0_fatal("gc: out of memory");
+        }
+    }
+    v->items[v->count++] = item;
+}
+
+static unsigned
+oldset_hash(M0_Heap *heap, uint64_t addr) {
+    return (unsigned)((addr >> 4) * 0x9E3779B97F4A7C15ULL >> 32) & (heap->oldset_size - 1);
+}
+
+static int
+oldset_contains(M0_Heap *heap, uint64_t addr) {
+    unsigned i = oldset_hash(heap, addr);
+
+    if (addr <= GC_OLDSET_DELETED || (addr & 7) != 0)
+        return 0;
+
+    while (heap->oldset[i] != GC_OLDSET_EMPTY) {
+        if (heap->oldset[i] == addr)
+            return 1;
+        i = (i + 1) & (heap->oldset_size - 1);
+    }
+    return 0;
+}
+
+static void oldset_insert(M0_Heap *heap, uint64_t addr);
+
+static void
+oldset_resize(M0_Heap *heap, unsigned newsize) {
+    uint64_t *old     = heap->oldset;
+    unsigned  oldsize = heap->oldset_size;
+    unsigned  i;
+
+    heap->oldset       = (uint64_t *)calloc(newsize, sizeof(uint64_t));
+    heap->oldset_size  = newsize;
+    heap->oldset_count = 0;
+    heap->oldset_used  = 0;
+    if (heap->oldset == NULL) {
+        m0_fatal("gc: out of memory");
+    }
+
+    for (i = 0; i < oldsize; i++) {
+        if (old[i] > GC_OLDSET_DELETED)
+            oldset_insert(heap, old[i]);
+    }
+    free(old);
+}
+
+static void
+oldset_insert(M0_Heap *heap, uint64_t addr) {
+    unsigned i;
+
+    /* keep the load factor (including deleted entries) below 1/2. */
+    if ((heap->oldset_used + 1) * 2 > heap->oldset_size)
+        oldset_resize(heap, heap->oldset_size * 2);
+
+    i = oldset_hash(heap, addr);
+    while (heap->oldset[i] > GC_OLDSET_DELETED)
+        i = (i + 1) & (heap->oldset_size - 1);
+
+    if (heap->oldset[i] == GC_OLDSET_EMPTY)
+        ++heap->oldset_used;
+    heap->oldset[i] = addr;
+    ++heap->oldset_count;
+}
+
+static void
+oldset_remove(M0_Heap *heap, uint64_t addr) {
+    unsigned i = oldset_hash(heap, addr);
+
+    while (heap->oldset[i] != GC_OLDSET_EMPTY) {
+        if (heap->oldset[i] == addr) {
+            heap->oldset[i] = GC_OLDSET_DELETED;
+            --heap->oldset_count;
+            return;
+        }
+        i = (i + 1) & (heap->oldset_size - 1);
+    }
+    assert(0); /* should never happen. */
+}
+
+int
+gc_is_young(M0_Heap *heap, uint64_t value) {
+    uint64_t offset;
+
+    if (value < (uint64_t)heap->nursery || value >= (uint64_t)heap->top || (value & 7) != 0)
+        return 0;
+
+    offset = (value - (uint64_t)heap->nursery) / 8;
+    return (heap->starts[offset / 8] >> (offset % 8)) & 1;
+}
+
+int
+gc_is_object(M0_Heap *heap, uint64_t value) {
+    return gc_is_young(heap, value) || oldset_contains(heap, value);
+}
+
+static uint64_t
+old_alloc(M0_Heap *heap, uint32_t size, uint32_t flags) {
+    gc_oldobj *obj = (gc_oldobj *)calloc(1, sizeof(gc_oldobj) + size);
+
+    if (obj == NULL) {
+        m0_fatal("gc: out of memory");
+    }
+
+    obj->hdr.size  = size;
+    obj->hdr.flags = flags;
+    obj->next      = heap->oldobjs;
+    heap->oldobjs  = obj;
+
+    heap->old_bytes += size;
+    oldset_insert(heap, GC_PAYLOAD(obj));
+    return GC_PAYLOAD(obj);
+}
+
+M0_Heap *
+gc_new_heap(void) {
+    M0_Heap *heap = (M0_Heap *)calloc(1, sizeof(M0_Heap));
+
+    if (heap == NULL) {
+        m0_fatal("gc: out of memory");
+    }
+
+    heap->nursery = (char *)calloc(1, GC_NURSERY_SIZE);
+    heap->starts  = (unsigned char *)calloc(1, GC_NURSERY_SIZE / 64);
+    heap->oldset  = (uint64_t *)calloc(GC_OLDSET_SIZE, sizeof(uint64_t));
+    if (heap->nursery == NULL || heap->starts == NULL || heap->oldset == NULL) {
+        m0_fatal("gc: out of memory");
+    }
+
+    heap->top             = heap->nursery;
+    heap->limit           = heap->nursery + GC_NURSERY_SIZE;
+    heap->oldset_size     = GC_OLDSET_SIZE;
+    heap->major_threshold = GC_MAJOR_THRESHOLD;
+    heap->print_stats     = getenv("M0_GC_STATS") != NULL;
+    return heap;
+}
+
+void
+gc_delete_heap(M0_Heap *heap) {
+    gc_oldobj *iter = heap->oldobjs;
+
+    if (heap->print_stats)
+        gc_print_stats(heap, stderr);
+
+    while (iter != NULL) {
+        gc_oldobj *next = iter->next;
+        free(iter);
+        iter = next;
+    }
+    free(heap->remembered.items);
+    free(heap->worklist.items);
+    free(heap->oldset);
+    free(heap->starts);
+    free(heap->nursery);
+    free(heap);
+}
+
+/*
+
+Return the number of slots to scan in obj, and set *skip_nums if the N
+registers should be skipped.
+
+*/
+static unsigned
+scan_slots(uint64_t obj, int *skip_nums) {
+    gc_header *hdr = GC_HEADER(obj);
+
+    *skip_nums = (hdr->flags & GC_FRAME) && hdr->size >= M0_NUM_REGS * 8;
+    return hdr->size / 8;
+}
+
+/* Copy young object value to the old generation, unless that's done already. */
+static uint64_t
+forward(M0_Heap *heap, uint64_t value) {
+    gc_header *hdr;
+    uint64_t   copy;
+
+    if (!gc_is_young(heap, value))
+        return value;
+
+    hdr = GC_HEADER(value);
+    if (hdr->flags & GC_FORWARDED)
+        return *(uint64_t *)value;
+
+    copy = old_alloc(heap, hdr->size, hdr->flags & GC_FRAME);
+    memcpy((void *)copy, (void *)value, hdr->size);
+    heap->bytes_promoted += hdr->size;
+
+    hdr->flags |= GC_FORWARDED;
+    *(uint64_t *)value = copy;
+
+    vector_push(&heap->worklist, copy);
+    return copy;
+}
+
+static void
+forward_slots(M0_Heap *heap, uint64_t obj) {
+    uint64_t *slots = (uint64_t *)obj;
+    int       skip_nums;
+    unsigned  n     = scan_slots(obj, &skip_nums);
+    unsigned  i;
+
+    for (i = 0; i < n; i++) {
+        if (skip_nums && i == M0_REG_N0) {
+            i = M0_REG_S0 - 1;
+            continue;
+        }
+        slots[i] = forward(heap, slots[i]);
+    }
+}
+
+static void
+collect_minor(M0_Interp *interp) {
+    M0_Heap *heap = interp->heap;
+    unsigned i;
+
+    assert(heap->worklist.count == 0);
+
+    if (interp->cf != NULL) {
+        interp->cf = (uint64_t *)forward(heap, (uint64_t)interp->cf);
+        forward_slots(heap, (uint64_t)interp->cf);
+    }
+
+    for (i = 0; i < heap->remembered.count; i++) {
+        uint64_t obj = heap->remembered.items[i];
+        GC_HEADER(obj)->flags &= ~GC_REMEMBERED;
+        forward_slots(heap, obj);
+    }
+    heap->remembered.count = 0;
+
+    while (heap->worklist.count > 0) {
+        uint64_t obj = heap->worklist.items[--heap->worklist.count];
+        forward_slots(heap, obj);
+    }
+
+    /* everything that's alive has been copied, so start over. */
+    memset(heap->nursery, 0, heap->top - heap->nursery);
+    memset(heap->starts, 0, GC_NURSERY_SIZE / 64);
+    heap->top = heap->nursery;
+
+    ++heap->minor_count;
+}
+
+static void
+mark(M0_Heap *heap, uint64_t value) {
+    gc_header *hdr;
+
+    if (!oldset_contains(heap, value))
+        return;
+
+    hdr = GC_HEADER(value);
+    if (hdr->flags & GC_MARKED)
+        return;
+
+    hdr->flags |= GC_MARKED;
+    vector_push(&heap->worklist, value);
+}
+
+/* Mark-sweep the old generation. Must run straight after a minor collection. */
+static void
+collect_major(M0_Interp *interp) {
+    M0_Heap    *heap = interp->heap;
+    gc_oldobj **iter;
+
+    assert(heap->top == heap->nursery);
+    assert(heap->remembered.count == 0);
+
+    if (interp->cf != NULL)
+        mark(heap, (uint64_t)interp->cf);
+
+    while (heap->worklist.count > 0) {
+        uint64_t  obj   = heap->worklist.items[--heap->worklist.count];
+        uint64_t *slots = (uint64_t *)obj;
+        int       skip_nums;
+        unsigned  n     = scan_slots(obj, &skip_nums);
+        unsigned  i;
+
+        for (i = 0; i < n; i++) {
+            if (skip_nums && i == M0_REG_N0) {
+                i = M0_REG_S0 - 1;
+                continue;
+            }
+            mark(heap, slots[i]);
+        }
+    }
+
+    iter = &heap->oldobjs;
+    while (*iter != NULL) {
+        gc_oldobj *obj = *iter;
+
+        if (obj->hdr.flags & GC_MARKED) {
+            obj->hdr.flags &= ~GC_MARKED;
+            iter = &obj->next;
+        }
+        else {
+            *iter = obj->next;
+            oldset_remove(heap, GC_PAYLOAD(obj));
+            heap->old_bytes   -= obj->hdr.size;
+            heap->bytes_freed += obj->hdr.size;
+            free(obj);
+        }
+    }
+
+    /* get rid of the deleted entries in the set, and shrink it if it's mostly empty. */
+    {
+        unsigned size = GC_OLDSET_SIZE;
+        while (size < heap->oldset_count * 4)
+            size *= 2;
+        oldset_resize(heap, size);
+    }
+
+    heap->major_threshold = heap->old_bytes * 2;
+    if (heap->major_threshold < GC_MAJOR_THRESHOLD)
+        heap->major_threshold = GC_MAJOR_THRESHOLD;
+
+    ++heap->major_count;
+}
+
+static double
+now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+void
+gc_collect(M0_Interp *interp, int major) {
+    M0_Heap *heap  = interp->heap;
+    double   start = now_ms();
+    double   pause;
+
+    collect_minor(interp);
+
+    if (major || heap->old_bytes > heap->major_threshold)
+        collect_major(interp);
+
+    pause = now_ms() - start;
+    heap->pause_total += pause;
+    if (pause > heap->pause_max)
+        heap->pause_max = pause;
+}
+
+void *
+gc_alloc(M0_Interp *interp, uint64_t size, uint64_t flags) {
+    M0_Heap   *heap = interp->heap;
+    gc_header *hdr;
+    uint64_t   obj;
+
+    (void)flags; /* not used yet. */
+
+    /* round up to whole slots; there must be room for a forwarding pointer. */
+    size = (size + 7) & ~(uint64_t)7;
+    if (size == 0)
+        size = 8;
+    if (size > UINT32_MAX)
+        m0_fatal("gc: cannot allocate %lu bytes", (unsigned long)size);
+
+    heap->bytes_allocated += size;
+
+    if (size >= GC_LARGE_OBJECT) {
+        if (heap->old_bytes + size > heap->major_threshold)
+            gc_collect(interp, 1);
+        return (void *)old_alloc(heap, (uint32_t)size, 0);
+    }
+
+    if (heap->top + sizeof(gc_header) + size > heap->limit)
+        gc_collect(interp, 0);
+
+    hdr        = (gc_header *)heap->top;
+    hdr->size  = (uint32_t)size;
+    hdr->flags = 0;
+    obj        = (uint64_t)(hdr + 1);
+    heap->top += sizeof(gc_header) + size;
+
+    /* mark the object's start. */
+    {
+        uint64_t offset = (obj - (uint64_t)heap->nursery) / 8;
+        heap->starts[offset / 8] |= (unsigned char)(1 << (offset % 8));
+    }
+    return (void *)obj;
+}
+
+void
+gc_write_barrier(M0_Heap *heap, uint64_t obj) {
+    gc_header *hdr;
+
+    /* young objects are always scanned. */
+    if (obj >= (uint64_t)heap->nursery && obj < (uint64_t)heap->limit)
+        return;
+    if (!oldset_contains(heap, obj))
+        return;
+
+    hdr = GC_HEADER(obj);
+    if ((hdr->flags & GC_REMEMBERED) == 0) {
+        hdr->flags |= GC_REMEMBERED;
+        vector_push(&heap->remembered, obj);
+    }
+}
+
+/*
+
+The frame we're leaving may have had young objects stored in its registers
+while it was running; remember it. Return 0 if newcf is not a valid object.
+
+*/
+int
+gc_frame_switch(M0_Heap *heap, uint64_t *oldcf, uint64_t *newcf) {
+    if (oldcf != NULL)
+        gc_write_barrier(heap, (uint64_t)oldcf);
+
+    if (!gc_is_object(heap, (uint64_t)newcf))
+        return 0;
+
+    GC_HEADER(newcf)->flags |= GC_FRAME;
+    return 1;
+}
+
+void
+gc_print_stats(M0_Heap *heap, FILE *out) {
+    unsigned long collections = heap->minor_count;
+
+    fprintf(out, "gc: minor collections:  %lu\n", heap->minor_count);
+    fprintf(out, "gc: major collections:  %lu\n", heap->major_count);
+    fprintf(out, "gc: bytes allocated:    %lu\n", (unsigned long)heap->bytes_allocated);
+    fprintf(out, "gc: bytes promoted:     %lu\n", (unsigned long)heap->bytes_promoted);
+    fprintf(out, "gc: bytes freed:        %lu\n", (unsigned long)heap->bytes_freed);
+    fprintf(out, "gc: old gen bytes:      %lu\n", (unsigned long)heap->old_bytes);
+    fprintf(out, "gc: pause total (ms):   %.3f\n", heap->pause_total);
+    fprintf(out, "gc: pause max (ms):     %.3f\n", heap->pause_max);
+    fprintf(out, "gc: pause avg (ms):     %.3f\n",
+            collections ? heap->pause_total / collections : 0.0);
+}
+
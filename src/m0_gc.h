@@ -0,0 +1,41 @@
+#ifndef __M0_GC_H__
+#define __M0_GC_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "m0_interp.h"
+
+/*
+
+Generational garbage collector for gc_alloc'ed memory.
+
+New objects are bump-allocated in a nursery. When the nursery is full,
+a minor collection copies the surviving objects into the old generation.
+The old generation is collected by mark-sweep once it has grown past a
+threshold. Roots are the current call frame and its chain of parent
+frames; see m0_gc.c for details.
+
+*/
+
+typedef struct M0_Heap M0_Heap;
+
+extern M0_Heap  *gc_new_heap(void);
+extern void      gc_delete_heap(M0_Heap *heap);
+
+/* allocate size bytes; may collect, so callers must reload interp->cf. */
+extern void     *gc_alloc(M0_Interp *interp, uint64_t size, uint64_t flags);
+
+/* notify the collector that obj may have been written to. For stores of a
+   single value, only needed if gc_is_young() is true for the value. */
+extern void      gc_write_barrier(M0_Heap *heap, uint64_t obj);
+extern int       gc_is_young(M0_Heap *heap, uint64_t value);
+
+/* notify the collector that the interpreter switched from frame oldcf to newcf. */
+extern int       gc_frame_switch(M0_Heap *heap, uint64_t *oldcf, uint64_t *newcf);
+
+extern int       gc_is_object(M0_Heap *heap, uint64_t value);
+extern void      gc_collect(M0_Interp *interp, int major);
+extern void      gc_print_stats(M0_Heap *heap, FILE *out);
+
+#endif
+
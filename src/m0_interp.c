@@ -0,0 +1,357 @@
+/*
+
+Interpreter for M0 bytecode.
+
+A call frame is an array of 256 64-bit slots (see m0_interp.h), allocated
+with gc_alloc(). The interpreter runs the instruction at PC in the current
+frame's CHUNK; PC is incremented before the instruction is executed, so
+instructions that read PC get the index of the next instruction.
+Whenever an instruction changes the CF register of the current frame, the
+interpreter continues in the frame that CF points to.
+
+Memory is addressed as follows:
+
+    deref   X, P, I     X = 8-byte slot I of P
+    set_ref P, I, X     8-byte slot I of P = X
+    get_byte/set_byte   byte I of P
+    get_word/set_word   4-byte word I of P (sign-extended on load)
+
+Execution stops at an exit instruction, or when the PC runs off the end of
+the current chunk.
+
+With --profile, the interpreter records a sample (see m0_profile.c) before
+the next instruction whenever the profiling timer has fired.
+
+If the JIT is enabled, chunks that are entered or loop often enough are
+compiled (see m0_jit.c), and their code is run instead. Compiled code
+returns here for anything it can't handle; the interpreter then executes
+at least one instruction before it enters compiled code again.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include "m0_interp.h"
+#include "m0_ops.h"
+#include "m0_gc.h"
+#include "m0_jit.h"
+#include "m0_profile.h"
+
+M0_Interp *
+m0_new_interp(void) {
+    M0_Interp *interp = (M0_Interp *)calloc(1, sizeof(M0_Interp));
+
+    if (interp == NULL) {
+        m0_fatal("out of memory");
+    }
+    interp->heap          = gc_new_heap();
+    interp->jit_threshold = M0_JIT_THRESHOLD;
+    return interp;
+}
+
+void
+m0_delete_interp(M0_Interp *interp) {
+    M0_Chunk *iter = interp->chunks;
+
+    while (iter != NULL) {
+        M0_Chunk *next = iter->next;
+        unsigned  i;
+
+        for (i = 0; i < iter->num_consts; i++) {
+            if (iter->const_types[i] == M0_CONST_STR)
+                free((void *)iter->constants[i]);
+            free(iter->const_chunks[i]);
+        }
+        free(iter->constants);
+        free(iter->const_types);
+        free(iter->const_chunks);
+        free(iter->bytecode);
+        free(iter->lines);
+        free(iter->name);
+        m0_jit_free(iter);
+        iter->magic = 0;
+        free(iter);
+        iter = next;
+    }
+
+    gc_delete_heap(interp->heap);
+    free(interp);
+}
+
+static double
+get_n(uint64_t *cf, unsigned char reg) {
+    double n;
+    memcpy(&n, &cf[reg], sizeof(double));
+    return n;
+}
+
+static void
+set_n(uint64_t *cf, unsigned char reg, double n) {
+    memcpy(&cf[reg], &n, sizeof(double));
+}
+
+static FILE *
+get_handle(uint64_t handle) {
+    return handle == 2 ? stderr : stdout;
+}
+
+/* Set up a frame to run chunk from PC 0. */
+static uint64_t *
+new_frame(M0_Interp *interp, M0_Chunk *chunk) {
+    uint64_t *cf = (uint64_t *)gc_alloc(interp, M0_NUM_REGS * sizeof(uint64_t), 0);
+
+    cf[M0_CF]     = (uint64_t)cf;
+    cf[M0_CHUNK]  = (uint64_t)chunk;
+    cf[M0_CONSTS] = (uint64_t)chunk->constants;
+    cf[M0_BCS]    = (uint64_t)chunk->bytecode;
+    cf[M0_INTERP] = (uint64_t)interp;
+    return cf;
+}
+
+/* Count an invocation of, or a backward jump in chunk, and compile it when it gets hot. */
+static void
+heat_chunk(M0_Interp *interp, M0_Chunk *chunk) {
+    if (interp->jit && chunk->jitcode == NULL && ++chunk->hotness > interp->jit_threshold) {
+        if (!m0_jit_compile(interp, chunk)) {
+            fprintf(stderr, "m0: JIT not available, using the interpreter\n");
+            interp->jit = 0;
+        }
+    }
+}
+
+#define I(n)    ((int64_t)cf[ops[n]])
+#define U(n)    (cf[ops[n]])
+#define N(n)    (get_n(cf, ops[n]))
+#define P(n)    ((void *)cf[ops[n]])
+
+/*
+
+Run chunk entry in a new call frame. Returns the exit code.
+
+*/
+int
+m0_run(M0_Interp *interp, M0_Chunk *entry) {
+    M0_Heap  *heap     = interp->heap;
+    int       from_jit = 0;
+    uint64_t  instrs   = 0;
+    uint64_t *cf;
+
+    interp->cf = NULL;
+    cf         = new_frame(interp, entry);
+    interp->cf = cf;
+    (void)gc_frame_switch(heap, NULL, cf);
+    heat_chunk(interp, entry);
+
+    for (;;) {
+        M0_Chunk      *chunk = (M0_Chunk *)cf[M0_CHUNK];
+        uint64_t       pc    = cf[M0_PC];
+        unsigned char *ops;
+
+        if (pc >= chunk->num_instrs)
+            break;
+
+        if (m0_profile_pending)
+            m0_profile_sample(interp, cf);
+
+        if (chunk->jitcode != NULL && !from_jit) {
+            cf       = m0_jit_run(interp, cf);
+            from_jit = 1;
+            goto switch_frames;
+        }
+        from_jit = 0;
+
+        ops        = (unsigned char *)cf[M0_BCS] + pc * M0_INSTR_SIZE;
+        cf[M0_PC]  = pc + 1;
+        ++instrs;
+
+        switch (ops[0]) {
+            case M0_NOOP:
+                break;
+            case M0_GOTO:
+                cf[M0_PC] = ops[1] * 256 + ops[2];
+                if (cf[M0_PC] <= pc)
+                    heat_chunk(interp, chunk);
+                break;
+            case M0_GOTO_IF:
+                if (U(3)) {
+                    cf[M0_PC] = ops[1] * 256 + ops[2];
+                    if (cf[M0_PC] <= pc)
+                        heat_chunk(interp, chunk);
+                }
+                break;
+            case M0_GOTO_CHUNK:
+            {
+                M0_Chunk *target   = (M0_Chunk *)U(1);
+                uint64_t  targetpc = U(2);
+
+                if (!m0_is_chunk(interp, (uint64_t)target))
+                    m0_fatal("goto_chunk: not a chunk in chunk '%s' at PC %lu",
+                             chunk->name, (unsigned long)pc);
+
+                cf[M0_CHUNK]  = (uint64_t)target;
+                cf[M0_CONSTS] = (uint64_t)target->constants;
+                cf[M0_MDS]    = 0;
+                cf[M0_BCS]    = (uint64_t)target->bytecode;
+                cf[M0_PC]     = targetpc;
+                heat_chunk(interp, target);
+                break;
+            }
+            case M0_ADD_I:
+                U(1) = (uint64_t)(I(2) + I(3));
+                break;
+            case M0_ADD_N:
+                set_n(cf, ops[1], N(2) + N(3));
+                break;
+            case M0_SUB_I:
+                U(1) = (uint64_t)(I(2) - I(3));
+                break;
+            case M0_SUB_N:
+                set_n(cf, ops[1], N(2) - N(3));
+                break;
+            case M0_MULT_I:
+                U(1) = (uint64_t)(I(2) * I(3));
+                break;
+            case M0_MULT_N:
+                set_n(cf, ops[1], N(2) * N(3));
+                break;
+            case M0_DIV_I:
+                if (I(3) == 0)
+                    m0_fatal("division by zero in chunk '%s' at PC %lu", chunk->name, (unsigned long)pc);
+                U(1) = (uint64_t)(I(2) / I(3));
+                break;
+            case M0_DIV_N:
+                set_n(cf, ops[1], N(2) / N(3));
+                break;
+            case M0_MOD_I:
+                if (I(3) == 0)
+                    m0_fatal("division by zero in chunk '%s' at PC %lu", chunk->name, (unsigned long)pc);
+                U(1) = (uint64_t)(I(2) % I(3));
+                break;
+            case M0_MOD_N:
+                set_n(cf, ops[1], fmod(N(2), N(3)));
+                break;
+            case M0_ITON:
+                set_n(cf, ops[1], (double)I(2));
+                break;
+            case M0_NTOI:
+                U(1) = (uint64_t)(int64_t)N(2);
+                break;
+            case M0_ASHR:
+                U(1) = (uint64_t)(I(2) >> (U(3) & 63));
+                break;
+            case M0_LSHR:
+                U(1) = U(2) >> (U(3) & 63);
+                break;
+            case M0_SHL:
+                U(1) = U(2) << (U(3) & 63);
+                break;
+            case M0_AND:
+                U(1) = U(2) & U(3);
+                break;
+            case M0_OR:
+                U(1) = U(2) | U(3);
+                break;
+            case M0_XOR:
+                U(1) = U(2) ^ U(3);
+                break;
+            case M0_GC_ALLOC:
+            {
+                void *mem;
+                interp->cf = cf;
+                mem        = gc_alloc(interp, U(2), U(3));
+                cf         = interp->cf; /* the frame may have moved. */
+                U(1)       = (uint64_t)mem;
+                break;
+            }
+            case M0_SYS_ALLOC:
+                U(1) = (uint64_t)calloc(1, U(2));
+                break;
+            case M0_SYS_FREE:
+                free(P(1));
+                break;
+            case M0_COPY_MEM:
+                memcpy(P(1), P(2), U(3));
+                gc_write_barrier(heap, U(1));
+                break;
+            case M0_SET:
+                U(1) = U(2);
+                break;
+            case M0_SET_IMM:
+                U(1) = ops[2] * 256 + ops[3];
+                break;
+            case M0_DEREF:
+                U(1) = ((uint64_t *)P(2))[U(3)];
+                break;
+            case M0_SET_REF:
+                ((uint64_t *)P(1))[U(2)] = U(3);
+                if (gc_is_young(heap, U(3)))
+                    gc_write_barrier(heap, U(1));
+                break;
+            case M0_SET_BYTE:
+                ((unsigned char *)P(1))[U(2)] = (unsigned char)U(3);
+                gc_write_barrier(heap, U(1));
+                break;
+            case M0_GET_BYTE:
+                U(1) = ((unsigned char *)P(2))[U(3)];
+                break;
+            case M0_SET_WORD:
+                ((uint32_t *)P(1))[U(2)] = (uint32_t)U(3);
+                gc_write_barrier(heap, U(1));
+                break;
+            case M0_GET_WORD:
+                U(1) = (uint64_t)(int64_t)(int32_t)((uint32_t *)P(2))[U(3)];
+                break;
+            case M0_CSYM:
+            case M0_CCALL_ARG:
+            case M0_CCALL_RET:
+            case M0_CCALL:
+                m0_fatal("ccall ops are not supported (chunk '%s', PC %lu)", chunk->name, (unsigned long)pc);
+                break;
+            case M0_PRINT_S:
+                fputs((char *)P(2), get_handle(U(1)));
+                break;
+            case M0_PRINT_I:
+                fprintf(get_handle(U(1)), "%" PRId64, I(2));
+                break;
+            case M0_PRINT_N:
+                fprintf(get_handle(U(1)), "%f", N(2));
+                break;
+            case M0_EXIT:
+                interp->instrs += instrs;
+                return (int)I(1);
+            case M0_ISGT_I:
+                U(1) = I(2) > I(3);
+                break;
+            case M0_ISGE_I:
+                U(1) = I(2) >= I(3);
+                break;
+            case M0_ISGT_N:
+                U(1) = N(2) > N(3);
+                break;
+            case M0_ISGE_N:
+                U(1) = N(2) >= N(3);
+                break;
+            default:
+                m0_fatal("invalid opcode %d in chunk '%s' at PC %lu", ops[0], chunk->name, (unsigned long)pc);
+                break;
+        }
+
+      switch_frames:
+        /* switch call frames if CF was changed. */
+        if ((uint64_t *)cf[M0_CF] != cf) {
+            uint64_t *newcf = (uint64_t *)cf[M0_CF];
+
+            if (!gc_frame_switch(heap, cf, newcf))
+                m0_fatal("invalid call frame in chunk '%s' at PC %lu", chunk->name, (unsigned long)pc);
+
+            cf         = newcf;
+            interp->cf = cf;
+        }
+    }
+
+    interp->instrs += instrs;
+    return 0;
+}
+
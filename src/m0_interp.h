@@ -0,0 +1,129 @@
+#ifndef __M0_INTERP_H__
+#define __M0_INTERP_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+
+Data structures for the M0 runtime: loaded chunks, call frames and the
+interpreter state. See PDD32 for the layout of a call frame; the first 12
+slots hold the special registers, followed by 61 registers of each type.
+
+*/
+
+#define M0_REG_I0       12
+#define M0_REG_N0       73
+#define M0_REG_S0       134
+#define M0_REG_P0       195
+#define M0_NUM_REGS     256
+
+/* names of the special registers in a call frame. */
+enum M0_SPECIAL_REGS {
+    M0_CF,       /* this call frame */
+    M0_PCF,      /* parent call frame */
+    M0_PC,       /* program counter; index of the next instruction */
+    M0_RETPC,    /* PC to return to in the parent frame */
+    M0_EH,       /* exception handler */
+    M0_CHUNK,    /* currently executing chunk */
+    M0_CONSTS,   /* constants segment of CHUNK */
+    M0_MDS,      /* metadata segment of CHUNK */
+    M0_BCS,      /* bytecode segment of CHUNK */
+    M0_INTERP,   /* the interpreter */
+    M0_SPILLCF   /* spill call frame */
+};
+
+/* every instruction is 4 bytes: opcode and 3 operands. */
+#define M0_INSTR_SIZE   4
+
+/* types of entries in the constants segment. */
+typedef enum m0_const_type {
+    M0_CONST_INT,
+    M0_CONST_NUM,
+    M0_CONST_STR,
+    M0_CONST_CHUNK
+} m0_const_type;
+
+/* the instructions from pc up to the next entry's pc come from source line line. */
+typedef struct M0_LineEntry {
+    uint32_t          pc;
+    uint32_t          line;
+} M0_LineEntry;
+
+/* the first field of every chunk; see m0_is_chunk(). */
+#define M0_CHUNK_MAGIC  UINT64_C(0x4b4e554843304d31)    /* "1M0CHUNK" */
+
+typedef struct M0_Chunk {
+    uint64_t          magic;         /* M0_CHUNK_MAGIC while loaded */
+    char             *name;
+    unsigned          id;            /* position in the file, starting at 0 */
+
+    uint64_t         *constants;     /* CONSTS; ints, nums (bits), char * or M0_Chunk * */
+    unsigned char    *const_types;   /* one m0_const_type per constant */
+    char            **const_chunks;  /* names of &chunk constants, until resolved */
+    unsigned          num_consts;
+
+    unsigned char    *bytecode;      /* BCS; num_instrs * M0_INSTR_SIZE bytes */
+    unsigned          num_instrs;
+
+    unsigned          line;          /* source line of the chunk; 0 if unknown */
+    M0_LineEntry     *lines;         /* line table from the metadata segment */
+    unsigned          num_lines;
+
+    /* JIT state; see m0_jit.c */
+    unsigned long     hotness;       /* invocations and backward jumps */
+    void             *jitcode;
+    size_t            jitsize;
+    uint32_t         *jitoffsets;    /* PC -> offset of its code in jitcode */
+
+    struct M0_Chunk  *next;
+} M0_Chunk;
+
+struct M0_Heap;
+struct M0_Profile;
+
+typedef struct M0_Interp {
+    M0_Chunk         *chunks;        /* loaded chunks, in file order */
+    unsigned          num_chunks;
+    uintptr_t         chunks_lo,     /* lowest and highest address of a chunk */
+                      chunks_hi;
+
+    uint64_t         *cf;            /* current call frame */
+    struct M0_Heap   *heap;
+
+    int               jit;           /* compile hot chunks? */
+    unsigned long     jit_threshold; /* hotness at which a chunk is compiled */
+
+    struct M0_Profile *profile;      /* sampling profiler, if enabled */
+    uint64_t          instrs;        /* number of instructions run by the interpreter */
+
+} M0_Interp;
+
+extern M0_Interp *m0_new_interp(void);
+extern void       m0_delete_interp(M0_Interp *interp);
+
+extern int        m0_load_file(M0_Interp *interp, char const *filename);
+extern void       m0_load_stream(M0_Interp *interp, FILE *fp, char const *filename);
+extern M0_Chunk  *m0_find_chunk(M0_Interp *interp, char const *name);
+extern unsigned   m0_chunk_line(M0_Chunk *chunk, uint64_t pc);
+
+extern int        m0_run(M0_Interp *interp, M0_Chunk *entry);
+
+extern void       m0_fatal(char const *fmt, ...);
+
+/* whether value, as from a register, points to a loaded chunk. This is
+   checked on every goto_chunk, so it doesn't search the chunks: a value
+   in the range of their addresses, suitably aligned, is read as a chunk,
+   which it is if it starts with the magic number. */
+static inline int
+m0_is_chunk(M0_Interp *interp, uint64_t value) {
+    uintptr_t p = (uintptr_t)value;
+
+    return p >= interp->chunks_lo && p <= interp->chunks_hi
+        && p % sizeof(uint64_t) == 0
+        && ((M0_Chunk *)p)->magic == M0_CHUNK_MAGIC;
+}
+
+#endif
+
@@ -0,0 +1,596 @@
+/*
+
+Baseline template JIT from M0 bytecode to x86-64.
+
+Every instruction of a chunk is translated separately into a fixed sequence
+of machine code. M0 registers are not mapped to machine registers; they
+stay in the call frame, which is kept in rbx, so "add_i I1, I2, I3" becomes:
+
+    mov rax, [rbx + 8 * I2]
+    add rax, [rbx + 8 * I3]
+    mov [rbx + 8 * I1], rax
+
+goto and goto_if become direct jumps within the chunk. All the code for a
+chunk is emitted into one mmap'ed buffer, which is made executable (and
+read-only) once it's complete. A table maps each PC to the start of its
+code, so that the interpreter can enter the compiled code at any PC.
+
+The generated code returns to the interpreter, with the frame's PC set to
+the instruction to continue with, when:
+
+ * it reaches an instruction it does not handle (goto_chunk, exit, ccall,
+   copy_mem, etc.), or an instruction that writes to CF, PC or one of the
+   registers describing the chunk. The interpreter then executes that
+   instruction;
+
+ * a division by zero is about to happen, so that the interpreter can
+   report it;
+
+ * a store might have changed CF or PC of the current frame;
+
+ * it runs off the end of the chunk.
+
+As in the interpreter, PC is incremented before an instruction runs, so
+instructions that read PC see the index of the next instruction. The value
+is only stored in the frame when it is needed.
+
+The compiled function is called as code(cf, interp, entry); it keeps cf in
+rbx and the interpreter in r12, jumps to entry, and returns the current
+call frame (gc_alloc may move it).
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+#include "m0_jit.h"
+#include "m0_ops.h"
+#include "m0_gc.h"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+
+#include <sys/mman.h>
+
+/* machine registers */
+#define RAX     0
+#define RCX     1
+#define RDX     2
+#define RBX     3
+#define RSI     6
+#define RDI     7
+
+/* opcodes for "op rax, [mem]" */
+#define X86_ADD     0x03
+#define X86_OR      0x0B
+#define X86_AND     0x23
+#define X86_SUB     0x2B
+#define X86_XOR     0x33
+#define X86_CMP     0x3B
+
+/* SSE2 opcodes, after F2 0F */
+#define SSE_LOAD    0x10
+#define SSE_STORE   0x11
+#define SSE_ADD     0x58
+#define SSE_MUL     0x59
+#define SSE_SUB     0x5C
+#define SSE_DIV     0x5E
+
+/* condition codes for setcc */
+#define CC_A        0x7
+#define CC_AE       0x3
+#define CC_GE       0xD
+#define CC_G        0xF
+
+#define MAX_INSTR_SIZE  128     /* upper bound of the code for one instruction */
+
+typedef uint64_t *(*jit_function)(uint64_t *cf, M0_Interp *interp, void *entry);
+
+/* a jump to a PC that's not known yet. */
+typedef struct jit_fixup {
+    size_t   pos;       /* position of the rel32 */
+    unsigned pc;
+} jit_fixup;
+
+typedef struct jit_buf {
+    unsigned char *code;
+    size_t         size;
+    size_t         pos;
+    size_t         epilogue;
+
+    jit_fixup     *fixups;
+    unsigned       num_fixups;
+} jit_buf;
+
+
+static void
+emit_byte(jit_buf *b, unsigned char c) {
+    assert(b->pos < b->size);
+    b->code[b->pos++] = c;
+}
+
+static void
+emit_bytes(jit_buf *b, char const *bytes, size_t n) {
+    size_t i;
+    for (i = 0; i < n; i++)
+        emit_byte(b, (unsigned char)bytes[i]);
+}
+
+static void
+emit_u32(jit_buf *b, uint32_t v) {
+    emit_byte(b, v & 0xff);
+    emit_byte(b, (v >> 8) & 0xff);
+    emit_byte(b, (v >> 16) & 0xff);
+    emit_byte(b, (v >> 24) & 0xff);
+}
+
+static void
+emit_u64(jit_buf *b, uint64_t v) {
+    emit_u32(b, (uint32_t)v);
+    emit_u32(b, (uint32_t)(v >> 32));
+}
+
+/* modrm (and displacement) for [rbx + 8 * slot] */
+static void
+emit_slot(jit_buf *b, int reg, unsigned slot) {
+    unsigned disp = slot * 8;
+
+    if (disp < 128) {
+        emit_byte(b, (unsigned char)(0x40 | (reg << 3) | RBX));
+        emit_byte(b, (unsigned char)disp);
+    }
+    else {
+        emit_byte(b, (unsigned char)(0x80 | (reg << 3) | RBX));
+        emit_u32(b, disp);
+    }
+}
+
+/* mov reg, [rbx + 8 * slot] */
+static void
+emit_load(jit_buf *b, int reg, unsigned slot) {
+    emit_byte(b, 0x48);
+    emit_byte(b, 0x8B);
+    emit_slot(b, reg, slot);
+}
+
+/* mov [rbx + 8 * slot], reg */
+static void
+emit_store(jit_buf *b, unsigned slot, int reg) {
+    emit_byte(b, 0x48);
+    emit_byte(b, 0x89);
+    emit_slot(b, reg, slot);
+}
+
+/* op rax, [rbx + 8 * slot] */
+static void
+emit_alu(jit_buf *b, unsigned char op, unsigned slot) {
+    emit_byte(b, 0x48);
+    emit_byte(b, op);
+    emit_slot(b, RAX, slot);
+}
+
+/* mov qword [rbx + 8 * slot], imm32 */
+static void
+emit_store_imm(jit_buf *b, unsigned slot, uint32_t value) {
+    emit_byte(b, 0x48);
+    emit_byte(b, 0xC7);
+    emit_slot(b, 0, slot);
+    emit_u32(b, value);
+}
+
+/* SSE2 op xmm0, [rbx + 8 * slot] */
+static void
+emit_sse(jit_buf *b, unsigned char op, unsigned slot) {
+    emit_byte(b, 0xF2);
+    emit_byte(b, 0x0F);
+    emit_byte(b, op);
+    emit_slot(b, 0, slot);
+}
+
+/* mov rax, imm64; call rax */
+static void
+emit_call(jit_buf *b, void *fun) {
+    emit_bytes(b, "\x48\xB8", 2);
+    emit_u64(b, (uint64_t)fun);
+    emit_bytes(b, "\xFF\xD0", 2);
+}
+
+/* jump (with opcode bytes op) to the epilogue. */
+static void
+emit_jump_epilogue(jit_buf *b, char const *op, size_t oplen) {
+    emit_bytes(b, op, oplen);
+    emit_u32(b, (uint32_t)(b->epilogue - (b->pos + 4)));
+}
+
+/* store pc in the frame's PC, and return to the interpreter. */
+static void
+emit_exit(jit_buf *b, unsigned pc) {
+    emit_store_imm(b, M0_PC, pc);
+    emit_jump_epilogue(b, "\xE9", 1);
+}
+
+/* jump (with opcode bytes op) to the code for pc. */
+static void
+emit_jump(jit_buf *b, char const *op, size_t oplen, unsigned pc) {
+    emit_bytes(b, op, oplen);
+    b->fixups[b->num_fixups].pos = b->pos;
+    b->fixups[b->num_fixups].pc  = pc;
+    ++b->num_fixups;
+    emit_u32(b, 0);
+}
+
+/* Return to the interpreter if a store changed CF or PC of the current frame. */
+static void
+emit_check_frame(jit_buf *b, unsigned nextpc) {
+    /* cmp [rbx], rbx; jne epilogue */
+    emit_bytes(b, "\x48\x39\x1B", 3);
+    emit_jump_epilogue(b, "\x0F\x85", 2);
+    /* cmp qword [rbx + 8 * PC], nextpc; jne epilogue */
+    emit_bytes(b, "\x48\x81", 2);
+    emit_slot(b, 7, M0_PC);
+    emit_u32(b, nextpc);
+    emit_jump_epilogue(b, "\x0F\x85", 2);
+}
+
+/* helpers called from generated code. */
+
+static void
+jit_print(uint64_t handle, uint64_t value, int op) {
+    FILE *out = handle == 2 ? stderr : stdout;
+
+    switch (op) {
+        case M0_PRINT_S:
+            fputs((char *)value, out);
+            break;
+        case M0_PRINT_I:
+            fprintf(out, "%" PRId64, (int64_t)value);
+            break;
+        case M0_PRINT_N:
+        {
+            double n;
+            memcpy(&n, &value, sizeof(double));
+            fprintf(out, "%f", n);
+            break;
+        }
+        default:
+            assert(0);
+    }
+}
+
+static uint64_t *
+jit_gc_alloc(M0_Interp *interp, uint64_t *cf, unsigned char const *ops) {
+    void *mem;
+
+    interp->cf = cf;
+    mem        = gc_alloc(interp, cf[ops[2]], cf[ops[3]]);
+    cf         = interp->cf;
+    cf[ops[1]] = (uint64_t)mem;
+    return cf;
+}
+
+static void
+jit_barrier(M0_Interp *interp, uint64_t obj, uint64_t value) {
+    if (gc_is_young(interp->heap, value))
+        gc_write_barrier(interp->heap, obj);
+}
+
+static void
+jit_barrier_mem(M0_Interp *interp, uint64_t obj) {
+    gc_write_barrier(interp->heap, obj);
+}
+
+/* registers that describe what's running; writing them is left to the interpreter. */
+static int
+is_control_reg(unsigned char reg) {
+    return reg == M0_CF || reg == M0_PC || reg == M0_CHUNK || reg == M0_CONSTS
+        || reg == M0_MDS || reg == M0_BCS;
+}
+
+/* Return 1 if operand 1 of op is a register that is written. */
+static int
+writes_operand1(unsigned char op) {
+    switch (op) {
+        case M0_NOOP:
+        case M0_GOTO:
+        case M0_GOTO_IF:
+        case M0_SET_REF:
+        case M0_SET_BYTE:
+        case M0_SET_WORD:
+        case M0_PRINT_S:
+        case M0_PRINT_I:
+        case M0_PRINT_N:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+/* Emit code for the instruction at pc; return 0 if it's not supported. */
+static int
+emit_instr(jit_buf *b, M0_Chunk *chunk, unsigned pc) {
+    unsigned char *ops    = chunk->bytecode + pc * M0_INSTR_SIZE;
+    unsigned       nextpc = pc + 1;
+
+    if (writes_operand1(ops[0]) && is_control_reg(ops[1]))
+        return 0;
+
+    /* make the value of PC available to instructions that read it. */
+    if (ops[0] != M0_GOTO && (ops[1] == M0_PC || ops[2] == M0_PC || ops[3] == M0_PC))
+        emit_store_imm(b, M0_PC, nextpc);
+
+    switch (ops[0]) {
+        case M0_NOOP:
+            break;
+        case M0_GOTO:
+        {
+            unsigned target = ops[1] * 256 + ops[2];
+            if (target < chunk->num_instrs)
+                emit_jump(b, "\xE9", 1, target);
+            else
+                emit_exit(b, target);
+            break;
+        }
+        case M0_GOTO_IF:
+        {
+            unsigned target = ops[1] * 256 + ops[2];
+            emit_load(b, RAX, ops[3]);
+            emit_bytes(b, "\x48\x85\xC0", 3);               /* test rax, rax */
+            if (target < chunk->num_instrs) {
+                emit_jump(b, "\x0F\x85", 2, target);        /* jnz target */
+            }
+            else {
+                emit_bytes(b, "\x74\x0D", 2);               /* jz over the exit */
+                emit_exit(b, target);
+            }
+            break;
+        }
+        case M0_ADD_I:
+        case M0_SUB_I:
+        case M0_AND:
+        case M0_OR:
+        case M0_XOR:
+        {
+            unsigned char alu = ops[0] == M0_ADD_I ? X86_ADD
+                              : ops[0] == M0_SUB_I ? X86_SUB
+                              : ops[0] == M0_AND   ? X86_AND
+                              : ops[0] == M0_OR    ? X86_OR
+                              :                      X86_XOR;
+            emit_load(b, RAX, ops[2]);
+            emit_alu(b, alu, ops[3]);
+            emit_store(b, ops[1], RAX);
+            break;
+        }
+        case M0_MULT_I:
+            emit_load(b, RAX, ops[2]);
+            emit_bytes(b, "\x48\x0F\xAF", 3);               /* imul rax, [slot] */
+            emit_slot(b, RAX, ops[3]);
+            emit_store(b, ops[1], RAX);
+            break;
+        case M0_DIV_I:
+        case M0_MOD_I:
+            emit_load(b, RCX, ops[3]);
+            emit_bytes(b, "\x48\x85\xC9", 3);               /* test rcx, rcx */
+            emit_bytes(b, "\x75\x0D", 2);                   /* jnz over the exit */
+            emit_exit(b, pc);
+            emit_load(b, RAX, ops[2]);
+            emit_bytes(b, "\x48\x99", 2);                   /* cqo */
+            emit_bytes(b, "\x48\xF7\xF9", 3);               /* idiv rcx */
+            emit_store(b, ops[1], ops[0] == M0_DIV_I ? RAX : RDX);
+            break;
+        case M0_ASHR:
+        case M0_LSHR:
+        case M0_SHL:
+            emit_load(b, RAX, ops[2]);
+            emit_load(b, RCX, ops[3]);
+            emit_bytes(b, ops[0] == M0_ASHR ? "\x48\xD3\xF8"   /* sar rax, cl */
+                        : ops[0] == M0_LSHR ? "\x48\xD3\xE8"   /* shr rax, cl */
+                        :                     "\x48\xD3\xE0",  /* shl rax, cl */
+                       3);
+            emit_store(b, ops[1], RAX);
+            break;
+        case M0_ISGT_I:
+        case M0_ISGE_I:
+            emit_load(b, RAX, ops[2]);
+            emit_alu(b, X86_CMP, ops[3]);
+            emit_bytes(b, "\x0F", 1);
+            emit_byte(b, 0x90 | (ops[0] == M0_ISGT_I ? CC_G : CC_GE));
+            emit_bytes(b, "\xC0\x0F\xB6\xC0", 4);           /* setcc al; movzx eax, al */
+            emit_store(b, ops[1], RAX);
+            break;
+        case M0_ADD_N:
+        case M0_SUB_N:
+        case M0_MULT_N:
+        case M0_DIV_N:
+            emit_sse(b, SSE_LOAD, ops[2]);
+            emit_sse(b, ops[0] == M0_ADD_N ? SSE_ADD
+                      : ops[0] == M0_SUB_N ? SSE_SUB
+                      : ops[0] == M0_MULT_N ? SSE_MUL
+                      :                       SSE_DIV, ops[3]);
+            emit_sse(b, SSE_STORE, ops[1]);
+            break;
+        case M0_ISGT_N:
+        case M0_ISGE_N:
+            emit_sse(b, SSE_LOAD, ops[2]);
+            emit_bytes(b, "\x66\x0F\x2F", 3);               /* comisd xmm0, [slot] */
+            emit_slot(b, 0, ops[3]);
+            emit_bytes(b, "\x0F", 1);
+            emit_byte(b, 0x90 | (ops[0] == M0_ISGT_N ? CC_A : CC_AE));
+            emit_bytes(b, "\xC0\x0F\xB6\xC0", 4);           /* setcc al; movzx eax, al */
+            emit_store(b, ops[1], RAX);
+            break;
+        case M0_ITON:
+            emit_bytes(b, "\xF2\x48\x0F\x2A", 4);           /* cvtsi2sd xmm0, [slot] */
+            emit_slot(b, 0, ops[2]);
+            emit_sse(b, SSE_STORE, ops[1]);
+            break;
+        case M0_NTOI:
+            emit_bytes(b, "\xF2\x48\x0F\x2C", 4);           /* cvttsd2si rax, [slot] */
+            emit_slot(b, RAX, ops[2]);
+            emit_store(b, ops[1], RAX);
+            break;
+        case M0_SET:
+            emit_load(b, RAX, ops[2]);
+            emit_store(b, ops[1], RAX);
+            break;
+        case M0_SET_IMM:
+            emit_store_imm(b, ops[1], ops[2] * 256 + ops[3]);
+            break;
+        case M0_DEREF:
+            emit_load(b, RAX, ops[2]);
+            emit_load(b, RCX, ops[3]);
+            emit_bytes(b, "\x48\x8B\x04\xC8", 4);           /* mov rax, [rax + rcx * 8] */
+            emit_store(b, ops[1], RAX);
+            break;
+        case M0_GET_BYTE:
+            emit_load(b, RAX, ops[2]);
+            emit_load(b, RCX, ops[3]);
+            emit_bytes(b, "\x0F\xB6\x04\x08", 4);           /* movzx eax, byte [rax + rcx] */
+            emit_store(b, ops[1], RAX);
+            break;
+        case M0_GET_WORD:
+            emit_load(b, RAX, ops[2]);
+            emit_load(b, RCX, ops[3]);
+            emit_bytes(b, "\x48\x63\x04\x88", 4);           /* movsxd rax, dword [rax + rcx * 4] */
+            emit_store(b, ops[1], RAX);
+            break;
+        case M0_SET_REF:
+        case M0_SET_BYTE:
+        case M0_SET_WORD:
+            /* the store may hit this frame's PC, so set it as the interpreter would. */
+            emit_store_imm(b, M0_PC, nextpc);
+            emit_load(b, RAX, ops[1]);
+            emit_load(b, RCX, ops[2]);
+            emit_load(b, RDX, ops[3]);
+            if (ops[0] == M0_SET_REF)
+                emit_bytes(b, "\x48\x89\x14\xC8", 4);       /* mov [rax + rcx * 8], rdx */
+            else if (ops[0] == M0_SET_BYTE)
+                emit_bytes(b, "\x88\x14\x08", 3);           /* mov [rax + rcx], dl */
+            else
+                emit_bytes(b, "\x89\x14\x88", 3);           /* mov [rax + rcx * 4], edx */
+            emit_bytes(b, "\x4C\x89\xE7", 3);               /* mov rdi, r12 */
+            emit_bytes(b, "\x48\x89\xC6", 3);               /* mov rsi, rax */
+            emit_call(b, ops[0] == M0_SET_REF ? (void *)jit_barrier : (void *)jit_barrier_mem);
+            emit_check_frame(b, nextpc);
+            break;
+        case M0_GC_ALLOC:
+            emit_bytes(b, "\x4C\x89\xE7", 3);               /* mov rdi, r12 */
+            emit_bytes(b, "\x48\x89\xDE", 3);               /* mov rsi, rbx */
+            emit_bytes(b, "\x48\xBA", 2);                   /* mov rdx, ops */
+            emit_u64(b, (uint64_t)ops);
+            emit_call(b, (void *)jit_gc_alloc);
+            emit_bytes(b, "\x48\x89\xC3", 3);               /* mov rbx, rax */
+            break;
+        case M0_PRINT_S:
+        case M0_PRINT_I:
+        case M0_PRINT_N:
+            emit_load(b, RDI, ops[1]);
+            emit_load(b, RSI, ops[2]);
+            emit_byte(b, 0xBA);                             /* mov edx, op */
+            emit_u32(b, ops[0]);
+            emit_call(b, (void *)jit_print);
+            break;
+        default:
+            return 0;
+    }
+    return 1;
+}
+
+int
+m0_jit_compile(M0_Interp *interp, M0_Chunk *chunk) {
+    jit_buf  b;
+    unsigned pc;
+    void    *mem;
+
+    (void)interp;
+    assert(chunk->jitcode == NULL);
+
+    memset(&b, 0, sizeof(jit_buf));
+    b.size = (chunk->num_instrs + 2) * MAX_INSTR_SIZE;
+    mem    = mmap(NULL, b.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return 0;
+
+    b.code   = (unsigned char *)mem;
+    b.fixups = (jit_fixup *)malloc((chunk->num_instrs + 1) * sizeof(jit_fixup));
+    chunk->jitoffsets = (uint32_t *)malloc((chunk->num_instrs + 1) * sizeof(uint32_t));
+    if (b.fixups == NULL || chunk->jitoffsets == NULL)
+        m0_fatal("out of memory");
+
+    /* prologue: push rbp; push rbx; push r12; mov rbx, rdi; mov r12, rsi; jmp rdx */
+    emit_bytes(&b, "\x55\x53\x41\x54\x48\x89\xFB\x49\x89\xF4\xFF\xE2", 12);
+
+    /* epilogue: mov rax, rbx; pop r12; pop rbx; pop rbp; ret */
+    b.epilogue = b.pos;
+    emit_bytes(&b, "\x48\x89\xD8\x41\x5C\x5B\x5D\xC3", 8);
+
+    for (pc = 0; pc < chunk->num_instrs; pc++) {
+        chunk->jitoffsets[pc] = (uint32_t)b.pos;
+        if (!emit_instr(&b, chunk, pc))
+            emit_exit(&b, pc);
+    }
+
+    /* running off the end. */
+    chunk->jitoffsets[pc] = (uint32_t)b.pos;
+    emit_exit(&b, pc);
+
+    for (pc = 0; pc < b.num_fixups; pc++) {
+        jit_fixup *f      = &b.fixups[pc];
+        uint32_t   rel    = (uint32_t)(chunk->jitoffsets[f->pc] - (f->pos + 4));
+        memcpy(b.code + f->pos, &rel, sizeof(uint32_t));
+    }
+    free(b.fixups);
+
+    if (mprotect(mem, b.size, PROT_READ | PROT_EXEC) != 0)
+        m0_fatal("jit: cannot make code executable");
+
+    chunk->jitcode = mem;
+    chunk->jitsize = b.size;
+    return 1;
+}
+
+uint64_t *
+m0_jit_run(M0_Interp *interp, uint64_t *cf) {
+    M0_Chunk     *chunk = (M0_Chunk *)cf[M0_CHUNK];
+    jit_function  code  = (jit_function)chunk->jitcode;
+    uint64_t      pc    = cf[M0_PC];
+
+    assert(code != NULL);
+    assert(pc < chunk->num_instrs);
+
+    cf         = code(cf, interp, (unsigned char *)chunk->jitcode + chunk->jitoffsets[pc]);
+    interp->cf = cf;
+    return cf;
+}
+
+void
+m0_jit_free(M0_Chunk *chunk) {
+    if (chunk->jitcode != NULL)
+        munmap(chunk->jitcode, chunk->jitsize);
+    free(chunk->jitoffsets);
+    chunk->jitcode    = NULL;
+    chunk->jitoffsets = NULL;
+}
+
+#else /* no JIT for this platform. */
+
+int
+m0_jit_compile(M0_Interp *interp, M0_Chunk *chunk) {
+    (void)interp;
+    (void)chunk;
+    return 0;
+}
+
+uint64_t *
+m0_jit_run(M0_Interp *interp, uint64_t *cf) {
+    (void)interp;
+    assert(0);
+    return cf;
+}
+
+void
+m0_jit_free(M0_Chunk *chunk) {
+    (void)chunk;
+}
+
+#endif
+
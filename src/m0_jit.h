@@ -0,0 +1,29 @@
+#ifndef __M0_JIT_H__
+#define __M0_JIT_H__
+
+#include <stdint.h>
+#include "m0_interp.h"
+
+/*
+
+Baseline template JIT for M0. Once a chunk is hot (see M0_JIT_THRESHOLD),
+its bytecode is translated into x86-64 machine code, one template per
+instruction. The generated code works directly on the call frame, and
+returns to the interpreter for instructions it does not handle.
+
+*/
+
+/* default number of invocations and backward jumps after which a chunk is compiled. */
+#define M0_JIT_THRESHOLD    100
+
+/* Compile chunk; returns 0 if that's not possible. */
+extern int       m0_jit_compile(M0_Interp *interp, M0_Chunk *chunk);
+
+/* Run compiled code for cf's CHUNK from its PC, until the compiled
+   code gives up control. Returns the current call frame. */
+extern uint64_t *m0_jit_run(M0_Interp *interp, uint64_t *cf);
+
+extern void      m0_jit_free(M0_Chunk *chunk);
+
+#endif
+
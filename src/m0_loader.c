@@ -0,0 +1,594 @@
+/*
+
+Loader for M0 assembly, as generated by the M1 compiler.
+
+The file is translated directly into the in-memory chunk representation;
+there is no separate assembly step. The format is:
+
+    .version 0
+    .chunk "name"
+    .constants
+    0 "a string"
+    1 &otherchunk
+    2 42
+    3 3.140000
+    .metadata
+    line 3
+    lines 0:+0 1:+1
+    .bytecode
+        set_imm I0, 0, 1
+    L1:
+        goto_if L1, I0
+
+Operands are registers (I0, N3, S1, P2), special registers (CF, PC,
+CONSTS, etc.), integers 0-255, "x" for unused operands, or labels for the
+goto and goto_if instructions. A label is translated into two operands,
+the high and low byte of the target PC.
+
+The metadata segment holds the source line table: the line of the chunk,
+and pairs of PC and line deltas (see gencode_metadata() in gencode.c).
+Other metadata is ignored.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include "m0_interp.h"
+#include "m0_ops.h"
+
+typedef struct m0_opinfo {
+    char const *name;
+    int         opcode;
+} m0_opinfo;
+
+static const m0_opinfo opinfo[] = {
+    { "noop",        M0_NOOP },
+    { "goto",        M0_GOTO },
+    { "goto_if",     M0_GOTO_IF },
+    { "goto_chunk",  M0_GOTO_CHUNK },
+    { "add_i",       M0_ADD_I },
+    { "add_n",       M0_ADD_N },
+    { "sub_i",       M0_SUB_I },
+    { "sub_n",       M0_SUB_N },
+    { "mult_i",      M0_MULT_I },
+    { "mult_n",      M0_MULT_N },
+    { "div_i",       M0_DIV_I },
+    { "div_n",       M0_DIV_N },
+    { "mod_i",       M0_MOD_I },
+    { "mod_n",       M0_MOD_N },
+    { "iton",        M0_ITON },
+    { "ntoi",        M0_NTOI },
+    { "ashr",        M0_ASHR },
+    { "lshr",        M0_LSHR },
+    { "shl",         M0_SHL },
+    { "and",         M0_AND },
+    { "or",          M0_OR },
+    { "xor",         M0_XOR },
+    { "gc_alloc",    M0_GC_ALLOC },
+    { "sys_alloc",   M0_SYS_ALLOC },
+    { "sys_free",    M0_SYS_FREE },
+    { "copy_mem",    M0_COPY_MEM },
+    { "set",         M0_SET },
+    { "set_imm",     M0_SET_IMM },
+    { "deref",       M0_DEREF },
+    { "set_ref",     M0_SET_REF },
+    { "set_byte",    M0_SET_BYTE },
+    { "get_byte",    M0_GET_BYTE },
+    { "set_word",    M0_SET_WORD },
+    { "get_word",    M0_GET_WORD },
+    { "csym",        M0_CSYM },
+    { "ccall_arg",   M0_CCALL_ARG },
+    { "ccall_ret",   M0_CCALL_RET },
+    { "ccall",       M0_CCALL },
+    { "print_s",     M0_PRINT_S },
+    { "print_i",     M0_PRINT_I },
+    { "print_n",     M0_PRINT_N },
+    { "exit",        M0_EXIT },
+    { "isgt_i",      M0_ISGT_I },
+    { "isge_i",      M0_ISGE_I },
+    { "isgt_n",      M0_ISGT_N },
+    { "isge_n",      M0_ISGE_N },
+    /* names used by the M1 compiler for the conversion ops. */
+    { "convert_i_n", M0_NTOI },
+    { "convert_n_i", M0_ITON },
+    { NULL,          0 }
+};
+
+static char const * const special_regs[] = {
+    "CF", "PCF", "PC", "RETPC", "EH", "CHUNK", "CONSTS", "MDS", "BCS", "INTERP", "SPILLCF", NULL
+};
+
+/* a reference to a label that can only be filled in at the end of the chunk. */
+typedef struct m0_fixup {
+    unsigned instr;
+    unsigned label;
+    unsigned line;
+} m0_fixup;
+
+typedef struct m0_loader {
+    char const *filename;
+    unsigned    line;
+    M0_Interp  *interp;
+    M0_Chunk   *chunk;
+    M0_Chunk   *lastchunk;
+
+    unsigned    instr_size;       /* allocated number of instructions in chunk */
+    unsigned    const_size;       /* allocated number of constants in chunk */
+    unsigned    line_size;        /* allocated number of line table entries in chunk */
+
+    int        *labels;           /* label number -> PC in current chunk; -1 if undefined */
+    unsigned    num_labels;
+    m0_fixup   *fixups;
+    unsigned    num_fixups;
+    unsigned    fixup_size;
+} m0_loader;
+
+static void
+load_error(m0_loader *l, char const *msg, char const *arg) {
+    m0_fatal("%s:%u: %s '%s'", l->filename, l->line, msg, arg);
+}
+
+static void *
+grow(void *ptr, unsigned *size, unsigned needed, size_t elemsize) {
+    unsigned newsize = *size ? *size : 16;
+
+    if (needed <= *size)
+        return ptr;
+
+    while (newsize < needed)
+        newsize *= 2;
+
+    ptr = realloc(ptr, newsize * elemsize);
+    if (ptr == NULL) {
+        m0_fatal("out of memory");
+    }
+    memset((char *)ptr + *size * elemsize, 0, (newsize - *size) * elemsize);
+    *size = newsize;
+    return ptr;
+}
+
+static char *
+trim(char *s) {
+    char *end;
+
+    while (isspace((unsigned char)*s))
+        s++;
+
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1]))
+        *--end = '\0';
+
+    return s;
+}
+
+/* Unescape the string literal (including quotes) at s. */
+static char *
+parse_string(m0_loader *l, char const *s) {
+    char  *str = (char *)malloc(strlen(s) + 1);
+    char  *out = str;
+
+    assert(*s == '"');
+    s++;
+    while (*s != '"') {
+        if (*s == '\0')
+            load_error(l, "unterminated string", s);
+
+        if (*s == '\\') {
+            s++;
+            switch (*s) {
+                case 'n':  *out++ = '\n'; break;
+                case 't':  *out++ = '\t'; break;
+                case 'r':  *out++ = '\r'; break;
+                case '\\': *out++ = '\\'; break;
+                case '"':  *out++ = '"';  break;
+                case '0': case '1': case '2': case '3':
+                case '4': case '5': case '6': case '7':
+                {
+                    /* up to 3 octal digits, as in C. */
+                    int value = 0;
+                    int i;
+                    for (i = 0; i < 3 && *s >= '0' && *s <= '7'; i++)
+                        value = value * 8 + (*s++ - '0');
+                    *out++ = (char)value;
+                    continue;
+                }
+                default:
+                    *out++ = '\\';
+                    *out++ = *s;
+                    break;
+            }
+            s++;
+        }
+        else {
+            *out++ = *s++;
+        }
+    }
+    *out = '\0';
+    return str;
+}
+
+static void
+parse_constant(m0_loader *l, char *line) {
+    M0_Chunk *c = l->chunk;
+    char     *value;
+    long      index = strtol(line, &value, 10);
+
+    if (value == line || index < 0)
+        load_error(l, "invalid constant", line);
+
+    value = trim(value);
+
+    if ((unsigned)index >= l->const_size) {
+        unsigned size   = l->const_size;
+        c->constants    = (uint64_t *)grow(c->constants, &size, index + 1, sizeof(uint64_t));
+        size            = l->const_size;
+        c->const_types  = (unsigned char *)grow(c->const_types, &size, index + 1, sizeof(unsigned char));
+        size            = l->const_size;
+        c->const_chunks = (char **)grow(c->const_chunks, &size, index + 1, sizeof(char *));
+        l->const_size   = size;
+    }
+    if ((unsigned)index >= c->num_consts)
+        c->num_consts = index + 1;
+
+    if (*value == '"') {
+        c->constants[index]   = (uint64_t)parse_string(l, value);
+        c->const_types[index] = M0_CONST_STR;
+    }
+    else if (*value == '&') {
+        c->const_chunks[index] = strdup(value + 1);
+        c->const_types[index]  = M0_CONST_CHUNK;
+    }
+    else if (strpbrk(value, ".eE") != NULL) {
+        double d = strtod(value, NULL);
+        memcpy(&c->constants[index], &d, sizeof(double));
+        c->const_types[index] = M0_CONST_NUM;
+    }
+    else {
+        char   *end;
+        int64_t i = strtoll(value, &end, 10);
+        if (end == value || *end != '\0')
+            load_error(l, "invalid constant", value);
+        c->constants[index]   = (uint64_t)i;
+        c->const_types[index] = M0_CONST_INT;
+    }
+}
+
+/* Parse a "lines" row of the line table; entries are delta-encoded. */
+static void
+parse_lines(m0_loader *l, char *row) {
+    M0_Chunk *c = l->chunk;
+    char     *entry;
+
+    for (entry = strtok(row, " \t"); entry != NULL; entry = strtok(NULL, " \t")) {
+        M0_LineEntry *prev = c->num_lines > 0 ? &c->lines[c->num_lines - 1] : NULL;
+        char         *end;
+        long          dpc   = strtol(entry, &end, 10);
+        long          dline;
+
+        if (end == entry || *end != ':' || dpc < 0)
+            load_error(l, "invalid line table entry", entry);
+        dline = strtol(end + 1, &end, 10);
+        if (*end != '\0')
+            load_error(l, "invalid line table entry", entry);
+
+        c->lines = (M0_LineEntry *)grow(c->lines, &l->line_size, c->num_lines + 1, sizeof(M0_LineEntry));
+        c->lines[c->num_lines].pc   = (uint32_t)((prev ? prev->pc : 0) + dpc);
+        c->lines[c->num_lines].line = (uint32_t)((long)(prev ? prev->line : c->line) + dline);
+        ++c->num_lines;
+    }
+}
+
+static void
+parse_metadata(m0_loader *l, char *line) {
+    if (strncmp(line, "lines ", 6) == 0)
+        parse_lines(l, line + 6);
+    else if (strncmp(line, "line ", 5) == 0)
+        l->chunk->line = (unsigned)strtoul(line + 5, NULL, 10);
+}
+
+/* Parse a single operand; registers are translated into their frame index. */
+static unsigned char
+parse_operand(m0_loader *l, char *op) {
+    int i;
+
+    if (strcmp(op, "x") == 0)
+        return 0;
+
+    if (strchr("INSP", op[0]) != NULL && isdigit((unsigned char)op[1])) {
+        static const int base[] = { M0_REG_I0, M0_REG_N0, M0_REG_S0, M0_REG_P0 };
+        int regno = atoi(op + 1);
+        if (regno > M0_REG_N0 - M0_REG_I0 - 1)
+            load_error(l, "invalid register", op);
+        return (unsigned char)(base[strchr("INSP", op[0]) - "INSP"] + regno);
+    }
+
+    for (i = 0; special_regs[i] != NULL; i++) {
+        if (strcmp(op, special_regs[i]) == 0)
+            return (unsigned char)i;
+    }
+
+    if (isdigit((unsigned char)op[0])) {
+        char *end;
+        long  value = strtol(op, &end, 10);
+        if (*end != '\0' || value > 255)
+            load_error(l, "invalid operand", op);
+        return (unsigned char)value;
+    }
+
+    load_error(l, "invalid operand", op);
+    return 0;
+}
+
+static void
+add_fixup(m0_loader *l, char *label) {
+    if (label[0] != 'L' || !isdigit((unsigned char)label[1]))
+        load_error(l, "invalid label", label);
+
+    l->fixups = (m0_fixup *)grow(l->fixups, &l->fixup_size, l->num_fixups + 1, sizeof(m0_fixup));
+    l->fixups[l->num_fixups].instr = l->chunk->num_instrs;
+    l->fixups[l->num_fixups].label = (unsigned)atoi(label + 1);
+    l->fixups[l->num_fixups].line  = l->line;
+    ++l->num_fixups;
+}
+
+static void
+define_label(m0_loader *l, char *label) {
+    unsigned n = (unsigned)atoi(label + 1);
+    unsigned i;
+
+    if (n >= l->num_labels) {
+        unsigned oldsize = l->num_labels;
+        l->labels = (int *)grow(l->labels, &l->num_labels, n + 1, sizeof(int));
+        for (i = oldsize; i < l->num_labels; i++)
+            l->labels[i] = -1;
+    }
+    l->labels[n] = (int)l->chunk->num_instrs;
+}
+
+static void
+parse_instruction(m0_loader *l, char *line) {
+    M0_Chunk      *c = l->chunk;
+    unsigned char *instr;
+    char          *name = line;
+    char          *args;
+    char          *operands[3];
+    int            num_operands = 0;
+    int            i;
+
+    while (*line != '\0' && !isspace((unsigned char)*line))
+        line++;
+    if (*line != '\0')
+        *line++ = '\0';
+    args = trim(line);
+
+    if (*args != '\0') {
+        char *arg = strtok(args, ",");
+        while (arg != NULL) {
+            if (num_operands == 3)
+                load_error(l, "too many operands for", name);
+            operands[num_operands++] = trim(arg);
+            arg = strtok(NULL, ",");
+        }
+    }
+
+    for (i = 0; opinfo[i].name != NULL; i++) {
+        if (strcmp(opinfo[i].name, name) == 0)
+            break;
+    }
+    if (opinfo[i].name == NULL)
+        load_error(l, "unknown instruction", name);
+
+    c->bytecode = (unsigned char *)grow(c->bytecode, &l->instr_size, c->num_instrs + 1, M0_INSTR_SIZE);
+    instr       = c->bytecode + c->num_instrs * M0_INSTR_SIZE;
+    instr[0]    = (unsigned char)opinfo[i].opcode;
+
+    if ((instr[0] == M0_GOTO || instr[0] == M0_GOTO_IF) && num_operands > 0 && operands[0][0] == 'L') {
+        add_fixup(l, operands[0]);
+        if (num_operands > 1)
+            instr[3] = parse_operand(l, operands[1]);
+    }
+    else {
+        for (i = 0; i < num_operands; i++)
+            instr[i + 1] = parse_operand(l, operands[i]);
+    }
+
+    ++c->num_instrs;
+}
+
+/* Resolve the label references in the chunk that was just loaded. */
+static void
+finish_chunk(m0_loader *l) {
+    unsigned i;
+
+    if (l->chunk == NULL)
+        return;
+
+    for (i = 0; i < l->num_fixups; i++) {
+        m0_fixup      *f     = &l->fixups[i];
+        unsigned char *instr = l->chunk->bytecode + f->instr * M0_INSTR_SIZE;
+        int            pc;
+
+        if (f->label >= l->num_labels || l->labels[f->label] < 0)
+            m0_fatal("%s:%u: undefined label 'L%u'", l->filename, f->line, f->label);
+
+        pc = l->labels[f->label];
+        if (pc > 0xffff)
+            m0_fatal("%s:%u: jump target too far", l->filename, f->line);
+
+        instr[1] = (unsigned char)(pc >> 8);
+        instr[2] = (unsigned char)(pc & 0xff);
+    }
+    l->num_fixups = 0;
+
+    for (i = 0; i < l->num_labels; i++)
+        l->labels[i] = -1;
+
+    for (i = 0; i < l->chunk->num_lines; i++) {
+        if (l->chunk->lines[i].pc > l->chunk->num_instrs)
+            m0_fatal("%s: line table of chunk '%s' is out of range", l->filename, l->chunk->name);
+    }
+}
+
+static void
+start_chunk(m0_loader *l, char *name) {
+    M0_Chunk *c = (M0_Chunk *)calloc(1, sizeof(M0_Chunk));
+    char     *end;
+
+    finish_chunk(l);
+
+    name = trim(name);
+    if (*name != '"' || (end = strchr(name + 1, '"')) == NULL)
+        load_error(l, "invalid chunk name", name);
+    *end = '\0';
+
+    c->magic = M0_CHUNK_MAGIC;
+    c->name  = strdup(name + 1);
+    c->id    = l->interp->num_chunks++;
+
+    if (l->interp->chunks == NULL || (uintptr_t)c < l->interp->chunks_lo)
+        l->interp->chunks_lo = (uintptr_t)c;
+    if ((uintptr_t)c > l->interp->chunks_hi)
+        l->interp->chunks_hi = (uintptr_t)c;
+
+    if (l->lastchunk == NULL)
+        l->interp->chunks = c;
+    else
+        l->lastchunk->next = c;
+
+    l->lastchunk  = c;
+    l->chunk      = c;
+    l->instr_size = 0;
+    l->const_size = 0;
+    l->line_size  = 0;
+}
+
+static void
+resolve_chunk_constants(M0_Interp *interp) {
+    M0_Chunk *iter;
+    unsigned  i;
+
+    for (iter = interp->chunks; iter != NULL; iter = iter->next) {
+        for (i = 0; i < iter->num_consts; i++) {
+            if (iter->const_types[i] == M0_CONST_CHUNK) {
+                M0_Chunk *target = m0_find_chunk(interp, iter->const_chunks[i]);
+                if (target == NULL)
+                    m0_fatal("chunk '%s' referenced from '%s' not found",
+                             iter->const_chunks[i], iter->name);
+                iter->constants[i] = (uint64_t)target;
+            }
+        }
+    }
+}
+
+M0_Chunk *
+m0_find_chunk(M0_Interp *interp, char const *name) {
+    M0_Chunk *iter;
+
+    for (iter = interp->chunks; iter != NULL; iter = iter->next) {
+        if (strcmp(iter->name, name) == 0)
+            return iter;
+    }
+    return NULL;
+}
+
+/* Source line of the instruction at pc in chunk; 0 if unknown. */
+unsigned
+m0_chunk_line(M0_Chunk *chunk, uint64_t pc) {
+    unsigned lo = 0;
+    unsigned hi = chunk->num_lines;
+
+    /* find the last entry at or before pc. */
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (chunk->lines[mid].pc <= pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 ? chunk->lines[lo - 1].line : chunk->line;
+}
+
+int
+m0_load_file(M0_Interp *interp, char const *filename) {
+    FILE *fp = fopen(filename, "r");
+
+    if (fp == NULL)
+        return 0;
+
+    m0_load_stream(interp, fp, filename);
+    fclose(fp);
+    return 1;
+}
+
+/*
+
+Load the M0 assembly in fp; filename is only used in error messages.
+
+*/
+void
+m0_load_stream(M0_Interp *interp, FILE *fp, char const *filename) {
+    enum { SEG_NONE, SEG_CONSTANTS, SEG_METADATA, SEG_BYTECODE } segment = SEG_NONE;
+    m0_loader  l;
+    char       buffer[4096];
+
+    memset(&l, 0, sizeof(m0_loader));
+    l.filename = filename;
+    l.interp   = interp;
+
+    while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+        char *line = trim(buffer);
+        ++l.line;
+
+        if (*line == '\0' || *line == '#')
+            continue;
+
+        if (strncmp(line, ".version", 8) == 0) {
+            if (atoi(line + 8) != 0)
+                load_error(&l, "unsupported version", line + 8);
+        }
+        else if (strncmp(line, ".chunk", 6) == 0) {
+            start_chunk(&l, line + 6);
+            segment = SEG_NONE;
+        }
+        else if (l.chunk == NULL) {
+            load_error(&l, "expected .chunk, got", line);
+        }
+        else if (strcmp(line, ".constants") == 0) {
+            segment = SEG_CONSTANTS;
+        }
+        else if (strcmp(line, ".metadata") == 0) {
+            segment = SEG_METADATA;
+        }
+        else if (strcmp(line, ".bytecode") == 0) {
+            segment = SEG_BYTECODE;
+        }
+        else if (segment == SEG_CONSTANTS) {
+            parse_constant(&l, line);
+        }
+        else if (segment == SEG_METADATA) {
+            parse_metadata(&l, line);
+        }
+        else if (segment == SEG_BYTECODE) {
+            size_t len = strlen(line);
+            if (line[0] == 'L' && line[len - 1] == ':') {
+                line[len - 1] = '\0';
+                define_label(&l, line);
+            }
+            else {
+                parse_instruction(&l, line);
+            }
+        }
+        else {
+            load_error(&l, "unexpected line", line);
+        }
+    }
+
+    finish_chunk(&l);
+    free(l.labels);
+    free(l.fixups);
+
+    resolve_chunk_constants(interp);
+}
+
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "m0_interp.h"
+#include "m0_profile.h"
+
+static void
+usage(void) {
+    fprintf(stderr, "Usage: m0 [--jit=on|off] [--jit-threshold=<n>] [--instr-count]\n"
+                    "          [--profile[=<file>]] [--profile-interval=<us>] <file.m0>\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[]) {
+    M0_Interp     *interp;
+    M0_Chunk      *entry;
+    char          *filename = NULL;
+    char          *profile  = NULL;
+    unsigned long  interval = M0_PROFILE_INTERVAL;
+    int            count    = 0;
+    int            exitcode;
+    int            i;
+
+    interp      = m0_new_interp();
+    interp->jit = 1;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--jit=on") == 0)
+            interp->jit = 1;
+        else if (strcmp(argv[i], "--jit=off") == 0)
+            interp->jit = 0;
+        else if (strncmp(argv[i], "--jit-threshold=", 16) == 0)
+            interp->jit_threshold = strtoul(argv[i] + 16, NULL, 10);
+        else if (strcmp(argv[i], "--instr-count") == 0)
+            count = 1;
+        else if (strcmp(argv[i], "--profile") == 0)
+            profile = "m0.folded";
+        else if (strncmp(argv[i], "--profile=", 10) == 0)
+            profile = argv[i] + 10;
+        else if (strncmp(argv[i], "--profile-interval=", 19) == 0)
+            interval = strtoul(argv[i] + 19, NULL, 10);
+        else if (argv[i][0] == '-' || filename != NULL)
+            usage();
+        else
+            filename = argv[i];
+    }
+
+    if (filename == NULL)
+        usage();
+
+    if (!m0_load_file(interp, filename)) {
+        fprintf(stderr, "Could not open file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    entry = m0_find_chunk(interp, "main");
+    if (entry == NULL) {
+        fprintf(stderr, "No chunk 'main' in %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    /* profile the interpreter; compiled code isn't sampled. */
+    if (profile != NULL) {
+        if (interval == 0)
+            usage();
+        interp->jit = 0;
+        m0_profile_start(interp, profile, interval);
+    }
+
+    /* only the interpreter counts instructions. */
+    if (count)
+        interp->jit = 0;
+
+    exitcode = m0_run(interp, entry);
+    m0_profile_finish(interp);
+
+    if (count)
+        fprintf(stderr, "# instructions: %llu\n", (unsigned long long)interp->instrs);
+
+    fflush(stdout);
+    m0_delete_interp(interp);
+    return exitcode;
+}
+
@@ -0,0 +1,123 @@
+/*
+
+Runtime for C code generated by "m1 --emit-c".
+
+The generated file defines one function per chunk and a main() that calls
+m0_native_run(). A chunk function returns whenever control leaves the chunk
+for one that it can't call directly; m0_native_run() then calls the
+function of the chunk to continue in, until the program stops.
+
+Link a generated file with m0_native.o, m0_gc.o and m0_util.o (see the
+libm0native.a target in the Makefile).
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "m0_native.h"
+#include "m0_gc.h"
+
+int
+m0_native_run(M0_NativeChunk *chunks, unsigned num_chunks, unsigned entry) {
+    M0_Native  rt;
+    M0_Interp *interp = (M0_Interp *)calloc(1, sizeof(M0_Interp));
+    uint64_t  *cf;
+
+    if (interp == NULL)
+        m0_fatal("out of memory");
+
+    interp->heap  = gc_new_heap();
+    rt.interp     = interp;
+    rt.chunks     = chunks;
+    rt.num_chunks = num_chunks;
+
+    cf            = (uint64_t *)gc_alloc(interp, M0_NUM_REGS * sizeof(uint64_t), 0);
+    cf[M0_CF]     = (uint64_t)cf;
+    cf[M0_INTERP] = (uint64_t)interp;
+    interp->cf    = cf;
+    (void)gc_frame_switch(interp->heap, NULL, cf);
+
+    m0_native_enter(&rt, cf, &chunks[entry], 0);
+    while (rt.next != NULL)
+        cf = rt.next->fn(&rt, cf, rt.next_pc);
+
+    m0_native_exit(&rt, 0);
+    return 0;
+}
+
+void
+m0_native_goto_chunk(M0_Native *rt, uint64_t *cf, uint64_t target, uint64_t targetpc,
+                     char const *chunk, uint64_t pc) {
+    M0_NativeChunk *c = (M0_NativeChunk *)target;
+
+    if (c < rt->chunks || c >= rt->chunks + rt->num_chunks)
+        m0_native_error("goto_chunk: not a chunk", chunk, pc);
+
+    m0_native_enter(rt, cf, c, targetpc);
+}
+
+/* continue in the frame that CF of cf points to. */
+uint64_t *
+m0_native_switch(M0_Native *rt, uint64_t *cf, char const *chunk, uint64_t pc) {
+    uint64_t *newcf = (uint64_t *)cf[M0_CF];
+
+    if (!gc_frame_switch(rt->interp->heap, cf, newcf))
+        m0_native_error("invalid call frame", chunk, pc);
+
+    rt->interp->cf = newcf;
+    return newcf;
+}
+
+/* allocate memory into register dest; returns the current frame, which may have moved. */
+uint64_t *
+m0_native_gc_alloc(M0_Native *rt, uint64_t *cf, unsigned dest, uint64_t size, uint64_t flags) {
+    void *mem;
+
+    rt->interp->cf = cf;
+    mem            = gc_alloc(rt->interp, size, flags);
+    cf             = rt->interp->cf;
+    cf[dest]       = (uint64_t)mem;
+    return cf;
+}
+
+void
+m0_native_barrier(M0_Native *rt, uint64_t obj, uint64_t value) {
+    if (gc_is_young(rt->interp->heap, value))
+        gc_write_barrier(rt->interp->heap, obj);
+}
+
+void
+m0_native_barrier_mem(M0_Native *rt, uint64_t obj) {
+    gc_write_barrier(rt->interp->heap, obj);
+}
+
+void
+m0_native_print(uint64_t handle, uint64_t value, int op) {
+    FILE *out = handle == 2 ? stderr : stdout;
+
+    switch (op) {
+        case M0_PRINT_S:
+            fputs((char *)value, out);
+            break;
+        case M0_PRINT_I:
+            fprintf(out, "%" PRId64, (int64_t)value);
+            break;
+        default:
+            fprintf(out, "%f", m0_native_get_n(value));
+            break;
+    }
+}
+
+void
+m0_native_exit(M0_Native *rt, int64_t code) {
+    fflush(stdout);
+    gc_delete_heap(rt->interp->heap);
+    free(rt->interp);
+    exit((int)code);
+}
+
+void
+m0_native_error(char const *msg, char const *chunk, uint64_t pc) {
+    m0_fatal("%s in chunk '%s' at PC %lu", msg, chunk, (unsigned long)pc);
+}
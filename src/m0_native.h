@@ -0,0 +1,87 @@
+#ifndef __M0_NATIVE_H__
+#define __M0_NATIVE_H__
+
+#include <stdint.h>
+#include <string.h>
+#include "m0_interp.h"
+#include "m0_ops.h"
+
+/*
+
+Runtime support for C code generated by "m1 --emit-c" (see emitc.c).
+
+Every chunk becomes a C function that runs the chunk from a given PC in
+call frame cf, and returns the current call frame once control leaves the
+chunk: next then holds the chunk to continue in and next_pc the PC in it,
+or next is NULL if the program stopped. Call frames are the same
+gc_alloc'ed arrays of 256 slots as in the interpreter, so the generated
+code follows the same calling conventions and uses the same collector.
+
+*/
+
+typedef struct M0_Native M0_Native;
+
+typedef uint64_t *(*m0_native_fn)(M0_Native *rt, uint64_t *cf, uint64_t pc);
+
+typedef struct M0_NativeChunk {
+    char const      *name;
+    m0_native_fn     fn;
+    uint64_t        *constants;
+} M0_NativeChunk;
+
+struct M0_Native {
+    M0_Interp       *interp;      /* the heap, and the current frame while collecting */
+    M0_NativeChunk  *chunks;
+    unsigned         num_chunks;
+
+    M0_NativeChunk  *next;        /* where to continue; NULL when done */
+    uint64_t         next_pc;
+};
+
+/* run chunks[entry] in a new call frame; returns the exit code. */
+extern int       m0_native_run(M0_NativeChunk *chunks, unsigned num_chunks, unsigned entry);
+
+/* helpers for the generated code; chunk and pc are only used in error messages. */
+extern void      m0_native_goto_chunk(M0_Native *rt, uint64_t *cf, uint64_t target, uint64_t targetpc,
+                                      char const *chunk, uint64_t pc);
+extern uint64_t *m0_native_switch(M0_Native *rt, uint64_t *cf, char const *chunk, uint64_t pc);
+extern uint64_t *m0_native_gc_alloc(M0_Native *rt, uint64_t *cf, unsigned dest, uint64_t size, uint64_t flags);
+extern void      m0_native_barrier(M0_Native *rt, uint64_t obj, uint64_t value);
+extern void      m0_native_barrier_mem(M0_Native *rt, uint64_t obj);
+extern void      m0_native_print(uint64_t handle, uint64_t value, int op);
+extern void      m0_native_exit(M0_Native *rt, int64_t code);
+extern void      m0_native_error(char const *msg, char const *chunk, uint64_t pc);
+
+/* make target the running chunk of cf, continuing at targetpc. */
+static inline void
+m0_native_enter(M0_Native *rt, uint64_t *cf, M0_NativeChunk *target, uint64_t targetpc) {
+    cf[M0_CHUNK]  = (uint64_t)target;
+    cf[M0_CONSTS] = (uint64_t)target->constants;
+    cf[M0_MDS]    = 0;
+    cf[M0_BCS]    = 0;
+    cf[M0_PC]     = targetpc;
+    rt->next      = target;
+    rt->next_pc   = targetpc;
+}
+
+static inline double
+m0_native_get_n(uint64_t v) {
+    double n;
+    memcpy(&n, &v, sizeof(double));
+    return n;
+}
+
+static inline uint64_t
+m0_native_set_n(double n) {
+    uint64_t v;
+    memcpy(&v, &n, sizeof(double));
+    return v;
+}
+
+/* shorthands used by the generated code. */
+#define M0_I(r)         ((int64_t)cf[r])
+#define M0_N(r)         m0_native_get_n(cf[r])
+#define M0_P(r)         ((void *)cf[r])
+#define M0_SET_N(r, n)  (cf[r] = m0_native_set_n(n))
+
+#endif
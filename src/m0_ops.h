@@ -45,7 +45,12 @@ enum M0_OPS {
     M0_PRINT_S,
     M0_PRINT_I,
     M0_PRINT_N,
-    M0_EXIT
+    M0_EXIT,
+    /* comparison ops generated by the M1 compiler; not in PDD32. */
+    M0_ISGT_I,
+    M0_ISGE_I,
+    M0_ISGT_N,
+    M0_ISGE_N
 };
 
 /*                      
@@ -0,0 +1,288 @@
+/*
+
+Sampling profiler for the M0 interpreter; see m0_profile.h.
+
+A sample walks the current frame and its parents through PCF. For the
+current frame, the instruction at PC is about to run; for its parents, PC
+is the instruction after the one that switched to the child frame, so the
+call site is at PC - 1. Every frame is written as chunk:line, using the line
+table from the chunk's metadata, or just the chunk name if there is none.
+
+Distinct stacks are counted in a hash table keyed by their folded text.
+A chunk's self count is the number of samples in which it was running; its
+total count is the number of samples in which it was anywhere on the stack.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+#include "m0_profile.h"
+#include "m0_gc.h"
+
+#define MAX_DEPTH   256
+
+typedef struct m0_stack_count {
+    char          *stack;    /* folded frames, outermost first */
+    unsigned long  count;
+} m0_stack_count;
+
+struct M0_Profile {
+    char const       *filename;
+    unsigned long     interval;
+    unsigned long     samples;
+
+    m0_stack_count   *stacks;      /* open addressing; size is a power of 2 */
+    unsigned          num_stacks;
+    unsigned          stack_size;
+
+    M0_Chunk        **chunks;      /* chunk id -> chunk */
+    unsigned long    *self;        /* per chunk id */
+    unsigned long    *total;
+    unsigned long    *seen;        /* sample number in which a chunk was last counted in total */
+
+    char             *buffer;      /* folded text of the current sample */
+    size_t            buffer_size;
+
+    struct sigaction  oldaction;
+};
+
+volatile sig_atomic_t m0_profile_pending = 0;
+
+static void
+on_sigprof(int sig) {
+    (void)sig;
+    m0_profile_pending = 1;
+}
+
+static void *
+profile_alloc(size_t size) {
+    void *mem = calloc(1, size);
+
+    if (mem == NULL)
+        m0_fatal("out of memory");
+    return mem;
+}
+
+void
+m0_profile_start(M0_Interp *interp, char const *filename, unsigned long interval) {
+    M0_Profile       *p = (M0_Profile *)profile_alloc(sizeof(M0_Profile));
+    M0_Chunk         *iter;
+    struct sigaction  action;
+    struct itimerval  timer;
+
+    p->filename   = filename;
+    p->interval   = interval;
+    p->stack_size = 256;
+    p->stacks     = (m0_stack_count *)profile_alloc(p->stack_size * sizeof(m0_stack_count));
+    p->chunks     = (M0_Chunk **)profile_alloc((interp->num_chunks + 1) * sizeof(M0_Chunk *));
+    p->self       = (unsigned long *)profile_alloc((interp->num_chunks + 1) * sizeof(unsigned long));
+    p->total      = (unsigned long *)profile_alloc((interp->num_chunks + 1) * sizeof(unsigned long));
+    p->seen       = (unsigned long *)profile_alloc((interp->num_chunks + 1) * sizeof(unsigned long));
+
+    for (iter = interp->chunks; iter != NULL; iter = iter->next)
+        p->chunks[iter->id] = iter;
+
+    interp->profile = p;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_sigprof;
+    action.sa_flags   = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &p->oldaction) != 0)
+        m0_fatal("cannot install the profiling signal handler");
+
+    timer.it_interval.tv_sec  = interval / 1000000;
+    timer.it_interval.tv_usec = interval % 1000000;
+    timer.it_value            = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0)
+        m0_fatal("cannot start the profiling timer");
+}
+
+static unsigned long
+hash_string(char const *s) {
+    unsigned long h = 2166136261UL;
+
+    while (*s != '\0')
+        h = (h ^ (unsigned char)*s++) * 16777619UL;
+    return h;
+}
+
+static void
+count_stack(M0_Profile *p, char const *stack) {
+    unsigned mask = p->stack_size - 1;
+    unsigned i    = (unsigned)hash_string(stack) & mask;
+
+    while (p->stacks[i].stack != NULL) {
+        if (strcmp(p->stacks[i].stack, stack) == 0) {
+            ++p->stacks[i].count;
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+
+    p->stacks[i].stack = strdup(stack);
+    p->stacks[i].count = 1;
+
+    /* keep the table at most half full. */
+    if (++p->num_stacks * 2 > p->stack_size) {
+        m0_stack_count *old     = p->stacks;
+        unsigned        oldsize = p->stack_size;
+        unsigned        j;
+
+        p->stack_size *= 2;
+        p->stacks      = (m0_stack_count *)profile_alloc(p->stack_size * sizeof(m0_stack_count));
+        mask           = p->stack_size - 1;
+
+        for (j = 0; j < oldsize; j++) {
+            if (old[j].stack == NULL)
+                continue;
+            i = (unsigned)hash_string(old[j].stack) & mask;
+            while (p->stacks[i].stack != NULL)
+                i = (i + 1) & mask;
+            p->stacks[i] = old[j];
+        }
+        free(old);
+    }
+}
+
+/* append frame to the folded text in the buffer, which holds len characters. */
+static size_t
+append_frame(M0_Profile *p, size_t len, M0_Chunk *chunk, uint64_t pc) {
+    unsigned line   = m0_chunk_line(chunk, pc);
+    size_t   needed = len + strlen(chunk->name) + 16;
+
+    if (needed > p->buffer_size) {
+        p->buffer_size = needed * 2;
+        p->buffer      = (char *)realloc(p->buffer, p->buffer_size);
+        if (p->buffer == NULL)
+            m0_fatal("out of memory");
+    }
+
+    if (line > 0)
+        return len + sprintf(p->buffer + len, "%s%s:%u", len > 0 ? ";" : "", chunk->name, line);
+    return len + sprintf(p->buffer + len, "%s%s", len > 0 ? ";" : "", chunk->name);
+}
+
+void
+m0_profile_sample(M0_Interp *interp, uint64_t *cf) {
+    M0_Profile *p = interp->profile;
+    M0_Chunk   *frames[MAX_DEPTH];
+    uint64_t    pcs[MAX_DEPTH];
+    unsigned    depth = 0;
+    size_t      len   = 0;
+    unsigned    i;
+
+    m0_profile_pending = 0;
+    if (p == NULL)
+        return;
+
+    while (cf != NULL && depth < MAX_DEPTH) {
+        M0_Chunk *chunk = (M0_Chunk *)cf[M0_CHUNK];
+        uint64_t  pc    = cf[M0_PC];
+
+        if (!m0_is_chunk(interp, (uint64_t)chunk))
+            break;
+
+        frames[depth] = chunk;
+        pcs[depth]    = depth > 0 && pc > 0 ? pc - 1 : pc;
+        ++depth;
+
+        cf = (uint64_t *)cf[M0_PCF];
+        if (cf != NULL && !gc_is_object(interp->heap, (uint64_t)cf))
+            break;
+    }
+    if (depth == 0)
+        return;
+
+    ++p->samples;
+    ++p->self[frames[0]->id];
+    for (i = 0; i < depth; i++) {
+        if (p->seen[frames[i]->id] != p->samples) {
+            p->seen[frames[i]->id] = p->samples;
+            ++p->total[frames[i]->id];
+        }
+    }
+
+    for (i = depth; i > 0; i--)
+        len = append_frame(p, len, frames[i - 1], pcs[i - 1]);
+    count_stack(p, p->buffer);
+}
+
+typedef struct m0_chunk_count {
+    M0_Chunk      *chunk;
+    unsigned long  self;
+    unsigned long  total;
+} m0_chunk_count;
+
+/* order by self, then total count, highest first. */
+static int
+compare_counts(void const *a, void const *b) {
+    m0_chunk_count const *x = (m0_chunk_count const *)a;
+    m0_chunk_count const *y = (m0_chunk_count const *)b;
+
+    if (x->self != y->self)
+        return x->self < y->self ? 1 : -1;
+    if (x->total != y->total)
+        return x->total < y->total ? 1 : -1;
+    return 0;
+}
+
+void
+m0_profile_finish(M0_Interp *interp) {
+    M0_Profile       *p = interp->profile;
+    struct itimerval  timer;
+    m0_chunk_count   *counts;
+    unsigned          num_counts = 0;
+    FILE             *out;
+    unsigned          i;
+
+    if (p == NULL)
+        return;
+
+    memset(&timer, 0, sizeof(timer));
+    (void)setitimer(ITIMER_PROF, &timer, NULL);
+    (void)sigaction(SIGPROF, &p->oldaction, NULL);
+
+    out = fopen(p->filename, "w");
+    if (out == NULL)
+        m0_fatal("cannot write profile to '%s'", p->filename);
+    for (i = 0; i < p->stack_size; i++) {
+        if (p->stacks[i].stack != NULL)
+            fprintf(out, "%s %lu\n", p->stacks[i].stack, p->stacks[i].count);
+    }
+    fclose(out);
+
+    fprintf(stderr, "# profile: %lu samples every %lu us, folded stacks in %s\n",
+            p->samples, p->interval, p->filename);
+    fprintf(stderr, "#   self%%  total%%     self    total  chunk\n");
+
+    counts = (m0_chunk_count *)profile_alloc((interp->num_chunks + 1) * sizeof(m0_chunk_count));
+    for (i = 0; i < interp->num_chunks; i++) {
+        if (p->chunks[i] == NULL || p->total[i] == 0)
+            continue;
+        counts[num_counts].chunk = p->chunks[i];
+        counts[num_counts].self  = p->self[i];
+        counts[num_counts].total = p->total[i];
+        ++num_counts;
+    }
+    qsort(counts, num_counts, sizeof(m0_chunk_count), compare_counts);
+
+    for (i = 0; i < num_counts; i++)
+        fprintf(stderr, "# %6.1f%% %6.1f%% %8lu %8lu  %s\n",
+                100.0 * counts[i].self / p->samples, 100.0 * counts[i].total / p->samples,
+                counts[i].self, counts[i].total, counts[i].chunk->name);
+    free(counts);
+
+    for (i = 0; i < p->stack_size; i++)
+        free(p->stacks[i].stack);
+    free(p->stacks);
+    free(p->chunks);
+    free(p->self);
+    free(p->total);
+    free(p->seen);
+    free(p->buffer);
+    free(p);
+    interp->profile = NULL;
+}
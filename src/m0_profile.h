@@ -0,0 +1,31 @@
+#ifndef __M0_PROFILE_H__
+#define __M0_PROFILE_H__
+
+#include <signal.h>
+#include <stdint.h>
+#include "m0_interp.h"
+
+/*
+
+Sampling profiler for the M0 interpreter. A CPU-time timer (SIGPROF) sets
+m0_profile_pending; the interpreter then calls m0_profile_sample(), which
+records the chain of call frames, mapped to source lines with the line
+tables of the chunks. At the end, the samples are written as folded stacks
+(one "main:3;fact:22;fact:22 17" line per distinct stack, as read by
+flamegraph tools), and a per-chunk summary is printed to stderr.
+
+*/
+
+#define M0_PROFILE_INTERVAL    1000    /* default sampling interval, in microseconds */
+
+typedef struct M0_Profile M0_Profile;
+
+extern volatile sig_atomic_t m0_profile_pending;
+
+/* start sampling every interval microseconds of CPU time; the folded stacks go to filename. */
+extern void m0_profile_start(M0_Interp *interp, char const *filename, unsigned long interval);
+extern void m0_profile_sample(M0_Interp *interp, uint64_t *cf);
+extern void m0_profile_finish(M0_Interp *interp);
+
+#endif
+
@@ -0,0 +1,21 @@
+/*
+
+Helpers shared by the M0 loader, interpreter and native runtime.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "m0_interp.h"
+
+void
+m0_fatal(char const *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "m0: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(EXIT_FAILURE);
+}
@@ -16,7 +16,9 @@
 #include "decl.h"
 #include "symtab.h"
 
-
+/* the parser's stacks grow as needed up to this depth. Bison's default of
+   10000 is exhausted by blocks nested a few thousand deep. */
+#define YYMAXDEPTH  1000000
 
 extern int yylex(YYSTYPE *yylval, yyscan_t yyscanner);
 
@@ -73,6 +75,7 @@ yyerror(yyscan_t yyscanner, M1_compiler *comp, char *str) {
         KW_CHAR         "char"
         TK_INT          
         KW_STRUCT       "struct"
+        KW_PACKED       "packed"
         TK_INC          "++"
         TK_DEC          "--"
         KW_IF           "if"
@@ -326,7 +329,8 @@ yyerror(yyscan_t yyscanner, M1_compiler *comp, char *str) {
 TOP     : imports chunks
             { 
               M1_compiler *comp = (M1_compiler *)yyget_extra(yyscanner);
-              comp->ast = $2; 
+              /* chunks were linked in reverse order; restore source order. */
+              comp->ast = reverse_chunks($2); 
             }
         ;
         
@@ -342,15 +346,16 @@ chunks  : chunk
             { $$ = $1; }
         | chunks chunk
             { 
-              if ($1 != NULL) {
-                m1_chunk *iter = $1;
-                while (iter->next != NULL)
-                    iter = iter->next;
-                iter->next = $2;
-                $$ = $1; 
+              /* link in reverse order, to avoid walking the list for
+                 each chunk; TOP puts them back in order. Note that $2 
+                 is NULL for anything but a function.
+               */
+              if ($2 != NULL) {
+                $2->next = $1;
+                $$ = $2;
               }
               else {
-                $$ = $2; 
+                $$ = $1; 
               }              
             }            
         ;
@@ -482,7 +487,7 @@ function_definition : function_init '(' parameters ')' open_block statements '}'
                           /* we only want the m1_block object, so remove its m1_expression wrapper. */
                           $1->block = $5; 
                           /* store the list of statements ($6) in the block ($5). */
-                          block_set_stat($5, $6);    
+                          block_set_stat($5, reverse_stats($6));    
                           
                           $$ = $1;
                           $$->parameters = $3;
@@ -544,23 +549,23 @@ param   : type TK_IDENT         { $$ = parameter((M1_compiler *)yyget_extra(yysc
 struct_definition   : "struct" TK_IDENT '{' struct_members '}' 
                         { 
                           M1_compiler *comp = (M1_compiler *)yyget_extra(yyscanner);
-                          $$ = newstruct(comp, $2, $4); 
+                          $$ = newstruct(comp, $2, $4, 0); 
                           type_enter_struct(comp, $2, $$);
                         }
+                    | "packed" "struct" TK_IDENT '{' struct_members '}' 
+                        { 
+                          /* fields may be reordered to leave no padding. */
+                          M1_compiler *comp = (M1_compiler *)yyget_extra(yyscanner);
+                          $$ = newstruct(comp, $3, $5, 1); 
+                          type_enter_struct(comp, $3, $$);
+                        }
                     ;         
                     
 struct_members      : struct_member
-                        { 
-                          $1->offset = 0; /* first field, no offset */
-                          $$ = $1;
-                        }
                     | struct_members struct_member
                         { 
-                          /* fields are linked in reverse order, but that's ok. */
-                          
-                          /* calculate offset of this field */
-                          $2->offset = $1->offset + field_size($1);
-                           
+                          /* fields are linked in reverse order; newstruct() 
+                             puts them back in order when it lays them out. */
                           $$ = $2;
                           $2->next = $1;                            
                         }
@@ -576,7 +581,7 @@ block   : open_block statements close_block
                 /* a <block> isa <statement>, so need to wrap it as a m1_expression. */
                 m1_expression *e = expression((M1_compiler *)yyget_extra(yyscanner), EXPR_BLOCK);
                 e->expr.blck     = $1;
-                block_set_stat($1, $2);
+                block_set_stat($1, reverse_stats($2));
                 $$ = e;                                
             }
         ;
@@ -591,19 +596,17 @@ statements  : /* empty */
                 { $$ = NULL; }
             | statements statement
                 { 
-                    if ($1 == NULL) {
+                    /* link in reverse order, so that adding a statement
+                       doesn't walk the list; users of <statements> put
+                       them back in order with reverse_stats().
+                     */
+                    if ($2 != NULL) {
+                        $2->next = $1;
                         $$ = $2;
-                        $$->next = NULL;                        
                     }
-                    else { /* add $2 to end of list. */
-                        m1_expression *iter = $1;
-                        while (iter->next != NULL)
-                            iter = iter->next;
-                            
-                        iter->next = $2;
-                        $$ = $1;                        
+                    else {
+                        $$ = $1;
                     }
-
                 }
             ;
             
@@ -734,13 +737,13 @@ cases       : /* empty */
             ;
             
 case        : "case" TK_INT ':' statements                       
-				{ $$ = switchcase((M1_compiler *)yyget_extra(yyscanner), $2, $4); }
+				{ $$ = switchcase((M1_compiler *)yyget_extra(yyscanner), $2, reverse_stats($4)); }
             ;
             
 default_case: /* empty */
 				{ $$ = NULL; }
             | "default" ':' statements
-            	{ $$ = $3; }
+            	{ $$ = reverse_stats($3); }
             ;
                        
 function_call_expr  : lhs '(' arguments ')' 
@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 
 
 /* m1parser.h needs to be included /before/ m1lexer.h. */
@@ -13,6 +15,10 @@
 #include "stack.h"
 #include "gencode.h"
 #include "decl.h"
+#include "emitc.h"
+#include "report.h"
+#include "stats.h"
+#include "remark.h"
 
 #include <assert.h>
 
@@ -34,26 +40,68 @@ init_compiler(M1_compiler *comp) {
     type_enter_type(comp, "void", DECL_VOID, 0);
     type_enter_type(comp, "int", DECL_INT, 4);
     type_enter_type(comp, "num", DECL_NUM, 8);
-    type_enter_type(comp, "bool", DECL_BOOL, 4); /* bools are stored in ints. */
-    type_enter_type(comp, "string", DECL_STRING, 4);  /* strings are pointers, so size is 4. */
-    type_enter_type(comp, "char", DECL_CHAR, 4); /* XXX can this be 1? what about padding in structs? */
+    type_enter_type(comp, "bool", DECL_BOOL, 1); /* held in int registers, stored in a byte. */
+    type_enter_type(comp, "string", DECL_STRING, 8);  /* strings are pointers. */
+    type_enter_type(comp, "char", DECL_CHAR, 1);
     
     /* global symbol table for functions, as they need a return type m1_decl pointer. */
     comp->globalsymtab = new_symtab();
 }
 
+static void
+usage(void) {
+    fprintf(stderr, "Usage: m1 [-O0|-O1|-O2] [--emit-c] [--time-report] [--mem-report] [--stats]\n"
+                    "          [-Rpass=<regex>] [-Rpass-missed=<regex>] [-Rpass-analysis=<regex>]\n"
+                    "          [--remarks=<file.yaml>] <file>\n");
+    exit(EXIT_FAILURE);
+}
+
 int
 main(int argc, char *argv[]) {
     FILE        *fp;
     yyscan_t     yyscanner;
     M1_compiler  comp;
+    char        *filename = NULL;
+    int          emit_c_code = 0;
+    int          time_report = 0;
+    int          mem_report  = 0;
+    int          code_stats  = 0;
+    char const  *remarks[3]  = { NULL, NULL, NULL }; /* patterns for each m1_remarkkind */
+    char const  *remarkfile  = NULL;
+    unsigned     optlevel    = 0;
+    int          i;
     
-    if (argc <= 1) {
-        fprintf(stderr, "Usage: m1 <file>\n");
-        exit(EXIT_FAILURE);    
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--emit-c") == 0)
+            emit_c_code = 1;
+        else if (strcmp(argv[i], "--time-report") == 0)
+            time_report = 1;
+        else if (strcmp(argv[i], "--mem-report") == 0)
+            mem_report = 1;
+        else if (strcmp(argv[i], "--stats") == 0)
+            code_stats = 1;
+        else if (strncmp(argv[i], "-Rpass=", 7) == 0)
+            remarks[REMARK_PASSED] = argv[i] + 7;
+        else if (strncmp(argv[i], "-Rpass-missed=", 14) == 0)
+            remarks[REMARK_MISSED] = argv[i] + 14;
+        else if (strncmp(argv[i], "-Rpass-analysis=", 16) == 0)
+            remarks[REMARK_ANALYSIS] = argv[i] + 16;
+        else if (strncmp(argv[i], "--remarks=", 10) == 0)
+            remarkfile = argv[i] + 10;
+        else if (strcmp(argv[i], "-O") == 0)
+            optlevel = 1;
+        else if (strncmp(argv[i], "-O", 2) == 0 && isdigit((unsigned char)argv[i][2]) && argv[i][3] == '\0')
+            optlevel = (unsigned)(argv[i][2] - '0');
+        else if (argv[i][0] == '-' || filename != NULL)
+            usage();
+        else
+            filename = argv[i];
     }
     
-    fp = fopen(argv[1], "r");
+    if (filename == NULL)
+        usage();
+    
+    fp = fopen(filename, "r");
     if (fp == NULL) {
         fprintf(stderr, "Could not open file\n");
         exit(EXIT_FAILURE);
@@ -61,6 +109,28 @@ main(int argc, char *argv[]) {
    
     /* set up compiler */
     init_compiler(&comp);
+    comp.outfile  = stdout;
+    comp.optlevel = optlevel;
+    report_enable(&comp, time_report, mem_report);
+    if (code_stats)
+        stats_enable(&comp);
+    
+    comp.filename = filename;
+    for (i = REMARK_PASSED; i <= REMARK_ANALYSIS; i++) {
+        if (remarks[i] != NULL)
+            remark_enable(&comp, (m1_remarkkind)i, remarks[i]);
+    }
+    if (remarkfile != NULL)
+        remark_enable_file(&comp, remarkfile);
+    
+    /* for C output, the M0 code is generated into a temporary file first. */
+    if (emit_c_code) {
+        comp.outfile = tmpfile();
+        if (comp.outfile == NULL) {
+            fprintf(stderr, "Could not create temporary file\n");
+            exit(EXIT_FAILURE);
+        }
+    }
                                        
     /* set up lexer and parser */   	
     yylex_init(&yyscanner);    
@@ -69,7 +139,9 @@ main(int argc, char *argv[]) {
     
     comp.yyscanner = yyscanner; /* yyscanner has a pointer to comp, and vice versa. */
     
+    report_begin(&comp, "parse");
     yyparse(yyscanner, &comp);
+    report_end(&comp);
     
     fprintf(stderr, "parsing done\n");
     if (comp.errors == 0) 
@@ -77,16 +149,33 @@ main(int argc, char *argv[]) {
         assert(intstack_isempty(comp.breakstack) != 0);
         assert(intstack_isempty(comp.continuestack) != 0);
         
+    	report_begin(&comp, "check");
     	check(&comp, comp.ast); /*  need to finish */
+    	report_end(&comp);
     	//if (comp.errors == 0) 
     	{
         	fprintf(stderr, "generating code...\n");
+	        report_begin(&comp, "gencode");
 	        gencode(&comp, comp.ast);
+	        report_end(&comp);
+	        
+	        if (emit_c_code) {
+	            fprintf(stderr, "generating C code...\n");
+	            rewind(comp.outfile);
+	            report_begin(&comp, "emit-c");
+	            emit_c(comp.outfile, filename, stdout);
+	            report_end(&comp);
+	        }
     	}
     }
     
     fclose(fp);
+    if (emit_c_code)
+        fclose(comp.outfile);
     fprintf(stderr, "compilation done\n");
+    report_print(&comp, stderr);
+    stats_print(&comp, stderr);
+    remark_finish(&comp);
     return 0;
 }
 
@@ -0,0 +1,109 @@
+/*
+
+The pass manager; see pass.h.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "compiler.h"
+#include "gencode.h"
+#include "cfg.h"
+#include "ssa.h"
+#include "pass.h"
+#include "report.h"
+#include "remark.h"
+
+/* the passes, in the order in which they run. */
+static const m1_pass passes[] = {
+    { "rotate",     2,  0,          pass_rotate },
+    { "sccp",       1,  PASS_SSA,   pass_sccp },
+    { "gvn",        2,  PASS_SSA,   pass_gvn },
+    { "licm",       2,  PASS_SSA,   pass_licm },
+    { "strength",   2,  PASS_SSA,   pass_strength },
+    { "dce",        1,  PASS_SSA,   pass_dce },
+};
+
+#define NUM_PASSES  (sizeof(passes) / sizeof(passes[0]))
+
+static int
+leave_ssa(m1_cfg *cfg) {
+    int ok;
+
+    report_begin(cfg->comp, "out-of-ssa");
+    ok = ssa_destruct(cfg);
+    report_end(cfg->comp);
+
+    if (!ok)
+        REMARK(cfg->comp, REMARK_MISSED, "out-of-ssa", "OutOfRegisters", cfg->chunk->line,
+               "chunk %s not optimized: its values don't fit in the registers", cfg->chunk->name);
+    return ok;
+}
+
+void
+optimize_chunk(M1_compiler *comp, m1_chunk *c, char **code, size_t *codesize) {
+    m1_cfg   *cfg;
+    FILE     *chunkout;
+    char     *newcode = NULL;
+    size_t    newsize = 0;
+    unsigned  i;
+
+    report_begin(comp, "cfg");
+    cfg = cfg_build(comp, c, *code, *codesize);
+    report_end(comp);
+
+    if (cfg == NULL) {
+        REMARK(comp, REMARK_MISSED, "cfg", "UnknownCode", c->line,
+               "chunk %s not optimized: its code could not be read back", c->name);
+        return;
+    }
+
+    for (i = 0; i < NUM_PASSES; i++) {
+        m1_pass const *pass = &passes[i];
+
+        if (pass->level > comp->optlevel)
+            continue;
+
+        if ((pass->flags & PASS_SSA) && !cfg->in_ssa) {
+            report_begin(comp, "ssa");
+            ssa_construct(cfg);
+            report_end(comp);
+        }
+        else if (!(pass->flags & PASS_SSA) && cfg->in_ssa && !leave_ssa(cfg)) {
+            cfg_free(cfg);
+            return;
+        }
+
+        report_begin(comp, pass->name);
+        (void)pass->run(cfg);
+        report_end(comp);
+    }
+
+    if (cfg->in_ssa && !leave_ssa(cfg)) {
+        cfg_free(cfg);
+        return;
+    }
+
+    cfg_cleanup(cfg);
+
+    /* write the code, and its line marks, anew. */
+    chunkout      = comp->outfile;
+    comp->outfile = open_memstream(&newcode, &newsize);
+    if (comp->outfile == NULL) {
+        fprintf(stderr, "Failed to allocate mem!\n");
+        exit(EXIT_FAILURE);
+    }
+    comp->num_linemarks = 0;
+    comp->currentline   = 0;
+    gencode_mark_line(comp, c->line);
+
+    cfg_print(cfg);
+
+    fclose(comp->outfile);
+    comp->outfile = chunkout;
+    cfg_free(cfg);
+
+    free(*code);
+    *code     = newcode;
+    *codesize = newsize;
+}
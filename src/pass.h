@@ -0,0 +1,64 @@
+#ifndef __M1_PASS_H__
+#define __M1_PASS_H__
+
+#include <stddef.h>
+#include "compiler.h"
+#include "ast.h"
+#include "cfg.h"
+
+/*
+
+Optimization passes over the M0 code of each chunk, for -O1 and up.
+
+optimize_chunk() builds the control-flow graph of the code that the code
+generator wrote for a chunk (see cfg.h), runs the passes of the -O level,
+in the order of the table in pass.c, and writes the code back. A pass
+that needs SSA form (see ssa.h) gets it; the form is kept for the passes
+that follow, until one that doesn't want it. If the code can't be read,
+or its values don't fit in the registers again, the chunk is left as the
+code generator wrote it.
+
+Every pass is timed on its own in --time-report, under its name, as are
+"cfg", "ssa" and "out-of-ssa", and reports what it does with remarks
+under that name (see remark.h).
+
+To add a pass, write a function that takes the graph and returns whether
+it changed the code, declare it below, and add it to the table.
+
+*/
+
+typedef int (*m1_passfn)(m1_cfg *cfg);
+
+#define PASS_SSA    0x01    /* needs SSA form */
+
+typedef struct m1_pass {
+    char const *name;
+    unsigned    level;      /* lowest -O level that runs it */
+    unsigned    flags;
+    m1_passfn   run;
+
+} m1_pass;
+
+/* optimize the code of chunk c in *code; on success, *code is replaced, along with the line marks. */
+extern void optimize_chunk(M1_compiler *comp, m1_chunk *c, char **code, size_t *codesize);
+
+/* loop rotation; see rotate.c. */
+extern int pass_rotate(m1_cfg *cfg);
+
+/* sparse conditional constant propagation; see sccp.c. */
+extern int pass_sccp(m1_cfg *cfg);
+
+/* global value numbering; see gvn.c. */
+extern int pass_gvn(m1_cfg *cfg);
+
+/* loop-invariant code motion; see licm.c. */
+extern int pass_licm(m1_cfg *cfg);
+
+/* strength reduction of induction variables; see strength.c. */
+extern int pass_strength(m1_cfg *cfg);
+
+/* dead code elimination; see dce.c. */
+extern int pass_dce(m1_cfg *cfg);
+
+#endif
+
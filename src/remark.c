@@ -0,0 +1,133 @@
+/*
+
+Optimization remarks; see remark.h.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <regex.h>
+#include "compiler.h"
+#include "ast.h"
+#include "remark.h"
+
+#define NUM_REMARK_KINDS    3
+#define MAX_MESSAGE         512
+
+typedef struct m1_remarks {
+    regex_t  patterns[NUM_REMARK_KINDS];
+    int      enabled[NUM_REMARK_KINDS];  /* whether patterns[kind] is set */
+    FILE    *file;                       /* YAML output, if any */
+
+} m1_remarks;
+
+static char const * const kindoptions[NUM_REMARK_KINDS] = { "-Rpass", "-Rpass-missed", "-Rpass-analysis" };
+static char const * const kindtags[NUM_REMARK_KINDS]    = { "Passed", "Missed", "Analysis" };
+
+static m1_remarks *
+get_remarks(M1_compiler *comp) {
+    if (comp->remarks == NULL) {
+        comp->remarks = (m1_remarks *)calloc(1, sizeof(m1_remarks));
+        if (comp->remarks == NULL) {
+            fprintf(stderr, "cant alloc mem for remarks\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return comp->remarks;
+}
+
+void
+remark_enable(M1_compiler *comp, m1_remarkkind kind, char const *pattern) {
+    m1_remarks *r = get_remarks(comp);
+
+    if (r->enabled[kind])
+        regfree(&r->patterns[kind]);
+
+    if (regcomp(&r->patterns[kind], pattern, REG_EXTENDED | REG_NOSUB) != 0) {
+        fprintf(stderr, "invalid pattern '%s' for %s\n", pattern, kindoptions[kind]);
+        exit(EXIT_FAILURE);
+    }
+    r->enabled[kind] = 1;
+}
+
+void
+remark_enable_file(M1_compiler *comp, char const *filename) {
+    m1_remarks *r = get_remarks(comp);
+
+    r->file = fopen(filename, "w");
+    if (r->file == NULL) {
+        fprintf(stderr, "Could not open remarks file '%s'\n", filename);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* write s as a YAML single-quoted scalar. */
+static void
+yaml_string(FILE *out, char const *s) {
+    fputc('\'', out);
+    for (; *s != '\0'; s++) {
+        if (*s == '\'')
+            fputc('\'', out);
+        fputc(*s, out);
+    }
+    fputc('\'', out);
+}
+
+void
+remark(M1_compiler *comp, m1_remarkkind kind, char const *pass, char const *name,
+       unsigned line, char const *fmt, ...) {
+    m1_remarks *r = comp->remarks;
+    char        message[MAX_MESSAGE];
+    va_list     args;
+    int         print;
+
+    if (r == NULL)
+        return;
+
+    print = r->enabled[kind] && regexec(&r->patterns[kind], pass, 0, NULL, 0) == 0;
+    if (!print && r->file == NULL)
+        return;
+
+    va_start(args, fmt);
+    vsnprintf(message, MAX_MESSAGE, fmt, args);
+    va_end(args);
+
+    if (print)
+        fprintf(stderr, "%s:%u: remark: %s [%s=%s]\n", comp->filename, line, message,
+                kindoptions[kind], pass);
+
+    if (r->file != NULL) {
+        fprintf(r->file, "--- !%s\n", kindtags[kind]);
+        fprintf(r->file, "Pass:            %s\n", pass);
+        fprintf(r->file, "Name:            %s\n", name);
+        fprintf(r->file, "DebugLoc:        { File: ");
+        yaml_string(r->file, comp->filename);
+        fprintf(r->file, ", Line: %u }\n", line);
+        if (comp->currentchunk != NULL)
+            fprintf(r->file, "Function:        %s\n", comp->currentchunk->name);
+        fprintf(r->file, "Message:         ");
+        yaml_string(r->file, message);
+        fprintf(r->file, "\n...\n");
+    }
+}
+
+void
+remark_finish(M1_compiler *comp) {
+    m1_remarks *r = comp->remarks;
+    int         i;
+
+    if (r == NULL)
+        return;
+
+    for (i = 0; i < NUM_REMARK_KINDS; i++) {
+        if (r->enabled[i])
+            regfree(&r->patterns[i]);
+    }
+    if (r->file != NULL)
+        fclose(r->file);
+
+    free(r);
+    comp->remarks = NULL;
+}
+
@@ -0,0 +1,57 @@
+#ifndef __M1_REMARK_H__
+#define __M1_REMARK_H__
+
+#include "compiler.h"
+
+/*
+
+Optimization remarks: notes from the compiler about what it did to the
+code, or didn't do and why, tied to a line in the source.
+
+Each remark belongs to a pass (such as "switch" or "regalloc"), has a short
+name that identifies the kind of remark within the pass, and is one of
+
+    passed      an optimization was done
+    missed      an optimization was not done; the message says why
+    analysis    a fact about the code that may explain the above
+
+Remarks are off by default. They are printed to stderr for the passes that
+match the regular expressions given with -Rpass=, -Rpass-missed= and
+-Rpass-analysis=, like
+
+    foo.m1:12: remark: switch with 40 cases lowered to compares [-Rpass-missed=switch]
+
+and written, all of them, to the file given with --remarks=<file.yaml>, as
+YAML records like those of LLVM's optimization record files.
+
+To keep them free when they're off, report remarks with the REMARK macro,
+which doesn't evaluate the message's arguments unless remarks are on.
+
+*/
+
+typedef enum m1_remarkkind {
+    REMARK_PASSED,
+    REMARK_MISSED,
+    REMARK_ANALYSIS
+
+} m1_remarkkind;
+
+/* enable remarks of kind for the passes that match the extended regular expression pattern. */
+extern void remark_enable(M1_compiler *comp, m1_remarkkind kind, char const *pattern);
+
+/* write all remarks to the YAML file filename. */
+extern void remark_enable_file(M1_compiler *comp, char const *filename);
+
+extern void remark(M1_compiler *comp, m1_remarkkind kind, char const *pass, char const *name,
+                   unsigned line, char const *fmt, ...);
+
+extern void remark_finish(M1_compiler *comp);
+
+#define REMARK(comp, kind, pass, name, line, ...)                       \
+    do {                                                                \
+        if ((comp)->remarks != NULL)                                    \
+            remark((comp), (kind), (pass), (name), (line), __VA_ARGS__); \
+    } while (0)
+
+#endif
+
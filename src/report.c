@@ -0,0 +1,206 @@
+/*
+
+Compile-time reports; see report.h.
+
+Phases are kept in the order in which they first begin. A phase that
+begins more than once, such as a pass that runs on every chunk, adds up
+its times in one record. Phases may nest; the total is the time from
+report_enable() to report_print().
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <assert.h>
+#include "compiler.h"
+#include "report.h"
+
+#define MAX_NESTING     16
+
+typedef struct m1_phase {
+    char const *name;
+    double      wall;       /* seconds */
+    double      cpu;
+} m1_phase;
+
+typedef struct m1_report {
+    int            time;
+    int            mem;
+
+    m1_phase      *phases;
+    unsigned       num_phases;
+    unsigned       phase_size;
+
+    /* phases that have begun but not ended, with their start times. */
+    unsigned       open[MAX_NESTING];
+    double         startwall[MAX_NESTING];
+    double         startcpu[MAX_NESTING];
+    unsigned       depth;
+
+    double         wall;        /* start of compilation */
+    double         cpu;
+
+    unsigned long  count[NUM_NODE_KINDS];
+    unsigned long  bytes[NUM_NODE_KINDS];
+
+} m1_report;
+
+/* names of the node kinds, in the order of m1_nodekind. */
+static char const * const nodenames[NUM_NODE_KINDS] = {
+    "m1_chunk",
+    "m1_block",
+    "m1_expression",
+    "m1_literal",
+    "m1_binexpr",
+    "m1_unexpr",
+    "m1_funcall",
+    "m1_const",
+    "m1_forexpr",
+    "m1_assignment",
+    "m1_whileexpr",
+    "m1_ifexpr",
+    "m1_object",
+    "m1_structfield",
+    "m1_struct",
+    "m1_pmc",
+    "m1_enum",
+    "m1_var",
+    "m1_switch",
+    "m1_case",
+    "m1_newexpr",
+    "m1_castexpr",
+    "m1_enumconst",
+    "m1_accesspath",
+    "m1_symbol",
+    "m1_decl"
+};
+
+static double
+clock_seconds(clockid_t clock) {
+    struct timespec ts;
+
+    if (clock_gettime(clock, &ts) != 0)
+        return 0.0;
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void
+report_enable(M1_compiler *comp, int time, int mem) {
+    m1_report *r;
+
+    if (!time && !mem)
+        return;
+
+    r = (m1_report *)calloc(1, sizeof(m1_report));
+    if (r == NULL) {
+        fprintf(stderr, "cant alloc mem for report\n");
+        exit(EXIT_FAILURE);
+    }
+    r->time = time;
+    r->mem  = mem;
+    r->wall = clock_seconds(CLOCK_MONOTONIC);
+    r->cpu  = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+
+    comp->report = r;
+}
+
+void
+report_begin(M1_compiler *comp, char const *phase) {
+    m1_report *r = comp->report;
+    unsigned   i;
+
+    if (r == NULL || !r->time)
+        return;
+
+    assert(r->depth < MAX_NESTING);
+
+    for (i = 0; i < r->num_phases; i++) {
+        if (strcmp(r->phases[i].name, phase) == 0)
+            break;
+    }
+
+    if (i == r->num_phases) { /* first time; add a record. */
+        if (r->num_phases == r->phase_size) {
+            r->phase_size = r->phase_size == 0 ? 16 : r->phase_size * 2;
+            r->phases     = (m1_phase *)realloc(r->phases, r->phase_size * sizeof(m1_phase));
+            if (r->phases == NULL) {
+                fprintf(stderr, "cant alloc mem for report\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        r->phases[i].name = phase;
+        r->phases[i].wall = 0.0;
+        r->phases[i].cpu  = 0.0;
+        ++r->num_phases;
+    }
+
+    r->open[r->depth]      = i;
+    r->startwall[r->depth] = clock_seconds(CLOCK_MONOTONIC);
+    r->startcpu[r->depth]  = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+    ++r->depth;
+}
+
+void
+report_end(M1_compiler *comp) {
+    m1_report *r = comp->report;
+    m1_phase  *p;
+
+    if (r == NULL || !r->time)
+        return;
+
+    assert(r->depth > 0);
+    --r->depth;
+
+    p        = &r->phases[r->open[r->depth]];
+    p->wall += clock_seconds(CLOCK_MONOTONIC) - r->startwall[r->depth];
+    p->cpu  += clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - r->startcpu[r->depth];
+}
+
+void
+report_alloc(M1_compiler *comp, m1_nodekind kind, size_t size) {
+    m1_report *r = comp->report;
+
+    if (r == NULL)
+        return;
+
+    ++r->count[kind];
+    r->bytes[kind] += size;
+}
+
+void
+report_print(M1_compiler *comp, FILE *out) {
+    m1_report *r = comp->report;
+    unsigned   i;
+
+    if (r == NULL)
+        return;
+
+    if (r->time) {
+        for (i = 0; i < r->num_phases; i++)
+            fprintf(out, "time\t%s\t%.6f\t%.6f\n", r->phases[i].name, r->phases[i].wall, r->phases[i].cpu);
+
+        fprintf(out, "time\ttotal\t%.6f\t%.6f\n",
+                clock_seconds(CLOCK_MONOTONIC) - r->wall,
+                clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - r->cpu);
+    }
+
+    if (r->mem) {
+        unsigned long count = 0,
+                      bytes = 0;
+        struct rusage usage;
+
+        for (i = 0; i < NUM_NODE_KINDS; i++) {
+            fprintf(out, "mem\t%s\t%lu\t%lu\n", nodenames[i], r->count[i], r->bytes[i]);
+            count += r->count[i];
+            bytes += r->bytes[i];
+        }
+        fprintf(out, "mem\ttotal\t%lu\t%lu\n", count, bytes);
+
+        /* ru_maxrss is in kilobytes. */
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+            fprintf(out, "rss\tpeak\t%lu\n", (unsigned long)usage.ru_maxrss * 1024);
+    }
+}
+
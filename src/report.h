@@ -0,0 +1,76 @@
+#ifndef __M1_REPORT_H__
+#define __M1_REPORT_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include "compiler.h"
+
+/*
+
+Compile-time reports, for "m1 --time-report" and "m1 --mem-report".
+
+The time report gives the wall and CPU time of every phase of the compiler
+(parsing, checking, any optimization pass and code generation); a phase is
+whatever runs between report_begin() and report_end(). The memory report
+counts the nodes allocated of each kind, and their size in bytes.
+
+Both are written as tab-separated records, one per line, that start with
+"time" or "mem", so that they can be picked out of m1's other messages:
+
+    time    <phase>    <wall seconds>    <cpu seconds>
+    mem     <kind>     <count>           <bytes>
+
+The last record of each report is for "total". The memory report is
+followed by the peak resident set size of the compiler:
+
+    rss     peak       <bytes>
+
+*/
+
+/* kinds of nodes counted by the memory report. */
+typedef enum m1_nodekind {
+    NODE_CHUNK,
+    NODE_BLOCK,
+    NODE_EXPRESSION,
+    NODE_LITERAL,
+    NODE_BINEXPR,
+    NODE_UNEXPR,
+    NODE_FUNCALL,
+    NODE_CONST,
+    NODE_FOR,
+    NODE_ASSIGNMENT,
+    NODE_WHILE,
+    NODE_IF,
+    NODE_OBJECT,
+    NODE_STRUCTFIELD,
+    NODE_STRUCT,
+    NODE_PMC,
+    NODE_ENUM,
+    NODE_VAR,
+    NODE_SWITCH,
+    NODE_CASE,
+    NODE_NEW,
+    NODE_CAST,
+    NODE_ENUMCONST,
+    NODE_ACCESSPATH,
+    NODE_SYMBOL,
+    NODE_DECL,
+
+    NUM_NODE_KINDS  /* not a kind; keep this last. */
+
+} m1_nodekind;
+
+/* which reports to give; set before compilation starts. */
+extern void report_enable(M1_compiler *comp, int time, int mem);
+
+/* time the phase from report_begin() to report_end(). */
+extern void report_begin(M1_compiler *comp, char const *phase);
+extern void report_end(M1_compiler *comp);
+
+/* count a node of size bytes. */
+extern void report_alloc(M1_compiler *comp, m1_nodekind kind, size_t size);
+
+extern void report_print(M1_compiler *comp, FILE *out);
+
+#endif
+
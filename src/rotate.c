@@ -0,0 +1,175 @@
+/*
+
+Loop rotation.
+
+The code generator puts the test of a loop at its bottom, and jumps to
+it on entry. This pass copies such a test, a small block at the head of
+a loop that ends with a goto_if, into each block that jumps to it, so
+the loop is entered through a test of its own, and an iteration takes
+one conditional branch at the bottom (a guarded do-while loop). The same
+goes for a loop with its test at the top, whose last block jumps back
+to it. The loop's code then starts after the test, which gives the
+passes that follow a preheader that only runs if the loop does.
+
+It works on registers, before SSA form, so that the copy needs no new
+values.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "compiler.h"
+#include "cfg.h"
+#include "pass.h"
+#include "remark.h"
+
+/* the largest test that is copied, in instructions. */
+#define ROTATE_MAX_INSNS    16
+
+/* mark the blocks of the natural loop of header h with stamp. */
+static void
+mark_loop(m1_bblock *h, unsigned *mark, unsigned stamp, m1_bblock **work) {
+    unsigned n = 0,
+             k;
+
+    mark[h->id] = stamp;
+    for (k = 0; k < h->num_preds; k++) {
+        m1_bblock *t = h->preds[k];
+        if (mark[t->id] != stamp && cfg_dominates(h, t)) {
+            mark[t->id] = stamp;
+            work[n++]   = t;
+        }
+    }
+
+    while (n > 0) {
+        m1_bblock *b = work[--n];
+
+        for (k = 0; k < b->num_preds; k++) {
+            m1_bblock *p = b->preds[k];
+            if (mark[p->id] != stamp) {
+                mark[p->id] = stamp;
+                work[n++]   = p;
+            }
+        }
+    }
+}
+
+/* whether block h, the header of a loop marked with stamp, is a test that
+   may be copied: it decides between the loop and its exit by itself. */
+static int
+is_loop_test(m1_cfg *cfg, m1_bblock *h, unsigned *mark, unsigned stamp) {
+    m1_insn  *insn;
+    unsigned  n = 0;
+
+    if (h == cfg->entry || h->last == NULL || h->last->op != M0_GOTO_IF)
+        return 0;
+    if ((mark[h->succs[0]->id] == stamp) == (mark[h->succs[1]->id] == stamp))
+        return 0;
+
+    for (insn = h->first; insn != NULL; insn = insn->next) {
+        if ((insn->flags & INSN_PINNED) || ++n > ROTATE_MAX_INSNS)
+            return 0;
+    }
+    return 1;
+}
+
+/* whether block q ends with a jump to h, which a copy of h can replace. */
+static int
+jumps_to(m1_bblock *q, m1_bblock *h) {
+    if (q == h || q->num_succs != 1 || q->succs[0] != h || q->next == h)
+        return 0;
+    if (q->last == NULL || !insn_is_terminator(q->last))
+        return 1;
+    return q->last->op == M0_GOTO && !(q->last->flags & INSN_PINNED);
+}
+
+static void
+copy_test(m1_cfg *cfg, m1_bblock *q, m1_bblock *h) {
+    m1_insn *insn;
+
+    if (q->last != NULL && q->last->op == M0_GOTO)
+        insn_remove(q->last);
+    cfg_remove_edge(cfg, q, 0);
+
+    for (insn = h->first; insn != NULL; insn = insn->next) {
+        m1_insn *copy = insn_new(insn->op, insn->line);
+
+        copy->num_args = insn->num_args;
+        memcpy(copy->args, insn->args, sizeof(copy->args));
+        insn_insert(q, copy, NULL);
+    }
+
+    cfg_add_edge(q, h->succs[0]);
+    cfg_add_edge(q, h->succs[1]);
+}
+
+int
+pass_rotate(m1_cfg *cfg) {
+    m1_bblock **headers,
+              **work;
+    char       *isheader;
+    unsigned   *mark;
+    unsigned    num_headers = 0,
+                rotated     = 0,
+                i, k;
+
+    assert(!cfg->in_ssa);
+    cfg_dominators(cfg);
+
+    headers  = (m1_bblock **)cfg_alloc(cfg->num_blocks * sizeof(m1_bblock *));
+    isheader = (char *)cfg_alloc(cfg->num_blocks);
+    mark     = (unsigned *)cfg_alloc(cfg->num_blocks * sizeof(unsigned));
+    work     = (m1_bblock **)cfg_alloc(cfg->num_blocks * sizeof(m1_bblock *));
+
+    for (i = 0; i < cfg->num_rpo; i++) {
+        m1_bblock *b = cfg->rpo[i];
+
+        for (k = 0; k < b->num_succs; k++) {
+            m1_bblock *h = b->succs[k];
+
+            if (!isheader[h->id] && cfg_dominates(h, b)) {
+                isheader[h->id]          = 1;
+                headers[num_headers++]   = h;
+            }
+        }
+    }
+
+    for (i = 0; i < num_headers; i++) {
+        m1_bblock *h      = headers[i];
+        unsigned   copies = 0;
+
+        /* an earlier rotation may have changed the loop. */
+        cfg_dominators(cfg);
+        mark_loop(h, mark, i + 1, work);
+        if (!is_loop_test(cfg, h, mark, i + 1))
+            continue;
+
+        /* a copy takes q out of the predecessors of h, so k stays. */
+        k = 0;
+        while (k < h->num_preds) {
+            m1_bblock *q = h->preds[k];
+
+            if (!jumps_to(q, h)) {
+                ++k;
+                continue;
+            }
+            copy_test(cfg, q, h);
+            ++copies;
+        }
+
+        if (copies > 0)
+            REMARK(cfg->comp, REMARK_PASSED, "rotate", "Rotated", h->first->line,
+                   "loop rotated: its test copied into %u block%s that jumped to it",
+                   copies, copies == 1 ? "" : "s");
+        rotated += copies;
+    }
+
+    free(headers);
+    free(isheader);
+    free(mark);
+    free(work);
+
+    cfg_dominators(cfg);
+    return rotated > 0;
+}
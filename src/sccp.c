@@ -0,0 +1,504 @@
+/*
+
+Sparse conditional constant propagation, in SSA form.
+
+Every int value starts out unknown, and is lowered to a constant, or to
+varying, as the instructions that define it are found to run; a phi
+function only meets the values that come in on edges that are found to
+be taken. A block runs if an edge into it is taken, and a goto_if whose
+condition is a constant takes only one of its edges. Two work lists
+drive this: one of blocks with new edges into them, and one of values
+that were lowered, whose uses are then looked at again.
+
+Then the instructions that compute a constant are made set_imm, if it
+fits (0 to 65535), so that the values they read may die; a goto_if with
+a constant condition becomes a goto, or goes, and the blocks that no
+taken edge leads to are removed. Code with flags that are constant, as
+in
+
+    int debug = 0;
+    ...
+    if (debug) { ... }
+
+so loses the code for the other case; and after rotate.c copied the test
+of a loop to its entry, a loop that is known to run skips the test.
+
+Values are known from set_imm, a deref of an int in the constants
+segment, copies, and integer arithmetic and compares on constants. A
+division by a constant 0 stays, as it traps.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include "compiler.h"
+#include "cfg.h"
+#include "pass.h"
+#include "remark.h"
+
+#define LAT_UNKNOWN     0
+#define LAT_CONST       1
+#define LAT_VARYING     2
+
+typedef struct m1_sccp {
+    m1_cfg      *cfg;
+    char        *lattice;       /* per value; LAT_* */
+    int64_t     *constant;      /* per value; its value if LAT_CONST */
+
+    m1_insn   ***uses;          /* per value; the instructions that read it */
+    unsigned    *num_uses;
+
+    char        *executable;    /* per block id; whether it runs */
+    char       **taken;         /* per block id; per predecessor, whether the edge from it is taken */
+
+    m1_bblock  **blockwork;
+    char        *in_blockwork;
+    unsigned     num_blockwork;
+    unsigned    *valuework;
+    char        *in_valuework;
+    unsigned     num_valuework;
+
+    int64_t     *consts;        /* ints of the constants segment, by index */
+    char        *is_int;
+    unsigned     num_consts;
+
+} m1_sccp;
+
+static void
+push_block(m1_sccp *s, m1_bblock *b) {
+    if (!s->in_blockwork[b->id]) {
+        s->in_blockwork[b->id]             = 1;
+        s->blockwork[s->num_blockwork++]   = b;
+    }
+}
+
+/* lower value v to lattice (and constant c), if that's lower than it is. */
+static void
+lower(m1_sccp *s, unsigned v, char lattice, int64_t c) {
+    if (lattice <= s->lattice[v])
+        return;
+    s->lattice[v]  = lattice;
+    s->constant[v] = c;
+    if (!s->in_valuework[v]) {
+        s->in_valuework[v]              = 1;
+        s->valuework[s->num_valuework++] = v;
+    }
+}
+
+/* take the edge from block from to its k'th successor. */
+static void
+take_edge(m1_sccp *s, m1_bblock *from, unsigned k) {
+    m1_bblock *to = from->succs[k];
+    unsigned   j;
+
+    for (j = 0; j < to->num_preds; j++) {
+        if (to->preds[j] == from && !s->taken[to->id][j]) {
+            s->taken[to->id][j] = 1;
+            push_block(s, to);
+        }
+    }
+}
+
+/* the value of the constants segment at index i, if it is an int. */
+static int
+const_int(m1_sccp *s, int64_t i, int64_t *c) {
+    if (i < 0 || (uint64_t)i >= s->num_consts || !s->is_int[i])
+        return 0;
+    *c = s->consts[i];
+    return 1;
+}
+
+/* the lattice of the value that insn computes, from that of its operands. */
+static char
+evaluate(m1_sccp *s, m1_insn *insn, int64_t *c) {
+    m1_opnd  *o;
+    int64_t   a = 0,
+              b = 0;
+    uint64_t  ua, ub;
+    unsigned  k;
+
+    if (insn->op == M1_PHI) {
+        char lattice = LAT_UNKNOWN;
+
+        for (k = 0; k < insn->block->num_preds; k++) {
+            unsigned v = insn->phiargs[k].no;
+
+            if (!s->taken[insn->block->id][k] || s->lattice[v] == LAT_UNKNOWN)
+                continue;
+            if (s->lattice[v] == LAT_VARYING || (lattice == LAT_CONST && s->constant[v] != *c))
+                return LAT_VARYING;
+            lattice = LAT_CONST;
+            *c      = s->constant[v];
+        }
+        return lattice;
+    }
+
+    if (insn->args[0].type != VAL_INT || (insn->flags & INSN_PINNED))
+        return LAT_VARYING;
+
+    switch (insn->op) {
+        case M0_SET_IMM:
+            if (insn->args[1].kind != OPND_IMM || insn->args[1].type != IMM_NUMBER
+            ||  insn->args[2].kind != OPND_IMM || insn->args[2].type != IMM_NUMBER)
+                return LAT_VARYING;
+            *c = (int64_t)imm_value(insn);
+            return LAT_CONST;
+        case M0_DEREF:
+            if (insn->args[1].kind != OPND_SPECIAL || insn->args[1].no != SPECIAL_CONSTS)
+                return LAT_VARYING;
+            break;
+        case M0_SET:
+        case M0_ADD_I:
+        case M0_SUB_I:
+        case M0_MULT_I:
+        case M0_DIV_I:
+        case M0_MOD_I:
+        case M0_ASHR:
+        case M0_LSHR:
+        case M0_SHL:
+        case M0_AND:
+        case M0_OR:
+        case M0_XOR:
+        case M0_ISGT_I:
+        case M0_ISGE_I:
+            break;
+        default:
+            return LAT_VARYING;
+    }
+
+    /* the operands, in order: a, and b if there are two. */
+    if ((insn->op != M0_DEREF && insn->args[1].kind != OPND_REG)
+    ||  (insn->op != M0_SET && insn->args[2].kind != OPND_REG))
+        return LAT_VARYING;
+    for (k = 0; (o = insn_use(insn, k)) != NULL; k++) {
+        if (o->type != VAL_INT || s->lattice[o->no] == LAT_VARYING)
+            return LAT_VARYING;
+        if (s->lattice[o->no] == LAT_UNKNOWN)
+            return LAT_UNKNOWN;
+        if (k == 0)
+            a = s->constant[o->no];
+        else
+            b = s->constant[o->no];
+    }
+    ua = (uint64_t)a;
+    ub = (uint64_t)b;
+
+    switch (insn->op) {
+        case M0_DEREF:
+            return const_int(s, a, c) ? LAT_CONST : LAT_VARYING;
+        case M0_SET:    *c = a;                                 break;
+        case M0_ADD_I:  *c = (int64_t)(ua + ub);                break;
+        case M0_SUB_I:  *c = (int64_t)(ua - ub);                break;
+        case M0_MULT_I: *c = (int64_t)(ua * ub);                break;
+        case M0_DIV_I:
+        case M0_MOD_I:
+            if (b == 0 || (b == -1 && a == INT64_MIN))
+                return LAT_VARYING;
+            *c = insn->op == M0_DIV_I ? a / b : a % b;
+            break;
+        case M0_ASHR:   *c = a < 0 ? (int64_t)~(~ua >> (ub & 63)) : (int64_t)(ua >> (ub & 63)); break;
+        case M0_LSHR:   *c = (int64_t)(ua >> (ub & 63));        break;
+        case M0_SHL:    *c = (int64_t)(ua << (ub & 63));        break;
+        case M0_AND:    *c = (int64_t)(ua & ub);                break;
+        case M0_OR:     *c = (int64_t)(ua | ub);                break;
+        case M0_XOR:    *c = (int64_t)(ua ^ ub);                break;
+        case M0_ISGT_I: *c = a > b;                             break;
+        case M0_ISGE_I: *c = a >= b;                            break;
+        default:
+            assert(0);
+    }
+    return LAT_CONST;
+}
+
+static void
+visit_insn(m1_sccp *s, m1_insn *insn) {
+    m1_bblock *b = insn->block;
+    m1_opnd   *d;
+
+    if (insn == b->last && insn->op == M0_GOTO_IF) {
+        unsigned v = insn->args[1].no;
+
+        if (insn->args[1].kind != OPND_REG || (insn->flags & INSN_PINNED) || s->lattice[v] == LAT_VARYING) {
+            take_edge(s, b, 0);
+            take_edge(s, b, 1);
+        }
+        else if (s->lattice[v] == LAT_CONST)
+            take_edge(s, b, s->constant[v] != 0 ? 0 : 1);
+        return;
+    }
+
+    if ((d = insn_def(insn)) != NULL) {
+        int64_t c    = 0;
+        char    lat  = evaluate(s, insn, &c);
+        lower(s, d->no, lat, c);
+    }
+}
+
+static void
+visit_block(m1_sccp *s, m1_bblock *b) {
+    m1_insn  *insn;
+    unsigned  k;
+
+    s->executable[b->id] = 1;
+    for (insn = b->first; insn != NULL; insn = insn->next)
+        visit_insn(s, insn);
+
+    /* a goto_if takes its edges above. */
+    if (b->last == NULL || b->last->op != M0_GOTO_IF) {
+        for (k = 0; k < b->num_succs; k++)
+            take_edge(s, b, k);
+    }
+}
+
+static void
+find_uses(m1_sccp *s) {
+    m1_cfg   *cfg = s->cfg;
+    unsigned  i, k;
+
+    s->uses     = (m1_insn ***)cfg_alloc((cfg->num_values + 1) * sizeof(m1_insn **));
+    s->num_uses = (unsigned *)cfg_alloc((cfg->num_values + 1) * sizeof(unsigned));
+
+    for (i = 0; i < cfg->num_rpo; i++) {
+        m1_insn *insn;
+        m1_opnd *o;
+
+        for (insn = cfg->rpo[i]->first; insn != NULL; insn = insn->next) {
+            for (k = 0; (o = insn_use(insn, k)) != NULL; k++)
+                ++s->num_uses[o->no];
+        }
+    }
+    for (i = 0; i < cfg->num_values; i++) {
+        s->uses[i]     = (m1_insn **)cfg_alloc((s->num_uses[i] + 1) * sizeof(m1_insn *));
+        s->num_uses[i] = 0;
+    }
+    for (i = 0; i < cfg->num_rpo; i++) {
+        m1_insn *insn;
+        m1_opnd *o;
+
+        for (insn = cfg->rpo[i]->first; insn != NULL; insn = insn->next) {
+            for (k = 0; (o = insn_use(insn, k)) != NULL; k++)
+                s->uses[o->no][s->num_uses[o->no]++] = insn;
+        }
+    }
+}
+
+static void
+find_consts(m1_sccp *s) {
+    m1_symbol *sym;
+
+    for (sym = s->cfg->chunk->constants.syms; sym != NULL; sym = sym->next) {
+        if (sym->constindex >= 0 && (unsigned)sym->constindex >= s->num_consts)
+            s->num_consts = (unsigned)sym->constindex + 1;
+    }
+    s->consts = (int64_t *)cfg_alloc((s->num_consts + 1) * sizeof(int64_t));
+    s->is_int = (char *)cfg_alloc(s->num_consts + 1);
+
+    for (sym = s->cfg->chunk->constants.syms; sym != NULL; sym = sym->next) {
+        if (sym->constindex >= 0 && sym->valtype == VAL_INT) {
+            s->consts[sym->constindex] = sym->value.ival;
+            s->is_int[sym->constindex] = 1;
+        }
+    }
+}
+
+/* make insn, which computes constant c, a set_imm; a phi function moves after the others. */
+static void
+make_set_imm(m1_insn *insn, int64_t c) {
+    if (insn->op == M1_PHI) {
+        m1_bblock *b = insn->block;
+        m1_insn   *after;
+
+        free(insn->phiargs);
+        insn->phiargs = NULL;
+        insn_unlink(insn);
+        for (after = b->first; after != NULL && after->op == M1_PHI; after = after->next)
+            ;
+        insn_insert(b, insn, after);
+    }
+
+    insn->op       = M0_SET_IMM;
+    insn->num_args = 3;
+    insn->args[1].kind = OPND_IMM;
+    insn->args[1].type = IMM_NUMBER;
+    insn->args[1].no   = (unsigned)(c / 256);
+    insn->args[2].kind = OPND_IMM;
+    insn->args[2].type = IMM_NUMBER;
+    insn->args[2].no   = (unsigned)(c % 256);
+}
+
+/* a block that is left with one predecessor needs no phi functions:
+   they become copies, as out of SSA form only edges into joins get them. */
+static void
+single_phis(m1_cfg *cfg) {
+    unsigned i;
+
+    for (i = 0; i < cfg->num_rpo; i++) {
+        m1_bblock *b = cfg->rpo[i];
+        m1_insn   *insn;
+
+        if (b->num_preds != 1)
+            continue;
+        for (insn = b->first; insn != NULL && insn->op == M1_PHI; insn = insn->next) {
+            insn->op       = M0_SET;
+            insn->num_args = 3;
+            insn->args[1]  = insn->phiargs[0];
+            insn->args[2].kind = OPND_NONE;
+            insn->args[2].type = 0;
+            insn->args[2].no   = 0;
+            free(insn->phiargs);
+            insn->phiargs  = NULL;
+        }
+    }
+}
+
+/* rewrite the code with what was found; returns whether it changed. */
+static int
+rewrite(m1_sccp *s) {
+    m1_cfg   *cfg      = s->cfg;
+    unsigned  folded   = 0,
+              removed  = 0,
+              replaced = 0,
+              i;
+
+    /* a branch on a condition that was never known would leave blocks
+       that run without having been looked at. */
+    for (i = 0; i < cfg->num_rpo; i++) {
+        m1_insn *last = cfg->rpo[i]->last;
+
+        if (s->executable[cfg->rpo[i]->id] && last != NULL && last->op == M0_GOTO_IF
+        &&  last->args[1].kind == OPND_REG && s->lattice[last->args[1].no] == LAT_UNKNOWN)
+            return 0;
+    }
+
+    for (i = 0; i < cfg->num_rpo; i++) {
+        m1_bblock *b = cfg->rpo[i];
+        m1_insn   *insn, *next;
+
+        if (!s->executable[b->id]) {
+            /* its values go with it. */
+            for (insn = b->first; insn != NULL; insn = insn->next) {
+                m1_opnd *d = insn_def(insn);
+                if (d != NULL)
+                    cfg->values[d->no].def = NULL;
+            }
+            ++removed;
+            continue;
+        }
+
+        for (insn = b->first; insn != NULL; insn = next) {
+            m1_opnd *d = insn_def(insn);
+
+            next = insn->next;
+            if (d == NULL || insn->op == M0_SET_IMM || s->lattice[d->no] != LAT_CONST
+            ||  s->constant[d->no] < 0 || s->constant[d->no] > 65535)
+                continue;
+            make_set_imm(insn, s->constant[d->no]);
+            ++replaced;
+        }
+
+        insn = b->last;
+        if (insn != NULL && insn->op == M0_GOTO_IF && !(insn->flags & INSN_PINNED)
+        &&  insn->args[1].kind == OPND_REG && s->lattice[insn->args[1].no] == LAT_CONST) {
+            if (s->constant[insn->args[1].no] != 0) {
+                insn->op       = M0_GOTO;
+                insn->num_args = 1;
+                cfg_remove_edge(cfg, b, 1);
+            }
+            else {
+                insn_remove(insn);
+                cfg_remove_edge(cfg, b, 0);
+            }
+            ++folded;
+        }
+    }
+
+    if (folded > 0 || removed > 0)
+        REMARK(cfg->comp, REMARK_PASSED, "sccp", "Folded", cfg->chunk->line,
+               "chunk %s: folded %u branch%s on constants, removed %u unreachable block%s",
+               cfg->chunk->name, folded, folded == 1 ? "" : "es", removed, removed == 1 ? "" : "s");
+    if (replaced > 0)
+        REMARK(cfg->comp, REMARK_PASSED, "sccp", "Constant", cfg->chunk->line,
+               "chunk %s: %u instruction%s computing constants made set_imm",
+               cfg->chunk->name, replaced, replaced == 1 ? "" : "s");
+
+    if (removed > 0)
+        cfg->has_doms = 0;
+    return folded + removed + replaced > 0;
+}
+
+int
+pass_sccp(m1_cfg *cfg) {
+    m1_sccp   s;
+    unsigned  i, v;
+    int       changed;
+
+    assert(cfg->in_ssa);
+    cfg_dominators(cfg);
+
+    memset(&s, 0, sizeof(s));
+    s.cfg          = cfg;
+    s.lattice      = (char *)cfg_alloc(cfg->num_values + 1);
+    s.constant     = (int64_t *)cfg_alloc((cfg->num_values + 1) * sizeof(int64_t));
+    s.executable   = (char *)cfg_alloc(cfg->num_blocks);
+    s.taken        = (char **)cfg_alloc(cfg->num_blocks * sizeof(char *));
+    s.blockwork    = (m1_bblock **)cfg_alloc(cfg->num_blocks * sizeof(m1_bblock *));
+    s.in_blockwork = (char *)cfg_alloc(cfg->num_blocks);
+    s.valuework    = (unsigned *)cfg_alloc((cfg->num_values + 1) * sizeof(unsigned));
+    s.in_valuework = (char *)cfg_alloc(cfg->num_values + 1);
+
+    for (i = 0; i < cfg->num_rpo; i++)
+        s.taken[cfg->rpo[i]->id] = (char *)cfg_alloc(cfg->rpo[i]->num_preds + 1);
+
+    /* values that come into the chunk, and those that aren't ints, vary. */
+    for (v = 0; v < cfg->num_values; v++) {
+        if (cfg->values[v].def == NULL || cfg->values[v].type != VAL_INT)
+            s.lattice[v] = LAT_VARYING;
+    }
+
+    find_uses(&s);
+    find_consts(&s);
+
+    push_block(&s, cfg->entry);
+    while (s.num_blockwork > 0 || s.num_valuework > 0) {
+        if (s.num_blockwork > 0) {
+            m1_bblock *b = s.blockwork[--s.num_blockwork];
+            s.in_blockwork[b->id] = 0;
+            visit_block(&s, b);
+        }
+        else {
+            v = s.valuework[--s.num_valuework];
+            s.in_valuework[v] = 0;
+            for (i = 0; i < s.num_uses[v]; i++) {
+                m1_insn *use = s.uses[v][i];
+                if (s.executable[use->block->id])
+                    visit_insn(&s, use);
+            }
+        }
+    }
+
+    changed = rewrite(&s);
+
+    for (i = 0; i < cfg->num_values; i++)
+        free(s.uses[i]);
+    for (i = 0; i < cfg->num_blocks; i++)
+        free(s.taken[i]);
+    free(s.uses);
+    free(s.num_uses);
+    free(s.lattice);
+    free(s.constant);
+    free(s.executable);
+    free(s.taken);
+    free(s.blockwork);
+    free(s.in_blockwork);
+    free(s.valuework);
+    free(s.in_valuework);
+    free(s.consts);
+    free(s.is_int);
+
+    cfg_dominators(cfg);
+    if (changed)
+        single_phis(cfg);
+    return changed;
+}
@@ -19,6 +19,7 @@ static m1_decl *check_obj(M1_compiler *comp, m1_object *obj, unsigned line);
 
 /* Cache these built-in types. Read-only. */
 static m1_decl *BOOLTYPE;
+static m1_decl *CHARTYPE;
 static m1_decl *INTTYPE;
 static m1_decl *NUMTYPE;
 static m1_decl *STRINGTYPE;
@@ -26,6 +27,7 @@ static m1_decl *STRINGTYPE;
 static void
 init_typechecker(M1_compiler *comp) {
     BOOLTYPE   = type_find_def(comp, "bool"); 
+    CHARTYPE   = type_find_def(comp, "char");
     INTTYPE    = type_find_def(comp, "int");
     NUMTYPE    = type_find_def(comp, "num");
     STRINGTYPE = type_find_def(comp, "string");  
@@ -125,54 +127,119 @@ check_assign(M1_compiler *comp, m1_assignment *a, unsigned line) {
 }
 
 
+/*
+
+Check an object, such as a.b[i].c, and resolve it into an access path
+for the code generator: the variable, and, for each field access or 
+index, the slot that is accessed and the type of what's in it. The
+object is stored as a chain of nodes through their parents, down to a;
+walk it with a stack of the links, so that long chains don't recurse 
+deeply. Returns the type of the object.
+
+*/
 static m1_decl *
 check_obj(M1_compiler *comp, m1_object *obj, unsigned line) {
-    m1_decl *t = NULL;
-
-    switch (obj->type) {
+    m1_ptrstack   *links = new_ptrstack();
+    m1_object     *iter;
+    m1_symbol     *sym;
+    m1_accesspath *path;
+    m1_decl       *t;
+    int            is_array;
+    unsigned       i;
+
+    for (iter = obj; iter->type == OBJECT_LINK; iter = iter->parent)
+        pushptr(links, iter);
         
-        case OBJECT_LINK: {
-            t = check_obj(comp, obj->parent, line);   
-            check_obj(comp, obj->obj.field, line);
-            
-            break;   
-        }
-        case OBJECT_MAIN: {
-            /* look up identifier's declaration. */
-            m1_symbol *sym = sym_lookup_symbol(comp->currentsymtab, obj->obj.name);            
+    if (iter->type != OBJECT_MAIN) { /* self and super are not handled yet. */
+        delete_ptrstack(links);
+        return NULL;
+    }
+    
+    /* look up identifier's declaration. */
+    sym = sym_lookup_symbol(comp->currentsymtab, iter->obj.name);            
 
-            if (sym == NULL) {
-                type_error_extra(comp, line, "Undeclared variable '%s'\n", obj->obj.name);
-            }
-            else { /* found symbol, now link it to the object node. */
-//                fprintf(stderr, "[semcheck] found var '%s'\n", obj->obj.name);
-                assert(sym != NULL);
-                obj->sym = sym;   
-                t = sym->typedecl;
-                assert(t != NULL);
-            }                           
+    if (sym == NULL) {
+        type_error_extra(comp, line, "Undeclared variable '%s'\n", iter->obj.name);
+        delete_ptrstack(links);
+        return NULL;
+    }
+    
+    /* found symbol, now link it to the object node. */
+    iter->sym = sym;   
+    t         = sym->typedecl;
+    is_array  = sym->num_elems > 1;
+    assert(t != NULL);
+    
+    path = accesspath(comp, sym, links->sp);
+    
+    /* visit the fields in order; in a.b.c, first b, then c. */
+    for (i = 0; !ptrstack_isempty(links); i++) {
+        m1_object *field = ((m1_object *)popptr(links))->obj.field;
+        m1_access *step  = &path->steps[i];
+        
+        if (field == NULL) { /* a::b */
+            type_error(comp, line, "scope operator '::' is not supported\n");
+            t = NULL;
             break;
         }
-        case OBJECT_FIELD:
-
-            break;
-        case OBJECT_DEREF:
-
-            break;
-        case OBJECT_INDEX: {
-            m1_decl *t;
-            t = check_expr(comp, obj->obj.index);
-            if (t != INTTYPE) {
-                type_error(comp, line, "result of expression does not yield an integer value!\n");   
+        
+        switch (field->type) {
+            case OBJECT_FIELD: {
+                m1_structfield *sfield;
+                
+                if (is_array || t->decltype != DECL_STRUCT) {
+                    type_error_extra(comp, line, "Cannot access field '%s' of non-struct type '%s'\n", 
+                                     field->obj.name, t->name);
+                    t = NULL;
+                    break;
+                }
+                sfield = struct_find_field(comp, t->d.s, field->obj.name);
+                if (sfield == NULL) {
+                    type_error_extra(comp, line, "Struct '%s' has no field '%s'\n", t->name, field->obj.name);
+                    t = NULL;
+                    break;
+                }
+                
+                step->kind   = ACCESS_FIELD;
+                step->offset = sfield->offset;
+                step->size   = sfield->size;
+                t            = type_find_def(comp, sfield->type);
+                
+                if (t == NULL) 
+                    type_error_extra(comp, line, "Cannot find type '%s' of field '%s'\n", sfield->type, sfield->name);
+                    
+                break;
             }
-
-            break;          
-        }  
-        default:
+            case OBJECT_INDEX: {
+                m1_decl *indextype = check_expr(comp, field->obj.index);
+                
+                if (indextype != INTTYPE) {
+                    type_error(comp, line, "result of expression does not yield an integer value!\n");   
+                }
+                step->kind  = ACCESS_INDEX;
+                step->index = field->obj.index;
+                step->size  = 8; /* array elements take a slot each. */
+                is_array    = 0;
+                break;          
+            }  
+            default: /* a->b */
+                type_error(comp, line, "operator '->' is not supported\n");
+                t = NULL;
+                break;
+        }      
+        
+        if (t == NULL)
             break;
-    }      
-    return t;
+            
+        step->type = t;
+    }
+    
+    delete_ptrstack(links);
     
+    if (t != NULL)
+        obj->path = path;
+        
+    return t;
 }
 
 static void
@@ -234,15 +301,25 @@ check_for(M1_compiler *comp, m1_forexpr *i, unsigned line) {
 static void
 check_if(M1_compiler *comp, m1_ifexpr *i, unsigned line) {
 
-    m1_decl *condtype = check_expr(comp, i->cond);
-    if (condtype != BOOLTYPE) {
-        warning(comp, line, "condition in if-statement does not yield boolean value\n");   
-    }
+    /* check "else if" cascades in a loop, as they can be very long. */
+    for (;;) {
+        m1_decl *condtype = check_expr(comp, i->cond);
+        if (condtype != BOOLTYPE) {
+            warning(comp, line, "condition in if-statement does not yield boolean value\n");   
+        }
 
-    check_exprlist(comp, i->ifblock);
+        check_exprlist(comp, i->ifblock);
 
-    if (i->elseblock) {
-        check_exprlist(comp, i->elseblock);
+        if (i->elseblock && i->elseblock->type == EXPR_IF && i->elseblock->next == NULL) {
+            line = i->elseblock->line;
+            i    = i->elseblock->expr.i;
+        }
+        else {
+            if (i->elseblock) {
+                check_exprlist(comp, i->elseblock);
+            }
+            break;
+        }
     }
            
 }
@@ -446,30 +523,29 @@ check_newexpr(M1_compiler *comp, m1_newexpr *n, unsigned line) {
 
 static void
 check_vardecl(M1_compiler *comp, m1_var *v, unsigned line) {        
-    assert(v->sym != NULL);
+    /* There may be a list of m1_vars. */
+    for (; v != NULL; v = v->next) {
+        assert(v->sym != NULL);
     
-    /* find the type declaration for the specified type. */
-    v->sym->typedecl = type_find_def(comp, v->type);
+        /* find the type declaration for the specified type. */
+        v->sym->typedecl = type_find_def(comp, v->type);
 
-    if (v->sym->typedecl == NULL) {        
-        type_error_extra(comp, line, "Cannot find type '%s'\n", v->type);   
-    }
-    else {
-        /* now check the type of the initialization expression and check compatibility
-           with type of variable. Only do this check if v->sym->typedecl was found.
-        */
-        if (v->init) {
-            m1_decl *inittype = check_expr(comp, v->init);   
+        if (v->sym->typedecl == NULL) {        
+            type_error_extra(comp, line, "Cannot find type '%s'\n", v->type);   
+        }
+        else {
+            /* now check the type of the initialization expression and check compatibility
+               with type of variable. Only do this check if v->sym->typedecl was found.
+            */
+            if (v->init) {
+                m1_decl *inittype = check_expr(comp, v->init);   
                
-            if (inittype != v->sym->typedecl) {
-                type_error_extra(comp, line, "Incompatible types in initialization of variable %s.", v->name);       
-            }            
+                if (inittype != v->sym->typedecl) {
+                    type_error_extra(comp, line, "Incompatible types in initialization of variable %s.", v->name);       
+                }            
+            }
         }
     }
-        
-    if (v->next) {
-        check_vardecl(comp, v->next, line);   
-    }
 }
 
 static m1_decl *
@@ -509,6 +585,9 @@ check_expr(M1_compiler *comp, m1_expression *e) {
 
         case EXPR_INT:
             return INTTYPE;
+            
+        case EXPR_CHAR:
+            return CHARTYPE;
 
         case EXPR_STRING:
             return STRINGTYPE;
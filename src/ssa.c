@@ -0,0 +1,858 @@
+/*
+
+SSA construction and destruction; see ssa.h.
+
+Construction is that of Cytron et al., with phi functions placed on the
+iterated dominance frontiers of the writes of a register, where the
+register is live, and renaming done in a walk of the dominator tree.
+The dominance frontiers are computed as in Cooper, Harvey and Kennedy.
+
+Destruction splits the critical edges into blocks with phi functions,
+so that each predecessor has a place for its copies, and colors the
+values in a walk of the dominator tree: in SSA form, the values live at
+a point are all defined in blocks that dominate it, so a value can take
+any register that is free where it is defined. The copies of each edge
+are done in parallel: they are ordered so that no register is written
+before it is read, with a free register to break cycles.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "compiler.h"
+#include "cfg.h"
+#include "ssa.h"
+
+#define NUM_VARS        (REG_TYPE_NUM * REG_NUM)
+#define VAR(type, no)   ((type) * REG_NUM + (no))
+
+#define WORD_BITS       (8 * sizeof(unsigned long))
+#define WORDS(n)        (((n) + WORD_BITS - 1) / WORD_BITS)
+#define SET(s, i)       ((s)[(i) / WORD_BITS] |= 1UL << ((i) % WORD_BITS))
+#define CLEAR(s, i)     ((s)[(i) / WORD_BITS] &= ~(1UL << ((i) % WORD_BITS)))
+#define ISSET(s, i)     (((s)[(i) / WORD_BITS] >> ((i) % WORD_BITS)) & 1UL)
+
+unsigned
+ssa_new_value(m1_cfg *cfg, unsigned type, unsigned reg, m1_insn *def) {
+    m1_ssavalue *v;
+
+    cfg->values = (m1_ssavalue *)cfg_grow(cfg->values, &cfg->value_size, cfg->num_values + 1, sizeof(m1_ssavalue));
+    v           = &cfg->values[cfg->num_values];
+    v->type     = (unsigned char)type;
+    v->reg      = (unsigned char)reg;
+    v->is_entry = def == NULL;
+    v->def      = def;
+    return cfg->num_values++;
+}
+
+static int
+is_phi(m1_insn *insn) {
+    return insn != NULL && insn->op == M1_PHI;
+}
+
+/*
+
+Construction.
+
+*/
+/*
+
+Liveness of the registers, as bit sets per block, for pruning the phi
+functions. Phi functions read their arguments at the end of their
+predecessors.
+
+*/
+typedef struct m1_liveness {
+    unsigned        words;      /* per set */
+    unsigned long  *in;         /* per block id */
+    unsigned long  *out;
+
+} m1_liveness;
+
+static unsigned
+var_reg(m1_opnd *o) {
+    return VAR(o->type, o->no);
+}
+
+static void
+liveness(m1_cfg *cfg, m1_liveness *l) {
+    unsigned long *uses, *defs;
+    unsigned       words = WORDS(NUM_VARS);
+    unsigned       i, k, w;
+    int            changed = 1;
+
+    l->words = words;
+    l->in    = (unsigned long *)cfg_alloc(cfg->num_blocks * words * sizeof(unsigned long));
+    l->out   = (unsigned long *)cfg_alloc(cfg->num_blocks * words * sizeof(unsigned long));
+    uses     = (unsigned long *)cfg_alloc(cfg->num_blocks * words * sizeof(unsigned long));
+    defs     = (unsigned long *)cfg_alloc(cfg->num_blocks * words * sizeof(unsigned long));
+
+    for (i = 0; i < cfg->num_rpo; i++) {
+        m1_bblock     *b = cfg->rpo[i];
+        unsigned long *u = uses + b->id * words,
+                      *d = defs + b->id * words;
+        m1_insn       *insn;
+
+        for (insn = b->first; insn != NULL; insn = insn->next) {
+            m1_opnd *o;
+
+            if (!is_phi(insn)) {
+                for (k = 0; (o = insn_use(insn, k)) != NULL; k++) {
+                    if (!ISSET(d, var_reg(o)))
+                        SET(u, var_reg(o));
+                }
+            }
+            if ((o = insn_def(insn)) != NULL)
+                SET(d, var_reg(o));
+        }
+    }
+
+    /* iterate to a fixed point, in postorder. */
+    while (changed) {
+        changed = 0;
+        for (i = cfg->num_rpo; i-- > 0; ) {
+            m1_bblock     *b   = cfg->rpo[i];
+            unsigned long *in  = l->in  + b->id * words,
+                          *out = l->out + b->id * words,
+                          *u   = uses   + b->id * words,
+                          *d   = defs   + b->id * words;
+
+            for (k = 0; k < b->num_succs; k++) {
+                m1_bblock *s = b->succs[k];
+                m1_insn   *phi;
+                unsigned   j;
+
+                for (w = 0; w < words; w++)
+                    out[w] |= l->in[s->id * words + w];
+
+                for (phi = s->first; is_phi(phi); phi = phi->next) {
+                    for (j = 0; j < s->num_preds; j++) {
+                        if (s->preds[j] == b)
+                            SET(out, var_reg(&phi->phiargs[j]));
+                    }
+                }
+            }
+
+            for (w = 0; w < words; w++) {
+                unsigned long n = u[w] | (out[w] & ~d[w]);
+                if (n != in[w]) {
+                    in[w]   = n;
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    free(uses);
+    free(defs);
+}
+
+static void
+free_liveness(m1_liveness *l) {
+    free(l->in);
+    free(l->out);
+}
+
+
+/* the dominance frontiers, as lists of blocks per block id. */
+typedef struct m1_frontier {
+    m1_bblock **blocks;
+    unsigned    num,
+                size;
+
+} m1_frontier;
+
+static m1_frontier *
+dominance_frontiers(m1_cfg *cfg) {
+    m1_frontier *df = (m1_frontier *)cfg_alloc(cfg->num_blocks * sizeof(m1_frontier));
+    unsigned     i, k;
+
+    for (i = 0; i < cfg->num_rpo; i++) {
+        m1_bblock *b = cfg->rpo[i];
+
+        if (b->num_preds < 2)
+            continue;
+
+        for (k = 0; k < b->num_preds; k++) {
+            m1_bblock *runner = b->preds[k];
+
+            while (runner != b->idom) {
+                m1_frontier *f = &df[runner->id];
+
+                /* b is added last, if at all; if it is there, it is
+                   there for the rest of the way up as well. */
+                if (f->num > 0 && f->blocks[f->num - 1] == b)
+                    break;
+                f->blocks = (m1_bblock **)cfg_grow(f->blocks, &f->size, f->num + 1, sizeof(m1_bblock *));
+                f->blocks[f->num++] = b;
+                runner = runner->idom;
+            }
+        }
+    }
+    return df;
+}
+
+static void
+insert_phis(m1_cfg *cfg, m1_liveness *live) {
+    m1_frontier  *df       = dominance_frontiers(cfg);
+    unsigned     *hasphi   = (unsigned *)cfg_alloc(cfg->num_blocks * sizeof(unsigned));
+    unsigned     *queued   = (unsigned *)cfg_alloc(cfg->num_blocks * sizeof(unsigned));
+    m1_bblock   **work     = (m1_bblock **)cfg_alloc(cfg->num_blocks * sizeof(m1_bblock *));
+    unsigned long *defs    = (unsigned long *)cfg_alloc(cfg->num_blocks * WORDS(NUM_VARS) * sizeof(unsigned long));
+    unsigned      v, i, k;
+
+    for (i = 0; i < cfg->num_rpo; i++) {
+        m1_bblock *b = cfg->rpo[i];
+        m1_insn   *insn;
+
+        for (insn = b->first; insn != NULL; insn = insn->next) {
+            m1_opnd *d = insn_def(insn);
+            if (d != NULL)
+                SET(defs + b->id * live->words, var_reg(d));
+        }
+    }
+
+    /* hasphi and queued hold the variable + 1 they were last set for. */
+    for (v = 0; v < NUM_VARS; v++) {
+        unsigned n = 0;
+
+        for (i = 0; i < cfg->num_rpo; i++) {
+            m1_bblock *b = cfg->rpo[i];
+            if (ISSET(defs + b->id * live->words, v)) {
+                queued[b->id] = v + 1;
+                work[n++]     = b;
+            }
+        }
+
+        while (n > 0) {
+            m1_bblock *b = work[--n];
+
+            for (k = 0; k < df[b->id].num; k++) {
+                m1_bblock *d = df[b->id].blocks[k];
+                m1_insn   *phi;
+                unsigned   j;
+
+                if (hasphi[d->id] == v + 1 || !ISSET(live->in + d->id * live->words, v))
+                    continue;
+
+                phi           = insn_new(M1_PHI, d->first != NULL ? d->first->line : cfg->chunk->line);
+                phi->num_args = 1;
+                phi->args[0]  = opnd_reg(v / REG_NUM, v % REG_NUM);
+                phi->phiargs  = (m1_opnd *)cfg_alloc(d->num_preds * sizeof(m1_opnd));
+                for (j = 0; j < d->num_preds; j++)
+                    phi->phiargs[j] = phi->args[0];
+                insn_insert(d, phi, d->first);
+
+                hasphi[d->id] = v + 1;
+                if (queued[d->id] != v + 1) {
+                    queued[d->id] = v + 1;
+                    work[n++]     = d;
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < cfg->num_blocks; i++)
+        free(df[i].blocks);
+    free(df);
+    free(hasphi);
+    free(queued);
+    free(work);
+    free(defs);
+}
+
+/* a stack of values for each variable, while renaming. */
+typedef struct m1_renamer {
+    unsigned  *stack[NUM_VARS];
+    unsigned   sp[NUM_VARS],
+               size[NUM_VARS];
+    int        entry[NUM_VARS];     /* entry value, or -1 */
+
+    unsigned  *log;                 /* variables pushed, to pop them again */
+    unsigned   num_log,
+               log_size;
+
+} m1_renamer;
+
+static unsigned
+current_value(m1_cfg *cfg, m1_renamer *r, unsigned var) {
+    if (r->sp[var] > 0)
+        return r->stack[var][r->sp[var] - 1];
+
+    if (r->entry[var] < 0)
+        r->entry[var] = (int)ssa_new_value(cfg, var / REG_NUM, var % REG_NUM, NULL);
+    return (unsigned)r->entry[var];
+}
+
+static void
+push_value(m1_renamer *r, unsigned var, unsigned value) {
+    r->stack[var] = (unsigned *)cfg_grow(r->stack[var], &r->size[var], r->sp[var] + 1, sizeof(unsigned));
+    r->stack[var][r->sp[var]++] = value;
+
+    r->log = (unsigned *)cfg_grow(r->log, &r->log_size, r->num_log + 1, sizeof(unsigned));
+    r->log[r->num_log++] = var;
+}
+
+static void
+rename_block(m1_cfg *cfg, m1_renamer *r, m1_bblock *b) {
+    m1_insn  *insn;
+    unsigned  k, j;
+
+    for (insn = b->first; insn != NULL; insn = insn->next) {
+        m1_opnd *o;
+
+        if (!is_phi(insn)) {
+            for (k = 0; (o = insn_use(insn, k)) != NULL; k++)
+                o->no = current_value(cfg, r, var_reg(o));
+        }
+        if ((o = insn_def(insn)) != NULL) {
+            unsigned var = var_reg(o);
+            o->no = ssa_new_value(cfg, o->type, o->no, insn);
+            push_value(r, var, o->no);
+        }
+    }
+
+    for (k = 0; k < b->num_succs; k++) {
+        m1_bblock *s = b->succs[k];
+        m1_insn   *phi;
+
+        if (k == 1 && s == b->succs[0])
+            continue;
+
+        for (j = 0; j < s->num_preds; j++) {
+            if (s->preds[j] != b)
+                continue;
+            for (phi = s->first; is_phi(phi); phi = phi->next)
+                phi->phiargs[j].no = current_value(cfg, r, var_reg(&phi->phiargs[j]));
+        }
+    }
+}
+
+void
+ssa_construct(m1_cfg *cfg) {
+    m1_liveness   live;
+    m1_renamer   *r;
+    m1_bblock   **stack;
+    unsigned     *mark;
+    unsigned      sp = 0,
+                  v;
+
+    assert(!cfg->in_ssa);
+    cfg_dominators(cfg);
+
+    liveness(cfg, &live);
+    insert_phis(cfg, &live);
+    free_liveness(&live);
+
+    /* rename in a walk of the dominator tree; a block is on the stack
+       twice, to be renamed, and to pop its values when its children are done. */
+    r     = (m1_renamer *)cfg_alloc(sizeof(m1_renamer));
+    stack = (m1_bblock **)cfg_alloc(2 * cfg->num_blocks * sizeof(m1_bblock *));
+    mark  = (unsigned *)cfg_alloc(cfg->num_blocks * sizeof(unsigned));
+
+    for (v = 0; v < NUM_VARS; v++)
+        r->entry[v] = -1;
+    cfg->num_values = 0;
+
+    stack[sp++] = cfg->entry;
+    while (sp > 0) {
+        m1_bblock *b = stack[--sp];
+
+        if (b == NULL) {
+            /* done with the children of the block below. */
+            m1_bblock *done = stack[--sp];
+            while (r->num_log > mark[done->id])
+                --r->sp[r->log[--r->num_log]];
+            continue;
+        }
+
+        mark[b->id] = r->num_log;
+        rename_block(cfg, r, b);
+
+        stack[sp++] = b;
+        stack[sp++] = NULL;
+        for (b = b->domchild; b != NULL; b = b->domsibling)
+            stack[sp++] = b;
+    }
+
+    for (v = 0; v < NUM_VARS; v++)
+        free(r->stack[v]);
+    free(r->log);
+    free(r);
+    free(stack);
+    free(mark);
+
+    cfg->in_ssa = 1;
+}
+
+/*
+
+Destruction.
+
+*/
+
+/* put a block on every critical edge into a block with phi functions. */
+static void
+split_critical_edges(m1_cfg *cfg) {
+    unsigned n = cfg->num_blocks,
+             i, k;
+
+    for (i = 0; i < n; i++) {
+        m1_bblock *p = cfg->blocks[i];
+
+        if (p == NULL || p->num_succs < 2)
+            continue;
+
+        for (k = 0; k < p->num_succs; k++) {
+            m1_bblock *s = p->succs[k];
+            if (s->num_preds > 1 && is_phi(s->first))
+                cfg_split_edge(cfg, p, k);
+        }
+    }
+    cfg_dominators(cfg);
+}
+
+/*
+
+The values live into and out of each block, as lists, found by walking
+back from the uses of each value to its definition. Values are done one
+at a time, so a value is in a list if it is the last one added.
+
+*/
+typedef struct m1_vlist {
+    unsigned  *values;
+    unsigned   num,
+               size;
+
+} m1_vlist;
+
+typedef struct m1_vliveness {
+    m1_vlist  *in;          /* per block id */
+    m1_vlist  *out;
+
+} m1_vliveness;
+
+static int
+vlist_add(m1_vlist *l, unsigned v) {
+    if (l->num > 0 && l->values[l->num - 1] == v)
+        return 0;
+    l->values = (unsigned *)cfg_grow(l->values, &l->size, l->num + 1, sizeof(unsigned));
+    l->values[l->num++] = v;
+    return 1;
+}
+
+/* a block where a value is read, or, for a phi function, its predecessor. */
+typedef struct m1_useblock {
+    m1_bblock *block;
+    int        at_end;
+
+} m1_useblock;
+
+static void
+value_liveness(m1_cfg *cfg, m1_vliveness *l) {
+    unsigned     *first = (unsigned *)cfg_alloc((cfg->num_values + 1) * sizeof(unsigned));
+    m1_useblock  *uses;
+    m1_bblock   **stack = NULL;
+    unsigned      stack_size = 0,
+                  num_uses   = 0,
+                  i, k, v;
+
+    l->in  = (m1_vlist *)cfg_alloc(cfg->num_blocks * sizeof(m1_vlist));
+    l->out = (m1_vlist *)cfg_alloc(cfg->num_blocks * sizeof(m1_vlist));
+
+    /* the uses of each value, grouped by value: count, then fill. */
+    for (i = 0; i < cfg->num_rpo; i++) {
+        m1_insn *insn;
+        m1_opnd *o;
+
+        for (insn = cfg->rpo[i]->first; insn != NULL; insn = insn->next) {
+            for (k = 0; (o = insn_use(insn, k)) != NULL; k++) {
+                ++first[o->no + 1];
+                ++num_uses;
+            }
+        }
+    }
+    for (v = 0; v < cfg->num_values; v++)
+        first[v + 1] += first[v];
+
+    uses = (m1_useblock *)cfg_alloc((num_uses + 1) * sizeof(m1_useblock));
+    for (i = 0; i < cfg->num_rpo; i++) {
+        m1_bblock *b = cfg->rpo[i];
+        m1_insn   *insn;
+        m1_opnd   *o;
+
+        for (insn = b->first; insn != NULL; insn = insn->next) {
+            for (k = 0; (o = insn_use(insn, k)) != NULL; k++) {
+                m1_useblock *u = &uses[first[o->no]++];
+                u->block  = is_phi(insn) ? b->preds[k] : b;
+                u->at_end = is_phi(insn);
+            }
+        }
+    }
+    /* first[v] is now where the uses of v + 1 start. */
+
+    for (v = 0; v < cfg->num_values; v++) {
+        m1_bblock *defblock = cfg->values[v].def != NULL ? cfg->values[v].def->block : NULL;
+        unsigned   sp       = 0;
+
+        for (i = v == 0 ? 0 : first[v - 1]; i < first[v]; i++) {
+            m1_bblock *b = uses[i].block;
+
+            if (uses[i].at_end)
+                vlist_add(&l->out[b->id], v);
+            if (b == defblock)
+                continue;
+
+            stack = (m1_bblock **)cfg_grow(stack, &stack_size, sp + 1, sizeof(m1_bblock *));
+            stack[sp++] = b;
+        }
+
+        while (sp > 0) {
+            m1_bblock *b = stack[--sp];
+
+            if (!vlist_add(&l->in[b->id], v))
+                continue;
+
+            for (k = 0; k < b->num_preds; k++) {
+                m1_bblock *p = b->preds[k];
+
+                vlist_add(&l->out[p->id], v);
+                if (p == defblock)
+                    continue;
+                stack = (m1_bblock **)cfg_grow(stack, &stack_size, sp + 1, sizeof(m1_bblock *));
+                stack[sp++] = p;
+            }
+        }
+    }
+
+    free(first);
+    free(uses);
+    free(stack);
+}
+
+static void
+free_vliveness(m1_cfg *cfg, m1_vliveness *l) {
+    unsigned i;
+
+    for (i = 0; i < cfg->num_blocks; i++) {
+        free(l->in[i].values);
+        free(l->out[i].values);
+    }
+    free(l->in);
+    free(l->out);
+}
+
+typedef struct m1_coloring {
+    int           *color;       /* per value, or -1 */
+    int           *hint;        /* preferred color per value, or -1 */
+    m1_insn      **lastuse;     /* per value, in the current block */
+    unsigned      *live;        /* per value; live in the backward scan if the block's stamp */
+    unsigned       stamp;
+    int            occupant[REG_TYPE_NUM][REG_NUM];
+
+} m1_coloring;
+
+static int
+pick_color(m1_cfg *cfg, m1_coloring *c, unsigned value) {
+    m1_ssavalue *v    = &cfg->values[value];
+    int         *occ  = c->occupant[v->type];
+    int          hint = c->hint[value];
+    int          r;
+
+    if (hint >= 0 && occ[hint] < 0 && (hint != 0 || v->reg == 0))
+        r = hint;
+    else if (occ[v->reg] < 0)
+        r = v->reg;
+    else {
+        for (r = 1; r < REG_NUM && occ[r] >= 0; r++)
+            ;
+        if (r == REG_NUM)
+            return 0;
+    }
+
+    occ[r]          = (int)value;
+    c->color[value] = r;
+    return 1;
+}
+
+static void
+free_color(m1_cfg *cfg, m1_coloring *c, unsigned value) {
+    int *occ = c->occupant[cfg->values[value].type];
+
+    if (c->color[value] >= 0 && occ[c->color[value]] == (int)value)
+        occ[c->color[value]] = -1;
+}
+
+static int
+color_block(m1_cfg *cfg, m1_coloring *c, m1_vliveness *live, m1_bblock *b) {
+    m1_vlist *in  = &live->in[b->id],
+             *out = &live->out[b->id];
+    m1_insn  *insn;
+    m1_opnd  *o;
+    unsigned  stamp = ++c->stamp;
+    unsigned  i, k;
+
+    for (k = 0; k < REG_TYPE_NUM; k++) {
+        for (i = 0; i < REG_NUM; i++)
+            c->occupant[k][i] = -1;
+    }
+
+    for (i = 0; i < in->num; i++) {
+        unsigned v = in->values[i];
+        assert(c->color[v] >= 0);
+        c->occupant[cfg->values[v].type][c->color[v]] = (int)v;
+    }
+
+    /* find the last use of each value in the block; a value that isn't
+       used after its definition is last used there. */
+    for (i = 0; i < out->num; i++)
+        c->live[out->values[i]] = stamp;
+
+    for (insn = b->last; insn != NULL && !is_phi(insn); insn = insn->prev) {
+        if ((o = insn_def(insn)) != NULL) {
+            if (c->live[o->no] != stamp)
+                c->lastuse[o->no] = insn;
+            c->live[o->no] = 0;
+        }
+        for (k = 0; (o = insn_use(insn, k)) != NULL; k++) {
+            if (c->live[o->no] != stamp)
+                c->lastuse[o->no] = insn;
+            c->live[o->no] = stamp;
+        }
+    }
+
+    for (insn = b->first; is_phi(insn); insn = insn->next) {
+        unsigned phi = insn->args[0].no;
+
+        /* prefer a register that an argument already has, and offer
+           this one to the others. */
+        for (k = 0; k < b->num_preds && c->hint[phi] < 0; k++) {
+            if (c->color[insn->phiargs[k].no] >= 0)
+                c->hint[phi] = c->color[insn->phiargs[k].no];
+        }
+        if (!pick_color(cfg, c, phi))
+            return 0;
+        for (k = 0; k < b->num_preds; k++) {
+            if (c->color[insn->phiargs[k].no] < 0 && c->hint[insn->phiargs[k].no] < 0)
+                c->hint[insn->phiargs[k].no] = c->color[phi];
+        }
+    }
+    for (insn = b->first; is_phi(insn); insn = insn->next) {
+        if (c->live[insn->args[0].no] != stamp)
+            free_color(cfg, c, insn->args[0].no);
+    }
+
+    for (; insn != NULL; insn = insn->next) {
+        for (k = 0; (o = insn_use(insn, k)) != NULL; k++) {
+            if (c->lastuse[o->no] == insn)
+                free_color(cfg, c, o->no);
+        }
+        if ((o = insn_def(insn)) != NULL) {
+            if (!pick_color(cfg, c, o->no))
+                return 0;
+            if (c->lastuse[o->no] == insn)
+                free_color(cfg, c, o->no);
+        }
+    }
+    return 1;
+}
+
+/* a copy of the parallel copies of an edge. */
+typedef struct m1_copy {
+    unsigned type;
+    int      dst,
+             src;
+
+} m1_copy;
+
+static void
+emit_copy(m1_bblock *b, unsigned type, int dst, int src, unsigned line) {
+    m1_insn *insn = insn_new(M0_SET, line);
+
+    insn->num_args = 3;
+    insn->args[0]  = opnd_reg(type, (unsigned)dst);
+    insn->args[1]  = opnd_reg(type, (unsigned)src);
+    insn_append(b, insn);
+}
+
+/* do the copies at the end of block p; busy are the registers of the values live there. */
+static int
+sequentialize(m1_bblock *p, m1_copy *copies, unsigned n, char busy[REG_TYPE_NUM][REG_NUM], unsigned line) {
+    unsigned i, k;
+
+    while (n > 0) {
+        /* a copy whose destination no other copy reads can go first. */
+        for (i = 0; i < n; i++) {
+            for (k = 0; k < n; k++) {
+                if (k != i && copies[k].type == copies[i].type && copies[k].src == copies[i].dst)
+                    break;
+            }
+            if (k == n)
+                break;
+        }
+
+        if (i < n) {
+            emit_copy(p, copies[i].type, copies[i].dst, copies[i].src, line);
+            /* it now holds a value for the successor; no temp for a cycle. */
+            busy[copies[i].type][copies[i].dst] = 1;
+            copies[i] = copies[--n];
+            continue;
+        }
+
+        /* all in cycles; move a source out of the way. */
+        {
+            unsigned type = copies[0].type;
+            int      tmp;
+
+            for (tmp = 1; tmp < REG_NUM; tmp++) {
+                if (busy[type][tmp])
+                    continue;
+                for (k = 0; k < n; k++) {
+                    if (copies[k].type == type && (copies[k].dst == tmp || copies[k].src == tmp))
+                        break;
+                }
+                if (k == n)
+                    break;
+            }
+            if (tmp == REG_NUM)
+                return 0;
+
+            emit_copy(p, type, tmp, copies[0].src, line);
+            copies[0].src = tmp;
+        }
+    }
+    return 1;
+}
+
+static int
+insert_copies(m1_cfg *cfg, m1_coloring *c, m1_vliveness *live) {
+    m1_copy  *copies = NULL;
+    unsigned  size   = 0;
+    unsigned  i, j, k;
+
+    for (i = 0; i < cfg->num_rpo; i++) {
+        m1_bblock *s = cfg->rpo[i];
+
+        if (!is_phi(s->first))
+            continue;
+
+        for (j = 0; j < s->num_preds; j++) {
+            m1_bblock *p   = s->preds[j];
+            m1_vlist  *out = &live->out[p->id];
+            m1_insn   *phi;
+            unsigned   n   = 0;
+            char       busy[REG_TYPE_NUM][REG_NUM];
+
+            assert(p->num_succs == 1);
+
+            for (phi = s->first; is_phi(phi); phi = phi->next) {
+                int dst = c->color[phi->args[0].no],
+                    src = c->color[phi->phiargs[j].no];
+
+                if (dst == src)
+                    continue;
+                copies = (m1_copy *)cfg_grow(copies, &size, n + 1, sizeof(m1_copy));
+                copies[n].type = phi->args[0].type;
+                copies[n].dst  = dst;
+                copies[n].src  = src;
+                ++n;
+            }
+            if (n == 0)
+                continue;
+
+            memset(busy, 0, sizeof(busy));
+            for (k = 0; k < out->num; k++)
+                busy[cfg->values[out->values[k]].type][c->color[out->values[k]]] = 1;
+
+            if (!sequentialize(p, copies, n, busy, p->last != NULL ? p->last->line : s->first->line)) {
+                free(copies);
+                return 0;
+            }
+        }
+    }
+    free(copies);
+    return 1;
+}
+
+int
+ssa_destruct(m1_cfg *cfg) {
+    m1_vliveness    live;
+    m1_coloring     c;
+    m1_bblock     **stack;
+    unsigned        sp = 0,
+                    i, k, v;
+    int             ok = 1;
+
+    assert(cfg->in_ssa);
+
+    split_critical_edges(cfg);
+    value_liveness(cfg, &live);
+
+    c.color   = (int *)cfg_alloc((cfg->num_values + 1) * sizeof(int));
+    c.hint    = (int *)cfg_alloc((cfg->num_values + 1) * sizeof(int));
+    c.lastuse = (m1_insn **)cfg_alloc((cfg->num_values + 1) * sizeof(m1_insn *));
+    c.live    = (unsigned *)cfg_alloc((cfg->num_values + 1) * sizeof(unsigned));
+    c.stamp   = 0;
+
+    for (v = 0; v < cfg->num_values; v++) {
+        c.color[v] = cfg->values[v].is_entry ? cfg->values[v].reg : -1;
+        c.hint[v]  = -1;
+    }
+
+    /* color in preorder of the dominator tree. */
+    stack       = (m1_bblock **)cfg_alloc(cfg->num_blocks * sizeof(m1_bblock *));
+    stack[sp++] = cfg->entry;
+    while (sp > 0 && ok) {
+        m1_bblock *b = stack[--sp];
+
+        ok = color_block(cfg, &c, &live, b);
+        for (b = b->domchild; b != NULL; b = b->domsibling)
+            stack[sp++] = b;
+    }
+    free(stack);
+
+    if (ok) {
+        /* back to registers; then the phi functions become copies, which
+           are made with registers already. */
+        for (i = 0; i < cfg->num_rpo; i++) {
+            m1_insn *insn;
+
+            for (insn = cfg->rpo[i]->first; insn != NULL; insn = insn->next) {
+                m1_opnd *o;
+
+                if (is_phi(insn))
+                    continue;
+                for (k = 0; (o = insn_use(insn, k)) != NULL; k++)
+                    o->no = (unsigned)c.color[o->no];
+                if ((o = insn_def(insn)) != NULL)
+                    o->no = (unsigned)c.color[o->no];
+            }
+        }
+
+        ok = insert_copies(cfg, &c, &live);
+
+        for (i = 0; i < cfg->num_rpo; i++) {
+            m1_insn *insn, *next;
+
+            for (insn = cfg->rpo[i]->first; insn != NULL; insn = next) {
+                next = insn->next;
+                if (is_phi(insn))
+                    insn_remove(insn);
+                else if (insn->op == M0_SET && !(insn->flags & INSN_PINNED) && insn_def(insn) != NULL
+                     &&  insn->args[1].kind == OPND_REG && insn->args[1].no == insn->args[0].no)
+                    insn_remove(insn);  /* coalesced */
+            }
+        }
+    }
+
+    free(c.color);
+    free(c.hint);
+    free(c.lastuse);
+    free(c.live);
+    free_vliveness(cfg, &live);
+
+    cfg->in_ssa     = 0;
+    cfg->num_values = 0;
+    return ok;
+}
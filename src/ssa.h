@@ -0,0 +1,37 @@
+#ifndef __M1_SSA_H__
+#define __M1_SSA_H__
+
+#include "cfg.h"
+
+/*
+
+Static single assignment form of the graph of a chunk (see cfg.h), for
+the optimization passes.
+
+ssa_construct() gives every write of a register its own value, numbered
+in cfg->values, and rewrites the reads of the register to the value that
+reaches them, with phi functions where values of several writes meet.
+Phi functions are only placed where the register is live (pruned SSA).
+A register that is read where no write reaches, such as a parameter, is
+an entry value.
+
+ssa_destruct() assigns the values to registers again, and turns the phi
+functions into copies at the end of their predecessors. Values tied by a
+phi function get the same register where possible, so that the copy goes
+away, and otherwise values keep the register they were in, except that
+no value moves into register 0, which is the slot of the return value.
+Entry values stay where they are. It fails if the values don't fit in
+the registers; the code must then be dropped.
+
+*/
+
+extern void ssa_construct(m1_cfg *cfg);
+
+/* returns 0 if the values didn't fit in the registers. */
+extern int ssa_destruct(m1_cfg *cfg);
+
+/* a new value of type, preferably in register reg, defined by def (or on entry if NULL). */
+extern unsigned ssa_new_value(m1_cfg *cfg, unsigned type, unsigned reg, m1_insn *def);
+
+#endif
+
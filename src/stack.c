@@ -2,6 +2,8 @@
 
 Simple stack implementation.
 Needed by code generator to store labels for break statements, etc.
+Stacks start with STACKSIZE slots, and double in size whenever they
+are full, so that there's no limit on how deep code may nest.
 
 */
 #include <stdio.h>
@@ -11,15 +13,38 @@ Needed by code generator to store labels for break statements, etc.
 
 #define STACKDEBUG  0
 
+/*
+
+Return a store of C<size> slots of C<slotsize> bytes, with the contents
+of C<store>, if any, copied into it.
+
+*/
+static void *
+grow_store(void *store, int size, size_t slotsize) {
+    store = realloc(store, size * slotsize);
+    if (store == NULL) {
+        fprintf(stderr, "cant alloc mem for stack\n");
+        exit(EXIT_FAILURE);
+    }
+    return store;
+}
+
 m1_intstack *
 new_intstack(void) {
     m1_intstack *stack = (m1_intstack *)calloc(1, sizeof(m1_intstack));
+    if (stack == NULL) {
+        fprintf(stderr, "cant alloc mem for stack\n");
+        exit(EXIT_FAILURE);
+    }
     stack->sp          = 0;
+    stack->size        = STACKSIZE;
+    stack->store       = (int *)grow_store(NULL, stack->size, sizeof(int));
     return stack;
 }
 
 void 
 delete_stack(m1_intstack *stack) {
+    free(stack->store);
     free(stack);
     stack = NULL;
 }
@@ -27,8 +52,11 @@ delete_stack(m1_intstack *stack) {
 void 
 push(m1_intstack *stack, int value) {
     assert(stack != NULL);
-    assert(stack->sp < STACKSIZE);
     
+    if (stack->sp == stack->size) {
+        stack->size *= 2;
+        stack->store = (int *)grow_store(stack->store, stack->size, sizeof(int));
+    }
     stack->store[stack->sp++] = value;
 }
 
@@ -51,7 +79,13 @@ top(m1_intstack *stack) {
 m1_regstack *
 new_regstack(void) {
     m1_regstack *stack = (m1_regstack *)calloc(1, sizeof(m1_regstack));
-    stack->sp = 0;
+    if (stack == NULL) {
+        fprintf(stderr, "cant alloc mem for stack\n");
+        exit(EXIT_FAILURE);
+    }
+    stack->sp    = 0;
+    stack->size  = STACKSIZE;
+    stack->store = (m1_reg *)grow_store(NULL, stack->size, sizeof(m1_reg));
     return stack;   
 }
 
@@ -75,6 +109,7 @@ print_stack(m1_regstack *stack, char *message) {
 void
 delete_regstack(m1_regstack *stack) {
     assert(stack != NULL);
+    free(stack->store);
     free(stack);
     stack = NULL;   
 }
@@ -82,8 +117,11 @@ delete_regstack(m1_regstack *stack) {
 void
 pushreg(m1_regstack *stack, m1_reg reg) {
     assert(stack != NULL);
-    assert(stack->sp < STACKSIZE);
     
+    if (stack->sp == stack->size) {
+        stack->size *= 2;
+        stack->store = (m1_reg *)grow_store(stack->store, stack->size, sizeof(m1_reg));
+    }
     stack->store[stack->sp++] = reg;
     print_stack(stack, "push (after)");
 }
@@ -112,11 +150,55 @@ topreg(m1_regstack *stack) {
     return r;
 }
 
+m1_ptrstack *
+new_ptrstack(void) {
+    m1_ptrstack *stack = (m1_ptrstack *)calloc(1, sizeof(m1_ptrstack));
+    if (stack == NULL) {
+        fprintf(stderr, "cant alloc mem for stack\n");
+        exit(EXIT_FAILURE);
+    }
+    stack->sp    = 0;
+    stack->size  = STACKSIZE;
+    stack->store = (void **)grow_store(NULL, stack->size, sizeof(void *));
+    return stack;   
+}
+
+void
+delete_ptrstack(m1_ptrstack *stack) {
+    assert(stack != NULL);
+    free(stack->store);
+    free(stack);
+}
+
+void
+pushptr(m1_ptrstack *stack, void *ptr) {
+    assert(stack != NULL);
+    
+    if (stack->sp == stack->size) {
+        stack->size *= 2;
+        stack->store = (void **)grow_store(stack->store, stack->size, sizeof(void *));
+    }
+    stack->store[stack->sp++] = ptr;
+}
+
+void *
+popptr(m1_ptrstack *stack) {
+    assert(stack != NULL);
+    assert(stack->sp > 0);
+    
+    return stack->store[--stack->sp];
+}
+
 int
 regstack_isempty(m1_regstack *stack) {
     return stack->sp == 0;   
 }
 
+int
+ptrstack_isempty(m1_ptrstack *stack) {
+    return stack->sp == 0;   
+}
+
 int
 intstack_isempty(m1_intstack *stack) {
     return stack->sp == 0;   
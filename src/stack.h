@@ -3,22 +3,32 @@
 
 #include "gencode.h"
 
-/* XXX make this flexible later */
+/* initial number of slots in a stack; stacks double in size when full. */
 #define STACKSIZE   128
 
 typedef struct m1_intstack {
-    int store[STACKSIZE];
-    int sp; /* stack pointer */        
+    int *store;
+    int  sp;   /* stack pointer */        
+    int  size; /* number of slots in store */
     
 } m1_intstack;
 
 
 typedef struct m1_regstack {
-    struct m1_reg store[STACKSIZE];
-    int           sp; /* stack pointer */
+    struct m1_reg *store;
+    int            sp;   /* stack pointer */
+    int            size; /* number of slots in store */
     
 } m1_regstack;
 
+/* a stack of pointers, for walking deep trees without recursion. */
+typedef struct m1_ptrstack {
+    void **store;
+    int    sp;   /* stack pointer */
+    int    size; /* number of slots in store */
+    
+} m1_ptrstack;
+
 
 extern m1_intstack *new_intstack(void);
 
@@ -40,8 +50,17 @@ extern m1_reg popreg(m1_regstack *stack);
 
 extern m1_reg topreg(m1_regstack *stack);
 
+extern m1_ptrstack *new_ptrstack(void);
+
+extern void delete_ptrstack(m1_ptrstack *stack);
+
+extern void pushptr(m1_ptrstack *stack, void *ptr);
+
+extern void *popptr(m1_ptrstack *stack);
+
 extern int intstack_isempty(m1_intstack *stack) ;
 extern int regstack_isempty(m1_regstack *stack) ;
+extern int ptrstack_isempty(m1_ptrstack *stack) ;
 
 #endif
 
@@ -0,0 +1,263 @@
+/*
+
+Code size statistics; see stats.h.
+
+Instructions are counted in the bytecode text of a chunk, as generated into
+a buffer by gencode_chunk(): every line that starts with a tab holds one
+instruction, named by its first word; other lines are labels. Opcodes are
+listed by name, so that the output doesn't depend on the order in which
+they first appear.
+
+Every constant takes a slot of 8 bytes in the loaded constants segment;
+strings and chunk names also take their characters and a NUL byte.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include "compiler.h"
+#include "symtab.h"
+#include "gencode.h"
+#include "stats.h"
+
+#define MAX_OPS         64
+#define MAX_OPNAME      16
+#define NUM_CONST_TYPES 4       /* VAL_INT, VAL_FLOAT, VAL_STRING, VAL_CHUNK */
+
+typedef struct m1_opcount {
+    char          name[MAX_OPNAME];
+    unsigned long count;
+} m1_opcount;
+
+typedef struct m1_chunkstats {
+    char const            *name;
+    m1_opcount             ops[MAX_OPS];
+    unsigned               num_ops;
+    unsigned long          instructions;
+    unsigned long          consts[NUM_CONST_TYPES];
+    unsigned long          constbytes[NUM_CONST_TYPES];
+    unsigned long          registers[REG_TYPE_NUM];
+    unsigned long          gc_allocs;
+    unsigned long          calls;
+
+    struct m1_chunkstats  *next;
+
+} m1_chunkstats;
+
+typedef struct m1_stats {
+    m1_chunkstats *chunks;      /* in order of generation */
+    m1_chunkstats *last;
+
+    /* registers used and calls made in the chunk being generated. */
+    unsigned long  registers[REG_TYPE_NUM];
+    unsigned long  calls;
+
+} m1_stats;
+
+static char const * const consttypes[NUM_CONST_TYPES] = { "int", "num", "string", "chunk" };
+static char const         regchars[REG_TYPE_NUM]      = { 'I', 'N', 'S', 'P' };
+
+static void *
+stats_alloc(size_t size) {
+    void *mem = calloc(1, size);
+
+    if (mem == NULL) {
+        fprintf(stderr, "cant alloc mem for stats\n");
+        exit(EXIT_FAILURE);
+    }
+    return mem;
+}
+
+void
+stats_enable(M1_compiler *comp) {
+    comp->stats = (m1_stats *)stats_alloc(sizeof(m1_stats));
+}
+
+void
+stats_reg(M1_compiler *comp, m1_reg r) {
+    m1_stats *s = comp->stats;
+
+    if (s == NULL)
+        return;
+
+    assert(r.type >= 0 && r.type < REG_TYPE_NUM);
+    if ((unsigned long)r.no + 1 > s->registers[r.type])
+        s->registers[r.type] = (unsigned long)r.no + 1;
+}
+
+void
+stats_call(M1_compiler *comp) {
+    if (comp->stats != NULL)
+        ++comp->stats->calls;
+}
+
+static void
+count_op(m1_chunkstats *cs, char const *name, size_t len, unsigned long n) {
+    unsigned i;
+
+    if (len >= MAX_OPNAME)
+        len = MAX_OPNAME - 1;
+
+    for (i = 0; i < cs->num_ops; i++) {
+        if (strncmp(cs->ops[i].name, name, len) == 0 && cs->ops[i].name[len] == '\0') {
+            cs->ops[i].count += n;
+            return;
+        }
+    }
+
+    assert(cs->num_ops < MAX_OPS);
+    memcpy(cs->ops[i].name, name, len);
+    cs->ops[i].name[len] = '\0';
+    cs->ops[i].count     = n;
+    ++cs->num_ops;
+}
+
+/* bytes of the string constant s, which is written with quotes and escapes. */
+static size_t
+string_bytes(char const *s) {
+    size_t len = 0;
+
+    if (*s == '"')
+        ++s;
+
+    while (*s != '\0' && *s != '"') {
+        if (*s == '\\' && s[1] != '\0') {
+            int digits = 0;
+            ++s;
+            while (digits < 3 && *s >= '0' && *s <= '7') {
+                ++s;
+                ++digits;
+            }
+            if (digits == 0)
+                ++s;
+        }
+        else
+            ++s;
+        ++len;
+    }
+    return len + 1;
+}
+
+void
+stats_chunk(M1_compiler *comp, m1_chunk *c, char const *code, size_t codesize) {
+    m1_stats      *s = comp->stats;
+    m1_chunkstats *cs;
+    m1_symbol     *sym;
+    char const    *p   = code;
+    char const    *end = code + codesize;
+    int            i;
+
+    if (s == NULL)
+        return;
+
+    cs       = (m1_chunkstats *)stats_alloc(sizeof(m1_chunkstats));
+    cs->name = c->name;
+
+    while (p < end) {
+        char const *eol = (char const *)memchr(p, '\n', (size_t)(end - p));
+
+        if (eol == NULL)
+            eol = end;
+
+        if (*p == '\t') {
+            char const *op = p + 1;
+            char const *q  = op;
+
+            while (q < eol && !isspace((unsigned char)*q))
+                ++q;
+
+            count_op(cs, op, (size_t)(q - op), 1);
+            ++cs->instructions;
+            if ((size_t)(q - op) == 8 && strncmp(op, "gc_alloc", 8) == 0)
+                ++cs->gc_allocs;
+        }
+        p = eol + 1;
+    }
+
+    for (sym = c->constants.syms; sym != NULL; sym = sym->next) {
+        if (sym->valtype > VAL_CHUNK)
+            continue;
+
+        ++cs->consts[sym->valtype];
+        cs->constbytes[sym->valtype] += 8;
+        if (sym->valtype == VAL_STRING)
+            cs->constbytes[sym->valtype] += string_bytes(sym->value.sval);
+        else if (sym->valtype == VAL_CHUNK)
+            cs->constbytes[sym->valtype] += strlen(sym->value.sval) + 1;
+    }
+
+    for (i = 0; i < REG_TYPE_NUM; i++) {
+        cs->registers[i] = s->registers[i];
+        s->registers[i]  = 0;
+    }
+    cs->calls = s->calls;
+    s->calls  = 0;
+
+    if (s->last == NULL)
+        s->chunks = cs;
+    else
+        s->last->next = cs;
+    s->last = cs;
+}
+
+static int
+compare_ops(void const *a, void const *b) {
+    return strcmp(((m1_opcount const *)a)->name, ((m1_opcount const *)b)->name);
+}
+
+static void
+print_chunkstats(FILE *out, m1_chunkstats *cs) {
+    unsigned i;
+
+    qsort(cs->ops, cs->num_ops, sizeof(m1_opcount), compare_ops);
+
+    fprintf(out, "stats\t%s\tinstructions\t%lu\n", cs->name, cs->instructions);
+    for (i = 0; i < cs->num_ops; i++)
+        fprintf(out, "stats\t%s\top\t%s\t%lu\n", cs->name, cs->ops[i].name, cs->ops[i].count);
+    for (i = 0; i < NUM_CONST_TYPES; i++)
+        fprintf(out, "stats\t%s\tconstants\t%s\t%lu\t%lu\n", cs->name, consttypes[i],
+                cs->consts[i], cs->constbytes[i]);
+    for (i = 0; i < REG_TYPE_NUM; i++)
+        fprintf(out, "stats\t%s\tregisters\t%c\t%lu\n", cs->name, regchars[i], cs->registers[i]);
+    fprintf(out, "stats\t%s\tgc_alloc\t%lu\n", cs->name, cs->gc_allocs);
+    fprintf(out, "stats\t%s\tcalls\t%lu\n", cs->name, cs->calls);
+}
+
+void
+stats_print(M1_compiler *comp, FILE *out) {
+    m1_stats      *s = comp->stats;
+    m1_chunkstats  total;
+    m1_chunkstats *cs;
+    unsigned       i;
+
+    if (s == NULL)
+        return;
+
+    memset(&total, 0, sizeof(m1_chunkstats));
+    total.name = "total";
+
+    for (cs = s->chunks; cs != NULL; cs = cs->next) {
+        print_chunkstats(out, cs);
+
+        for (i = 0; i < cs->num_ops; i++)
+            count_op(&total, cs->ops[i].name, strlen(cs->ops[i].name), cs->ops[i].count);
+
+        total.instructions += cs->instructions;
+        for (i = 0; i < NUM_CONST_TYPES; i++) {
+            total.consts[i]     += cs->consts[i];
+            total.constbytes[i] += cs->constbytes[i];
+        }
+        /* registers are per chunk; the total is the most any chunk uses. */
+        for (i = 0; i < REG_TYPE_NUM; i++) {
+            if (cs->registers[i] > total.registers[i])
+                total.registers[i] = cs->registers[i];
+        }
+        total.gc_allocs += cs->gc_allocs;
+        total.calls     += cs->calls;
+    }
+
+    print_chunkstats(out, &total);
+}
+
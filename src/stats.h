@@ -0,0 +1,47 @@
+#ifndef __M1_STATS_H__
+#define __M1_STATS_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include "compiler.h"
+#include "ast.h"
+#include "gencode.h"
+
+/*
+
+Code size statistics, for "m1 --stats".
+
+For every chunk, including PMC methods, this counts the instructions
+generated by opcode, the entries and bytes in the constants segment by
+type, the number of registers used of each type, and the number of gc_alloc
+instructions and function calls. The statistics are written as
+tab-separated records, one per line, that start with "stats" and the name
+of the chunk, followed by those for "total":
+
+    stats   <chunk>   instructions   <count>
+    stats   <chunk>   op             <opcode>   <count>
+    stats   <chunk>   constants      <type>     <count>   <bytes>
+    stats   <chunk>   registers      <I|N|S|P>  <count>
+    stats   <chunk>   gc_alloc       <count>
+    stats   <chunk>   calls          <count>
+
+The output only depends on the generated code, so it can be used as a
+golden file (see t/stats/).
+
+*/
+
+extern void stats_enable(M1_compiler *comp);
+
+/* note that register r is used in the current chunk. */
+extern void stats_reg(M1_compiler *comp, m1_reg r);
+
+/* note a function call in the current chunk. */
+extern void stats_call(M1_compiler *comp);
+
+/* count the bytecode in code, and the constants of chunk c. */
+extern void stats_chunk(M1_compiler *comp, m1_chunk *c, char const *code, size_t codesize);
+
+extern void stats_print(M1_compiler *comp, FILE *out);
+
+#endif
+
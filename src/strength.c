@@ -0,0 +1,338 @@
+/*
+
+Strength reduction of induction variables, in SSA form.
+
+A basic induction variable of a loop is a phi function in its header
+that starts at some value, and then goes up (or down) by an amount that
+the loop doesn't change on every way around the loop:
+
+    i  = phi(i0, i2)        # i0 from the preheader, i2 from the back edges
+    ...
+    i2 = add_i i, s
+
+A multiplication of such a variable by a value that the loop doesn't
+change, mult_i i, k, or a shift of it, shl i, k, as the code generator
+writes for a constant power of 2, is then an induction variable too. It
+is computed by an addition instead:
+
+    preheader:  j0 = mult_i i0, k
+                t  = mult_i s, k
+    header:     j  = phi(j0, j2)
+    ...
+                i2 = add_i i, s
+                j2 = add_i j, t
+
+and the multiplication goes. In matmul, b[k * n + j] in the loop over k
+then costs an addition per iteration. Like the values that licm.c moves
+out of a loop, j and t are live in all of it, so reductions stop when the
+code of the chunk leaves no registers free for them.
+
+Indexing itself needs no multiplication in M0, as deref and friends
+scale the index by the size of an element.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "compiler.h"
+#include "cfg.h"
+#include "ssa.h"
+#include "loop.h"
+#include "pass.h"
+#include "remark.h"
+
+/* a multiplication that was reduced, for others that do the same. */
+typedef struct m1_reduced {
+    m0_instr_code  op;
+    unsigned       iv,          /* the phi function of the induction variable */
+                   factor,      /* k */
+                   value;       /* the new phi function */
+
+} m1_reduced;
+
+typedef struct m1_strength {
+    m1_cfg      *cfg;
+    m1_loops     loops;
+    unsigned    *replace;       /* per value; the value that replaces it, or itself */
+    unsigned    *seen;          /* per value; counted in the current loop if its stamp */
+    unsigned     num_values,    /* in replace and seen */
+                 replace_size,
+                 seen_size;
+    unsigned     pressure[REG_TYPE_NUM];
+    m1_reduced  *reduced;       /* in the current loop */
+    unsigned     num_reduced,
+                 reduced_size;
+    unsigned     total;
+
+} m1_strength;
+
+/* whether value v is defined outside the current loop. A value that was
+   reduced has no def either, but its phi function is in the loop. */
+static int
+is_invariant(m1_strength *s, unsigned v) {
+    m1_insn *def = s->cfg->values[v].def;
+
+    if (v < s->num_values && s->replace[v] != v)
+        return 0;
+    return def == NULL || !IN_LOOP(&s->loops, def->block);
+}
+
+/* the instruction that steps phi function phi, with index pre of the
+   preheader among the preds of its block, if it is a basic induction
+   variable; NULL otherwise. */
+static m1_insn *
+induction_step(m1_strength *s, m1_insn *phi, unsigned pre) {
+    m1_bblock *h    = phi->block;
+    unsigned   iv   = phi->args[0].no,
+               next = phi->phiargs[pre == 0 ? 1 : 0].no,
+               k;
+    m1_insn   *step;
+
+    if (phi->args[0].type != VAL_INT || h->num_preds < 2)
+        return NULL;
+
+    for (k = 0; k < h->num_preds; k++) {
+        if (k != pre && phi->phiargs[k].no != next)
+            return NULL;
+    }
+
+    /* i = i - 3 is a sub_i and a copy. */
+    step = s->cfg->values[next].def;
+    while (step != NULL && step->op == M0_SET && IN_LOOP(&s->loops, step->block))
+        step = s->cfg->values[step->args[1].no].def;
+    if (step == NULL || !IN_LOOP(&s->loops, step->block))
+        return NULL;
+
+    if (step->op == M0_ADD_I) {
+        if (step->args[1].no == iv && is_invariant(s, step->args[2].no))
+            return step;
+        if (step->args[2].no == iv && is_invariant(s, step->args[1].no)) {
+            /* i2 = add_i s, i: make it add_i i, s. */
+            m1_opnd o     = step->args[1];
+            step->args[1] = step->args[2];
+            step->args[2] = o;
+            return step;
+        }
+    }
+    else if (step->op == M0_SUB_I && step->args[1].no == iv && is_invariant(s, step->args[2].no))
+        return step;
+    return NULL;
+}
+
+/* insert a new instruction op d, a, b before position in block b (at its
+   end, before any jump, if NULL), and return d. */
+static unsigned
+new_insn(m1_strength *s, m1_bblock *block, m1_insn *position, m0_instr_code op,
+         unsigned a, unsigned b, unsigned reg, unsigned line) {
+    m1_insn  *insn = insn_new(op, line);
+    unsigned  d    = ssa_new_value(s->cfg, VAL_INT, reg, insn);
+
+    insn->num_args = 3;
+    insn->args[0]  = opnd_reg(VAL_INT, d);
+    insn->args[1]  = opnd_reg(VAL_INT, a);
+    insn->args[2]  = opnd_reg(VAL_INT, b);
+    if (position == NULL)
+        insn_append(block, insn);
+    else
+        insn_insert(block, insn, position);
+    return d;
+}
+
+/* reduce insn, op d, i, k, with phi the phi function of i, and step the
+   instruction that steps it; returns the value that replaces d. */
+static unsigned
+reduce(m1_strength *s, m1_insn *insn, m1_insn *phi, m1_insn *step, m1_bblock *pre, unsigned prei) {
+    m1_bblock  *h      = phi->block;
+    unsigned    iv     = phi->args[0].no,
+                factor = insn->args[2].no,
+                reg    = insn->args[0].no,
+                j0, t, j, j2, k;
+    m1_insn    *jphi;
+    m1_reduced *r;
+
+    for (k = 0; k < s->num_reduced; k++) {
+        r = &s->reduced[k];
+        if (r->op == insn->op && r->iv == iv && r->factor == factor)
+            return r->value;
+    }
+
+    reg = s->cfg->values[reg].reg;
+    j0  = new_insn(s, pre, NULL, insn->op, phi->phiargs[prei].no, factor, reg, insn->line);
+    t   = new_insn(s, pre, NULL, insn->op, step->args[2].no, factor, reg, insn->line);
+
+    jphi = insn_new(M1_PHI, phi->line);
+    j    = ssa_new_value(s->cfg, VAL_INT, reg, jphi);
+    jphi->num_args = 1;
+    jphi->args[0]  = opnd_reg(VAL_INT, j);
+    jphi->phiargs  = (m1_opnd *)cfg_alloc(h->num_preds * sizeof(m1_opnd));
+    insn_insert(h, jphi, h->first);
+
+    /* right after i2, so that it reaches the back edges as i2 does. */
+    j2 = new_insn(s, step->block, step->next, step->op, j, t, reg, step->line);
+
+    for (k = 0; k < h->num_preds; k++)
+        jphi->phiargs[k] = opnd_reg(VAL_INT, k == prei ? j0 : j2);
+
+    s->reduced = (m1_reduced *)cfg_grow(s->reduced, &s->reduced_size, s->num_reduced + 1, sizeof(m1_reduced));
+    r = &s->reduced[s->num_reduced++];
+    r->op     = insn->op;
+    r->iv     = iv;
+    r->factor = factor;
+    r->value  = j;
+    return j;
+}
+
+/* make room in replace and seen for the values made so far. */
+static void
+grow_values(m1_strength *s) {
+    unsigned v;
+
+    s->replace = (unsigned *)cfg_grow(s->replace, &s->replace_size, s->cfg->num_values, sizeof(unsigned));
+    s->seen    = (unsigned *)cfg_grow(s->seen, &s->seen_size, s->cfg->num_values, sizeof(unsigned));
+    for (v = s->num_values; v < s->cfg->num_values; v++) {
+        s->replace[v] = v;
+        s->seen[v]    = 0;
+    }
+    s->num_values = s->cfg->num_values;
+}
+
+/* let the reads of reduced values read the phi functions that replace them. */
+static void
+replace_uses(m1_strength *s) {
+    m1_cfg   *cfg = s->cfg;
+    unsigned  i, k;
+
+    for (i = 0; i < cfg->num_blocks; i++) {
+        m1_insn *insn;
+        m1_opnd *o;
+
+        if (cfg->blocks[i] == NULL)
+            continue;
+        for (insn = cfg->blocks[i]->first; insn != NULL; insn = insn->next) {
+            for (k = 0; (o = insn_use(insn, k)) != NULL; k++) {
+                if (o->no < s->num_values)
+                    o->no = s->replace[o->no];
+            }
+        }
+    }
+}
+
+static void
+reduce_loop(m1_strength *s, m1_loop *loop) {
+    m1_cfg    *cfg = s->cfg;
+    m1_loops  *lp  = &s->loops;
+    m1_bblock *pre;
+    m1_insn   *insn, *next, *phi = NULL;
+    unsigned   line    = loop->header->first != NULL ? loop->header->first->line : cfg->chunk->line;
+    unsigned   outside = 0,
+               reduced = 0,
+               prei, i, k;
+    int        full = 0;
+
+    loop_body(lp, loop);
+    pre = loop_preheader(lp, loop);
+    if (pre == NULL)
+        return;
+    grow_values(s);
+    prei           = block_pred_index(loop->header, pre);
+    s->num_reduced = 0;
+
+    /* values moved out of the loop, that are live in all of it. */
+    for (i = 0; i < lp->num_body; i++) {
+        for (insn = lp->body[i]->first; insn != NULL; insn = insn->next) {
+            m1_opnd *o;
+            for (k = 0; (o = insn_use(insn, k)) != NULL; k++) {
+                m1_insn *def = cfg->values[o->no].def;
+                if (o->type != VAL_INT || def == NULL || !insn_is_pure(def) || IN_LOOP(lp, def->block)
+                    || s->seen[o->no] == lp->stamp)
+                    continue;
+                s->seen[o->no] = lp->stamp;
+                ++outside;
+            }
+        }
+    }
+
+    for (i = 0; i < lp->num_body; i++) {
+        for (insn = lp->body[i]->first; insn != NULL; insn = next) {
+            m1_insn  *step = NULL;
+            unsigned  j;
+
+            next = insn->next;
+            if ((insn->op != M0_MULT_I && insn->op != M0_SHL) || !insn_is_pure(insn))
+                continue;
+
+            /* i * k: the operands may come either way round. */
+            for (k = 1; k <= 2 && step == NULL; k++) {
+                m1_insn *def = cfg->values[insn->args[k].no].def;
+
+                if (k == 2 && insn->op == M0_SHL)
+                    break;
+                if (def == NULL || def->op != M1_PHI || def->block != loop->header
+                    || !is_invariant(s, insn->args[3 - k].no))
+                    continue;
+                step = induction_step(s, def, prei);
+                if (step != NULL && k == 2) {
+                    m1_opnd o      = insn->args[1];
+                    insn->args[1]  = insn->args[2];
+                    insn->args[2]  = o;
+                }
+                phi = def;
+            }
+            if (step == NULL)
+                continue;
+
+            /* the new phi function and step are live in all of the loop. */
+            if (s->pressure[VAL_INT] + outside + 2 * s->num_reduced + 2 + LOOP_RESERVE >= REG_NUM) {
+                full = 1;
+                continue;
+            }
+
+            j = reduce(s, insn, phi, step, pre, prei);
+            s->replace[insn->args[0].no]      = j;
+            cfg->values[insn->args[0].no].def = NULL;
+            insn_remove(insn);
+            ++reduced;
+        }
+    }
+
+    if (reduced > 0) {
+        replace_uses(s);
+        REMARK(cfg->comp, REMARK_PASSED, "strength", "Reduced", line,
+               "reduced %u multiplication%s of induction variables in loop to additions",
+               reduced, reduced == 1 ? "" : "s");
+    }
+    if (full)
+        REMARK(cfg->comp, REMARK_MISSED, "strength", "RegisterPressure", line,
+               "multiplications of induction variables left in loop: no registers free for the additions");
+    s->total += reduced;
+}
+
+int
+pass_strength(m1_cfg *cfg) {
+    m1_strength s;
+    unsigned    i;
+
+    assert(cfg->in_ssa);
+    cfg_dominators(cfg);
+
+    memset(&s, 0, sizeof(s));
+    if (loops_find(cfg, &s.loops) == 0) {
+        loops_free(&s.loops);
+        return 0;
+    }
+
+    s.cfg = cfg;
+    loops_pressure(cfg, s.pressure);
+
+    for (i = 0; i < s.loops.num_loops; i++)
+        reduce_loop(&s, &s.loops.loops[i]);
+
+    loops_free(&s.loops);
+    free(s.replace);
+    free(s.seen);
+    free(s.reduced);
+
+    cfg_dominators(cfg);
+    return s.total > 0;
+}
@@ -10,6 +10,10 @@
 #include "symtab.h"
 #include "decl.h"
 #include "stack.h"
+#include "report.h"
+
+/* tables with fewer symbols than this are searched linearly, without an index. */
+#define INDEX_THRESHOLD     16
 
 m1_symboltable *
 new_symtab(void) {
@@ -18,56 +22,157 @@ new_symtab(void) {
         fprintf(stderr, "cant alloc new symtab");
         exit(EXIT_FAILURE);   
     }
-    table->syms = NULL;
+    init_symtab(table);
     return table;   
 }
 
 void 
 init_symtab(m1_symboltable *symtab) {
     symtab->syms        = NULL;
+    symtab->lastsym     = NULL;
+    symtab->buckets     = NULL;
+    symtab->num_buckets = 0;
+    symtab->num_syms    = 0;
     symtab->parentscope = NULL;    
 }
 
+static unsigned
+hash_str(char const *str) {
+    unsigned hash = 5381;
+    
+    while (*str != '\0')
+        hash = hash * 33 + (unsigned char)*str++;
+    return hash;
+}
+
+static unsigned
+hash_int(int ival) {
+    return (unsigned)ival * 2654435761u;
+}
+
+static unsigned
+hash_num(double fval) {
+    unsigned char const *bytes = (unsigned char const *)&fval;
+    unsigned             hash  = 5381;
+    size_t               i;
+    
+    if (fval == 0.0) /* -0.0 == 0.0, so they must hash alike. */
+        fval = 0.0;
+        
+    for (i = 0; i < sizeof (double); i++)
+        hash = hash * 33 + bytes[i];
+    return hash;
+}
+
 /*
 
-Add symbol C<sym> to symboltable C<table>. 
+Return the hash of C<sym>: of its name for variables, or of its value
+for constants, which have no name.
 
 */
+static unsigned
+hash_sym(m1_symbol *sym) {
+    if (sym->name != NULL)
+        return hash_str(sym->name);
+        
+    switch (sym->valtype) {
+        case VAL_STRING:
+        case VAL_CHUNK:
+            return hash_str(sym->value.sval);
+        case VAL_FLOAT:
+            return hash_num(sym->value.fval);
+        case VAL_INT:
+            return hash_int(sym->value.ival);
+        default:
+            return 0;
+    }
+}
+
 static void
-link_sym(m1_symboltable *table, m1_symbol *sym) {
+index_sym(m1_symboltable *table, m1_symbol *sym) {
+    unsigned bucket = hash_sym(sym) & (table->num_buckets - 1);
+    
+    sym->hashnext          = table->buckets[bucket];
+    table->buckets[bucket] = sym;
+}
+
+/*
+
+(Re)build the index of C<table> with twice as many buckets as before, so that
+the chains stay short as the table grows.
+
+*/
+static void
+grow_index(m1_symboltable *table) {
     m1_symbol *iter;
     
+    free(table->buckets);
+    
+    table->num_buckets = table->num_buckets == 0 ? 2 * INDEX_THRESHOLD : table->num_buckets * 2;
+    table->buckets     = (m1_symbol **)calloc(table->num_buckets, sizeof (m1_symbol *));
+    if (table->buckets == NULL) {
+        fprintf(stderr, "cant alloc mem for symtab index");
+        exit(EXIT_FAILURE);
+    }
+    
+    for (iter = table->syms; iter != NULL; iter = iter->next)
+        index_sym(table, iter);
+}
+
+/*
+
+Return the first symbol in C<table> that may have hash C<hash>; walk the
+others with next_candidate(). Without an index, that is every symbol.
+
+*/
+static m1_symbol *
+first_candidate(m1_symboltable *table, unsigned hash) {
+    if (table->buckets == NULL)
+        return table->syms;
+    return table->buckets[hash & (table->num_buckets - 1)];
+}
+
+static m1_symbol *
+next_candidate(m1_symboltable *table, m1_symbol *sym) {
+    return table->buckets == NULL ? sym->next : sym->hashnext;
+}
+
+/*
+
+Add symbol C<sym> to symboltable C<table>. The symbols in the constants
+segment must be stored in-order, so the symbol is added at the end.
+
+*/
+static void
+link_sym(m1_symboltable *table, m1_symbol *sym) {
     assert(table != NULL);
     assert(sym != NULL);
     
-    iter = table->syms;
+    sym->next = NULL;
     
-    if (iter == NULL) {
+    if (table->lastsym == NULL) 
         table->syms = sym;
-    }
-    else {
+    else 
+        table->lastsym->next = sym;
         
-        /* go to end of list, and hook on symbol at the end 
-        This is needed because the symbols in the constants segment 
-        must be stored in-order. XXX Make this more efficient.
-        
-        */
-        while (iter->next != NULL) {
-            iter = iter->next;
-        }      
-        iter->next = sym;
-    }
-
+    table->lastsym = sym;
+    ++table->num_syms;
+    
+    if (table->buckets != NULL && table->num_syms <= table->num_buckets)
+        index_sym(table, sym);
+    else if (table->num_syms >= INDEX_THRESHOLD)
+        grow_index(table); /* also indexes sym. */
 }
 
 static m1_symbol *
-mk_sym(void) {
+mk_sym(M1_compiler *comp) {
     m1_symbol *sym = (m1_symbol *)calloc(1, sizeof(m1_symbol));
    	
     if (sym == NULL) {
         fprintf(stderr, "cant alloc mem for sym");
         exit(EXIT_FAILURE);
     }      
+    report_alloc(comp, NODE_SYMBOL, sizeof(m1_symbol));
     return sym;
 }
 
@@ -89,7 +194,7 @@ sym_new_symbol(M1_compiler *comp, m1_symboltable *table, char *varname, char *ty
         return sym;  
     }
     /* if it existed, the function would have returned by now. */
-    sym = mk_sym();
+    sym = mk_sym(comp);
     
     sym->num_elems = num_elems;  /* for arrays. */
     sym->name      = varname;    /* name of this symbol */
@@ -104,28 +209,30 @@ sym_new_symbol(M1_compiler *comp, m1_symboltable *table, char *varname, char *ty
 
 m1_symbol *
 sym_lookup_symbol(m1_symboltable *table, char *name) {
-    m1_symbol *sym = NULL;
+    m1_symbol *sym  = NULL;
+    unsigned   hash;
     
     assert(table != NULL);
     assert(name != NULL);
     
-    sym = table->syms;
+    hash = hash_str(name);
+    
+    /* try this scope, then the enclosing ones. Deeply nested code has
+       many scopes, so walk them in a loop rather than recursively. 
+     */
+    for (; table != NULL; table = table->parentscope) {
+        sym = first_candidate(table, hash);
         
-    while (sym != NULL) {        
+        while (sym != NULL) {        
     
-        assert(sym->name != NULL);
-        assert(name != NULL);  
+            assert(sym->name != NULL);
    
-        if (strcmp(sym->name, name) == 0) {     
-            return sym;
-        }   
+            if (strcmp(sym->name, name) == 0) {     
+                return sym;
+            }   
             
-        sym = sym->next;   
-    }
-    
-    /* try and find the symbol in the parent scope, recursively. */
-    if (table->parentscope != NULL) {
-        return sym_lookup_symbol(table->parentscope, name);
+            sym = next_candidate(table, sym);   
+        }
     }
         
     return NULL;
@@ -157,7 +264,7 @@ sym_enter_str(M1_compiler *comp, m1_symboltable *table, char *str) {
     	return sym;
     }
     	
-   	sym = mk_sym();   
+   	sym = mk_sym(comp);   
     
     sym->value.sval = str;
     sym->valtype    = VAL_STRING;
@@ -189,7 +296,7 @@ sym_enter_num(M1_compiler *comp, m1_symboltable *table, double val) {
     if (sym)
     	return sym;
     	
-    sym = mk_sym();
+    sym = mk_sym(comp);
     
     sym->value.fval = val;
     sym->valtype    = VAL_FLOAT;
@@ -209,7 +316,7 @@ sym_enter_int(M1_compiler *comp, m1_symboltable *table, int val) {
     	return sym;
     }
         	
-    sym = mk_sym();
+    sym = mk_sym(comp);
     
     sym->value.ival = val;
     sym->valtype    = VAL_INT;    
@@ -227,7 +334,7 @@ sym_find_str(m1_symboltable *table, char *name) {
     assert(table != NULL);
     assert(name != NULL);
     
-    sym = table->syms;
+    sym = first_candidate(table, hash_str(name));
         
     while (sym != NULL) {        
         if (sym->valtype == VAL_STRING || sym->valtype == VAL_CHUNK) {
@@ -239,7 +346,7 @@ sym_find_str(m1_symboltable *table, char *name) {
             }   
         }
             
-        sym = sym->next;   
+        sym = next_candidate(table, sym);   
     }
     return NULL;
 }
@@ -248,7 +355,7 @@ sym_find_str(m1_symboltable *table, char *name) {
 
 m1_symbol *
 sym_find_num(m1_symboltable *table, double fval) {
-    m1_symbol *sym = table->syms;
+    m1_symbol *sym = first_candidate(table, hash_num(fval));
     
     while (sym != NULL) {
         /* exact comparison on floats usually doesn't work, but 
@@ -261,14 +368,14 @@ sym_find_num(m1_symboltable *table, double fval) {
             }
         }
             
-        sym = sym->next;   
+        sym = next_candidate(table, sym);   
     }
     return NULL;
 }
 
 m1_symbol *
 sym_find_int(m1_symboltable *table, int ival) {
-    m1_symbol *sym = table->syms;
+    m1_symbol *sym = first_candidate(table, hash_int(ival));
     
     while (sym != NULL) {
         if (sym->valtype == VAL_INT) {
@@ -276,7 +383,7 @@ sym_find_int(m1_symboltable *table, int ival) {
                 return sym;
             }
         }    
-        sym = sym->next;   
+        sym = next_candidate(table, sym);   
     }
     return NULL;
 }
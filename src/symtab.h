@@ -72,16 +72,24 @@ typedef struct m1_symbol {
     struct m1_decl   *typedecl;     /* pointer to declaration of type. */
     
     struct m1_symbol *next;         /* symbols are stored in a list. */
+    struct m1_symbol *hashnext;     /* next symbol in the same bucket of the index. */
     
 } m1_symbol;
 
 
 
 /* A symboltable is just a list of symbols, and a constant-counter, in case the 
-   symbol represents a constant.   
+   symbol represents a constant. Symbols are appended at the tail, as constants
+   must be stored in-order. Once a table holds more than a few symbols, they are
+   also indexed by a hash table of their name (or, for constants, their value),
+   so that large tables can be searched in constant time.
  */
 typedef struct m1_symboltable {
     struct m1_symbol      *syms;            /* list of symbols. */
+    struct m1_symbol      *lastsym;         /* tail of syms, for appending. */
+    struct m1_symbol     **buckets;         /* hash index of syms; NULL for small tables. */
+    unsigned               num_buckets;
+    unsigned               num_syms;
     struct m1_symboltable *parentscope;     /* pointer to outer scope */
 } m1_symboltable;
 